@@ -0,0 +1,682 @@
+// VaultUSB microbenchmarks
+// Measures the crypto, KDF and TOTP primitives in isolation and prints
+// machine-readable results (JSON or CSV) for comparing boards and builds.
+// --small-files N instead stores N small files through StorageManager with
+// and without pack segments and reports files/s and disk usage.
+// --large-file GIB round-trips one generated file of that size through the
+// streaming store and read paths and checks it comes back intact with
+// bounded memory.
+
+#include "config.h"
+#include "crypto.h"
+#include "cipher.h"
+#include "codec.h"
+#include "compression.h"
+#include "database.h"
+#include "pack_store.h"
+#include "storage.h"
+#include "totp.h"
+
+#include <ftw.h>
+#include <openssl/opensslv.h>
+#include <openssl/rand.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Counts heap allocations so each case can report allocs/op. SecureArena
+// blocks do not go through operator new unless the arena is exhausted.
+static std::atomic<uint64_t> g_heap_allocations{0};
+
+void* operator new(size_t size) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace vaultusb {
+
+namespace {
+
+struct Result {
+    std::string name;
+    size_t size = 0;          // bytes processed per operation (0 when not size-based)
+    uint64_t iterations = 0;
+    double ns_per_op = 0;
+    double mb_per_second = 0;
+    double allocs_per_op = 0; // heap allocations (operator new) per operation
+};
+
+struct Options {
+    std::string config_file = "config.toml";
+    std::string format = "json";
+    std::string filter;
+    size_t max_size = 64u << 20;
+    double min_seconds = 0.5;
+    bool argon2 = true;
+    size_t small_files = 0;
+    double large_file_gib = 0;
+    std::string workdir = "/tmp/vaultusb-bench";
+};
+
+// Keeps results observable so the optimizer cannot drop the work
+volatile size_t g_sink = 0;
+
+// Repeat `op` until at least `min_seconds` have elapsed (one warm-up call first)
+Result measure(const std::string& name, size_t size, double min_seconds, const std::function<size_t()>& op) {
+    using clock = std::chrono::steady_clock;
+    g_sink = g_sink + op();
+
+    Result result;
+    result.name = name;
+    result.size = size;
+    uint64_t allocations = g_heap_allocations.load();
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        g_sink = g_sink + op();
+        result.iterations++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    result.ns_per_op = elapsed * 1e9 / result.iterations;
+    result.allocs_per_op = static_cast<double>(g_heap_allocations.load() - allocations) / result.iterations;
+    if (size > 0) {
+        result.mb_per_second = (static_cast<double>(size) * result.iterations) / (1024.0 * 1024.0) / elapsed;
+    }
+    return result;
+}
+
+std::string read_first_line(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    // Device-tree strings are NUL-terminated
+    while (!line.empty() && (line.back() == '\0' || line.back() == '\n')) {
+        line.pop_back();
+    }
+    return line;
+}
+
+std::string json_escape(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string csv_escape(const std::string& value) {
+    if (value.find_first_of(",\"") == std::string::npos) {
+        return value;
+    }
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::vector<std::pair<std::string, std::string>> environment() {
+    std::vector<std::pair<std::string, std::string>> env;
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        env.emplace_back("kernel", std::string(uts.sysname) + " " + uts.release);
+        env.emplace_back("arch", uts.machine);
+    }
+    std::string model = read_first_line("/proc/device-tree/model");
+    env.emplace_back("model", model.empty() ? "unknown" : model);
+    env.emplace_back("compiler", __VERSION__);
+#ifdef NDEBUG
+    env.emplace_back("build", "release");
+#else
+    env.emplace_back("build", "debug");
+#endif
+    env.emplace_back("openssl", OPENSSL_VERSION_TEXT);
+
+    KdfParams kdf = CryptoManager::instance().kdf_policy();
+    env.emplace_back("argon2", "m=" + std::to_string(kdf.memory_cost) + ",t=" + std::to_string(kdf.time_cost) +
+                               ",p=" + std::to_string(kdf.parallelism));
+    env.emplace_back("timestamp", std::to_string(std::time(nullptr)));
+    return env;
+}
+
+void print_json(const std::vector<Result>& results) {
+    std::cout << "{\n  \"environment\": {";
+    auto env = environment();
+    for (size_t i = 0; i < env.size(); i++) {
+        std::cout << (i ? ", " : "") << "\"" << env[i].first << "\": \"" << json_escape(env[i].second) << "\"";
+    }
+    std::cout << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        std::cout << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size
+                  << ", \"iterations\": " << r.iterations
+                  << std::fixed << std::setprecision(1) << ", \"ns_per_op\": " << r.ns_per_op
+                  << std::setprecision(2) << ", \"mb_per_s\": " << r.mb_per_second
+                  << ", \"allocs_per_op\": " << r.allocs_per_op << "}"
+                  << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}" << std::endl;
+}
+
+void print_csv(const std::vector<Result>& results) {
+    auto env = environment();
+    for (const auto& entry : env) {
+        std::cout << "# " << entry.first << ": " << entry.second << "\n";
+    }
+    std::cout << "name,size,iterations,ns_per_op,mb_per_s,allocs_per_op\n";
+    for (const auto& r : results) {
+        std::cout << csv_escape(r.name) << "," << r.size << "," << r.iterations << ","
+                  << std::fixed << std::setprecision(1) << r.ns_per_op << ","
+                  << std::setprecision(2) << r.mb_per_second << "," << r.allocs_per_op << "\n";
+    }
+    std::cout.flush();
+}
+
+void print_help() {
+    std::cout << "Usage: vaultusb_bench [options]\n"
+              << "  --config FILE      Configuration file for KDF parameters (default: config.toml)\n"
+              << "  --format json|csv  Output format (default: json)\n"
+              << "  --filter TEXT      Only run benchmarks whose name contains TEXT\n"
+              << "  --max-size BYTES   Largest buffer for size sweeps (default: 67108864)\n"
+              << "  --min-time SEC     Minimum measuring time per case (default: 0.5)\n"
+              << "  --no-argon2        Skip the Argon2 benchmark\n"
+              << "  --small-files N    Store N small files packed and unpacked instead (default N: 100000)\n"
+              << "  --large-file GIB   Store and read back one generated file instead (default GIB: 8)\n"
+              << "  --workdir DIR      Scratch vaults for --small-files and --large-file (default: /tmp/vaultusb-bench)\n"
+              << "  --help             Show this help\n";
+}
+
+struct SmallFileResult {
+    std::string layout;
+    size_t files = 0;
+    double store_files_per_s = 0;
+    double read_files_per_s = 0;
+    int64_t disk_bytes = 0; // allocated blocks of the vault and database
+    int64_t inodes = 0;
+    int64_t segments = 0;
+};
+
+int64_t g_disk_bytes = 0;
+int64_t g_inodes = 0;
+
+int count_usage(const char*, const struct stat* st, int, struct FTW*) {
+    g_disk_bytes += static_cast<int64_t>(st->st_blocks) * 512;
+    g_inodes++;
+    return 0;
+}
+
+// Seals `key` into the configured master_key_file and unlocks it as the
+// server does; callers point master_key_file at a scratch directory before
+// CryptoManager is first used
+void unlock_fixed_key(const SecureBytes& key) {
+    auto& crypto = CryptoManager::instance();
+    if (!crypto.save_master_key(key, "bench") || !crypto.load_master_key("bench")) {
+        throw std::runtime_error("Cannot unlock the bench master key");
+    }
+}
+
+// Fresh vault, database and user under dir, unlocked with a fixed key
+User open_scratch_vault(const std::string& dir, int pack_threshold) {
+    if (system(("rm -rf '" + dir + "' && mkdir -p '" + dir + "'").c_str()) != 0) {
+        throw std::runtime_error("Cannot create " + dir);
+    }
+    {
+        std::ofstream config(dir + "/config.toml");
+        config << "[security]\nvault_dir = \"" << dir << "/vault\"\nmaster_key_file = \"" << dir << "/master.key\"\n"
+               << "[storage]\npack_threshold = " << pack_threshold << "\n";
+    }
+    Config::instance().load_from_file(dir + "/config.toml");
+    if (!Database::instance().initialize(dir + "/vault.db")) {
+        throw std::runtime_error("Cannot open database in " + dir);
+    }
+    unlock_fixed_key(SecureBytes(32, 0x42));
+
+    User user("bench", "unused");
+    Database::instance().create_user(user);
+    return *Database::instance().get_user_by_username("bench");
+}
+
+// Runs in a forked child: every configuration gets fresh singletons
+SmallFileResult store_small_files(const Options& options, const std::string& layout, int pack_threshold) {
+    using clock = std::chrono::steady_clock;
+    std::string dir = options.workdir + "/" + layout;
+    User user = open_scratch_vault(dir, pack_threshold);
+
+    // 100 B .. 2 KiB of random bytes: typical config files, notes and thumbnails
+    std::vector<std::string> ids;
+    std::vector<uint8_t> data(2048);
+    auto start = clock::now();
+    for (size_t i = 0; i < options.small_files; i++) {
+        data.resize(100 + (i * 7919) % 1949);
+        RAND_bytes(data.data(), static_cast<int>(data.size()));
+        ids.push_back(StorageManager::instance().store_file(data, "file" + std::to_string(i) + ".bin", user));
+        if (ids.back().empty()) {
+            throw std::runtime_error("store_file failed");
+        }
+    }
+    double store_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    size_t read_bytes = 0;
+    start = clock::now();
+    for (const auto& id : ids) {
+        read_bytes += StorageManager::instance().retrieve_file(id, user).size();
+    }
+    double read_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    g_sink = g_sink + read_bytes;
+
+    SmallFileResult result;
+    result.layout = layout;
+    result.files = ids.size();
+    result.store_files_per_s = ids.size() / std::max(store_seconds, 1e-9);
+    result.read_files_per_s = ids.size() / std::max(read_seconds, 1e-9);
+    result.segments = PackStore::instance().stats().segments;
+    nftw(dir.c_str(), count_usage, 64, FTW_PHYS);
+    result.disk_bytes = g_disk_bytes;
+    result.inodes = g_inodes;
+    return result;
+}
+
+int run_small_files(const Options& options) {
+    std::vector<SmallFileResult> results;
+    for (const auto& layout : {std::make_pair(std::string("packed"), 16384), std::make_pair(std::string("file_per_object"), 0)}) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            std::ostringstream line;
+            try {
+                auto r = store_small_files(options, layout.first, layout.second);
+                line << r.files << " " << r.store_files_per_s << " " << r.read_files_per_s << " " << r.disk_bytes
+                     << " " << r.inodes << " " << r.segments << "\n";
+            } catch (const std::exception& e) {
+                std::cerr << layout.first << ": " << e.what() << std::endl;
+            }
+            std::string text = line.str();
+            ssize_t written = write(fds[1], text.data(), text.size());
+            _exit(written == static_cast<ssize_t>(text.size()) && !text.empty() ? 0 : 1);
+        }
+        close(fds[1]);
+        std::string text;
+        char buffer[256];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            text.append(buffer, static_cast<size_t>(n));
+        }
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+
+        SmallFileResult result;
+        result.layout = layout.first;
+        std::istringstream in(text);
+        if (!(in >> result.files >> result.store_files_per_s >> result.read_files_per_s >> result.disk_bytes >>
+              result.inodes >> result.segments)) {
+            std::cerr << layout.first << " run failed" << std::endl;
+            return 1;
+        }
+        std::cerr << layout.first << " done" << std::endl;
+        results.push_back(result);
+    }
+
+    if (options.format == "csv") {
+        for (const auto& entry : environment()) {
+            std::cout << "# " << entry.first << ": " << entry.second << "\n";
+        }
+        std::cout << "layout,files,store_files_per_s,read_files_per_s,disk_bytes,inodes,segments\n";
+        for (const auto& r : results) {
+            std::cout << r.layout << "," << r.files << "," << std::fixed << std::setprecision(1)
+                      << r.store_files_per_s << "," << r.read_files_per_s << "," << r.disk_bytes << ","
+                      << r.inodes << "," << r.segments << "\n";
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    std::cout << "{\n  \"environment\": {";
+    auto env = environment();
+    for (size_t i = 0; i < env.size(); i++) {
+        std::cout << (i ? ", " : "") << "\"" << env[i].first << "\": \"" << json_escape(env[i].second) << "\"";
+    }
+    std::cout << "},\n  \"small_files\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        std::cout << "    {\"layout\": \"" << r.layout << "\", \"files\": " << r.files << std::fixed
+                  << std::setprecision(1) << ", \"store_files_per_s\": " << r.store_files_per_s
+                  << ", \"read_files_per_s\": " << r.read_files_per_s << ", \"disk_bytes\": " << r.disk_bytes
+                  << ", \"inodes\": " << r.inodes << ", \"segments\": " << r.segments << "}"
+                  << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}" << std::endl;
+    return 0;
+}
+
+int run_bench(const Options& options) {
+    Config::instance().load_from_file(options.config_file);
+
+    std::vector<Result> results;
+    auto wanted = [&](const std::string& name) {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    };
+    auto run = [&](const std::string& name, size_t size, const std::function<size_t()>& op) {
+        if (wanted(name)) {
+            results.push_back(measure(name, size, options.min_seconds, op));
+            std::cerr << name << " " << size << " done" << std::endl;
+        }
+    };
+
+    SecureBytes key(32, 0x42);
+    std::vector<uint8_t> nonce(12, 0x24);
+
+    // Size sweep: 64 B .. max_size in powers of four. Sealed plaintexts are
+    // SecureBytes, so sizes beyond the arena measure its heap fallback.
+    for (size_t size = 64; size <= options.max_size; size *= 4) {
+        std::vector<uint8_t> plain(size, 0xA5);
+        SecureBytes secret(plain.begin(), plain.end());
+        auto encrypted = cipher::encrypt_data(plain, key, nonce);
+        auto sealed = cipher::aead_seal(secret, key, nonce, {});
+
+        run("encrypt_data", size, [&]() { return cipher::encrypt_data(plain, key, nonce).size(); });
+        run("decrypt_data", size, [&]() { return cipher::decrypt_data(encrypted, key, nonce).size(); });
+        run("aead_seal", size, [&]() { return cipher::aead_seal(secret, key, nonce, {}).size(); });
+        run("aead_open", size, [&]() { return cipher::aead_open(sealed, key, nonce, {}).size(); });
+    }
+
+    run("hkdf_derive", 0, [&]() { return cipher::hkdf_derive(key, "file_key_bench", 32).size(); });
+
+    // Per-file key handling against an in-memory master key
+    {
+        // A scratch key file, so the configured one is never touched
+        std::string dir = options.workdir + "/keys";
+        if (system(("rm -rf '" + dir + "' && mkdir -p '" + dir + "'").c_str()) != 0) {
+            throw std::runtime_error("Cannot create " + dir);
+        }
+        {
+            std::ofstream config(dir + "/config.toml");
+            config << "[security]\nmaster_key_file = \"" << dir << "/master.key\"\n";
+        }
+        Config::instance().load_from_file(dir + "/config.toml");
+        CryptoManager& crypto = CryptoManager::instance();
+        unlock_fixed_key(key);
+        const std::string file_id = "00000000-0000-4000-8000-000000000000";
+        auto file_key = crypto.generate_file_key();
+        uint32_t key_id = 0;
+        std::string wrapped = crypto.wrap_file_key(file_key, file_id, key_id);
+
+        run("generate_file_key", 0, [&]() { return crypto.generate_file_key().size(); });
+        run("derive_file_key", 0, [&]() { return crypto.derive_file_key(file_id).size(); });
+        run("wrap_file_key", 0, [&]() {
+            uint32_t id = 0;
+            return crypto.wrap_file_key(file_key, file_id, id).size();
+        });
+        run("unwrap_file_key", 0, [&]() { return crypto.unwrap_file_key(wrapped, file_id, key_id).size(); });
+        run("resolve_file_key", 0, [&]() { return crypto.resolve_file_key(file_id, wrapped, key_id).size(); });
+        crypto.lock();
+
+        auto arena = SecureArena::instance().stats();
+        std::cerr << "secure arena: capacity " << arena.capacity << ", peak " << arena.peak
+                  << ", heap fallbacks " << arena.heap_fallbacks << (arena.locked ? "" : " (not locked)")
+                  << std::endl;
+    }
+
+    if (options.argon2) {
+        // A PHC-encoded hash at the configured policy; encoding is noise next to Argon2
+        CryptoManager& crypto = CryptoManager::instance();
+        run("argon2id", 0, [&]() { return crypto.hash_password("benchmark-password").size(); });
+    }
+
+    // Codecs over a 32-byte key and a 4 KiB blob
+    for (size_t size : {static_cast<size_t>(32), static_cast<size_t>(4096)}) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) data[i] = static_cast<uint8_t>(i * 31);
+        std::string hex = codec::hex_encode(data);
+        std::string b64 = codec::base64_encode(data);
+        std::string b32 = totp::base32_encode(data);
+        std::vector<uint8_t> out;
+
+        run("hex_encode", size, [&]() { return codec::hex_encode(data).size(); });
+        run("hex_decode", size, [&]() { return codec::hex_decode(hex, out) ? out.size() : 0; });
+        run("base64_encode", size, [&]() { return codec::base64_encode(data).size(); });
+        run("base64_decode", size, [&]() { return codec::base64_decode(b64, out) ? out.size() : 0; });
+        run("base32_encode", size, [&]() { return totp::base32_encode(data).size(); });
+        run("base32_decode", size, [&]() { return totp::base32_decode(b32).size(); });
+    }
+
+    // Chunk compression on one pipeline block of log-like text
+    {
+        std::string line = "2026-01-01T00:00:00Z INFO GET /api/files 200 12ms\n";
+        std::vector<uint8_t> text;
+        while (text.size() < 262144) text.insert(text.end(), line.begin(), line.end());
+        text.resize(262144);
+        std::vector<uint8_t> packed(text.size()), unpacked(text.size());
+        for (auto c : {compression::Codec::Zlib, compression::Codec::Zstd}) {
+            if (!compression::available(c)) continue;
+            std::string name = compression::name(c);
+            size_t packed_len = compression::compress(c, 0, text.data(), text.size(), packed.data(), packed.size());
+            run(name + "_compress", text.size(), [&]() {
+                return compression::compress(c, 0, text.data(), text.size(), packed.data(), packed.size());
+            });
+            run(name + "_decompress", text.size(), [&]() {
+                return static_cast<size_t>(compression::decompress(c, packed.data(), packed_len,
+                                                                   unpacked.data(), unpacked.size()));
+            });
+        }
+        run("entropy_sample", text.size(), [&]() {
+            return static_cast<size_t>(compression::sample_entropy(text.data(), text.size()));
+        });
+    }
+
+    // TOTP: a single code and the full +/-1 step verification
+    std::string secret = totp::base32_encode(std::vector<uint8_t>(20, 0x5A));
+    uint64_t time_step = static_cast<uint64_t>(std::time(nullptr)) / 30;
+    run("totp_generate", 0, [&]() { return totp::code(secret, time_step).size(); });
+    run("totp_verify", 0, [&]() { return static_cast<size_t>(totp::verify(secret, "000000", time_step)); });
+
+    if (options.format == "csv") {
+        print_csv(results);
+    } else {
+        print_json(results);
+    }
+    return 0;
+}
+
+// Content is generated on the fly from one random 1 MiB pattern with each
+// MiB stamped with its index, so nothing file-sized is ever held in memory
+// and misplaced data is caught on the way back
+class PatternSource {
+public:
+    static constexpr size_t kRegion = 1u << 20;
+
+    PatternSource() : pattern_(kRegion) {
+        RAND_bytes(pattern_.data(), static_cast<int>(pattern_.size()));
+    }
+
+    void generate(uint64_t offset, uint8_t* out, size_t length) const {
+        while (length > 0) {
+            uint64_t region = offset / kRegion;
+            size_t in = static_cast<size_t>(offset % kRegion);
+            size_t n = std::min(length, kRegion - in);
+            std::memcpy(out, pattern_.data() + in, n);
+            if (in < sizeof(region)) {
+                std::memcpy(out, reinterpret_cast<const uint8_t*>(&region) + in, std::min(sizeof(region) - in, n));
+            }
+            offset += n;
+            out += n;
+            length -= n;
+        }
+    }
+
+private:
+    std::vector<uint8_t> pattern_;
+};
+
+int run_large_file(const Options& options) {
+    using clock = std::chrono::steady_clock;
+    const uint64_t total = static_cast<uint64_t>(options.large_file_gib * 1024 * 1024 * 1024);
+    std::string dir = options.workdir + "/large";
+    User user = open_scratch_vault(dir, 0);
+    PatternSource pattern;
+
+    uint64_t offset = 0;
+    auto start = clock::now();
+    std::string file_id = StorageManager::instance().store_stream(
+        [&](uint8_t* buffer, size_t length) -> ssize_t {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(length, total - offset));
+            pattern.generate(offset, buffer, n);
+            offset += n;
+            return static_cast<ssize_t>(n);
+        },
+        "large.bin", user);
+    double store_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    if (file_id.empty()) {
+        std::cerr << "store_stream failed" << std::endl;
+        return 1;
+    }
+    auto file = StorageManager::instance().get_file_info(file_id, user);
+
+    // Read back and compare against the regenerated content
+    std::vector<uint8_t> expected;
+    uint64_t read_offset = 0;
+    bool intact = true;
+    start = clock::now();
+    bool read_ok = StorageManager::instance().retrieve_stream(file_id, user, [&](const uint8_t* data, size_t length) {
+        expected.resize(length);
+        pattern.generate(read_offset, expected.data(), length);
+        intact = intact && std::memcmp(data, expected.data(), length) == 0;
+        read_offset += length;
+        return true;
+    });
+    double read_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    bool ok = read_ok && intact && read_offset == total && file && static_cast<uint64_t>(file->size) == total;
+    double mib = static_cast<double>(total) / (1024.0 * 1024.0);
+    int64_t recorded = file ? file->size : -1;
+    int64_t stored = file ? file->stored_size : -1;
+    if (system(("rm -rf '" + dir + "'").c_str()) != 0) {
+        std::cerr << "Could not remove " << dir << std::endl;
+    }
+
+    if (options.format == "csv") {
+        for (const auto& entry : environment()) {
+            std::cout << "# " << entry.first << ": " << entry.second << "\n";
+        }
+        std::cout << "bytes,recorded_size,stored_size,store_mb_per_s,read_mb_per_s,max_rss_kib,intact\n"
+                  << total << "," << recorded << "," << stored << "," << std::fixed << std::setprecision(1)
+                  << mib / store_seconds << "," << mib / read_seconds << "," << usage.ru_maxrss << ","
+                  << (ok ? "true" : "false") << "\n";
+        std::cout.flush();
+        return ok ? 0 : 1;
+    }
+
+    std::cout << "{\n  \"environment\": {";
+    auto env = environment();
+    for (size_t i = 0; i < env.size(); i++) {
+        std::cout << (i ? ", " : "") << "\"" << env[i].first << "\": \"" << json_escape(env[i].second) << "\"";
+    }
+    std::cout << "},\n  \"large_file\": {\"bytes\": " << total << ", \"recorded_size\": " << recorded
+              << ", \"stored_size\": " << stored << std::fixed << std::setprecision(1)
+              << ", \"store_mb_per_s\": " << mib / store_seconds << ", \"read_mb_per_s\": " << mib / read_seconds
+              << ", \"max_rss_kib\": " << usage.ru_maxrss << ", \"intact\": " << (ok ? "true" : "false")
+              << "}\n}" << std::endl;
+    return ok ? 0 : 1;
+}
+
+} // namespace
+
+} // namespace vaultusb
+
+int main(int argc, char* argv[]) {
+    vaultusb::Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            options.config_file = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            options.format = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--max-size" && i + 1 < argc) {
+            options.max_size = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_seconds = std::atof(argv[++i]);
+        } else if (arg == "--no-argon2") {
+            options.argon2 = false;
+        } else if (arg == "--small-files") {
+            options.small_files = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.small_files = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--large-file") {
+            options.large_file_gib = 8;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.large_file_gib = std::atof(argv[++i]);
+            }
+        } else if (arg == "--workdir" && i + 1 < argc) {
+            options.workdir = argv[++i];
+        } else if (arg == "--help") {
+            vaultusb::print_help();
+            return 0;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            vaultusb::print_help();
+            return 1;
+        }
+    }
+
+    if (options.format != "json" && options.format != "csv") {
+        std::cerr << "Unsupported format: " << options.format << std::endl;
+        return 1;
+    }
+
+    if (options.large_file_gib > 0) {
+        return vaultusb::run_large_file(options);
+    }
+    if (options.small_files > 0) {
+        return vaultusb::run_small_files(options);
+    }
+    return vaultusb::run_bench(options);
+}
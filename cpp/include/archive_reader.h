@@ -0,0 +1,80 @@
+#pragma once
+
+#include "pipeline.h"
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vaultusb {
+
+// Pull parser for archives arriving as a byte stream: tar (ustar, pax and
+// GNU long names, optionally gzip-compressed) and ZIP read front to back
+// through the local headers. Nothing is buffered beyond one input block, so
+// each entry can be handed on as a ByteSource while the archive is still
+// arriving. ZIP entries stored with a data descriptor are delimited by
+// finding a descriptor whose CRC and size match the data before it.
+class ArchiveReader {
+public:
+    enum class Format { Unknown, Tar, Zip };
+
+    struct Entry {
+        std::string name; // path inside the archive, '/' separated
+        int64_t size = -1; // -1 until read for ZIP entries with a descriptor
+        std::time_t mtime = 0;
+        bool regular = false; // directories, links and devices carry no data
+    };
+
+    explicit ArchiveReader(ByteSource source);
+    ~ArchiveReader();
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    // Moves to the next entry, skipping what is left of the current one;
+    // false at the end of the archive or when it is malformed (see error())
+    bool next(Entry& entry);
+    // The current entry's data: 0 at its end, -1 when the archive is
+    // corrupt (a ZIP entry whose CRC does not match fails on its last read)
+    ssize_t read(uint8_t* buffer, size_t length);
+
+    Format format() const { return format_; }
+    const std::string& error() const { return error_; }
+
+private:
+    struct Input;
+    std::unique_ptr<Input> input_;
+    Format format_ = Format::Unknown;
+    std::string error_;
+    bool finished_ = false;
+
+    // Current entry
+    bool in_entry_ = false;
+    bool entry_done_ = false;
+    bool raw_skip_ = false; // ZIP entry in a format we cannot extract
+    int64_t remaining_ = 0; // tar data, or stored ZIP data of known size
+    int64_t padding_ = 0; // tar block padding after the data
+    uint16_t method_ = 0;
+    bool descriptor_ = false;
+    bool zip64_ = false;
+    uint32_t expected_crc_ = 0;
+    uint64_t expected_size_ = 0;
+    uint32_t crc_ = 0;
+    uint64_t produced_ = 0;
+
+    struct Inflater;
+    std::unique_ptr<Inflater> inflater_;
+
+    bool detect();
+    bool skip_entry();
+    bool next_tar(Entry& entry);
+    bool next_zip(Entry& entry);
+    ssize_t read_tar(uint8_t* buffer, size_t length);
+    ssize_t read_zip(uint8_t* buffer, size_t length);
+    ssize_t read_until_descriptor(uint8_t* buffer, size_t length);
+    ssize_t read_inflated(uint8_t* buffer, size_t length);
+    bool finish_zip_entry();
+    bool fail(const std::string& message);
+};
+
+} // namespace vaultusb
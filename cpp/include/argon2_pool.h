@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace vaultusb {
+
+// Pre-faulted, locked memory for Argon2 passed through argon2_context
+// allocate/free callbacks. Slots are sized for the configured memory cost and
+// reused across hashes, so logins and unlocks no longer mmap, fault in and
+// unmap tens of MiB each time, and peak RSS is bounded by the slot count.
+class Argon2MemoryPool {
+public:
+    static Argon2MemoryPool& instance();
+
+    bool initialize(size_t slot_bytes, size_t slot_count, bool huge_pages);
+
+    // argon2_context callbacks
+    static int allocate(uint8_t** memory, size_t bytes);
+    static void release(uint8_t* memory, size_t bytes);
+
+    struct Stats {
+        size_t slot_count = 0;
+        size_t slot_bytes = 0;
+        size_t slots_in_use = 0;
+        uint64_t pooled_allocations = 0;
+        uint64_t fallback_allocations = 0;
+        bool huge_pages = false;
+        bool locked = false;
+    };
+    Stats stats();
+
+private:
+    Argon2MemoryPool() = default;
+    ~Argon2MemoryPool();
+    Argon2MemoryPool(const Argon2MemoryPool&) = delete;
+    Argon2MemoryPool& operator=(const Argon2MemoryPool&) = delete;
+
+    struct Slot {
+        uint8_t* base = nullptr;
+        bool in_use = false;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Slot> slots_;
+    size_t slot_bytes_ = 0;
+    size_t mapping_bytes_ = 0;
+    Stats stats_;
+
+    uint8_t* map_region(size_t bytes, bool huge_pages, bool& used_huge_pages);
+    int acquire(uint8_t** memory, size_t bytes);
+    void give_back(uint8_t* memory, size_t bytes);
+};
+
+} // namespace vaultusb
@@ -6,6 +6,7 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <future>
 
 namespace vaultusb {
 
@@ -15,12 +16,15 @@ public:
     
     // Authentication
     std::shared_ptr<User> authenticate_user(const std::string& username, const std::string& password);
+    // Runs on the KDF executor; the future is invalid when it is saturated
+    std::future<std::shared_ptr<User>> authenticate_user_async(const std::string& username, const std::string& password);
     std::string create_session(const User& user, const std::string& ip_address = "", const std::string& user_agent = "");
     std::shared_ptr<User> verify_session(const std::string& token);
     bool invalidate_session(const std::string& token);
     
     // Password management
     bool change_password(User& user, const std::string& current_password, const std::string& new_password);
+    std::future<bool> change_password_async(const User& user, const std::string& current_password, const std::string& new_password);
     std::string hash_password(const std::string& password);
     bool verify_password(const std::string& password, const std::string& password_hash);
     
@@ -34,13 +38,15 @@ public:
     void cleanup_expired_sessions();
     
 private:
-    AuthManager() = default;
+    AuthManager();
     AuthManager(const AuthManager&) = delete;
     AuthManager& operator=(const AuthManager&) = delete;
     
     std::string secret_key_;
     int idle_timeout_ = 600;
     
+    std::string generate_session_id();
+    
     // JWT-like token management
     std::string create_token(const std::map<std::string, std::string>& payload);
     std::map<std::string, std::string> parse_token(const std::string& token);
@@ -49,18 +55,9 @@ private:
     // TOTP implementation
     std::string generate_totp_secret();
     std::string generate_totp_qr_url(const std::string& secret, const std::string& username);
-    bool verify_totp_token(const std::string& secret, const std::string& token);
-    
-    // Base32 encoding/decoding for TOTP
-    std::string base32_encode(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> base32_decode(const std::string& encoded);
-    
-    // HMAC-SHA1 for TOTP
-    std::vector<uint8_t> hmac_sha1(const std::vector<uint8_t>& key, const std::vector<uint8_t>& data);
     
     // Time-based functions
     uint64_t get_current_time_step();
-    std::string time_step_to_totp(const std::string& secret, uint64_t time_step);
 };
 
 } // namespace vaultusb
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vaultusb {
+
+// Incremental backup of the vault to a directory (a second USB drive or a
+// mounted share). A run snapshots the database with SQLite's online backup
+// API and copies every ciphertext the snapshot refers to verbatim, together
+// with the password-sealed master key file and, during a rotation, the next
+// key; nothing is decrypted. A manifest in the target records the size and
+// SHA-256 of every file, so later runs copy only objects that are new or
+// changed and drop the ones no longer referenced. Shredding and pack wipes
+// are held while a run copies, so nothing the snapshot refers to disappears
+// under it.
+//
+// Target layout: vaultusb.db, master.key, master.key.next (during a
+// rotation), objects/<2 chars>/<name>, manifest and report.json.
+class VaultBackup {
+public:
+    static VaultBackup& instance();
+
+    struct Report {
+        std::string operation; // backup, mirror, verify or restore
+        std::string target;
+        std::time_t started_at = 0;
+        std::time_t finished_at = 0;
+        bool complete = false;   // backup committed, backup verified, or vault restored
+        bool full = false;       // no earlier backup in the target: everything was copied
+        uint64_t objects = 0;    // ciphertext files in the snapshot (files checked for verify)
+        uint64_t objects_copied = 0;
+        uint64_t objects_removed = 0;
+        uint64_t bytes_total = 0;
+        uint64_t bytes_copied = 0; // bytes read for verify
+        double seconds = 0.0;
+        double full_seconds = 0.0; // duration of the last full backup into this target
+        std::vector<std::string> missing; // objects the snapshot refers to that could not be found
+        std::vector<std::string> errors;
+
+        bool clean() const { return complete && missing.empty() && errors.empty(); }
+        std::string to_json() const;
+    };
+
+    // Synchronous runs, for the CLI and the background jobs; one at a time
+    Report run_backup(const std::string& target);
+    // Pass of the vault mirror into a directory that must already exist.
+    // Unless `full`, only the objects queued in the pass's snapshot and the
+    // pack segments are compared (objects the snapshot no longer has are
+    // removed); when full, or when the target holds no backup yet, every
+    // object is. queue_seq is set to the last queue entry the snapshot held.
+    Report run_mirror(const std::string& target, bool full, int64_t& queue_seq);
+    // Re-hashes every file against the manifest and checks the snapshot
+    Report verify(const std::string& target);
+    // Copies a backup into the configured db_file, master_key_file and
+    // vault_dir, checking every file against the manifest on the way, and
+    // brings back the next key of a pending rotation. The database and key
+    // files must not exist yet.
+    Report restore(const std::string& target);
+
+    // Background backup to storage.backup_dir; false if one is running or
+    // no backup_dir is configured
+    bool start();
+    void stop();
+
+    struct Progress {
+        bool running = false;
+        uint64_t objects_total = 0;
+        uint64_t objects_done = 0;
+        uint64_t bytes_done = 0;
+        std::string last_report; // JSON of the last backup, empty if none
+    };
+    Progress progress();
+    // Objects done and in total of the mirror pass in progress
+    void mirror_pass_progress(uint64_t& objects_done, uint64_t& objects_total);
+
+private:
+    VaultBackup() = default;
+    ~VaultBackup();
+    VaultBackup(const VaultBackup&) = delete;
+    VaultBackup& operator=(const VaultBackup&) = delete;
+
+    struct Manifest;
+
+    std::mutex mutex_;
+    std::mutex run_mutex_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_requested_{false};
+    // Progress of the run in progress; mirror passes count apart so they
+    // never show up as backup progress
+    struct Counters {
+        std::atomic<uint64_t> objects_total{0};
+        std::atomic<uint64_t> objects_done{0};
+        std::atomic<uint64_t> bytes_done{0};
+    };
+    Counters backup_counters_; // backup, verify and restore
+    Counters mirror_counters_;
+    Counters* counters_ = &backup_counters_; // set under run_mutex_
+    std::string last_report_;
+
+    // Picks and resets the run's counters; callers hold run_mutex_
+    Report begin(const std::string& operation, const std::string& target);
+    void finish(Report& report, std::chrono::steady_clock::time_point started);
+    // `partial` compares only the objects queued for the mirror, whose last
+    // seq goes to queue_seq
+    Report sync(const std::string& operation, const std::string& target, bool partial, int64_t* queue_seq);
+    // Copies length bytes (-1: to the end) from in_fd, hashing them
+    bool copy_fd(int in_fd, int out_fd, int64_t length, std::string& sha256, uint64_t& bytes);
+    // Copies into path through a .part file renamed into place; with
+    // `expected` set a copy whose SHA-256 differs is discarded
+    bool copy_to(int in_fd, int64_t length, const std::string& path, std::string& sha256, uint64_t& bytes,
+                 const std::string& expected = "");
+    bool hash_file(const std::string& path, std::string& sha256, uint64_t& bytes);
+    bool load_manifest(const std::string& target, Manifest& manifest);
+    bool save_manifest(const std::string& target, const Manifest& manifest);
+    uint64_t remove_unlisted(const std::string& target, const Manifest& manifest);
+};
+
+} // namespace vaultusb
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vaultusb {
+
+// Content-defined chunking (FastCDC). Cut points come from a gear hash
+// rolled over the data itself, so an edit only moves the boundaries next to
+// it and every other chunk keeps its content. A stricter mask before the
+// average size and a looser one after it keep chunk sizes close to the
+// average; chunks are at least a quarter and at most four times of it.
+class Chunker {
+public:
+    // average_size is rounded down to a power of two, at least 256 bytes
+    explicit Chunker(size_t average_size);
+
+    // Length of the chunk at the start of data. Callers pass at least
+    // max_size() bytes unless the input ends sooner; then the whole rest is
+    // one chunk when no cut point falls inside it.
+    size_t cut(const uint8_t* data, size_t length) const;
+
+    size_t min_size() const { return min_size_; }
+    size_t average_size() const { return average_size_; }
+    size_t max_size() const { return max_size_; }
+
+private:
+    size_t min_size_;
+    size_t average_size_;
+    size_t max_size_;
+    uint64_t mask_small_; // before the average: more bits must be zero
+    uint64_t mask_large_; // after it: fewer
+};
+
+} // namespace vaultusb
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "secure_memory.h"
+
+namespace vaultusb {
+namespace cipher {
+
+// ChaCha20-Poly1305 and HKDF primitives under CryptoManager.
+// encrypt_data/decrypt_data produce and accept the legacy untagged layout;
+// aead_seal/aead_open append and verify the 16-byte tag and authenticate
+// `aad`. aead_seal/aead_open only ever carry keys, so their plaintext is
+// SecureBytes. All of them throw on failure.
+
+std::vector<uint8_t> encrypt_data(const std::vector<uint8_t>& data, const SecureBytes& key,
+                                  const std::vector<uint8_t>& nonce);
+std::vector<uint8_t> decrypt_data(const std::vector<uint8_t>& encrypted_data, const SecureBytes& key,
+                                  const std::vector<uint8_t>& nonce);
+std::vector<uint8_t> aead_seal(const SecureBytes& plaintext, const SecureBytes& key,
+                               const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& aad);
+SecureBytes aead_open(const std::vector<uint8_t>& sealed, const SecureBytes& key,
+                      const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& aad);
+
+// HKDF-SHA256 with the file-key salt
+SecureBytes hkdf_derive(const SecureBytes& key, const std::string& info, size_t length);
+
+} // namespace cipher
+} // namespace vaultusb
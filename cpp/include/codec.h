@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace vaultusb {
+namespace codec {
+
+// Table-driven text codecs for keys, hashes and exports.
+// Decoders return false on malformed input instead of throwing.
+
+std::string hex_encode(const uint8_t* data, size_t length);
+std::string hex_encode(const std::vector<uint8_t>& data);
+bool hex_decode(const std::string& text, std::vector<uint8_t>& out);
+
+// Standard alphabet; `pad` controls trailing '=' (PHC strings omit it)
+std::string base64_encode(const uint8_t* data, size_t length, bool pad = true);
+std::string base64_encode(const std::vector<uint8_t>& data, bool pad = true);
+bool base64_decode(const std::string& text, std::vector<uint8_t>& out);
+
+// Escapes a string for use inside a JSON string literal
+std::string json_escape(const std::string& text);
+
+// Search key for UTF-8 text: lower case, Latin accents stripped (é -> e,
+// ß -> ss), combining marks dropped so NFC and NFD names fold alike
+std::string fold_text(const std::string& text);
+
+} // namespace codec
+} // namespace vaultusb
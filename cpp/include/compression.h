@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace vaultusb {
+namespace compression {
+
+// Chunk codecs for compress-before-encrypt. The value is stored in the
+// stream header, so existing entries must never be renumbered.
+enum class Codec : uint8_t {
+    None = 0,
+    Zlib = 1,
+    Zstd = 2, // only when built with libzstd (VAULTUSB_HAVE_ZSTD)
+};
+
+bool available(Codec codec);
+const char* name(Codec codec);
+
+// "auto" picks zstd when built in and zlib otherwise; "off"/"none" disables
+Codec from_name(const std::string& name);
+
+// False for formats that are already compressed (images, media, archives)
+bool compressible_mime(const std::string& mime_type);
+
+// Shannon entropy in bits per byte over a few windows spread across the
+// buffer; close to 8 means random-looking data that will not shrink.
+double sample_entropy(const uint8_t* data, size_t length);
+
+// Returns the compressed length, or 0 when the output would not fit in
+// `capacity` (callers pass capacity < length to only keep real gains).
+// level 0 selects a fast per-codec default.
+size_t compress(Codec codec, int level, const uint8_t* data, size_t length, uint8_t* out, size_t capacity);
+
+// Returns the decompressed length, or -1 on corrupt input or overflow
+ssize_t decompress(Codec codec, const uint8_t* data, size_t length, uint8_t* out, size_t capacity);
+
+} // namespace compression
+} // namespace vaultusb
@@ -17,6 +17,7 @@ public:
     const std::string& host() const { return host_; }
     int port() const { return port_; }
     const std::string& secret_key() const { return secret_key_; }
+    int http_workers() const { return http_workers_; }
     
     // Networking configuration
     const std::string& usb0_ip() const { return usb0_ip_; }
@@ -36,7 +37,39 @@ public:
     int argon2_time_cost() const { return argon2_time_cost_; }
     int argon2_memory_cost() const { return argon2_memory_cost_; }
     int argon2_parallelism() const { return argon2_parallelism_; }
+    int argon2_max_concurrency() const { return argon2_max_concurrency_; }
+    bool argon2_huge_pages() const { return argon2_huge_pages_; }
+    int kdf_memory_budget() const { return kdf_memory_budget_; }
+    int kdf_queue_depth() const { return kdf_queue_depth_; }
     int file_key_size() const { return file_key_size_; }
+    int secure_arena_size() const { return secure_arena_size_; }
+    
+    // Storage configuration
+    int pipeline_block_size() const { return pipeline_block_size_; }
+    int pipeline_depth() const { return pipeline_depth_; }
+    const std::string& shred_mode() const { return shred_mode_; }
+    int shred_rate_limit() const { return shred_rate_limit_; }
+    bool dedup_enabled() const { return dedup_enabled_; }
+    const std::string& compression() const { return compression_; }
+    int compression_level() const { return compression_level_; }
+    int check_threads() const { return check_threads_; }
+    int check_rate_limit() const { return check_rate_limit_; }
+    int check_interval() const { return check_interval_; }
+    const std::string& check_report() const { return check_report_; }
+    int vault_fanout() const { return vault_fanout_; }
+    int pack_threshold() const { return pack_threshold_; }
+    int pack_segment_size() const { return pack_segment_size_; }
+    int pack_compact_threshold() const { return pack_compact_threshold_; }
+    int default_quota() const { return default_quota_; }
+    int trash_retention() const { return trash_retention_; }
+    int upload_chunk_size() const { return upload_chunk_size_; }
+    int upload_expiry() const { return upload_expiry_; }
+    int version_chunk_size() const { return version_chunk_size_; }
+    int version_retention() const { return version_retention_; }
+    int version_max_age() const { return version_max_age_; }
+    const std::string& backup_dir() const { return backup_dir_; }
+    const std::string& mirror_dir() const { return mirror_dir_; }
+    int mirror_interval() const { return mirror_interval_; }
     
     // TLS configuration
     bool tls_enabled() const { return tls_enabled_; }
@@ -73,6 +106,7 @@ private:
     std::string host_ = "0.0.0.0";
     int port_ = 8000;
     std::string secret_key_ = "vaultusb-secret-key";
+    int http_workers_ = 4;
     
     // Networking configuration
     std::string usb0_ip_ = "192.168.3.1";
@@ -92,7 +126,39 @@ private:
     int argon2_time_cost_ = 3;
     int argon2_memory_cost_ = 65536;
     int argon2_parallelism_ = 1;
+    int argon2_max_concurrency_ = 1;
+    bool argon2_huge_pages_ = false;
+    int kdf_memory_budget_ = 0;
+    int kdf_queue_depth_ = 8;
     int file_key_size_ = 32;
+    int secure_arena_size_ = 64;
+    
+    // Storage configuration
+    int pipeline_block_size_ = 262144;
+    int pipeline_depth_ = 4;
+    std::string shred_mode_ = "auto";
+    int shred_rate_limit_ = 8192;
+    bool dedup_enabled_ = true;
+    std::string compression_ = "auto";
+    int compression_level_ = 0;
+    int check_threads_ = 0;
+    int check_rate_limit_ = 4096;
+    int check_interval_ = 168;
+    std::string check_report_ = "/opt/vaultusb/vault_check.json";
+    int vault_fanout_ = 2;
+    int pack_threshold_ = 16384;
+    int pack_segment_size_ = 4096;
+    int pack_compact_threshold_ = 30;
+    int default_quota_ = 0;
+    int trash_retention_ = 30;
+    int upload_chunk_size_ = 4096;
+    int upload_expiry_ = 24;
+    int version_chunk_size_ = 64;
+    int version_retention_ = 20;
+    int version_max_age_ = 0;
+    std::string backup_dir_;
+    std::string mirror_dir_;
+    int mirror_interval_ = 30;
     
     // TLS configuration
     bool tls_enabled_ = false;
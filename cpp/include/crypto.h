@@ -4,41 +4,123 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include "pipeline.h"
+#include "compression.h"
+#include "secure_memory.h"
 
 namespace vaultusb {
 
+// Argon2 cost parameters, stored next to every hash or sealed key
+struct KdfParams {
+    uint32_t time_cost = 3;
+    uint32_t memory_cost = 65536; // KiB
+    uint32_t parallelism = 1;
+};
+
 class CryptoManager {
 public:
     static CryptoManager& instance();
     
     // Master key management
-    std::vector<uint8_t> generate_master_key();
-    std::string seal_master_key(const std::vector<uint8_t>& master_key, const std::string& password);
-    std::vector<uint8_t> unseal_master_key(const std::string& sealed_data, const std::string& password);
+    SecureBytes generate_master_key();
+    std::string seal_master_key(const SecureBytes& master_key, const std::string& password);
+    SecureBytes unseal_master_key(const std::string& sealed_data, const std::string& password);
     bool load_master_key(const std::string& password);
-    bool save_master_key(const std::vector<uint8_t>& master_key, const std::string& password);
+    std::future<bool> load_master_key_async(const std::string& password);
+    bool save_master_key(const SecureBytes& master_key, const std::string& password);
+    // A legacy master-key file has no tag, so any password unseals it to some
+    // key. Until KeyMigrator::confirm_master_key() finds proof that the key is
+    // right the file is not resealed, no data key is wrapped under it and keys
+    // are neither migrated nor rotated.
+    bool master_key_confirmed() const { return master_key_confirmed_; }
+    // Proof for a candidate key: the first frame of a key_id 0 object in the
+    // chunked format authenticates under the file key derived from it
+    bool authenticate_legacy_object(const SecureBytes& master_key, int fd, int64_t offset, int64_t length,
+                                    const std::string& file_id);
+    
+    // Envelope encryption: each file has a random data key wrapped by the
+    // master key (files.wrapped_key / files.key_id). key_id 0 marks legacy
+    // files whose key is still derived from the file id with HKDF.
+    SecureBytes generate_file_key();
+    std::string wrap_file_key(const SecureBytes& file_key, const std::string& file_id, uint32_t& key_id);
+    SecureBytes unwrap_file_key(const std::string& wrapped_key, const std::string& file_id, uint32_t key_id);
+    SecureBytes resolve_file_key(const std::string& file_id, const std::string& wrapped_key, uint32_t key_id);
+    uint32_t active_key_id();
+    
+    // Keyed content digest for deduplication: HMAC-SHA256(key, SHA-256(content)),
+    // so a client-supplied SHA-256 can be matched without storing plain hashes
+    std::string content_digest(const SecureBytes& key, const uint8_t* sha256);
+    
+    // Master-key rotation: the new key is sealed to <master_key_file>.next,
+    // data keys are rewrapped in the background, then the new key is promoted
+    bool begin_key_rotation(const std::string& password);
+    std::future<bool> begin_key_rotation_async(const std::string& password);
+    bool finish_key_rotation();
+    bool rotation_in_progress();
     
     // File encryption/decryption
-    std::vector<uint8_t> derive_file_key(const std::string& file_id);
+    SecureBytes derive_file_key(const std::string& file_id);
     bool encrypt_file(const std::string& file_path, const std::string& file_id);
     std::vector<uint8_t> decrypt_file(const std::string& file_path, const std::string& file_id);
-    bool secure_delete(const std::string& file_path);
+    bool decrypt_file_to(const std::string& file_path, const std::string& file_id, const ByteSink& sink);
+    bool decrypt_file_to(const std::string& file_path, const SecureBytes& file_key, const ByteSink& sink);
+    // fd stays open; offset/length select one object inside a pack segment
+    bool decrypt_file_to(int fd, const SecureBytes& file_key, const ByteSink& sink,
+                         int64_t offset = 0, int64_t length = -1);
+    bool secure_delete(const std::string& file_path); // queued to the Shredder
     
-    // Password hashing
+    // Streaming encryption: chunked ChaCha20-Poly1305 frames produced by a
+    // read/encrypt/write pipeline so disk I/O overlaps with the cipher
+    bool encrypt_stream(const ByteSource& source, const ByteSink& sink, const std::string& file_id);
+    bool decrypt_stream(const ByteSource& source, const ByteSink& sink, const std::string& file_id);
+    // A codec other than None compresses each chunk before sealing it; chunks
+    // that would not shrink (or sample as high entropy) are stored raw
+    bool encrypt_stream(const ByteSource& source, const ByteSink& sink, const SecureBytes& file_key,
+                        compression::Codec codec = compression::Codec::None);
+    bool decrypt_stream(const ByteSource& source, const ByteSink& sink, const SecureBytes& file_key);
+    // Building a stream out of order (resumable uploads): the header is made
+    // once, then each run of plaintext is sealed into the frames starting at
+    // first_index. A run must cover whole chunks unless it is the final one,
+    // which closes the stream; the header followed by every run's frames in
+    // index order reads back with decrypt_stream.
+    std::vector<uint8_t> new_stream_header(compression::Codec codec);
+    size_t stream_chunk_size() const { return stream_chunk_size_; }
+    static size_t stream_chunk_size(const std::vector<uint8_t>& header); // 0 if not a stream header
+    bool encrypt_frames(const std::vector<uint8_t>& header, const SecureBytes& file_key, uint64_t first_index,
+                        const uint8_t* data, size_t length, bool final, std::vector<uint8_t>& out);
+    // True for chunked (tag-authenticated) streams; false for the legacy untagged format
+    static bool is_stream_format(const uint8_t* header, size_t length);
+    
+    // Password hashing (Argon2id, PHC string format)
     std::string hash_password(const std::string& password);
     bool verify_password(const std::string& password, const std::string& password_hash);
+    bool password_needs_rehash(const std::string& password_hash);
+    
+    // KDF policy and calibration
+    KdfParams kdf_policy() const;
+    size_t kdf_concurrency() const;
+    KdfParams calibrate_kdf(int target_ms, uint32_t max_memory_kib, double* measured_ms = nullptr);
     
     // Vault state
     bool is_unlocked() const { return is_unlocked_; }
     void lock();
     
 private:
-    CryptoManager() = default;
+    CryptoManager();
     CryptoManager(const CryptoManager&) = delete;
     CryptoManager& operator=(const CryptoManager&) = delete;
     
-    std::vector<uint8_t> master_key_;
-    bool is_unlocked_ = false;
+    // Key material lives in the locked SecureArena and is wiped on release
+    SecureBytes master_key_;
+    SecureBytes next_master_key_; // set while a rotation is in progress
+    uint32_t master_key_id_ = 0;
+    uint32_t next_key_id_ = 0;
+    std::atomic<bool> is_unlocked_{false};
+    std::atomic<bool> master_key_confirmed_{false};
+    std::mutex key_mutex_;
     std::string master_key_file_;
     std::string vault_dir_;
     
@@ -48,18 +130,22 @@ private:
     int argon2_parallelism_ = 1;
     int file_key_size_ = 32;
     
+    // Streaming parameters
+    size_t stream_chunk_size_ = 262144;
+    size_t stream_depth_ = 4;
+    int compression_level_ = 0;
+    
     // Helper methods
-    std::vector<uint8_t> derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt);
+    SecureBytes derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt);
+    SecureBytes derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt,
+                                         int argon2_type, const KdfParams& params);
+    SecureBytes argon2_raw(int argon2_type, const KdfParams& params, const std::string& password,
+                           const std::vector<uint8_t>& salt, size_t length);
+    bool params_below_policy(const KdfParams& params) const;
+    uint32_t key_id_for(const SecureBytes& master_key);
     std::vector<uint8_t> generate_salt(size_t length = 32);
     std::vector<uint8_t> generate_nonce(size_t length = 12);
     
-    // ChaCha20-Poly1305 encryption/decryption
-    std::vector<uint8_t> encrypt_data(const std::vector<uint8_t>& data, const std::vector<uint8_t>& key, const std::vector<uint8_t>& nonce);
-    std::vector<uint8_t> decrypt_data(const std::vector<uint8_t>& encrypted_data, const std::vector<uint8_t>& key, const std::vector<uint8_t>& nonce);
-    
-    // HKDF for key derivation
-    std::vector<uint8_t> hkdf_derive(const std::vector<uint8_t>& key, const std::string& info, size_t length);
-    
     // Utility methods
     std::string bytes_to_hex(const std::vector<uint8_t>& bytes);
     std::vector<uint8_t> hex_to_bytes(const std::string& hex);
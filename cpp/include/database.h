@@ -2,6 +2,7 @@
 
 #include "models.h"
 #include <sqlite3.h>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,6 +22,8 @@ public:
     std::shared_ptr<User> get_user_by_username(const std::string& username);
     std::shared_ptr<User> get_user_by_id(int user_id);
     bool update_user(const User& user);
+    // Not counted as a metadata change (see metadata_change_count)
+    bool update_last_login(int user_id, std::time_t last_login);
     bool delete_user(int user_id);
     
     // Session operations
@@ -33,11 +36,154 @@ public:
     
     // File operations
     bool create_file(const File& file);
+    // All rows in one transaction, or none (archive import)
+    bool create_files(const std::vector<File>& files);
     std::shared_ptr<File> get_file_by_id(const std::string& file_id);
     std::vector<File> get_user_files(int user_id, int limit = 100, int offset = 0);
     bool update_file(const File& file);
+    // Moves a live row to the trash; its ciphertext and dedup reference stay
     bool delete_file(const std::string& file_id);
     int get_user_file_count(int user_id);
+    // Case- and accent-insensitive substring search over names, ranked
+    // exact > prefix > shorter name > newest; "type:pdf" terms match the mime type
+    std::vector<File> search_files(int user_id, const std::string& query, int limit = 100);
+    bool has_search_index() const { return search_index_; }
+    bool get_user_storage(int user_id, int64_t& logical_bytes, int64_t& stored_bytes);
+    std::vector<StorageUsage> get_user_usage(int user_id);
+    // Recomputes every counter from the files table; returns how many
+    // counter rows were wrong, -1 on failure
+    int rebuild_user_stats();
+    // Quota on stored bytes: -1 when unset (the configured default applies), 0 = unlimited
+    int64_t get_user_quota(int user_id);
+    bool set_user_quota(int user_id, int64_t quota_bytes);
+    // Rows holding a ciphertext (live or in the trash) of every user in id
+    // order, for paging with the last id seen
+    std::vector<File> get_files_after(const std::string& after_id, int limit = 256);
+    // True while a live or trashed row, or a chunk of one, still refers to the ciphertext
+    bool has_file_ref(const std::string& encrypted_name);
+    
+    // File versions. A versioned file's chunks are stored once per file and
+    // counted by the versions listing them; versions are written and
+    // switched to in one transaction
+    std::vector<ContentChunk> get_file_chunks(const std::string& file_id);
+    // Adds the version with the chunk list `digests` (new_chunks are inserted
+    // first) and makes it current. A non-empty encrypted_name replaces the
+    // row's own object (the first version of a file). False if the file's
+    // current version is no longer expected_version.
+    bool add_file_version(const FileVersion& version, int64_t expected_version,
+                          const std::vector<ContentChunk>& new_chunks, const std::vector<std::string>& digests,
+                          const std::string& encrypted_name);
+    // Newest first
+    std::vector<FileVersion> get_file_versions(const std::string& file_id);
+    // The version's chunks in content order
+    bool get_version_chunks(const std::string& file_id, int64_t version, std::vector<ContentChunk>& chunks);
+    // Deletes `version` when > 0, else every version beyond the newest `keep`
+    // (0 = any number) or created before created_before; the current one
+    // always stays. Chunks left unlisted are dropped, and their objects
+    // returned when no other file shares them. Returns versions deleted, -1 on failure.
+    int delete_file_versions(const std::string& file_id, int64_t version, int keep, std::time_t created_before,
+                             std::vector<std::string>& unreferenced);
+    std::vector<std::string> get_files_with_versions_before(std::time_t created_before, int limit = 64);
+    // Inserts the copy's row with the source's current version as its first,
+    // sharing the chunk objects
+    bool create_versioned_copy(const File& copy, const std::string& source_id, int64_t source_version);
+    // Chunk objects in name order, each as a row of a file holding it (its
+    // data key opens the chunk), for paging with the last name seen
+    std::vector<File> get_chunk_objects_after(const std::string& after_name, int limit = 256);
+    
+    // Virtual folders; folder id "" is the user's root. Listings are single
+    // index range scans, moves rewrite one row and subtree totals sum the
+    // per-folder counters over the subtree's folders, never its files
+    bool create_folder(const Folder& folder);
+    std::shared_ptr<Folder> get_folder(const std::string& folder_id);
+    std::shared_ptr<Folder> get_folder_by_name(int user_id, const std::string& parent_id, const std::string& name);
+    std::vector<Folder> get_subfolders(int user_id, const std::string& parent_id, int limit = 1000, int offset = 0);
+    std::vector<File> get_folder_files(int user_id, const std::string& folder_id, int limit = 100, int offset = 0);
+    // The folder's ancestors and itself, outermost first
+    std::vector<Folder> get_folder_path(const std::string& folder_id);
+    bool get_folder_stats(int user_id, const std::string& folder_id, FolderStats& stats);
+    // False if the name is taken in the new parent or the parent lies in the folder's own subtree
+    bool move_folder(int user_id, const std::string& folder_id, const std::string& parent_id, const std::string& name);
+    bool move_file(int user_id, const std::string& file_id, const std::string& folder_id);
+    // Trashes the subtree's files and deletes its folders in one transaction;
+    // returns the files trashed, -1 on failure
+    int64_t delete_folder(int user_id, const std::string& folder_id);
+    
+    // Trash
+    std::shared_ptr<File> get_trashed_file(const std::string& file_id);
+    std::vector<File> get_user_trash(int user_id, int limit = 100, int offset = 0);
+    bool get_trash_usage(int user_id, int64_t& files, int64_t& bytes);
+    bool restore_file(const std::string& file_id);
+    // Deletes up to `limit` trashed rows deleted at or before deleted_before
+    // (user_id 0: any user, file_id "": any file) in one transaction and
+    // releases their dedup references. Ciphertexts no row refers to any more
+    // are returned for shredding. Returns the rows purged, -1 on failure.
+    int purge_trash(int user_id, const std::string& file_id, std::time_t deleted_before, int limit,
+                    std::vector<std::string>& unreferenced);
+    
+    // Data key rewrapping (master-key rotation and legacy conversion)
+    std::vector<File> get_files_to_rekey(uint32_t key_id, int limit = 64);
+    int count_files_to_rekey(uint32_t key_id);
+    // HKDF-keyed (key_id 0) files with a single object, newest first
+    std::vector<File> get_legacy_key_files(int limit = 64);
+    bool update_file_key(const std::string& file_id, const std::string& wrapped_key, uint32_t key_id,
+                         uint32_t expected_key_id);
+    
+    // Deduplicated content objects, reference counted per user
+    std::shared_ptr<File> get_file_by_encrypted_name(const std::string& encrypted_name);
+    bool acquire_object(int user_id, const std::string& digest, const std::string& encrypted_name, int64_t size,
+                        std::string& stored_name);
+    bool add_object_ref(int user_id, const std::string& digest);
+    bool find_object(int user_id, const std::string& digest, std::string& encrypted_name, int64_t& size);
+    bool release_object(int user_id, const std::string& digest);
+    
+    // Small-object packs (segments and the offset index)
+    int64_t create_pack(const std::string& encrypted_name);
+    std::vector<Pack> get_packs();
+    bool seal_pack(int64_t pack_id);
+    bool delete_pack(int64_t pack_id);
+    bool is_pack_segment(const std::string& encrypted_name);
+    bool add_pack_entry(const PackEntry& entry);
+    bool get_pack_entry(const std::string& encrypted_name, PackEntry& entry);
+    std::vector<PackEntry> get_pack_entries(int64_t pack_id);
+    bool move_pack_entry(const std::string& encrypted_name, int64_t from_pack, int64_t to_pack, int64_t offset);
+    bool delete_pack_entry(const std::string& encrypted_name);
+    
+    // Resumable upload sessions and their received chunks
+    bool create_upload_session(const UploadSession& session);
+    std::shared_ptr<UploadSession> get_upload_session(const std::string& session_id);
+    std::vector<UploadSession> get_user_upload_sessions(int user_id);
+    // Sessions without a chunk since `before`, oldest first
+    std::vector<UploadSession> get_expired_upload_sessions(std::time_t before, int limit = 64);
+    bool delete_upload_session(const std::string& session_id);
+    std::vector<UploadChunk> get_upload_chunks(const std::string& session_id);
+    bool get_upload_chunk(const std::string& session_id, int64_t index, UploadChunk& chunk);
+    // False if the chunk was already recorded; the first one stays
+    bool add_upload_chunk(const std::string& session_id, const UploadChunk& chunk);
+    std::vector<UploadSession> get_upload_sessions_to_rekey(uint32_t key_id, int limit = 64);
+    bool update_upload_session_key(const std::string& session_id, const std::string& wrapped_key, uint32_t key_id,
+                                   uint32_t expected_key_id);
+    
+    // Wrapped per-user secrets
+    std::shared_ptr<UserKey> get_user_key(int user_id, const std::string& purpose);
+    bool create_user_key(const UserKey& key);
+    std::vector<UserKey> get_user_keys_to_rekey(uint32_t key_id, int limit = 64);
+    bool update_user_key(const UserKey& key, uint32_t expected_key_id);
+    
+    // Shred queue operations
+    bool enqueue_shred(const std::string& path, int64_t size);
+    std::vector<ShredJob> get_shred_jobs(int limit = 16);
+    bool update_shred_progress(int job_id, int64_t bytes_done);
+    bool delete_shred_job(int job_id);
+    bool get_shred_backlog(int64_t& files, int64_t& bytes);
+    
+    // Vault mirror queue, filled by triggers while a mirror is configured;
+    // passes read it from their snapshot (see backup_to)
+    bool delete_mirror_queue(int64_t last_seq);
+    bool get_mirror_backlog(int64_t& entries, std::time_t& oldest);
+    // Rows changed through this connection since it was opened, in the
+    // tables a mirror pass ships (not sessions, logs, queues or last_login)
+    int64_t metadata_change_count();
     
     // WiFi network operations
     bool create_wifi_network(const std::string& ssid, const std::string& security, int priority = 0);
@@ -50,7 +196,18 @@ public:
     
     // Database maintenance
     bool create_tables();
+    bool migrate_schema();
     bool create_default_admin_user();
+    // Online copy of the database into a new file at path, a batch of pages
+    // at a time; sessions and queues that mean nothing elsewhere are dropped.
+    // With mirror_queue and mirror_seq the copy's mirror queue is returned
+    // first: its distinct names and its last seq (0 if empty)
+    bool backup_to(const std::string& path, std::vector<std::string>* mirror_queue = nullptr,
+                   int64_t* mirror_seq = nullptr);
+    // Checks a backup copy and lists the ciphertext files it refers to
+    // (packed objects are covered by their segments, also listed on their own)
+    static bool read_backup(const std::string& db_file, std::vector<std::string>& objects,
+                            std::vector<std::string>* segments = nullptr);
     
 private:
     Database() = default;
@@ -59,7 +216,15 @@ private:
     
     sqlite3* db_ = nullptr;
     std::string db_file_;
+    bool search_index_ = false; // FTS5 trigram index available
+    std::atomic<int64_t> metadata_changes_{0};
     
+    bool ensure_search_index();
+    // BEGIN IMMEDIATE .. COMMIT around body, holding the connection mutex so
+    // statements of other threads cannot land inside the transaction
+    bool run_transaction(const std::function<bool()>& body);
+    // Binds and steps the prepared files INSERT, after resetting it
+    bool insert_file(sqlite3_stmt* stmt, const File& file);
     bool execute_query(const std::string& query);
     bool execute_query(const std::string& query, std::function<int(sqlite3_stmt*)> callback);
     
@@ -72,6 +237,9 @@ private:
     int get_int_column(sqlite3_stmt* stmt, int column);
     int64_t get_int64_column(sqlite3_stmt* stmt, int column);
     bool get_bool_column(sqlite3_stmt* stmt, int column);
+    File file_from_row(sqlite3_stmt* stmt);
+    Folder folder_from_row(sqlite3_stmt* stmt);
+    UploadSession upload_session_from_row(sqlite3_stmt* stmt);
 };
 
 } // namespace vaultusb
@@ -8,9 +8,15 @@
 #include "crypto.h"
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace vaultusb {
 
@@ -22,6 +28,10 @@ struct HttpRequest {
     std::map<std::string, std::string> query_params;
     std::string client_ip;
     std::string user_agent;
+    
+    // Routes registered with register_streaming_route get the body through
+    // this source, read from the connection as it is consumed; `body` stays empty
+    ByteSource body_source;
 };
 
 struct HttpResponse {
@@ -31,6 +41,12 @@ struct HttpResponse {
     std::string body;
     std::string content_type = "application/json";
     
+    // Incremental body producer for large payloads. When set, `body` is
+    // ignored and the payload is sent as it is produced: with Content-Length
+    // if content_length is known, chunked transfer encoding otherwise.
+    std::function<bool(const ByteSink&)> body_stream;
+    int64_t content_length = -1;
+    
     HttpResponse() = default;
     HttpResponse(int code, const std::string& text) : status_code(code), status_text(text) {}
 };
@@ -46,6 +62,9 @@ public:
     // Route registration
     void register_route(const std::string& method, const std::string& path, 
                        std::function<HttpResponse(const HttpRequest&)> handler);
+    // For bodies that may exceed what is read into memory
+    void register_streaming_route(const std::string& method, const std::string& path,
+                                  std::function<HttpResponse(const HttpRequest&)> handler);
     
     // Middleware
     void add_middleware(std::function<bool(const HttpRequest&, HttpResponse&)> middleware);
@@ -64,9 +83,19 @@ private:
     
     int port_ = 8000;
     int server_socket_ = -1;
-    bool running_ = false;
+    std::atomic<bool> running_{false};
+    size_t max_request_size_ = 1024 * 1024; // requests are read whole
+    
+    // Connection workers, so a request waiting on the KDF does not stall others
+    std::vector<std::thread> workers_;
+    std::deque<int> pending_connections_;
+    std::mutex connections_mutex_;
+    std::condition_variable connections_cv_;
+    void worker_loop();
+    void reject_busy(int client_socket);
     
     std::map<std::string, std::map<std::string, std::function<HttpResponse(const HttpRequest&)>>> routes_;
+    std::set<std::string> streaming_routes_; // "METHOD path"
     std::vector<std::function<bool(const HttpRequest&, HttpResponse&)>> middlewares_;
     
     // Server operations
@@ -76,18 +105,32 @@ private:
     HttpRequest parse_request(const std::string& raw_request);
     std::string build_response(const HttpResponse& response);
     void send_response(int client_socket, const HttpResponse& response);
+    bool send_all(int client_socket, const char* data, size_t length);
     
     // Route matching
     std::function<HttpResponse(const HttpRequest&)> find_route(const std::string& method, const std::string& path);
+    // Registered path the request path resolves to, "" if none
+    std::string route_pattern(const std::string& method, const std::string& path);
     bool match_route(const std::string& pattern, const std::string& path);
+    static std::string path_segment(const std::string& path, size_t index);
+    static std::string json_string_field(const std::string& body, const std::string& key);
+    static int64_t json_int_field(const std::string& body, const std::string& key); // -1 if absent
+    static std::vector<std::string> json_string_array_field(const std::string& body, const std::string& key);
+    static std::string upload_json(const UploadSession& session, const std::vector<UploadChunk>& chunks,
+                                   bool list_chunks);
+    static std::string folder_param(const std::string& value);
+    static std::string folder_json(const Folder& folder);
+    static std::string version_json(const FileVersion& version);
+    // Version number in a path segment; -1 if it is not one
+    static int64_t version_param(const std::string& value);
     
     // Authentication middleware
     bool auth_middleware(const HttpRequest& request, HttpResponse& response);
     std::shared_ptr<User> get_current_user(const HttpRequest& request);
     
     // Vault state management
-    bool vault_unlocked_ = false;
-    std::time_t last_activity_ = 0;
+    std::atomic<bool> vault_unlocked_{false};
+    std::atomic<std::time_t> last_activity_{0};
     bool check_vault_unlocked();
     void update_activity();
     
@@ -101,17 +144,52 @@ private:
     HttpResponse handle_unlock_vault(const HttpRequest& request);
     HttpResponse handle_lock_vault(const HttpRequest& request);
     HttpResponse handle_vault_status(const HttpRequest& request);
+    HttpResponse handle_rotate_key(const HttpRequest& request);
+    HttpResponse handle_rotation_status(const HttpRequest& request);
     HttpResponse handle_list_files(const HttpRequest& request);
+    HttpResponse handle_search_files(const HttpRequest& request);
     HttpResponse handle_upload_file(const HttpRequest& request);
     HttpResponse handle_download_file(const HttpRequest& request);
+    HttpResponse handle_export_files(const HttpRequest& request);
+    HttpResponse handle_import_archive(const HttpRequest& request);
     HttpResponse handle_preview_file(const HttpRequest& request);
     HttpResponse handle_delete_file(const HttpRequest& request);
+    HttpResponse handle_copy_file(const HttpRequest& request);
+    HttpResponse handle_move_file(const HttpRequest& request);
+    HttpResponse handle_write_version(const HttpRequest& request);
+    HttpResponse handle_list_versions(const HttpRequest& request);
+    HttpResponse handle_download_version(const HttpRequest& request);
+    HttpResponse handle_restore_version(const HttpRequest& request);
+    HttpResponse handle_delete_version(const HttpRequest& request);
+    HttpResponse handle_create_folder(const HttpRequest& request);
+    HttpResponse handle_list_folder(const HttpRequest& request);
+    HttpResponse handle_folder_stats(const HttpRequest& request);
+    HttpResponse handle_move_folder(const HttpRequest& request);
+    HttpResponse handle_delete_folder(const HttpRequest& request);
+    HttpResponse handle_list_trash(const HttpRequest& request);
+    HttpResponse handle_restore_file(const HttpRequest& request);
+    HttpResponse handle_purge_file(const HttpRequest& request);
+    HttpResponse handle_empty_trash(const HttpRequest& request);
+    HttpResponse handle_dedup_check(const HttpRequest& request);
+    HttpResponse handle_create_upload(const HttpRequest& request);
+    HttpResponse handle_list_uploads(const HttpRequest& request);
+    HttpResponse handle_upload_status(const HttpRequest& request);
+    HttpResponse handle_put_upload_chunk(const HttpRequest& request);
+    HttpResponse handle_commit_upload(const HttpRequest& request);
+    HttpResponse handle_abort_upload(const HttpRequest& request);
+    HttpResponse handle_storage_stats(const HttpRequest& request);
     HttpResponse handle_scan_wifi(const HttpRequest& request);
     HttpResponse handle_wifi_status(const HttpRequest& request);
     HttpResponse handle_connect_wifi(const HttpRequest& request);
     HttpResponse handle_disconnect_wifi(const HttpRequest& request);
     HttpResponse handle_forget_wifi(const HttpRequest& request);
     HttpResponse handle_system_status(const HttpRequest& request);
+    HttpResponse handle_shred_status(const HttpRequest& request);
+    HttpResponse handle_check_status(const HttpRequest& request);
+    HttpResponse handle_start_check(const HttpRequest& request);
+    HttpResponse handle_backup_status(const HttpRequest& request);
+    HttpResponse handle_start_backup(const HttpRequest& request);
+    HttpResponse handle_mirror_status(const HttpRequest& request);
     HttpResponse handle_check_updates(const HttpRequest& request);
     HttpResponse handle_upgrade_system(const HttpRequest& request);
     HttpResponse handle_reboot_system(const HttpRequest& request);
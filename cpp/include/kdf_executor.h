@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace vaultusb {
+
+// Bounded executor for Argon2 work (login, unlock, password change).
+// Worker count matches the number of hashes the memory pool can hold at once;
+// a short queue absorbs bursts and anything beyond it is rejected immediately
+// so request handlers can answer 503 instead of piling up behind the KDF.
+class KdfExecutor {
+public:
+    static KdfExecutor& instance();
+
+    void start(size_t workers, size_t queue_depth);
+    void stop();
+
+    // Returns an invalid future when the executor is saturated
+    template <typename F>
+    auto submit(F&& job) -> std::future<decltype(job())> {
+        using Result = decltype(job());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+        std::future<Result> result = task->get_future();
+        if (!enqueue([task]() { (*task)(); })) {
+            return std::future<Result>();
+        }
+        return result;
+    }
+
+    struct Stats {
+        size_t workers = 0;
+        size_t queue_depth = 0;
+        size_t queued = 0;
+        size_t running = 0;
+        uint64_t completed = 0;
+        uint64_t rejected = 0;
+    };
+    Stats stats();
+
+private:
+    KdfExecutor() = default;
+    ~KdfExecutor();
+    KdfExecutor(const KdfExecutor&) = delete;
+    KdfExecutor& operator=(const KdfExecutor&) = delete;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    std::vector<std::thread> workers_;
+    size_t queue_depth_ = 0;
+    bool running_ = false;
+    Stats stats_;
+
+    bool enqueue(std::function<void()> task);
+    void worker_loop();
+};
+
+} // namespace vaultusb
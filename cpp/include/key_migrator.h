@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "secure_memory.h"
+
+namespace vaultusb {
+
+// Background job that rewraps file data keys (and wrapped per-user secrets)
+// under the active master key.
+// It wraps the derived key of legacy HKDF-keyed files (key_id 0) and drives
+// master-key rotation to completion. Every row is updated on
+// its own, so the job resumes after a restart or lock from where it stopped.
+class KeyMigrator {
+public:
+    static KeyMigrator& instance();
+
+    // Checks a master key unsealed from a legacy (untagged) file against the
+    // vault before it is installed. Confirmed when a key_id 0 object in the
+    // chunked format authenticates under it or a pending rotation key was
+    // unsealed with the same password; Rejected when that object does not
+    // authenticate (the password was wrong); Unconfirmed without such proof.
+    enum class Confirmation { Confirmed, Rejected, Unconfirmed };
+    Confirmation confirm_master_key(const SecureBytes& master_key, bool rotation_pending);
+
+    // Starts the job if the vault is unlocked with a confirmed master key
+    // and it is not already running
+    void start();
+    void stop();
+
+    struct Progress {
+        bool running = false;
+        bool rotating = false;
+        uint32_t target_key_id = 0;
+        int remaining = 0;
+        uint64_t rewrapped = 0;
+        uint64_t failed = 0;
+        std::string error;
+    };
+    Progress progress();
+
+private:
+    KeyMigrator() = default;
+    ~KeyMigrator();
+    KeyMigrator(const KeyMigrator&) = delete;
+    KeyMigrator& operator=(const KeyMigrator&) = delete;
+
+    std::mutex mutex_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_requested_{false};
+    Progress stats_;
+
+    void run();
+};
+
+} // namespace vaultusb
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace vaultusb {
+
+// Asynchronous replication of the vault to storage.mirror_dir (a second USB
+// drive). Commits never wait for it: triggers add every object a transaction
+// writes or drops to the mirror_queue table in the same transaction, and a
+// background worker takes a database snapshot every storage.mirror_interval
+// seconds and ships it with the objects queued in it, as a partial
+// VaultBackup pass. The mirror is therefore a backup that --verify-backup
+// and --restore-backup accept, with a checksum for every file. The first
+// pass after start, after the directory was absent (drive unplugged) or
+// after a failed pass compares every object instead, which catches up on
+// whatever the queue missed.
+class VaultMirror {
+public:
+    static VaultMirror& instance();
+
+    // No-op without a mirror_dir
+    void start();
+    void stop();
+
+    struct Progress {
+        bool enabled = false;
+        std::string target;
+        std::string state; // absent, catching_up, syncing, idle or failed
+        int64_t pending = 0;     // queued changes not shipped yet
+        int64_t lag_seconds = 0; // age of the oldest of them
+        uint64_t pass_objects_done = 0;  // of the pass in progress
+        uint64_t pass_objects_total = 0;
+        std::time_t last_sync = 0; // end of the last pass that completed
+        uint64_t passes = 0;
+        uint64_t objects_shipped = 0;
+        uint64_t bytes_shipped = 0;
+        double busy_seconds = 0.0; // spent in passes, for throughput
+        std::string last_error;
+    };
+    Progress progress();
+
+private:
+    VaultMirror() = default;
+    ~VaultMirror();
+    VaultMirror(const VaultMirror&) = delete;
+    VaultMirror& operator=(const VaultMirror&) = delete;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    Progress stats_;
+
+    void worker_loop();
+    void set_state(const std::string& state);
+};
+
+} // namespace vaultusb
@@ -4,6 +4,7 @@
 #include <ctime>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
 namespace vaultusb {
 
@@ -28,16 +29,23 @@ struct File {
     std::string id;
     std::string original_name;
     std::string encrypted_name;
-    int size = 0;
+    int64_t size = 0;           // plaintext bytes
     std::string mime_type;
     std::time_t created_at = 0;
     std::time_t modified_at = 0;
     int user_id = 0;
     bool is_deleted = false;
+    std::string wrapped_key; // hex nonce || sealed data key; empty for HKDF-keyed legacy files
+    uint32_t key_id = 0;     // master key that wrapped it, 0 = legacy
+    std::string content_digest; // keyed digest of the plaintext when deduplicated
+    int64_t stored_size = 0;    // ciphertext bytes on disk (after compression), 0 = unknown
+    std::time_t deleted_at = 0; // when it was moved to the trash, 0 = not in the trash
+    std::string folder_id;      // empty = the user's root folder
+    int64_t version = 0;        // current version; 0 = one object at encrypted_name
     
     File() = default;
     File(const std::string& file_id, const std::string& orig_name, 
-         const std::string& enc_name, int file_size, const std::string& mime, int uid)
+         const std::string& enc_name, int64_t file_size, const std::string& mime, int uid)
         : id(file_id), original_name(orig_name), encrypted_name(enc_name), 
           size(file_size), mime_type(mime), user_id(uid) {
         created_at = std::time(nullptr);
@@ -45,6 +53,112 @@ struct File {
     }
 };
 
+// Virtual folder. Folders and files only point at their parent, so moving a
+// subtree rewrites one row and never touches ciphertext
+struct Folder {
+    std::string id;
+    int user_id = 0;
+    std::string parent_id; // empty = the user's root folder
+    std::string name;
+    std::time_t created_at = 0;
+    std::time_t modified_at = 0;
+};
+
+// Totals of a folder's whole subtree, summed from per-folder counters
+struct FolderStats {
+    int64_t folders = 0;
+    int64_t file_count = 0;
+    int64_t logical_bytes = 0; // plaintext
+};
+
+// One version of a versioned file: an ordered list of content-defined
+// chunks, each stored once per file however many versions use it
+struct FileVersion {
+    std::string file_id;
+    int64_t version = 0;
+    int64_t size = 0;          // plaintext
+    int64_t chunk_count = 0;
+    int64_t written_bytes = 0; // stored bytes of the chunks this version added
+    std::time_t created_at = 0;
+};
+
+// A stored chunk of a versioned file, sealed with the file's data key
+struct ContentChunk {
+    std::string digest; // keyed digest of the plaintext, as for deduplication
+    std::string encrypted_name;
+    int64_t size = 0;        // plaintext
+    int64_t stored_size = 0; // ciphertext
+};
+
+// Per-user secret (e.g. the dedup digest key), wrapped like file data keys
+struct UserKey {
+    int user_id = 0;
+    std::string purpose;
+    std::string wrapped_key;
+    uint32_t key_id = 0;
+};
+
+// Append-only segment holding small encrypted objects
+struct Pack {
+    int64_t id = 0;
+    std::string encrypted_name; // segment file in the vault layout
+    bool sealed = false;        // full; no more appends
+    std::time_t created_at = 0;
+    int64_t entries = 0;
+    int64_t live_bytes = 0;     // bytes still referenced by pack_entries
+};
+
+// Location of a packed object: `length` bytes at `offset` in a segment
+struct PackEntry {
+    std::string encrypted_name;
+    int64_t pack_id = 0;
+    int64_t offset = 0;
+    int64_t length = 0;
+    std::string segment; // the segment's encrypted_name
+};
+
+// A user's files of one MIME class (image, video, audio, text, document,
+// archive, other), from counters kept current by triggers on the files table
+struct StorageUsage {
+    std::string mime_class;
+    int64_t file_count = 0;
+    int64_t logical_bytes = 0; // plaintext
+};
+
+// Resumable upload. The data key (wrapped for file_id, the id the file gets
+// on commit) and the stream header are fixed when the session is created, so
+// every chunk can be sealed on arrival into its own run of frames
+struct UploadSession {
+    std::string id;
+    int user_id = 0;
+    std::string file_id;
+    std::string original_name;
+    int64_t size = 0;          // declared plaintext size
+    int64_t chunk_size = 0;    // plaintext bytes per chunk; only the last may be shorter
+    std::string stream_header; // hex
+    std::string wrapped_key;
+    uint32_t key_id = 0;
+    std::time_t created_at = 0;
+    std::time_t updated_at = 0; // last chunk received
+    
+    int64_t chunk_count() const { return size > 0 ? (size + chunk_size - 1) / chunk_size : 1; }
+};
+
+// A received chunk, sealed and staged under vault_dir/.uploads/<session>
+struct UploadChunk {
+    int64_t index = 0;
+    int64_t stored_size = 0; // ciphertext bytes
+    std::string digest;      // SHA-256 of the ciphertext, hex
+};
+
+struct ShredJob {
+    int id = 0;
+    std::string path;
+    int64_t size = 0;
+    int64_t bytes_done = 0; // persisted so shredding resumes after a restart
+    std::time_t created_at = 0;
+};
+
 struct Session {
     std::string id;
     int user_id = 0;
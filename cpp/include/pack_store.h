@@ -0,0 +1,114 @@
+#pragma once
+
+#include "models.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace vaultusb {
+
+// Storage for small objects. Ciphertexts of files below storage.pack_threshold
+// are appended to an append-only segment file in the vault layout instead of
+// getting a file (and inode) each; pack_entries maps each encrypted name to
+// its offset and length in a segment. Every entry is a complete stream with
+// its own header and tags, since every file has its own data key.
+//
+// Deleted entries are zeroed in place and leave a dead range behind. A
+// background pass rewrites segments whose dead share exceeds
+// storage.pack_compact_threshold: live entries are copied verbatim to the
+// active segment, the index is updated, and the old segment is shredded.
+class PackStore {
+public:
+    static PackStore& instance();
+
+    // Largest plaintext that is packed; 0 when packing is disabled
+    size_t threshold() const { return threshold_; }
+
+    // Appends a complete ciphertext and indexes it under encrypted_name
+    bool append(const std::string& encrypted_name, const uint8_t* data, size_t length);
+
+    // Calls reader with the segment fd and the entry's byte range. *packed
+    // tells whether the object is packed at all (false: look in the layout).
+    using RangeReader = std::function<bool(int fd, int64_t offset, int64_t length)>;
+    bool read(const std::string& encrypted_name, const RangeReader& reader, bool* packed = nullptr);
+
+    // Copies a packed entry under a new name
+    bool copy(const std::string& source_name, const std::string& target_name, bool* packed = nullptr);
+
+    // Drops the entry and zeroes its bytes; false if the object is not packed
+    bool release(const std::string& encrypted_name);
+    bool contains(const std::string& encrypted_name);
+
+    // While held (a backup is copying segments), released entries keep their
+    // bytes until the last hold ends; nests
+    void hold_wipes();
+    void release_wipes();
+
+    // Encrypted names of every segment file (not objects of their own)
+    std::vector<std::string> segment_names();
+
+    void start();
+    void stop();
+    // One compaction pass over every segment; returns bytes reclaimed
+    int64_t compact();
+
+    struct Stats {
+        int64_t segments = 0;
+        int64_t entries = 0;
+        int64_t live_bytes = 0;
+        int64_t segment_bytes = 0; // file sizes, dead ranges included
+        uint64_t compacted_segments = 0;
+        uint64_t reclaimed_bytes = 0;
+    };
+    Stats stats();
+
+private:
+    PackStore();
+    ~PackStore();
+    PackStore(const PackStore&) = delete;
+    PackStore& operator=(const PackStore&) = delete;
+
+    size_t threshold_ = 0;
+    int64_t segment_size_ = 0;
+    int compact_threshold_ = 0; // percent of a segment that is dead
+
+    // Appends go to one active segment at a time
+    std::mutex append_mutex_;
+    int64_t active_id_ = 0;
+    int active_fd_ = -1;
+
+    // Readers hold it shared across lookup and read; a compacted segment is
+    // only closed and shredded under the exclusive lock
+    std::shared_mutex segments_mutex_;
+    std::mutex fd_mutex_;
+    std::unordered_map<int64_t, int> read_fds_; // pack id -> O_RDONLY fd
+
+    std::mutex wipe_mutex_;
+    int wipe_holds_ = 0;
+    std::vector<PackEntry> held_wipes_;
+
+    std::thread worker_;
+    std::mutex worker_mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<uint64_t> compacted_segments_{0};
+    std::atomic<uint64_t> reclaimed_bytes_{0};
+
+    bool open_active();
+    void seal_active();
+    bool write_active(const uint8_t* data, size_t length, bool sync, int64_t& pack_id, int64_t& offset);
+    int segment_fd(const PackEntry& entry, bool& cached);
+    void wipe(const PackEntry& entry);
+    int64_t compact_segment(const Pack& pack, int64_t segment_bytes);
+    void worker_loop();
+};
+
+} // namespace vaultusb
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace vaultusb {
+
+// Byte stream endpoints shared by the storage and crypto layers.
+// A source returns the number of bytes read, 0 at end of stream and -1 on error.
+using ByteSource = std::function<ssize_t(uint8_t* buffer, size_t length)>;
+using ByteSink = std::function<bool(const uint8_t* data, size_t length)>;
+
+// Reusable block circulating between pipeline stages
+struct PipelineBlock {
+    std::vector<uint8_t> data;
+    size_t length = 0;
+    uint64_t index = 0;
+    bool last = false;
+};
+
+// Bounded three-stage pipeline: read -> transform -> write.
+// The read stage runs on its own thread, the transform (encrypt/decrypt) on a
+// worker thread and the write stage on the calling thread. A fixed pool of
+// blocks is recycled so I/O and crypto overlap without per-block allocation.
+class BlockPipeline {
+public:
+    using ReadStage = std::function<bool(PipelineBlock& block)>;
+    using TransformStage = std::function<bool(PipelineBlock& block)>;
+    using WriteStage = std::function<bool(const PipelineBlock& block)>;
+
+    struct Stats {
+        uint64_t blocks = 0;
+        uint64_t bytes_written = 0;
+        double seconds = 0.0;
+        double mb_per_second = 0.0;
+    };
+
+    // block_capacity is the size of every pooled buffer, depth the number of
+    // buffers in flight (at least two so each stage can double-buffer).
+    BlockPipeline(size_t block_capacity, size_t depth);
+
+    // Runs until the read stage marks a block as last or any stage fails.
+    bool run(const ReadStage& read, const TransformStage& transform, const WriteStage& write);
+
+    const std::string& error() const { return error_; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    class BlockQueue {
+    public:
+        void push(PipelineBlock* block);
+        PipelineBlock* pop(); // nullptr once closed
+        void close();
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<PipelineBlock*> blocks_;
+        bool closed_ = false;
+    };
+
+    std::vector<PipelineBlock> pool_;
+    BlockQueue free_;
+    BlockQueue filled_;
+    BlockQueue sealed_;
+    std::string error_;
+    std::mutex error_mutex_;
+    std::atomic<bool> aborted_{false};
+    Stats stats_;
+
+    void fail(const std::string& message);
+};
+
+} // namespace vaultusb
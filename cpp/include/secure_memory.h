@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace vaultusb {
+
+// Fixed-size arena for key material. The region is mlock'ed so it never
+// reaches swap, excluded from core dumps, and bracketed by PROT_NONE guard
+// pages so an overrun faults instead of reading neighbouring heap. Every
+// block is wiped on free. When the arena is full (or could not be mapped)
+// allocations fall back to the heap, still wiped on free, and are counted.
+class SecureArena {
+public:
+    static SecureArena& instance();
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+
+    struct Stats {
+        size_t capacity = 0;
+        size_t in_use = 0;
+        size_t peak = 0;
+        uint64_t allocations = 0;
+        uint64_t heap_fallbacks = 0;
+        bool locked = false; // mlock succeeded
+    };
+    Stats stats();
+
+private:
+    // Sized from security.secure_arena_size on first use
+    SecureArena();
+    SecureArena(const SecureArena&) = delete;
+    SecureArena& operator=(const SecureArena&) = delete;
+
+    std::mutex mutex_;
+    uint8_t* mapping_ = nullptr; // including both guard pages
+    size_t mapping_size_ = 0;
+    uint8_t* base_ = nullptr;    // first usable byte
+    size_t capacity_ = 0;
+    std::vector<uint64_t> used_; // one bit per slot
+    Stats stats_;
+
+    bool owns(const void* ptr) const;
+};
+
+// std::allocator replacement backed by SecureArena
+template <typename T>
+struct SecureAllocator {
+    using value_type = T;
+
+    SecureAllocator() noexcept = default;
+    template <typename U>
+    SecureAllocator(const SecureAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(SecureArena::instance().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) noexcept {
+        SecureArena::instance().deallocate(ptr, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const SecureAllocator<T>&, const SecureAllocator<U>&) noexcept { return true; }
+template <typename T, typename U>
+bool operator!=(const SecureAllocator<T>&, const SecureAllocator<U>&) noexcept { return false; }
+
+// Byte buffer for keys and other secrets
+using SecureBytes = std::vector<uint8_t, SecureAllocator<uint8_t>>;
+
+} // namespace vaultusb
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "models.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vaultusb {
+
+// Background secure-delete engine. Deletes only record the ciphertext path in
+// the persisted shred_queue table; a single throttled worker then discards
+// (fallocate PUNCH_HOLE, which the filesystem turns into device discards) or
+// overwrites the file slice by slice before unlinking it. Progress is saved
+// to the queue so an interrupted shred resumes where it stopped.
+class Shredder {
+public:
+    static Shredder& instance();
+
+    void start();
+    void stop();
+
+    // O(1): queue a file for shredding and wake the worker
+    bool enqueue(const std::string& file_path);
+
+    // Jobs stay queued while paused (a backup is copying the vault); nests
+    void pause();
+    void resume();
+
+    struct Progress {
+        std::string mode;
+        int64_t rate_limit = 0; // bytes per second, 0 = unthrottled
+        int64_t pending_files = 0;
+        int64_t pending_bytes = 0;
+        bool active = false;
+        int64_t current_size = 0;
+        int64_t current_done = 0;
+        uint64_t shredded_files = 0;
+        uint64_t shredded_bytes = 0;
+        uint64_t failed_files = 0;
+    };
+    Progress progress();
+
+private:
+    Shredder() = default;
+    ~Shredder();
+    Shredder(const Shredder&) = delete;
+    Shredder& operator=(const Shredder&) = delete;
+
+    enum class Mode { Auto, Discard, Overwrite };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    std::atomic<int> paused_{0};
+    bool wake_ = false;
+
+    Mode mode_ = Mode::Auto;
+    int64_t rate_limit_ = 0;
+    Progress stats_;
+
+    void worker_loop();
+    bool shred_job(ShredJob& job);
+    bool discard_range(int fd, int64_t offset, int64_t length);
+    bool overwrite_range(int fd, int64_t offset, int64_t length, const std::vector<uint8_t>& pattern);
+    void throttle(int64_t bytes, double elapsed_seconds);
+};
+
+} // namespace vaultusb
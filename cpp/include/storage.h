@@ -6,6 +6,9 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <functional>
 
 namespace vaultusb {
 
@@ -16,24 +19,137 @@ public:
     // File operations
     std::string store_file(const std::vector<uint8_t>& file_data, const std::string& original_name, const User& user);
     std::vector<uint8_t> retrieve_file(const std::string& file_id, const User& user);
+    
+    // Streaming variants: plaintext flows through the crypto pipeline in
+    // fixed-size blocks and never has to fit in memory
+    std::string store_stream(const ByteSource& source, const std::string& original_name, const User& user);
+    bool retrieve_stream(const std::string& file_id, const User& user, const ByteSink& sink);
+    // Streams the files as one ZIP archive, decrypting straight into it;
+    // with deflate, compressible types are deflated and the rest stored
+    bool export_zip(const std::vector<File>& files, const User& user, bool deflate, const ByteSink& sink);
+    // Unpacks a tar (optionally gzipped) or ZIP stream entry by entry straight
+    // into the encrypted store, so no plaintext reaches the disk; file rows
+    // are inserted in batched transactions. Directories in entry paths are
+    // recreated as folders below folder_id ("" = the root). An import that
+    // stops early keeps the files before the failing entry.
+    struct ImportSummary {
+        int64_t files = 0;
+        int64_t bytes = 0;   // plaintext bytes imported
+        int64_t skipped = 0; // directories, links and entries we cannot extract
+        double seconds = 0;
+        std::string error;   // empty when the whole archive was imported
+        bool quota_exceeded = false;
+    };
+    ImportSummary import_archive(const ByteSource& source, const User& user, const std::string& folder_id = "");
+    // Moves the file to the trash (or purges it when storage.trash_retention is 0)
     bool delete_file(const std::string& file_id, const User& user);
+    // Copies share the ciphertext bytes; only the wrapped data key differs
+    std::string copy_file(const std::string& file_id, const User& user);
+    
+    // Deduplication: identical content is stored once per user and reference
+    // counted. link_existing adds a file for content the user already has,
+    // given its plain SHA-256, so clients can skip the upload; "" if unknown.
+    std::string link_existing(const std::string& sha256_hex, const std::string& original_name, const User& user);
     std::vector<File> list_files(const User& user, int limit = 100, int offset = 0);
+    
+    // Virtual folders ("" is the root). Moves and renames are metadata
+    // updates; no ciphertext is read or rewritten
+    std::shared_ptr<Folder> create_folder(const std::string& parent_id, const std::string& name, const User& user);
+    std::shared_ptr<Folder> get_folder(const std::string& folder_id, const User& user);
+    std::vector<Folder> list_subfolders(const std::string& folder_id, const User& user, int limit = 1000,
+                                        int offset = 0);
+    std::vector<File> list_folder_files(const std::string& folder_id, const User& user, int limit = 100,
+                                        int offset = 0);
+    // Breadcrumbs: the folder's ancestors and itself, outermost first
+    std::vector<Folder> folder_path(const std::string& folder_id, const User& user);
+    bool folder_stats(const std::string& folder_id, const User& user, FolderStats& stats);
+    // An empty name keeps the current one
+    bool move_folder(const std::string& folder_id, const std::string& parent_id, const std::string& name,
+                     const User& user);
+    bool move_file(const std::string& file_id, const std::string& folder_id, const User& user);
+    // Moves the subtree's files to the trash and removes its folders;
+    // returns the files trashed, -1 if the folder is not found
+    int64_t delete_folder(const std::string& folder_id, const User& user);
     std::shared_ptr<File> get_file_info(const std::string& file_id, const User& user);
     std::vector<File> search_files(const std::string& query, const User& user, int limit = 100);
     
-    // Storage statistics
+    // Storage statistics, read from counters the database keeps per user
     struct StorageStats {
-        int total_size = 0;
-        int file_count = 0;
+        int64_t total_size = 0;
+        int64_t file_count = 0;
         double total_size_mb = 0.0;
+        int64_t logical_bytes = 0; // plaintext bytes
+        int64_t stored_bytes = 0;  // ciphertext bytes on disk
+        int64_t quota_bytes = 0;   // 0 = unlimited
+        int64_t trash_files = 0;
+        int64_t trash_bytes = 0;   // stored bytes held by the trash, not counted above
+        std::vector<StorageUsage> by_type;
     };
     StorageStats get_storage_stats(const User& user);
+    // Quota on stored bytes (0 = unlimited) and what is left of it (-1 = unlimited)
+    int64_t quota_bytes(const User& user);
+    int64_t quota_remaining(const User& user);
+    
+    // Trash: deleted files keep their ciphertext until purged
+    std::vector<File> list_trash(const User& user, int limit = 100, int offset = 0);
+    bool restore_file(const std::string& file_id, const User& user);
+    bool purge_file(const std::string& file_id, const User& user);
+    int64_t empty_trash(const User& user);
+    // When a trashed file is purged automatically
+    std::time_t purge_time(const File& file) const;
     
-    // Maintenance
-    void cleanup_deleted_files();
+    // Maintenance: purges up to `limit` files whose retention has expired in
+    // one transaction; returns the number purged, -1 on failure
+    int cleanup_deleted_files(int limit = 256);
+    
+    // Resumable uploads. A session fixes the size, data key and stream header
+    // up front, so chunks can arrive in any order and in parallel: each one
+    // is sealed into its own frames on arrival and staged under
+    // vault_dir/.uploads until commit joins them into the file's ciphertext.
+    // Session state lives in the database and survives a restart.
+    enum class UploadResult { Ok, NotFound, Invalid, Conflict, Failed };
+    std::shared_ptr<UploadSession> create_upload(const std::string& original_name, int64_t size, const User& user);
+    std::shared_ptr<UploadSession> get_upload(const std::string& upload_id, const User& user);
+    std::vector<UploadSession> list_uploads(const User& user);
+    std::vector<UploadChunk> get_upload_chunks(const std::string& upload_id);
+    // A received chunk is only accepted again with identical content (Ok);
+    // different content is a Conflict, as its frame nonces are already used
+    UploadResult put_upload_chunk(const std::string& upload_id, int64_t index, const uint8_t* data, size_t length,
+                                  const User& user);
+    // The new file's id; "" while chunks are missing or another commit runs
+    std::string commit_upload(const std::string& upload_id, const User& user);
+    bool abort_upload(const std::string& upload_id, const User& user);
+    // Plaintext bytes per chunk for new sessions (whole stream chunks)
+    size_t upload_chunk_size() const;
+    // When an idle session is discarded (0 = never)
+    std::time_t upload_expiry_time(const UploadSession& session) const;
+    // Discards sessions idle for storage.upload_expiry hours and staging
+    // left behind by ended ones; returns the sessions discarded
+    int cleanup_upload_sessions(int limit = 64);
+    
+    // File versions. Writing new content to a file keeps the old content as
+    // a version. Content is cut into content-defined chunks (see Chunker),
+    // and only chunks the file does not hold yet are encrypted, with the
+    // file's data key, and stored, so an edit costs about the chunks around
+    // it. The first write turns the file's single object into version 1.
+    // Old versions are pruned past storage.version_retention versions or
+    // storage.version_max_age days; the current one always stays.
+    // The new version; nullptr on failure or while another write to the file runs
+    std::shared_ptr<FileVersion> write_version(const std::string& file_id, const ByteSource& source,
+                                               const User& user);
+    // Newest first; empty for a file that was never rewritten
+    std::vector<FileVersion> list_versions(const std::string& file_id, const User& user);
+    // Streams the version's chunks in order (0 or the current version: the file)
+    bool retrieve_version(const std::string& file_id, int64_t version, const User& user, const ByteSink& sink);
+    // Makes an older version current again as a new version sharing its
+    // chunks; nothing is copied
+    std::shared_ptr<FileVersion> restore_version(const std::string& file_id, int64_t version, const User& user);
+    bool delete_version(const std::string& file_id, int64_t version, const User& user);
+    // Applies storage.version_max_age to files not being written; returns files pruned
+    int prune_versions(int limit = 64);
     
 private:
-    StorageManager() = default;
+    StorageManager();
     StorageManager(const StorageManager&) = delete;
     StorageManager& operator=(const StorageManager&) = delete;
     
@@ -48,7 +164,48 @@ private:
     // File path operations
     std::string get_encrypted_file_path(const std::string& encrypted_name);
     bool file_exists(const std::string& file_path);
+    bool clone_file(const std::string& source_name, const std::string& target_name);
+    // Removes a ciphertext wherever it is stored; shred for ones that held data
+    bool discard_object(const std::string& encrypted_name, bool shred);
+    bool share_object(File& file_record, const std::string& stored_name);
+    // Purges trashed rows and shreds the ciphertexts nothing refers to any more
+    int purge(int user_id, const std::string& file_id, std::time_t deleted_before, int limit);
+    SecureBytes user_secret(int user_id, const std::string& purpose);
     bool create_directory(const std::string& path);
+    // The store half of store_stream: writes the object and fills in its row
+    // without inserting it; release_file undoes it if the row is not inserted
+    bool seal_file(const ByteSource& source, const std::string& original_name, const User& user, int64_t remaining,
+                   File& file_record, std::string& written_name);
+    void release_file(const File& file_record, const std::string& written_name);
+    
+    // Upload staging: vault_dir/.uploads/<session>/<index>-<digest prefix>
+    std::mutex commit_mutex_;
+    std::set<std::string> committing_;
+    // "<upload>:<index>" of chunks being stored (commit_mutex_)
+    std::set<std::string> chunk_claims_;
+    UploadResult store_upload_chunk(const UploadSession& session, int64_t index, const uint8_t* data, size_t length,
+                                    bool final);
+    std::string upload_dir(const std::string& upload_id);
+    std::string assemble_upload(const UploadSession& session, const User& user);
+    void discard_staging(const std::string& upload_id);
+    
+    // Version writes and pruning of a file exclude each other (commit_mutex_)
+    std::set<std::string> versioning_;
+    struct ChunkSet;
+    bool lock_versions(const std::string& file_id);
+    void unlock_versions(const std::string& file_id);
+    // Cuts what content pushes into its sink into chunks, stores the new ones
+    // and lists the version's chunks in order
+    bool write_chunks(const std::function<bool(const ByteSink&)>& content, ChunkSet& chunks, FileVersion& version,
+                      std::vector<std::string>& digests);
+    bool seal_chunk(const uint8_t* data, size_t length, ChunkSet& chunks, ContentChunk& chunk);
+    bool commit_version(FileVersion& version, int64_t expected_version, ChunkSet& chunks,
+                        const std::vector<std::string>& digests, const std::string& encrypted_name);
+    int prune_file_versions(const std::string& file_id);
+    // Decrypts one object, packed or in the layout
+    bool read_object(const std::string& encrypted_name, const SecureBytes& file_key, const ByteSink& sink);
+    bool read_version(const std::string& file_id, int64_t version, const SecureBytes& file_key,
+                      const ByteSink& sink);
 };
 
 } // namespace vaultusb
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "secure_memory.h"
+
+namespace vaultusb {
+namespace totp {
+
+// RFC 6238 codes (HMAC-SHA1, six digits) over base32 secrets, as used by
+// AuthManager. time_step counts 30-second steps since the epoch.
+
+// Base32 without padding; the decoder skips characters outside the alphabet
+std::string base32_encode(const uint8_t* data, size_t length);
+std::string base32_encode(const std::vector<uint8_t>& data);
+SecureBytes base32_decode(const std::string& encoded);
+
+std::string code(const std::string& secret, uint64_t time_step);
+std::string code(const SecureBytes& secret, uint64_t time_step);
+// Accepts the code of time_step or of the step either side of it
+bool verify(const std::string& secret, const std::string& token, uint64_t time_step);
+
+} // namespace totp
+} // namespace vaultusb
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+namespace vaultusb {
+
+// Background purge of the trash. Deleted files stay restorable for
+// storage.trash_retention days; after that the worker deletes their rows in
+// batches, one transaction each, and hands ciphertexts that no row refers to
+// any more to the shredder. The worker runs in the idle I/O scheduling class
+// and pauses between batches, so purging yields to interactive transfers.
+// Each pass also discards upload sessions idle for storage.upload_expiry
+// hours, along with their staged chunks, and drops file versions older than
+// storage.version_max_age days.
+class TrashCollector {
+public:
+    static TrashCollector& instance();
+
+    void start();
+    void stop();
+    // Runs a pass now instead of at the next interval
+    void wake();
+
+    struct Progress {
+        bool running = false;
+        uint64_t passes = 0;
+        uint64_t purged_files = 0;
+        uint64_t failed_batches = 0;
+        uint64_t expired_uploads = 0;
+        uint64_t pruned_version_files = 0;
+        std::time_t last_pass = 0;
+    };
+    Progress progress();
+
+private:
+    TrashCollector() = default;
+    ~TrashCollector();
+    TrashCollector(const TrashCollector&) = delete;
+    TrashCollector& operator=(const TrashCollector&) = delete;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> running_{false};
+    bool wake_ = false;
+
+    std::atomic<uint64_t> passes_{0};
+    std::atomic<uint64_t> purged_files_{0};
+    std::atomic<uint64_t> failed_batches_{0};
+    std::atomic<uint64_t> expired_uploads_{0};
+    std::atomic<uint64_t> pruned_version_files_{0};
+    std::atomic<std::time_t> last_pass_{0};
+
+    void worker_loop();
+    void run_pass();
+};
+
+} // namespace vaultusb
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "models.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vaultusb {
+
+// Vault integrity check. Reconciles vault_dir against the files table
+// (orphaned ciphertexts, rows whose ciphertext is missing) and, when the
+// vault is unlocked, authenticates every chunk tag of every ciphertext on
+// a pool of threads. Decrypted chunks are discarded as they are produced;
+// no plaintext is written anywhere. Runs from the CLI (--check-vault) or as
+// a throttled background job whose last report is saved as JSON.
+class VaultChecker {
+public:
+    static VaultChecker& instance();
+
+    struct Entry {
+        std::string file_id;
+        std::string name;           // original name
+        std::string encrypted_name;
+        int64_t size = 0;           // bytes on disk where known
+        std::string error;
+    };
+
+    struct Report {
+        std::time_t started_at = 0;
+        std::time_t finished_at = 0;
+        bool verified = false;  // tags were authenticated (vault unlocked)
+        bool complete = false;  // false if stopped or the vault locked mid-check
+        uint64_t files = 0;
+        uint64_t objects_checked = 0;
+        uint64_t bytes_checked = 0;
+        std::vector<Entry> orphans;      // ciphertexts no live row refers to
+        std::vector<Entry> missing;      // live rows without a ciphertext
+        std::vector<Entry> corrupt;      // failed authentication or unreadable
+        std::vector<Entry> unverifiable; // legacy untagged format
+
+        bool clean() const { return orphans.empty() && missing.empty() && corrupt.empty(); }
+        std::string to_json() const;
+    };
+
+    // Synchronous check; tags are only verified when `verify` is set and the
+    // vault is unlocked. rate_limit is in bytes per second, 0 = unthrottled.
+    Report run_check(bool verify, int64_t rate_limit, int threads);
+
+    // Background check with the configured threads and rate limit.
+    // Returns false if one is already running.
+    bool start();
+    // Starts a background check if the last report is older than check_interval
+    void start_if_due();
+    void stop();
+
+    struct Progress {
+        bool running = false;
+        uint64_t objects_total = 0;
+        uint64_t objects_done = 0;
+        uint64_t bytes_done = 0;
+        std::string last_report; // JSON of the last finished check, empty if none
+    };
+    Progress progress();
+
+private:
+    VaultChecker() = default;
+    ~VaultChecker();
+    VaultChecker(const VaultChecker&) = delete;
+    VaultChecker& operator=(const VaultChecker&) = delete;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<uint64_t> objects_total_{0};
+    std::atomic<uint64_t> objects_done_{0};
+    std::atomic<uint64_t> bytes_done_{0};
+    std::string last_report_;
+
+    // Token bucket shared by all verification threads
+    int64_t rate_limit_ = 0;
+    std::chrono::steady_clock::time_point throttle_next_;
+
+    enum class Outcome { Ok, Corrupt, Legacy, Vanished, Aborted };
+
+    void reconcile(const std::vector<File>& files, Report& report);
+    Outcome verify_object(const File& file, Entry& entry);
+    Outcome verify_range(const File& file, Entry& entry, int fd, int64_t offset, int64_t length);
+    void throttle(size_t bytes);
+    std::string load_report();
+    bool save_report(const std::string& json);
+};
+
+} // namespace vaultusb
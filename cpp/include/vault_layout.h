@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+namespace vaultusb {
+
+// Placement of ciphertexts under vault_dir. With storage.vault_fanout = N an
+// object lives N directory levels down, each level named by two hex digits
+// of a hash of its encrypted name (vault/3f/a0/<name>), so no directory
+// grows beyond a few hundred entries. The vault and first-level directories
+// are opened once and objects are reached with openat().
+//
+// Objects still in another layout (flat vaults from before fan-out, or a
+// changed fan-out) are found by falling back to the other locations until a
+// background pass has moved every live object; the pass then records the
+// layout in vault_dir/.layout so later starts skip it.
+class VaultLayout {
+public:
+    static VaultLayout& instance();
+
+    // openat() on the object; with O_CREAT missing shard directories are created
+    int open(const std::string& encrypted_name, int flags, mode_t mode = 0600);
+    // Absolute path of the object where it currently is (its target if absent)
+    std::string path(const std::string& encrypted_name);
+    // Location relative to vault_dir for a fan-out of `levels`
+    static std::string relative_path(const std::string& encrypted_name, int levels);
+
+    int fanout() const { return fanout_; }
+    const std::string& root() const { return root_; }
+
+    // Every ciphertext below vault_dir, whatever layout it is in
+    struct Object {
+        std::string name;
+        std::string path;
+        int64_t size = 0;
+        std::time_t mtime = 0;
+    };
+    std::vector<Object> list_objects();
+
+    // Moves live objects into the configured layout without blocking readers
+    void start_migration();
+    void stop_migration();
+
+    struct Progress {
+        bool running = false;
+        bool migrated = false; // every live object is in the configured layout
+        uint64_t moved = 0;
+        uint64_t failed = 0;
+    };
+    Progress migration_progress();
+
+private:
+    VaultLayout();
+    ~VaultLayout();
+    VaultLayout(const VaultLayout&) = delete;
+    VaultLayout& operator=(const VaultLayout&) = delete;
+
+    std::string root_;
+    int fanout_ = 0;
+    int root_fd_ = -1;
+    std::vector<int> top_fds_; // first-level shard directories, opened on demand
+    std::mutex fd_mutex_;
+    // Held across each migration rename and by path(), so a path handed to
+    // the shredder is never moved from under it
+    std::mutex move_mutex_;
+    std::atomic<bool> migrated_{false};
+
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<uint64_t> moved_{0};
+    std::atomic<uint64_t> failed_{0};
+
+    bool open_root();
+    int shard_fd(const std::string& encrypted_name, bool create, std::string& rest);
+    bool make_shard_dirs(const std::string& encrypted_name);
+    bool locate(const std::string& encrypted_name, std::string& relative);
+    bool move_object(const std::string& encrypted_name);
+    void run_migration();
+    std::string marker_path() const;
+};
+
+} // namespace vaultusb
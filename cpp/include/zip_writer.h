@@ -0,0 +1,60 @@
+#pragma once
+
+#include "pipeline.h"
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vaultusb {
+
+// Streaming ZIP archive writer. Entries go out front to back with a data
+// descriptor after each one, so sizes and CRC-32 are computed on the way
+// through and nothing is buffered beyond a small output block. Local headers
+// always carry a ZIP64 field and descriptors use 64-bit sizes, so entries
+// and archives may pass 4 GiB; the central directory switches to ZIP64
+// records only where a value does not fit.
+class ZipWriter {
+public:
+    explicit ZipWriter(ByteSink sink);
+    ~ZipWriter();
+    ZipWriter(const ZipWriter&) = delete;
+    ZipWriter& operator=(const ZipWriter&) = delete;
+
+    // deflate: raw DEFLATE at a fast level; otherwise the entry is stored
+    bool begin_entry(const std::string& name, std::time_t mtime, bool deflate);
+    bool write(const uint8_t* data, size_t length);
+    bool end_entry();
+    // Writes the central directory; the archive is complete once it returns true
+    bool finish();
+
+    uint64_t bytes_written() const { return offset_ + buffer_.size(); }
+
+private:
+    struct Entry {
+        std::string name;
+        uint16_t method = 0;
+        uint16_t dos_time = 0;
+        uint16_t dos_date = 0;
+        uint32_t crc = 0;
+        uint64_t compressed_size = 0;
+        uint64_t size = 0;
+        uint64_t offset = 0; // of the local header
+    };
+
+    ByteSink sink_;
+    std::vector<uint8_t> buffer_;
+    uint64_t offset_ = 0; // bytes handed to the sink
+    std::vector<Entry> entries_;
+    bool in_entry_ = false;
+
+    struct Deflater;
+    std::unique_ptr<Deflater> deflater_;
+
+    bool emit(const uint8_t* data, size_t length);
+    bool flush();
+    bool deflate_input(const uint8_t* data, size_t length, bool finish);
+};
+
+} // namespace vaultusb
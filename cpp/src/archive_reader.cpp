@@ -0,0 +1,682 @@
+#include "archive_reader.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr size_t kBlockSize = 65536;
+constexpr size_t kTarBlock = 512;
+constexpr int64_t kMaxTarMetadata = 1024 * 1024; // pax headers and GNU long names
+
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kDescriptorSignature = 0x08074b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kZip64EndSignature = 0x06064b50;
+constexpr uint32_t kEndSignature = 0x06054b50;
+constexpr uint16_t kFlagEncrypted = 0x0001;
+constexpr uint16_t kFlagDescriptor = 0x0008;
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+constexpr uint16_t kZip64ExtraId = 0x0001;
+constexpr uint32_t kMax32 = 0xffffffff;
+
+uint16_t le16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t le32(const uint8_t* p) {
+    return static_cast<uint32_t>(le16(p)) | (static_cast<uint32_t>(le16(p + 2)) << 16);
+}
+
+uint64_t le64(const uint8_t* p) {
+    return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+}
+
+uint32_t update_crc(uint32_t crc, const uint8_t* data, size_t length) {
+    // crc32() takes a uInt length
+    for (size_t done = 0; done < length;) {
+        uInt n = static_cast<uInt>(std::min<size_t>(length - done, 1u << 30));
+        crc = static_cast<uint32_t>(crc32(crc, data + done, n));
+        done += n;
+    }
+    return crc;
+}
+
+// Octal numeric field, or GNU base-256 when the high bit is set (sizes past 8 GiB)
+bool parse_tar_number(const uint8_t* field, size_t length, int64_t& value) {
+    value = 0;
+    if (field[0] & 0x80) {
+        value = field[0] & 0x3f;
+        for (size_t i = 1; i < length; i++) {
+            if (value > (INT64_MAX >> 8)) {
+                return false;
+            }
+            value = (value << 8) | field[i];
+        }
+        return true;
+    }
+    size_t i = 0;
+    while (i < length && (field[i] == ' ' || field[i] == '\0')) {
+        i++;
+    }
+    for (; i < length && field[i] != ' ' && field[i] != '\0'; i++) {
+        if (field[i] < '0' || field[i] > '7' || value > (INT64_MAX >> 3)) {
+            return false;
+        }
+        value = (value << 3) | (field[i] - '0');
+    }
+    return true;
+}
+
+// The checksum field counts as spaces
+bool tar_checksum_ok(const uint8_t* header) {
+    int64_t expected = 0;
+    if (!parse_tar_number(header + 148, 8, expected)) {
+        return false;
+    }
+    int64_t sum = 0;
+    for (size_t i = 0; i < kTarBlock; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == expected;
+}
+
+std::string tar_string(const uint8_t* field, size_t length) {
+    const uint8_t* end = static_cast<const uint8_t*>(std::memchr(field, 0, length));
+    return std::string(reinterpret_cast<const char*>(field), end ? static_cast<size_t>(end - field) : length);
+}
+
+std::time_t dos_time_to_unix(uint16_t dos_time, uint16_t dos_date) {
+    struct tm tm {};
+    tm.tm_year = ((dos_date >> 9) & 0x7f) + 80;
+    tm.tm_mon = ((dos_date >> 5) & 0x0f) - 1;
+    tm.tm_mday = dos_date & 0x1f;
+    tm.tm_hour = (dos_time >> 11) & 0x1f;
+    tm.tm_min = (dos_time >> 5) & 0x3f;
+    tm.tm_sec = (dos_time & 0x1f) * 2;
+    tm.tm_isdst = -1;
+    std::time_t result = std::mktime(&tm);
+    return result < 0 ? 0 : result;
+}
+
+} // namespace
+
+// Read-ahead buffer over the request body, gunzipping it when needed
+struct ArchiveReader::Input {
+    ByteSource source;
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(kBlockSize);
+    size_t pos = 0;
+    size_t end = 0;
+    bool eof = false;
+    bool failed = false;
+
+    bool gzip = false;
+    z_stream stream {};
+    std::vector<uint8_t> compressed;
+    size_t compressed_pos = 0;
+    size_t compressed_end = 0;
+    bool source_eof = false;
+    bool gzip_end = false;
+
+    explicit Input(ByteSource source) : source(std::move(source)) {}
+
+    ~Input() {
+        if (gzip) {
+            inflateEnd(&stream);
+        }
+    }
+
+    size_t available() const { return end - pos; }
+    const uint8_t* data() const { return buffer.data() + pos; }
+    void consume(size_t n) { pos += n; }
+
+    // Reads until n bytes are buffered or the stream ends
+    bool fill(size_t n) {
+        if (available() >= n) {
+            return true;
+        }
+        if (pos > 0) {
+            std::memmove(buffer.data(), buffer.data() + pos, available());
+            end -= pos;
+            pos = 0;
+        }
+        if (buffer.size() < n) {
+            buffer.resize(n);
+        }
+        while (available() < n && !eof && !failed) {
+            ssize_t got = pull(buffer.data() + end, buffer.size() - end);
+            if (got < 0) {
+                failed = true;
+            } else if (got == 0) {
+                eof = true;
+            } else {
+                end += static_cast<size_t>(got);
+            }
+        }
+        return available() >= n;
+    }
+
+    bool read_exact(uint8_t* out, size_t n) {
+        while (n > 0) {
+            if (!fill(1)) {
+                return false;
+            }
+            size_t k = std::min(n, available());
+            std::memcpy(out, data(), k);
+            consume(k);
+            out += k;
+            n -= k;
+        }
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        while (n > 0) {
+            if (!fill(1)) {
+                return false;
+            }
+            size_t k = static_cast<size_t>(std::min<uint64_t>(n, available()));
+            consume(k);
+            n -= k;
+        }
+        return true;
+    }
+
+    // Whatever is buffered becomes gzip input
+    bool start_gzip() {
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+            return false;
+        }
+        gzip = true;
+        compressed.assign(buffer.begin() + pos, buffer.begin() + end);
+        compressed.resize(std::max(compressed.size(), kBlockSize));
+        compressed_end = end - pos;
+        pos = end = 0;
+        eof = false;
+        return true;
+    }
+
+    ssize_t pull(uint8_t* out, size_t length) {
+        if (!gzip) {
+            return source(out, length);
+        }
+        while (!gzip_end) {
+            if (compressed_pos == compressed_end && !source_eof) {
+                ssize_t got = source(compressed.data(), compressed.size());
+                if (got < 0) {
+                    return -1;
+                }
+                source_eof = got == 0;
+                compressed_pos = 0;
+                compressed_end = static_cast<size_t>(got);
+            }
+            stream.next_in = compressed.data() + compressed_pos;
+            stream.avail_in = static_cast<uInt>(compressed_end - compressed_pos);
+            stream.next_out = out;
+            stream.avail_out = static_cast<uInt>(std::min<size_t>(length, UINT_MAX));
+            int rc = inflate(&stream, Z_NO_FLUSH);
+            compressed_pos = compressed_end - stream.avail_in;
+            size_t produced = std::min<size_t>(length, UINT_MAX) - stream.avail_out;
+            if (rc == Z_STREAM_END) {
+                gzip_end = true;
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                return -1;
+            } else if (produced == 0 && source_eof && compressed_pos == compressed_end) {
+                return -1; // truncated
+            }
+            if (produced > 0) {
+                return static_cast<ssize_t>(produced);
+            }
+        }
+        return 0;
+    }
+};
+
+struct ArchiveReader::Inflater {
+    z_stream stream {};
+    bool ready = false;
+
+    ~Inflater() {
+        if (ready) {
+            inflateEnd(&stream);
+        }
+    }
+};
+
+ArchiveReader::ArchiveReader(ByteSource source) : input_(std::make_unique<Input>(std::move(source))) {}
+
+ArchiveReader::~ArchiveReader() = default;
+
+bool ArchiveReader::next(Entry& entry) {
+    if (finished_ || !error_.empty()) {
+        return false;
+    }
+    if (format_ == Format::Unknown && !detect()) {
+        return false;
+    }
+    if (in_entry_ && !skip_entry()) {
+        return false;
+    }
+    in_entry_ = false;
+    entry = Entry();
+    return format_ == Format::Tar ? next_tar(entry) : next_zip(entry);
+}
+
+ssize_t ArchiveReader::read(uint8_t* buffer, size_t length) {
+    if (!error_.empty()) {
+        return -1;
+    }
+    if (!in_entry_ || length == 0) {
+        return 0;
+    }
+    return format_ == Format::Tar ? read_tar(buffer, length) : read_zip(buffer, length);
+}
+
+bool ArchiveReader::detect() {
+    if (!input_->fill(4)) {
+        return fail(input_->failed ? "Could not read the archive" : "Not a tar or ZIP archive");
+    }
+    const uint8_t* p = input_->data();
+    if (p[0] == 0x1f && p[1] == 0x8b) {
+        if (!input_->start_gzip()) {
+            return fail("Could not start gzip decompression");
+        }
+        if (!input_->fill(kTarBlock)) {
+            return fail(input_->failed ? "Corrupt gzip stream" : "Not a tar archive");
+        }
+        p = input_->data();
+    }
+
+    uint32_t signature = le32(p);
+    if (signature == kLocalHeaderSignature || signature == kDescriptorSignature || signature == kEndSignature) {
+        format_ = Format::Zip;
+        return true;
+    }
+    if (input_->fill(kTarBlock) && tar_checksum_ok(input_->data())) {
+        format_ = Format::Tar;
+        return true;
+    }
+    return fail("Not a tar or ZIP archive");
+}
+
+bool ArchiveReader::skip_entry() {
+    if (format_ == Format::Tar) {
+        if (!input_->skip(static_cast<uint64_t>(remaining_ + padding_))) {
+            return fail("Archive is truncated");
+        }
+        remaining_ = padding_ = 0;
+        return true;
+    }
+    if (raw_skip_) {
+        if (!input_->skip(static_cast<uint64_t>(remaining_))) {
+            return fail("Archive is truncated");
+        }
+        remaining_ = 0;
+        return true;
+    }
+    // ZIP entries without a size have to be read to find where they end
+    uint8_t scratch[16384];
+    ssize_t n;
+    while ((n = read(scratch, sizeof(scratch))) > 0) {
+    }
+    return n == 0;
+}
+
+bool ArchiveReader::next_tar(Entry& entry) {
+    std::string long_name;
+    std::string pax_path;
+    int64_t pax_size = -1;
+    int64_t pax_mtime = -1;
+    while (true) {
+        if (!input_->fill(kTarBlock)) {
+            if (input_->available() == 0 && input_->eof) {
+                finished_ = true; // no end-of-archive blocks
+                return false;
+            }
+            return fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+        }
+        const uint8_t* header = input_->data();
+        if (std::all_of(header, header + kTarBlock, [](uint8_t b) { return b == 0; })) {
+            finished_ = true;
+            return false;
+        }
+        int64_t size = 0;
+        int64_t mtime = 0;
+        if (!tar_checksum_ok(header) || !parse_tar_number(header + 124, 12, size) ||
+            !parse_tar_number(header + 136, 12, mtime)) {
+            return fail("Corrupt tar header");
+        }
+        char type = static_cast<char>(header[156]);
+        std::string name = tar_string(header, 100);
+        if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != 0) {
+            name = tar_string(header + 345, 155) + "/" + name;
+        }
+        input_->consume(kTarBlock);
+        int64_t padding = (static_cast<int64_t>(kTarBlock) - size % static_cast<int64_t>(kTarBlock)) %
+                          static_cast<int64_t>(kTarBlock);
+
+        // Extended headers describe the entry that follows them
+        if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+            if (size > kMaxTarMetadata) {
+                return fail("Oversized tar extended header");
+            }
+            std::string meta(static_cast<size_t>(size), '\0');
+            if (!input_->read_exact(reinterpret_cast<uint8_t*>(&meta[0]), meta.size()) ||
+                !input_->skip(static_cast<uint64_t>(padding))) {
+                return fail("Archive is truncated");
+            }
+            if (type == 'L') {
+                long_name = meta.substr(0, meta.find('\0'));
+            } else if (type == 'x') {
+                // Records are "<length> <key>=<value>\n"
+                size_t pos = 0;
+                while (pos < meta.size()) {
+                    size_t space = meta.find(' ', pos);
+                    if (space == std::string::npos) {
+                        break;
+                    }
+                    size_t length = std::strtoull(meta.c_str() + pos, nullptr, 10);
+                    if (length <= space - pos || pos + length > meta.size()) {
+                        return fail("Corrupt pax header");
+                    }
+                    std::string record = meta.substr(space + 1, pos + length - space - 2);
+                    size_t equals = record.find('=');
+                    std::string key = record.substr(0, equals);
+                    std::string value = equals == std::string::npos ? "" : record.substr(equals + 1);
+                    if (key == "path") {
+                        pax_path = value;
+                    } else if (key == "size") {
+                        pax_size = std::strtoll(value.c_str(), nullptr, 10);
+                    } else if (key == "mtime") {
+                        pax_mtime = std::strtoll(value.c_str(), nullptr, 10);
+                    }
+                    pos += length;
+                }
+            }
+            continue;
+        }
+
+        if (pax_size >= 0) {
+            size = pax_size;
+            padding = (static_cast<int64_t>(kTarBlock) - size % static_cast<int64_t>(kTarBlock)) %
+                      static_cast<int64_t>(kTarBlock);
+        }
+        entry.name = !pax_path.empty() ? pax_path : !long_name.empty() ? long_name : name;
+        entry.size = size;
+        entry.mtime = static_cast<std::time_t>(pax_mtime >= 0 ? pax_mtime : mtime);
+        entry.regular = type == '0' || type == '\0' || type == '7';
+        remaining_ = size;
+        padding_ = padding;
+        in_entry_ = true;
+        return true;
+    }
+}
+
+bool ArchiveReader::next_zip(Entry& entry) {
+    if (!input_->fill(4)) {
+        if (input_->available() == 0 && input_->eof) {
+            finished_ = true; // cut off before the central directory
+            return false;
+        }
+        return fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+    }
+    uint32_t signature = le32(input_->data());
+    if (signature == kDescriptorSignature) {
+        // Split-archive marker some writers put in front of the first entry
+        input_->consume(4);
+        return next_zip(entry);
+    }
+    if (signature == kCentralHeaderSignature || signature == kEndSignature || signature == kZip64EndSignature) {
+        finished_ = true;
+        return false;
+    }
+    if (signature != kLocalHeaderSignature) {
+        return fail("Corrupt ZIP header");
+    }
+    if (!input_->fill(30)) {
+        return fail("Archive is truncated");
+    }
+
+    const uint8_t* header = input_->data();
+    uint16_t flags = le16(header + 6);
+    uint16_t method = le16(header + 8);
+    uint16_t dos_time = le16(header + 10);
+    uint16_t dos_date = le16(header + 12);
+    uint32_t crc = le32(header + 14);
+    uint64_t compressed_size = le32(header + 18);
+    uint64_t size = le32(header + 22);
+    uint16_t name_length = le16(header + 26);
+    uint16_t extra_length = le16(header + 28);
+    input_->consume(30);
+
+    std::string name(name_length, '\0');
+    std::vector<uint8_t> extra(extra_length);
+    if (!input_->read_exact(reinterpret_cast<uint8_t*>(&name[0]), name.size()) ||
+        !input_->read_exact(extra.data(), extra.size())) {
+        return fail("Archive is truncated");
+    }
+
+    // The ZIP64 field holds the sizes that are 0xffffffff in the header, in order
+    zip64_ = false;
+    for (size_t pos = 0; pos + 4 <= extra.size();) {
+        uint16_t id = le16(&extra[pos]);
+        size_t length = le16(&extra[pos + 2]);
+        size_t field = pos + 4;
+        if (field + length > extra.size()) {
+            break;
+        }
+        if (id == kZip64ExtraId) {
+            zip64_ = true;
+            size_t p = field;
+            if (size == kMax32 && p + 8 <= field + length) {
+                size = le64(&extra[p]);
+                p += 8;
+            }
+            if (compressed_size == kMax32 && p + 8 <= field + length) {
+                compressed_size = le64(&extra[p]);
+            }
+        }
+        pos = field + length;
+    }
+
+    method_ = method;
+    descriptor_ = (flags & kFlagDescriptor) != 0;
+    expected_crc_ = crc;
+    expected_size_ = size;
+    crc_ = static_cast<uint32_t>(crc32(0, Z_NULL, 0));
+    produced_ = 0;
+    entry_done_ = false;
+    raw_skip_ = false;
+    remaining_ = 0;
+
+    bool supported = !(flags & kFlagEncrypted) && (method == kMethodStored || method == kMethodDeflated);
+    if (!supported) {
+        // Skippable only when the header says how long the data is
+        if (descriptor_) {
+            return fail("Cannot skip unsupported ZIP entry " + name);
+        }
+        raw_skip_ = true;
+        remaining_ = static_cast<int64_t>(compressed_size);
+    } else if (method == kMethodStored && !descriptor_) {
+        remaining_ = static_cast<int64_t>(compressed_size);
+    } else if (method == kMethodDeflated) {
+        if (!inflater_) {
+            inflater_ = std::make_unique<Inflater>();
+        }
+        if (!inflater_->ready) {
+            if (inflateInit2(&inflater_->stream, -MAX_WBITS) != Z_OK) {
+                return fail("Could not start deflate decompression");
+            }
+            inflater_->ready = true;
+        } else if (inflateReset(&inflater_->stream) != Z_OK) {
+            return fail("Could not start deflate decompression");
+        }
+    }
+
+    entry.name = name;
+    entry.size = descriptor_ ? -1 : static_cast<int64_t>(size);
+    entry.mtime = dos_time_to_unix(dos_time, dos_date);
+    entry.regular = supported && !name.empty() && name.back() != '/';
+    in_entry_ = true;
+    return true;
+}
+
+ssize_t ArchiveReader::read_tar(uint8_t* buffer, size_t length) {
+    if (remaining_ == 0) {
+        return 0;
+    }
+    if (!input_->fill(1)) {
+        fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+        return -1;
+    }
+    size_t n = static_cast<size_t>(std::min<int64_t>({static_cast<int64_t>(length), remaining_,
+                                                      static_cast<int64_t>(input_->available())}));
+    std::memcpy(buffer, input_->data(), n);
+    input_->consume(n);
+    remaining_ -= static_cast<int64_t>(n);
+    return static_cast<ssize_t>(n);
+}
+
+ssize_t ArchiveReader::read_zip(uint8_t* buffer, size_t length) {
+    if (entry_done_ || raw_skip_) {
+        return 0;
+    }
+    if (method_ == kMethodDeflated) {
+        return read_inflated(buffer, length);
+    }
+    if (descriptor_) {
+        return read_until_descriptor(buffer, length);
+    }
+
+    if (remaining_ == 0) {
+        return finish_zip_entry() ? 0 : -1;
+    }
+    if (!input_->fill(1)) {
+        fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+        return -1;
+    }
+    size_t n = static_cast<size_t>(std::min<int64_t>({static_cast<int64_t>(length), remaining_,
+                                                      static_cast<int64_t>(input_->available())}));
+    std::memcpy(buffer, input_->data(), n);
+    input_->consume(n);
+    remaining_ -= static_cast<int64_t>(n);
+    crc_ = update_crc(crc_, buffer, n);
+    produced_ += n;
+    return static_cast<ssize_t>(n);
+}
+
+// Stored data of unknown length ends at the first descriptor signature whose
+// CRC and sizes match everything before it
+ssize_t ArchiveReader::read_until_descriptor(uint8_t* buffer, size_t length) {
+    size_t descriptor_length = zip64_ ? 24 : 16;
+    input_->fill(kBlockSize / 2);
+    if (input_->failed || input_->available() < descriptor_length) {
+        fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+        return -1;
+    }
+
+    const uint8_t* data = input_->data();
+    size_t limit = std::min(input_->available() - descriptor_length + 1, length);
+    size_t end = limit;
+    bool found = false;
+    for (size_t i = 0; i < limit && !found; i++) {
+        const void* hit = std::memchr(data + i, 'P', limit - i);
+        if (!hit) {
+            break;
+        }
+        i = static_cast<const uint8_t*>(hit) - data;
+        if (le32(data + i) != kDescriptorSignature) {
+            continue;
+        }
+        uint64_t size = produced_ + i;
+        const uint8_t* fields = data + i + 8;
+        bool sizes_match = zip64_ ? le64(fields) == size && le64(fields + 8) == size
+                                  : le32(fields) == static_cast<uint32_t>(size) &&
+                                        le32(fields + 4) == static_cast<uint32_t>(size);
+        if (sizes_match && le32(data + i + 4) == update_crc(crc_, data, i)) {
+            end = i;
+            found = true;
+        }
+    }
+
+    if (found && end == 0) {
+        input_->consume(descriptor_length);
+        entry_done_ = true;
+        return 0;
+    }
+    std::memcpy(buffer, data, end);
+    input_->consume(end);
+    crc_ = update_crc(crc_, buffer, end);
+    produced_ += end;
+    return static_cast<ssize_t>(end);
+}
+
+ssize_t ArchiveReader::read_inflated(uint8_t* buffer, size_t length) {
+    z_stream& stream = inflater_->stream;
+    length = std::min<size_t>(length, UINT_MAX);
+    while (true) {
+        if (!input_->fill(1)) {
+            fail(input_->failed ? "Could not read the archive" : "Archive is truncated");
+            return -1;
+        }
+        size_t available = input_->available();
+        stream.next_in = const_cast<Bytef*>(input_->data());
+        stream.avail_in = static_cast<uInt>(std::min<size_t>(available, UINT_MAX));
+        stream.next_out = buffer;
+        stream.avail_out = static_cast<uInt>(length);
+        int rc = inflate(&stream, Z_NO_FLUSH);
+        input_->consume(std::min<size_t>(available, UINT_MAX) - stream.avail_in);
+        size_t produced = length - stream.avail_out;
+        crc_ = update_crc(crc_, buffer, produced);
+        produced_ += produced;
+
+        if (rc == Z_STREAM_END) {
+            return finish_zip_entry() ? static_cast<ssize_t>(produced) : -1;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            fail("Corrupt deflate data");
+            return -1;
+        }
+        if (produced > 0) {
+            return static_cast<ssize_t>(produced);
+        }
+    }
+}
+
+bool ArchiveReader::finish_zip_entry() {
+    if (descriptor_) {
+        // The signature is optional; sizes are 64-bit when the header had a ZIP64 field
+        size_t length = zip64_ ? 20 : 12;
+        if (!input_->fill(4)) {
+            return fail("Archive is truncated");
+        }
+        if (le32(input_->data()) == kDescriptorSignature) {
+            input_->consume(4);
+        }
+        if (!input_->fill(length)) {
+            return fail("Archive is truncated");
+        }
+        const uint8_t* fields = input_->data();
+        expected_crc_ = le32(fields);
+        expected_size_ = zip64_ ? le64(fields + 12) : le32(fields + 8);
+        input_->consume(length);
+    }
+    if (crc_ != expected_crc_ || produced_ != expected_size_) {
+        return fail("CRC or size mismatch in ZIP entry");
+    }
+    entry_done_ = true;
+    return true;
+}
+
+bool ArchiveReader::fail(const std::string& message) {
+    if (error_.empty()) {
+        error_ = message;
+    }
+    return false;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,161 @@
+#include "argon2_pool.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+Argon2MemoryPool& Argon2MemoryPool::instance() {
+    static Argon2MemoryPool instance;
+    return instance;
+}
+
+Argon2MemoryPool::~Argon2MemoryPool() {
+    if (!slots_.empty() && slots_.front().base) {
+        munmap(slots_.front().base, mapping_bytes_);
+    }
+}
+
+bool Argon2MemoryPool::initialize(size_t slot_bytes, size_t slot_count, bool huge_pages) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!slots_.empty() || slot_bytes == 0 || slot_count == 0) {
+        return !slots_.empty();
+    }
+
+    slot_bytes_ = huge_pages ? round_up(slot_bytes, kHugePageSize) : round_up(slot_bytes, 4096);
+    mapping_bytes_ = slot_bytes_ * slot_count;
+
+    bool used_huge_pages = false;
+    uint8_t* region = map_region(mapping_bytes_, huge_pages, used_huge_pages);
+    if (!region) {
+        std::cerr << "Argon2 memory pool unavailable, falling back to per-hash allocation" << std::endl;
+        return false;
+    }
+
+    // Keep the working set out of swap and core dumps
+    stats_.locked = mlock(region, mapping_bytes_) == 0;
+    if (!stats_.locked) {
+        std::cerr << "Warning: could not mlock Argon2 memory pool (" << std::strerror(errno) << ")" << std::endl;
+    }
+    madvise(region, mapping_bytes_, MADV_DONTDUMP);
+
+    slots_.resize(slot_count);
+    for (size_t i = 0; i < slot_count; i++) {
+        slots_[i].base = region + i * slot_bytes_;
+    }
+
+    stats_.slot_count = slot_count;
+    stats_.slot_bytes = slot_bytes_;
+    stats_.huge_pages = used_huge_pages;
+    return true;
+}
+
+uint8_t* Argon2MemoryPool::map_region(size_t bytes, bool huge_pages, bool& used_huge_pages) {
+    void* region = MAP_FAILED;
+    used_huge_pages = false;
+
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        used_huge_pages = region != MAP_FAILED;
+    }
+#endif
+
+    if (region == MAP_FAILED) {
+        region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (region == MAP_FAILED) {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(region, bytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    return static_cast<uint8_t*>(region);
+}
+
+int Argon2MemoryPool::allocate(uint8_t** memory, size_t bytes) {
+    return instance().acquire(memory, bytes);
+}
+
+void Argon2MemoryPool::release(uint8_t* memory, size_t bytes) {
+    instance().give_back(memory, bytes);
+}
+
+int Argon2MemoryPool::acquire(uint8_t** memory, size_t bytes) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!slots_.empty() && bytes <= slot_bytes_) {
+            // Wait for a slot rather than growing past the configured concurrency
+            Slot* free_slot = nullptr;
+            cv_.wait(lock, [&]() {
+                for (auto& slot : slots_) {
+                    if (!slot.in_use) {
+                        free_slot = &slot;
+                        return true;
+                    }
+                }
+                return false;
+            });
+
+            free_slot->in_use = true;
+            stats_.slots_in_use++;
+            stats_.pooled_allocations++;
+            *memory = free_slot->base;
+            return 0;
+        }
+        stats_.fallback_allocations++;
+    }
+
+    // Parameters larger than the pool (legacy hashes, calibration) get a private mapping
+    void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        *memory = nullptr;
+        return -1;
+    }
+    *memory = static_cast<uint8_t*>(region);
+    return 0;
+}
+
+void Argon2MemoryPool::give_back(uint8_t* memory, size_t bytes) {
+    if (!memory) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!slots_.empty()) {
+            uint8_t* begin = slots_.front().base;
+            if (memory >= begin && memory < begin + mapping_bytes_) {
+                // Argon2 has already wiped the blocks before calling us
+                slots_[(memory - begin) / slot_bytes_].in_use = false;
+                stats_.slots_in_use--;
+                cv_.notify_one();
+                return;
+            }
+        }
+    }
+
+    munmap(memory, bytes);
+}
+
+Argon2MemoryPool::Stats Argon2MemoryPool::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace vaultusb
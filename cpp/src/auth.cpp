@@ -2,12 +2,16 @@
 #include "config.h"
 #include "database.h"
 #include "crypto.h"
+#include "kdf_executor.h"
+#include "totp.h"
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <cctype>
 #include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
 #include <openssl/sha.h>
 #include <ctime>
 
@@ -31,13 +35,25 @@ std::shared_ptr<User> AuthManager::authenticate_user(const std::string& username
     
     if (CryptoManager::instance().verify_password(password, user->password_hash)) {
         user->last_login = std::time(nullptr);
-        Database::instance().update_user(*user);
+        // Transparently upgrade hashes stored below the current KDF policy
+        if (CryptoManager::instance().password_needs_rehash(user->password_hash)) {
+            user->password_hash = CryptoManager::instance().hash_password(password);
+            Database::instance().update_user(*user);
+        } else {
+            Database::instance().update_last_login(user->id, user->last_login);
+        }
         return user;
     }
     
     return nullptr;
 }
 
+std::future<std::shared_ptr<User>> AuthManager::authenticate_user_async(const std::string& username, const std::string& password) {
+    return KdfExecutor::instance().submit([this, username, password]() {
+        return authenticate_user(username, password);
+    });
+}
+
 std::string AuthManager::create_session(const User& user, const std::string& ip_address, const std::string& user_agent) {
     Session session(user.id, ip_address, user_agent);
     session.id = generate_session_id();
@@ -124,6 +140,12 @@ bool AuthManager::change_password(User& user, const std::string& current_passwor
     return Database::instance().update_user(user);
 }
 
+std::future<bool> AuthManager::change_password_async(const User& user, const std::string& current_password, const std::string& new_password) {
+    return KdfExecutor::instance().submit([this, target = user, current_password, new_password]() mutable {
+        return change_password(target, current_password, new_password);
+    });
+}
+
 std::string AuthManager::hash_password(const std::string& password) {
     return CryptoManager::instance().hash_password(password);
 }
@@ -149,7 +171,7 @@ bool AuthManager::verify_totp(const User& user, const std::string& token) {
         return false;
     }
     
-    return verify_totp_token(user.totp_secret, token);
+    return totp::verify(user.totp_secret, token, get_current_time_step());
 }
 
 bool AuthManager::enable_totp(User& user, const std::string& token) {
@@ -183,11 +205,11 @@ std::string AuthManager::generate_session_id() {
 
 std::string AuthManager::generate_totp_secret() {
     // Generate 20 random bytes and encode as base32
-    std::vector<uint8_t> secret(20);
-    for (auto& b : secret) {
-        b = std::rand() % 256;
+    SecureBytes secret(20);
+    if (RAND_bytes(secret.data(), secret.size()) != 1) {
+        throw std::runtime_error("Failed to generate TOTP secret");
     }
-    return base32_encode(secret);
+    return totp::base32_encode(secret.data(), secret.size());
 }
 
 std::string AuthManager::generate_totp_qr_url(const std::string& secret, const std::string& username) {
@@ -196,112 +218,8 @@ std::string AuthManager::generate_totp_qr_url(const std::string& secret, const s
     return url.str();
 }
 
-bool AuthManager::verify_totp_token(const std::string& secret, const std::string& token) {
-    try {
-        auto secret_bytes = base32_decode(secret);
-        uint64_t time_step = get_current_time_step();
-        
-        // Check current and previous time step
-        for (int i = -1; i <= 1; i++) {
-            std::string expected_token = time_step_to_totp(secret, time_step + i);
-            if (expected_token == token) {
-                return true;
-            }
-        }
-        return false;
-    } catch (const std::exception&) {
-        return false;
-    }
-}
-
-std::string AuthManager::base32_encode(const std::vector<uint8_t>& data) {
-    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
-    std::string result;
-    
-    for (size_t i = 0; i < data.size(); i += 5) {
-        uint64_t buffer = 0;
-        int bits = 0;
-        
-        for (int j = 0; j < 5 && i + j < data.size(); j++) {
-            buffer = (buffer << 8) | data[i + j];
-            bits += 8;
-        }
-        
-        while (bits >= 5) {
-            result += chars[(buffer >> (bits - 5)) & 0x1F];
-            bits -= 5;
-        }
-        
-        if (bits > 0) {
-            result += chars[(buffer << (5 - bits)) & 0x1F];
-        }
-    }
-    
-    return result;
-}
-
-std::vector<uint8_t> AuthManager::base32_decode(const std::string& encoded) {
-    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
-    std::vector<uint8_t> result;
-    
-    uint64_t buffer = 0;
-    int bits = 0;
-    
-    for (char c : encoded) {
-        size_t pos = chars.find(std::toupper(c));
-        if (pos == std::string::npos) continue;
-        
-        buffer = (buffer << 5) | pos;
-        bits += 5;
-        
-        while (bits >= 8) {
-            result.push_back((buffer >> (bits - 8)) & 0xFF);
-            bits -= 8;
-        }
-    }
-    
-    return result;
-}
-
-std::vector<uint8_t> AuthManager::hmac_sha1(const std::vector<uint8_t>& key, const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> result(20);
-    unsigned int len;
-    
-    HMAC(EVP_sha1(), key.data(), key.size(), data.data(), data.size(), result.data(), &len);
-    result.resize(len);
-    
-    return result;
-}
-
 uint64_t AuthManager::get_current_time_step() {
     return std::time(nullptr) / 30; // 30-second time steps
 }
 
-std::string AuthManager::time_step_to_totp(const std::string& secret, uint64_t time_step) {
-    auto secret_bytes = base32_decode(secret);
-    
-    // Convert time step to big-endian bytes
-    std::vector<uint8_t> time_bytes(8);
-    for (int i = 7; i >= 0; i--) {
-        time_bytes[i] = time_step & 0xFF;
-        time_step >>= 8;
-    }
-    
-    // Compute HMAC-SHA1
-    auto hmac = hmac_sha1(secret_bytes, time_bytes);
-    
-    // Dynamic truncation
-    int offset = hmac[19] & 0x0F;
-    int code = ((hmac[offset] & 0x7F) << 24) |
-               ((hmac[offset + 1] & 0xFF) << 16) |
-               ((hmac[offset + 2] & 0xFF) << 8) |
-               (hmac[offset + 3] & 0xFF);
-    
-    code %= 1000000; // 6-digit code
-    
-    std::ostringstream oss;
-    oss << std::setfill('0') << std::setw(6) << code;
-    return oss.str();
-}
-
 } // namespace vaultusb
@@ -0,0 +1,797 @@
+#include "backup.h"
+#include "codec.h"
+#include "config.h"
+#include "database.h"
+#include "pack_store.h"
+#include "shredder.h"
+#include "vault_layout.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr size_t kCopyBlockSize = 1 << 20;
+
+const std::string kDatabaseName = "vaultusb.db";
+const std::string kMasterKeyName = "master.key";
+const std::string kNextKeyName = "master.key.next";
+const std::string kManifestName = "manifest";
+const std::string kReportName = "report.json";
+const std::string kManifestHeader = "# vaultusb backup 1";
+// Suffix of a copy that replaces a file the committed backup still uses
+const std::string kStagedSuffix = ".new";
+
+std::string object_path(const std::string& encrypted_name) {
+    return "objects/" + encrypted_name.substr(0, 2) + "/" + encrypted_name;
+}
+
+bool make_dirs(const std::string& path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            std::cerr << "Cannot create " << dir << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (pos == std::string::npos) {
+            return true;
+        }
+    }
+}
+
+std::string parent_dir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos || slash == 0 ? "/" : path.substr(0, slash);
+}
+
+bool write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool sync_filesystem(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = syncfs(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+void strings_to_json(std::ostringstream& json, const char* key, const std::vector<std::string>& values) {
+    json << "\"" << key << "\":[";
+    for (size_t i = 0; i < values.size(); i++) {
+        json << (i > 0 ? "," : "") << "\"" << codec::json_escape(values[i]) << "\"";
+    }
+    json << "]";
+}
+
+// Nothing a database snapshot refers to may be shredded or wiped until the
+// objects it names have been copied
+struct DeleteHold {
+    DeleteHold() {
+        Shredder::instance().pause();
+        PackStore::instance().hold_wipes();
+    }
+    ~DeleteHold() {
+        PackStore::instance().release_wipes();
+        Shredder::instance().resume();
+    }
+};
+
+} // namespace
+
+// Relative path -> size and SHA-256 of the copy in the target, plus the
+// source's size and mtime, which decide whether the next run copies it again
+struct VaultBackup::Manifest {
+    struct Entry {
+        std::string sha256;
+        int64_t size = 0;
+        int64_t source_mtime = 0; // nanoseconds
+    };
+    double full_seconds = 0.0;
+    std::map<std::string, Entry> entries;
+};
+
+std::string VaultBackup::Report::to_json() const {
+    double mb = bytes_copied / (1024.0 * 1024.0);
+
+    std::ostringstream json;
+    json << "{\"operation\":\"" << operation << "\","
+         << "\"target\":\"" << codec::json_escape(target) << "\","
+         << "\"started_at\":" << started_at << ","
+         << "\"finished_at\":" << finished_at << ","
+         << "\"complete\":" << (complete ? "true" : "false") << ","
+         << "\"clean\":" << (clean() ? "true" : "false") << ","
+         << "\"full\":" << (full ? "true" : "false") << ","
+         << "\"objects\":" << objects << ","
+         << "\"objects_copied\":" << objects_copied << ","
+         << "\"objects_removed\":" << objects_removed << ","
+         << "\"bytes_total\":" << bytes_total << ","
+         << "\"bytes_copied\":" << bytes_copied << ","
+         << "\"seconds\":" << seconds << ","
+         << "\"mb_per_second\":" << (seconds > 0.0 ? mb / seconds : 0.0) << ","
+         << "\"full_seconds\":" << full_seconds << ","
+         << "\"incremental_ratio\":" << (full_seconds > 0.0 ? seconds / full_seconds : 0.0) << ",";
+    strings_to_json(json, "missing", missing);
+    json << ",";
+    strings_to_json(json, "errors", errors);
+    json << "}";
+    return json.str();
+}
+
+VaultBackup& VaultBackup::instance() {
+    static VaultBackup instance;
+    return instance;
+}
+
+VaultBackup::~VaultBackup() {
+    stop();
+}
+
+bool VaultBackup::start() {
+    const std::string target = Config::instance().backup_dir();
+    if (target.empty() || running_.exchange(true)) {
+        return false;
+    }
+
+    // A previous run has finished; reap its thread before starting a new one
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    stop_requested_ = false;
+    worker_ = std::thread([this, target]() {
+        Report report = run_backup(target);
+        std::string json = report.to_json();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last_report_ = json;
+        }
+        if (!report.clean()) {
+            std::cerr << "Backup to " << target << " finished with " << report.missing.size() << " missing objects and "
+                      << report.errors.size() << " errors" << std::endl;
+        }
+        running_ = false;
+    });
+    return true;
+}
+
+void VaultBackup::stop() {
+    stop_requested_ = true;
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+VaultBackup::Progress VaultBackup::progress() {
+    Progress progress;
+    progress.running = running_;
+    progress.objects_total = backup_counters_.objects_total;
+    progress.objects_done = backup_counters_.objects_done;
+    progress.bytes_done = backup_counters_.bytes_done;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (last_report_.empty() && !Config::instance().backup_dir().empty()) {
+        std::ifstream file(Config::instance().backup_dir() + "/" + kReportName);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        last_report_ = buffer.str();
+        while (!last_report_.empty() && last_report_.back() == '\n') {
+            last_report_.pop_back();
+        }
+    }
+    progress.last_report = last_report_;
+    return progress;
+}
+
+void VaultBackup::mirror_pass_progress(uint64_t& objects_done, uint64_t& objects_total) {
+    objects_done = mirror_counters_.objects_done;
+    objects_total = mirror_counters_.objects_total;
+}
+
+VaultBackup::Report VaultBackup::begin(const std::string& operation, const std::string& target) {
+    counters_ = operation == "mirror" ? &mirror_counters_ : &backup_counters_;
+    counters_->objects_total = 0;
+    counters_->objects_done = 0;
+    counters_->bytes_done = 0;
+
+    Report report;
+    report.operation = operation;
+    report.target = target;
+    report.started_at = std::time(nullptr);
+    return report;
+}
+
+void VaultBackup::finish(Report& report, std::chrono::steady_clock::time_point started) {
+    report.finished_at = std::time(nullptr);
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+VaultBackup::Report VaultBackup::run_backup(const std::string& target) {
+    return sync("backup", target, false, nullptr);
+}
+
+VaultBackup::Report VaultBackup::run_mirror(const std::string& target, bool full, int64_t& queue_seq) {
+    // Never created here: a missing directory means the drive is not mounted
+    struct stat st;
+    if (stat(target.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        Report report;
+        report.operation = "mirror";
+        report.target = target;
+        report.started_at = report.finished_at = std::time(nullptr);
+        report.errors.push_back(target + ": absent");
+        return report;
+    }
+    return sync("mirror", target, !full, &queue_seq);
+}
+
+VaultBackup::Report VaultBackup::sync(const std::string& operation, const std::string& target, bool partial,
+                                      int64_t* queue_seq) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    auto started = std::chrono::steady_clock::now();
+    Report report = begin(operation, target);
+
+    Manifest previous;
+    report.full = !load_manifest(target, previous);
+    partial = partial && !report.full; // nothing to build on
+    if (!make_dirs(target + "/objects")) {
+        report.errors.push_back("cannot create " + target);
+        finish(report, started);
+        return report;
+    }
+
+    Manifest manifest;
+    std::vector<std::string> removed;
+    const std::string db_part = target + "/" + kDatabaseName + ".part";
+    unlink(db_part.c_str());
+    std::vector<std::string> objects;
+    std::vector<std::string> segments;
+    std::vector<std::string> queued;
+    // The pending rotation key travels with the master key: rows of the
+    // snapshot may already be rewrapped under it
+    const std::string& key_file = Config::instance().master_key_file();
+    const std::pair<std::string, std::string> key_files[] = {{kMasterKeyName, key_file},
+                                                             {kNextKeyName, key_file + ".next"}};
+    int key_fds[2] = {-1, -1};
+    // Pack segments and key files change in place, and the committed backup
+    // needs its own copies until the new snapshot and manifest replace it:
+    // replacements are staged and renamed into place only after that
+    std::vector<std::string> staged;
+    auto copy_staged = [&](int fd, int64_t length, const std::string& path, std::string& sha256, uint64_t& bytes) {
+        struct stat existing;
+        if (stat(path.c_str(), &existing) != 0) {
+            return copy_to(fd, length, path, sha256, bytes);
+        }
+        if (!copy_to(fd, length, path + kStagedSuffix, sha256, bytes)) {
+            return false;
+        }
+        staged.push_back(path);
+        return true;
+    };
+    auto drop_staged = [&staged]() {
+        for (const auto& path : staged) {
+            unlink((path + kStagedSuffix).c_str());
+        }
+    };
+    auto close_keys = [&key_fds]() {
+        for (int& fd : key_fds) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    };
+    {
+        DeleteHold hold;
+        // Key files are replaced by rename, never rewritten: descriptors
+        // opened before the snapshot keep the keys it was taken under
+        for (int i = 0; i < 2; i++) {
+            key_fds[i] = open(key_files[i].second.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (!Database::instance().backup_to(db_part, queue_seq ? &queued : nullptr, queue_seq) ||
+            !Database::read_backup(db_part, objects, &segments)) {
+            close_keys();
+            report.errors.push_back(kDatabaseName + ": snapshot failed");
+            finish(report, started);
+            return report;
+        }
+
+        // A rotation that began or finished meanwhile leaves keys that may
+        // not match the snapshot's rows; the next run catches up
+        for (int i = 0; i < 2; i++) {
+            struct stat now, held;
+            bool exists = stat(key_files[i].second.c_str(), &now) == 0;
+            if (exists != (key_fds[i] >= 0) ||
+                (exists && (fstat(key_fds[i], &held) != 0 || held.st_dev != now.st_dev || held.st_ino != now.st_ino))) {
+                close_keys();
+                report.errors.push_back(key_files[i].first + ": changed during the snapshot");
+                finish(report, started);
+                return report;
+            }
+        }
+
+        // A partial run starts from the previous manifest and only looks at
+        // the queued objects, plus every segment since wipes are not queued
+        if (partial) {
+            manifest.entries = previous.entries;
+            std::unordered_set<std::string> live(objects.begin(), objects.end());
+            std::set<std::string> wanted(queued.begin(), queued.end());
+            wanted.insert(segments.begin(), segments.end());
+            objects.clear();
+            for (const auto& name : wanted) {
+                if (live.count(name)) {
+                    objects.push_back(name);
+                } else if (manifest.entries.erase(object_path(name))) {
+                    removed.push_back(object_path(name));
+                }
+            }
+        }
+        counters_->objects_total = objects.size();
+
+        // Objects never change once written, except pack segments, which
+        // are appended to and wiped in place; size and mtime tell both apart
+        auto& layout = VaultLayout::instance();
+        for (const auto& name : objects) {
+            if (stop_requested_) {
+                break;
+            }
+            counters_->objects_done++;
+            std::string relative = object_path(name);
+            int fd = layout.open(name, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                // The backup's earlier copy may be the only one left: keep it
+                report.missing.push_back(name);
+                auto kept = previous.entries.find(relative);
+                if (kept != previous.entries.end()) {
+                    manifest.entries[relative] = kept->second;
+                }
+                if (fd >= 0) {
+                    close(fd);
+                }
+                continue;
+            }
+
+            Manifest::Entry entry;
+            entry.size = st.st_size;
+            entry.source_mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+            auto old = previous.entries.find(relative);
+            struct stat copied;
+            if (old != previous.entries.end() && old->second.size == entry.size &&
+                old->second.source_mtime == entry.source_mtime &&
+                stat((target + "/" + relative).c_str(), &copied) == 0 && copied.st_size == entry.size) {
+                entry.sha256 = old->second.sha256;
+            } else {
+                // Bytes appended after the snapshot are not needed by it
+                uint64_t bytes = 0;
+                std::string path = target + "/" + relative;
+                if (!make_dirs(parent_dir(path)) || !copy_staged(fd, entry.size, path, entry.sha256, bytes)) {
+                    if (!stop_requested_) {
+                        report.errors.push_back(relative + ": copy failed");
+                    }
+                    close(fd);
+                    continue;
+                }
+                report.objects_copied++;
+                report.bytes_copied += bytes;
+            }
+            close(fd);
+            manifest.entries[relative] = entry;
+        }
+    }
+
+    // Only the master key is required; the next key exists during a rotation
+    uint64_t key_bytes = 0;
+    for (int i = 0; i < 2; i++) {
+        if (key_fds[i] < 0 && i > 0) {
+            continue;
+        }
+        Manifest::Entry key_entry;
+        uint64_t bytes = 0;
+        if (key_fds[i] < 0 ||
+            !copy_staged(key_fds[i], -1, target + "/" + key_files[i].first, key_entry.sha256, bytes)) {
+            report.errors.push_back(key_files[i].first + ": copy failed");
+        }
+        key_entry.size = static_cast<int64_t>(bytes);
+        manifest.entries[key_files[i].first] = key_entry;
+        key_bytes += bytes;
+    }
+    bool rotating = key_fds[1] >= 0;
+    close_keys();
+
+    Manifest::Entry db_entry;
+    uint64_t db_bytes = 0;
+    if (!hash_file(db_part, db_entry.sha256, db_bytes)) {
+        report.errors.push_back(kDatabaseName + ": unreadable");
+    }
+    db_entry.size = static_cast<int64_t>(db_bytes);
+    manifest.entries[kDatabaseName] = db_entry;
+    report.bytes_copied += key_bytes + db_bytes;
+
+    for (const auto& item : manifest.entries) {
+        report.bytes_total += item.second.size;
+        if (item.first.compare(0, 8, "objects/") == 0) {
+            report.objects++;
+        }
+    }
+
+    // Everything is on disk before the snapshot and manifest that point at
+    // it are switched over; a run that fails, or that found objects missing
+    // from the vault, leaves the previous backup, staged copies aside
+    if (stop_requested_ || !report.errors.empty() || !report.missing.empty()) {
+        drop_staged();
+        finish(report, started);
+        return report;
+    }
+    if (!sync_filesystem(target) || rename(db_part.c_str(), (target + "/" + kDatabaseName).c_str()) != 0) {
+        drop_staged();
+        report.errors.push_back(kDatabaseName + ": cannot be saved");
+        finish(report, started);
+        return report;
+    }
+    finish(report, started);
+    manifest.full_seconds = report.full ? report.seconds : previous.full_seconds;
+    report.full_seconds = manifest.full_seconds;
+    if (!save_manifest(target, manifest)) {
+        drop_staged();
+        report.errors.push_back(kManifestName + ": cannot be saved");
+        return report;
+    }
+    for (const auto& path : staged) {
+        if (rename((path + kStagedSuffix).c_str(), path.c_str()) != 0) {
+            report.errors.push_back(path.substr(target.size() + 1) + ": cannot be replaced");
+        }
+    }
+    if (!staged.empty() && !sync_filesystem(target)) {
+        report.errors.push_back(kManifestName + ": cannot be synced");
+    }
+    report.complete = true;
+    if (!rotating) {
+        unlink((target + "/" + kNextKeyName).c_str()); // left by a run taken during a finished rotation
+    }
+    if (partial) {
+        for (const auto& relative : removed) {
+            if (unlink((target + "/" + relative).c_str()) == 0) {
+                report.objects_removed++;
+            }
+        }
+    } else {
+        report.objects_removed = remove_unlisted(target, manifest);
+    }
+
+    if (operation == "backup") {
+        std::ofstream file(target + "/" + kReportName, std::ios::trunc);
+        file << report.to_json() << "\n";
+    }
+    return report;
+}
+
+VaultBackup::Report VaultBackup::verify(const std::string& target) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    auto started = std::chrono::steady_clock::now();
+    Report report = begin("verify", target);
+
+    Manifest manifest;
+    if (!load_manifest(target, manifest)) {
+        report.errors.push_back(kManifestName + ": missing or unreadable");
+        finish(report, started);
+        return report;
+    }
+    counters_->objects_total = manifest.entries.size();
+
+    for (const auto& item : manifest.entries) {
+        if (stop_requested_) {
+            break;
+        }
+        counters_->objects_done++;
+        std::string sha256;
+        uint64_t bytes = 0;
+        if (!hash_file(target + "/" + item.first, sha256, bytes)) {
+            report.errors.push_back(item.first + ": unreadable");
+            continue;
+        }
+        report.objects++;
+        report.bytes_total += item.second.size;
+        report.bytes_copied += bytes;
+        if (static_cast<int64_t>(bytes) != item.second.size || sha256 != item.second.sha256) {
+            report.errors.push_back(item.first + ": checksum mismatch");
+        }
+    }
+
+    // Every object the snapshot refers to must be in the backup
+    std::vector<std::string> objects;
+    if (!Database::read_backup(target + "/" + kDatabaseName, objects)) {
+        report.errors.push_back(kDatabaseName + ": damaged");
+    }
+    for (const auto& name : objects) {
+        if (!manifest.entries.count(object_path(name))) {
+            report.missing.push_back(name);
+        }
+    }
+    if (!manifest.entries.count(kMasterKeyName)) {
+        report.errors.push_back(kMasterKeyName + ": not in the manifest");
+    }
+
+    report.complete = !stop_requested_;
+    finish(report, started);
+    return report;
+}
+
+VaultBackup::Report VaultBackup::restore(const std::string& target) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    auto started = std::chrono::steady_clock::now();
+    Report report = begin("restore", target);
+    const std::string& db_file = Config::instance().db_file();
+    const std::string& key_file = Config::instance().master_key_file();
+
+    struct stat st;
+    for (const auto& path : {db_file, key_file, key_file + ".next"}) {
+        if (stat(path.c_str(), &st) == 0) {
+            report.errors.push_back(path + ": already exists");
+        }
+    }
+    Manifest manifest;
+    std::vector<std::string> objects;
+    if (!load_manifest(target, manifest)) {
+        report.errors.push_back(kManifestName + ": missing or unreadable");
+    } else if (!Database::read_backup(target + "/" + kDatabaseName, objects)) {
+        report.errors.push_back(kDatabaseName + ": damaged");
+    }
+    if (!report.errors.empty()) {
+        finish(report, started);
+        return report;
+    }
+    counters_->objects_total = objects.size();
+
+    auto& layout = VaultLayout::instance();
+    for (const auto& name : objects) {
+        if (stop_requested_) {
+            break;
+        }
+        counters_->objects_done++;
+        std::string relative = object_path(name);
+        auto entry = manifest.entries.find(relative);
+        int in_fd = entry != manifest.entries.end() ? open((target + "/" + relative).c_str(), O_RDONLY | O_CLOEXEC) : -1;
+        if (in_fd < 0) {
+            report.missing.push_back(name);
+            continue;
+        }
+        report.objects++;
+        report.bytes_total += entry->second.size;
+
+        int out_fd = layout.open(name, O_WRONLY | O_CREAT | O_EXCL);
+        std::string sha256;
+        uint64_t bytes = 0;
+        bool ok = out_fd >= 0 && copy_fd(in_fd, out_fd, -1, sha256, bytes) && sha256 == entry->second.sha256;
+        close(in_fd);
+        if (out_fd >= 0) {
+            close(out_fd);
+        }
+        if (!ok) {
+            report.errors.push_back(relative + (out_fd < 0 ? ": cannot be created" : ": checksum mismatch"));
+            if (out_fd >= 0) {
+                unlink(layout.path(name).c_str());
+            }
+            continue;
+        }
+        report.objects_copied++;
+        report.bytes_copied += bytes;
+    }
+    if (stop_requested_ || !report.missing.empty() || !report.errors.empty() || !sync_filesystem(layout.root())) {
+        finish(report, started);
+        return report;
+    }
+
+    // The database goes last: a vault without one is not a vault yet. The
+    // next key is only in backups taken during a rotation
+    const std::pair<std::string, std::string> files[] = {
+        {kMasterKeyName, key_file}, {kNextKeyName, key_file + ".next"}, {kDatabaseName, db_file}};
+    for (const auto& file : files) {
+        auto entry = manifest.entries.find(file.first);
+        if (entry == manifest.entries.end() && file.first == kNextKeyName) {
+            continue;
+        }
+        int in_fd = entry != manifest.entries.end() ? open((target + "/" + file.first).c_str(), O_RDONLY | O_CLOEXEC) : -1;
+        std::string sha256;
+        uint64_t bytes = 0;
+        bool ok = in_fd >= 0 && make_dirs(parent_dir(file.second)) &&
+                  copy_to(in_fd, -1, file.second, sha256, bytes, entry->second.sha256);
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (!ok) {
+            report.errors.push_back(file.first + ": restore failed");
+            finish(report, started);
+            return report;
+        }
+        report.bytes_copied += bytes;
+        report.bytes_total += bytes;
+    }
+
+    report.complete = sync_filesystem(parent_dir(db_file));
+    finish(report, started);
+    return report;
+}
+
+bool VaultBackup::copy_fd(int in_fd, int out_fd, int64_t length, std::string& sha256, uint64_t& bytes) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> sha(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (!sha || EVP_DigestInit_ex(sha.get(), EVP_sha256(), nullptr) != 1) {
+        return false;
+    }
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<uint8_t> buffer(kCopyBlockSize);
+    bytes = 0;
+    while (length < 0 || bytes < static_cast<uint64_t>(length)) {
+        if (stop_requested_) {
+            return false;
+        }
+        size_t want = length < 0 ? buffer.size() : std::min<uint64_t>(buffer.size(), length - bytes);
+        ssize_t n = read(in_fd, buffer.data(), want);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || (n == 0 && length >= 0)) {
+            return false; // read error, or the source is shorter than it was
+        }
+        if (n == 0) {
+            break;
+        }
+        if (EVP_DigestUpdate(sha.get(), buffer.data(), n) != 1 || (out_fd >= 0 && !write_all(out_fd, buffer.data(), n))) {
+            return false;
+        }
+        bytes += n;
+        counters_->bytes_done += n;
+    }
+
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (EVP_DigestFinal_ex(sha.get(), digest, &digest_length) != 1) {
+        return false;
+    }
+    sha256 = codec::hex_encode(digest, digest_length);
+    return true;
+}
+
+bool VaultBackup::copy_to(int in_fd, int64_t length, const std::string& path, std::string& sha256, uint64_t& bytes,
+                          const std::string& expected) {
+    std::string part = path + ".part";
+    int out_fd = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out_fd < 0) {
+        std::cerr << "Cannot create " << part << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = copy_fd(in_fd, out_fd, length, sha256, bytes) && (expected.empty() || sha256 == expected);
+    ok = close(out_fd) == 0 && ok;
+    if (!ok || rename(part.c_str(), path.c_str()) != 0) {
+        unlink(part.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool VaultBackup::hash_file(const std::string& path, std::string& sha256, uint64_t& bytes) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = copy_fd(fd, -1, -1, sha256, bytes);
+    close(fd);
+    return ok;
+}
+
+bool VaultBackup::load_manifest(const std::string& target, Manifest& manifest) {
+    std::ifstream file(target + "/" + kManifestName);
+    std::string line;
+    if (!std::getline(file, line) || line != kManifestHeader) {
+        return false;
+    }
+
+    // "# full_seconds S", then one "sha256 size source_mtime path" per file
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        if (line.compare(0, 2, "# ") == 0) {
+            std::string hash, key;
+            if (fields >> hash >> key && key == "full_seconds") {
+                fields >> manifest.full_seconds;
+            }
+            continue;
+        }
+        Manifest::Entry entry;
+        std::string path;
+        if (!(fields >> entry.sha256 >> entry.size >> entry.source_mtime) || !std::getline(fields >> std::ws, path)) {
+            return false;
+        }
+        manifest.entries[path] = entry;
+    }
+    return true;
+}
+
+bool VaultBackup::save_manifest(const std::string& target, const Manifest& manifest) {
+    std::string path = target + "/" + kManifestName;
+    std::string tmp_path = path + ".part";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        file << kManifestHeader << "\n# full_seconds " << manifest.full_seconds << "\n";
+        for (const auto& item : manifest.entries) {
+            file << item.second.sha256 << " " << item.second.size << " " << item.second.source_mtime << " "
+                 << item.first << "\n";
+        }
+        if (!file.flush()) {
+            unlink(tmp_path.c_str());
+            return false;
+        }
+    }
+    int fd = open(tmp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return sync_filesystem(target);
+}
+
+uint64_t VaultBackup::remove_unlisted(const std::string& target, const Manifest& manifest) {
+    // Objects dropped from the vault since the last run, and copies left by
+    // a run that failed
+    uint64_t removed = 0;
+    std::string objects_dir = target + "/objects";
+    DIR* top = opendir(objects_dir.c_str());
+    if (!top) {
+        return 0;
+    }
+    while (struct dirent* shard = readdir(top)) {
+        if (shard->d_name[0] == '.') {
+            continue;
+        }
+        std::string shard_dir = objects_dir + "/" + shard->d_name;
+        DIR* dir = opendir(shard_dir.c_str());
+        if (!dir) {
+            continue;
+        }
+        while (struct dirent* de = readdir(dir)) {
+            if (de->d_name[0] == '.') {
+                continue;
+            }
+            std::string relative = std::string("objects/") + shard->d_name + "/" + de->d_name;
+            if (!manifest.entries.count(relative) && unlink((target + "/" + relative).c_str()) == 0) {
+                removed++;
+            }
+        }
+        closedir(dir);
+    }
+    closedir(top);
+    return removed;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,73 @@
+#include "chunker.h"
+#include <algorithm>
+#include <array>
+
+namespace vaultusb {
+
+namespace {
+
+// Fixed pseudo-random value per byte (splitmix64 from a constant seed).
+// Boundaries depend on it, so it must never change: stored chunks would no
+// longer line up with new ones.
+const std::array<uint64_t, 256>& gear_table() {
+    static const std::array<uint64_t, 256> table = []() {
+        std::array<uint64_t, 256> values {};
+        uint64_t state = 0x7661756c74757362ULL;
+        for (auto& value : values) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+        return values;
+    }();
+    return table;
+}
+
+// The hash shifts left once per byte, so its top bits cover the last 64
+// bytes; masks test those
+uint64_t top_bits(int bits) {
+    return bits <= 0 ? 0 : ~0ULL << (64 - bits);
+}
+
+} // namespace
+
+Chunker::Chunker(size_t average_size) {
+    int bits = 8;
+    while (bits < 30 && (size_t(1) << (bits + 1)) <= average_size) {
+        bits++;
+    }
+    average_size_ = size_t(1) << bits;
+    min_size_ = average_size_ / 4;
+    max_size_ = average_size_ * 4;
+    mask_small_ = top_bits(bits + 2);
+    mask_large_ = top_bits(bits - 2);
+}
+
+size_t Chunker::cut(const uint8_t* data, size_t length) const {
+    if (length <= min_size_) {
+        return length;
+    }
+    size_t end = std::min(length, max_size_);
+    size_t normal = std::min(end, average_size_);
+    const auto& gear = gear_table();
+
+    // The first min_size bytes can never end a chunk and are not hashed
+    uint64_t hash = 0;
+    size_t i = min_size_;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & mask_small_) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & mask_large_) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,150 @@
+#include "cipher.h"
+#include <algorithm>
+#include <stdexcept>
+#include <openssl/evp.h>
+#include <openssl/hkdf.h>
+
+namespace vaultusb {
+namespace cipher {
+
+namespace {
+
+constexpr size_t kTagSize = 16;
+constexpr size_t kEvpSlice = 1u << 30; // EVP update lengths are int
+
+} // namespace
+
+std::vector<uint8_t> encrypt_data(const std::vector<uint8_t>& data, const SecureBytes& key, const std::vector<uint8_t>& nonce) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    
+    if (EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Failed to initialize encryption");
+    }
+    
+    std::vector<uint8_t> ciphertext(data.size() + 16); // Extra space for tag
+    int len;
+    size_t ciphertext_len = 0;
+    
+    for (size_t done = 0; done < data.size(); done += kEvpSlice) {
+        int n = static_cast<int>(std::min(data.size() - done, kEvpSlice));
+        if (EVP_EncryptUpdate(ctx, ciphertext.data() + ciphertext_len, &len, data.data() + done, n) != 1) {
+            EVP_CIPHER_CTX_free(ctx);
+            throw std::runtime_error("Failed to encrypt data");
+        }
+        ciphertext_len += static_cast<size_t>(len);
+    }
+    
+    if (EVP_EncryptFinal_ex(ctx, ciphertext.data() + ciphertext_len, &len) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Failed to finalize encryption");
+    }
+    ciphertext_len += static_cast<size_t>(len);
+    
+    EVP_CIPHER_CTX_free(ctx);
+    ciphertext.resize(ciphertext_len);
+    return ciphertext;
+}
+
+std::vector<uint8_t> decrypt_data(const std::vector<uint8_t>& encrypted_data, const SecureBytes& key, const std::vector<uint8_t>& nonce) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    
+    if (EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Failed to initialize decryption");
+    }
+    
+    std::vector<uint8_t> plaintext(encrypted_data.size());
+    int len;
+    size_t plaintext_len = 0;
+    
+    for (size_t done = 0; done < encrypted_data.size(); done += kEvpSlice) {
+        int n = static_cast<int>(std::min(encrypted_data.size() - done, kEvpSlice));
+        if (EVP_DecryptUpdate(ctx, plaintext.data() + plaintext_len, &len, encrypted_data.data() + done, n) != 1) {
+            EVP_CIPHER_CTX_free(ctx);
+            throw std::runtime_error("Failed to decrypt data");
+        }
+        plaintext_len += static_cast<size_t>(len);
+    }
+    
+    if (EVP_DecryptFinal_ex(ctx, plaintext.data() + plaintext_len, &len) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Failed to finalize decryption");
+    }
+    plaintext_len += static_cast<size_t>(len);
+    
+    EVP_CIPHER_CTX_free(ctx);
+    plaintext.resize(plaintext_len);
+    return plaintext;
+}
+
+std::vector<uint8_t> aead_seal(const SecureBytes& plaintext, const SecureBytes& key,
+                               const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& aad) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    
+    std::vector<uint8_t> sealed(plaintext.size() + kTagSize);
+    int len = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) == 1 &&
+              (aad.empty() || EVP_EncryptUpdate(ctx, nullptr, &len, aad.data(), aad.size()) == 1) &&
+              EVP_EncryptUpdate(ctx, sealed.data(), &len, plaintext.data(), plaintext.size()) == 1 &&
+              EVP_EncryptFinal_ex(ctx, sealed.data() + len, &len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, kTagSize, sealed.data() + plaintext.size()) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    
+    if (!ok) {
+        throw std::runtime_error("Failed to encrypt data");
+    }
+    return sealed;
+}
+
+SecureBytes aead_open(const std::vector<uint8_t>& sealed, const SecureBytes& key,
+                      const std::vector<uint8_t>& nonce, const std::vector<uint8_t>& aad) {
+    if (sealed.size() < kTagSize) {
+        throw std::runtime_error("Ciphertext too short");
+    }
+    
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    
+    size_t cipher_len = sealed.size() - kTagSize;
+    SecureBytes plaintext(cipher_len);
+    int len = 0;
+    bool ok = EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) == 1 &&
+              (aad.empty() || EVP_DecryptUpdate(ctx, nullptr, &len, aad.data(), aad.size()) == 1) &&
+              EVP_DecryptUpdate(ctx, plaintext.data(), &len, sealed.data(), cipher_len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, kTagSize,
+                                  const_cast<uint8_t*>(sealed.data() + cipher_len)) == 1 &&
+              EVP_DecryptFinal_ex(ctx, plaintext.data() + len, &len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    
+    if (!ok) {
+        throw std::runtime_error("Authentication failed");
+    }
+    return plaintext;
+}
+
+SecureBytes hkdf_derive(const SecureBytes& key, const std::string& info, size_t length) {
+    SecureBytes derived_key(length);
+    
+    if (HKDF(derived_key.data(), length, EVP_sha256(), key.data(), key.size(),
+             reinterpret_cast<const uint8_t*>("vaultusb_file_key"), 16,
+             reinterpret_cast<const uint8_t*>(info.c_str()), info.length()) != 1) {
+        throw std::runtime_error("HKDF derivation failed");
+    }
+    
+    return derived_key;
+}
+
+} // namespace cipher
+} // namespace vaultusb
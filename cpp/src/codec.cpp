@@ -0,0 +1,232 @@
+#include "codec.h"
+#include <array>
+
+namespace vaultusb {
+namespace codec {
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+constexpr char kBase64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr uint8_t kInvalid = 0xFF;
+
+constexpr std::array<uint8_t, 256> make_hex_table() {
+    std::array<uint8_t, 256> table{};
+    for (auto& entry : table) entry = kInvalid;
+    for (int i = 0; i < 10; i++) table['0' + i] = static_cast<uint8_t>(i);
+    for (int i = 0; i < 6; i++) {
+        table['a' + i] = static_cast<uint8_t>(10 + i);
+        table['A' + i] = static_cast<uint8_t>(10 + i);
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> make_base64_table() {
+    std::array<uint8_t, 256> table{};
+    for (auto& entry : table) entry = kInvalid;
+    for (int i = 0; i < 64; i++) table[static_cast<uint8_t>(kBase64Chars[i])] = static_cast<uint8_t>(i);
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> kHexTable = make_hex_table();
+constexpr std::array<uint8_t, 256> kBase64Table = make_base64_table();
+
+// ASCII folding of U+00C0..U+017F; "" keeps the character
+const char* const kLatinFold[] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",  // U+00C0
+    "d", "n", "o", "o", "o", "o", "o", "", "o", "u", "u", "u", "u", "y", "th", "ss",  // U+00D0
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",  // U+00E0
+    "d", "n", "o", "o", "o", "o", "o", "", "o", "u", "u", "u", "u", "y", "th", "y",   // U+00F0
+    "a", "a", "a", "a", "a", "a", "c", "c", "c", "c", "c", "c", "c", "c", "d", "d",   // U+0100
+    "d", "d", "e", "e", "e", "e", "e", "e", "e", "e", "e", "e", "g", "g", "g", "g",   // U+0110
+    "g", "g", "g", "g", "h", "h", "h", "h", "i", "i", "i", "i", "i", "i", "i", "i",   // U+0120
+    "i", "i", "ij", "ij", "j", "j", "k", "k", "k", "l", "l", "l", "l", "l", "l", "l", // U+0130
+    "l", "l", "l", "n", "n", "n", "n", "n", "n", "n", "n", "n", "o", "o", "o", "o",   // U+0140
+    "o", "o", "oe", "oe", "r", "r", "r", "r", "r", "r", "s", "s", "s", "s", "s", "s", // U+0150
+    "s", "s", "t", "t", "t", "t", "t", "t", "u", "u", "u", "u", "u", "u", "u", "u",   // U+0160
+    "u", "u", "u", "u", "w", "w", "y", "y", "y", "z", "z", "z", "z", "z", "z", "s",   // U+0170
+};
+
+void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    }
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+}
+
+} // namespace
+
+std::string hex_encode(const uint8_t* data, size_t length) {
+    std::string out(length * 2, '\0');
+    for (size_t i = 0; i < length; i++) {
+        out[2 * i] = kHexDigits[data[i] >> 4];
+        out[2 * i + 1] = kHexDigits[data[i] & 0x0F];
+    }
+    return out;
+}
+
+std::string hex_encode(const std::vector<uint8_t>& data) {
+    return hex_encode(data.data(), data.size());
+}
+
+bool hex_decode(const std::string& text, std::vector<uint8_t>& out) {
+    if (text.length() % 2 != 0) {
+        return false;
+    }
+
+    out.resize(text.length() / 2);
+    for (size_t i = 0; i < out.size(); i++) {
+        uint8_t hi = kHexTable[static_cast<uint8_t>(text[2 * i])];
+        uint8_t lo = kHexTable[static_cast<uint8_t>(text[2 * i + 1])];
+        if (hi == kInvalid || lo == kInvalid) {
+            out.clear();
+            return false;
+        }
+        out[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+    return true;
+}
+
+std::string base64_encode(const uint8_t* data, size_t length, bool pad) {
+    std::string out;
+    out.reserve((length + 2) / 3 * 4);
+
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t v = (static_cast<uint32_t>(data[i]) << 16) | (static_cast<uint32_t>(data[i + 1]) << 8) | data[i + 2];
+        out += kBase64Chars[(v >> 18) & 0x3F];
+        out += kBase64Chars[(v >> 12) & 0x3F];
+        out += kBase64Chars[(v >> 6) & 0x3F];
+        out += kBase64Chars[v & 0x3F];
+    }
+
+    size_t rest = length - i;
+    if (rest > 0) {
+        uint32_t v = static_cast<uint32_t>(data[i]) << 16;
+        if (rest == 2) {
+            v |= static_cast<uint32_t>(data[i + 1]) << 8;
+        }
+        out += kBase64Chars[(v >> 18) & 0x3F];
+        out += kBase64Chars[(v >> 12) & 0x3F];
+        if (rest == 2) {
+            out += kBase64Chars[(v >> 6) & 0x3F];
+        }
+        if (pad) {
+            out.append(3 - rest, '=');
+        }
+    }
+    return out;
+}
+
+std::string base64_encode(const std::vector<uint8_t>& data, bool pad) {
+    return base64_encode(data.data(), data.size(), pad);
+}
+
+bool base64_decode(const std::string& text, std::vector<uint8_t>& out) {
+    size_t length = text.length();
+    while (length > 0 && text[length - 1] == '=') {
+        length--;
+    }
+    if (length % 4 == 1 || text.length() - length > 2) {
+        return false;
+    }
+
+    out.clear();
+    out.reserve(length * 3 / 4);
+
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t v = kBase64Table[static_cast<uint8_t>(text[i])];
+        if (v == kInvalid) {
+            out.clear();
+            return false;
+        }
+        buffer = (buffer << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<uint8_t>(buffer >> bits));
+        }
+    }
+    return true;
+}
+
+std::string json_escape(const std::string& text) {
+    std::string out;
+    out.reserve(text.length());
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<uint8_t>(c) < 0x20) {
+                    out += "\\u00";
+                    out += kHexDigits[(c >> 4) & 0x0F];
+                    out += kHexDigits[c & 0x0F];
+                } else {
+                    out += c;
+                }
+                break;
+        }
+    }
+    return out;
+}
+
+std::string fold_text(const std::string& text) {
+    std::string out;
+    out.reserve(text.length());
+    size_t i = 0;
+    while (i < text.length()) {
+        uint8_t c = static_cast<uint8_t>(text[i]);
+        if (c < 0x80) {
+            out += static_cast<char>(c >= 'A' && c <= 'Z' ? c + 32 : c);
+            i++;
+            continue;
+        }
+
+        // Decode one sequence; malformed bytes are kept as they are
+        size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        uint32_t cp = length == 4 ? c & 0x07 : length == 3 ? c & 0x0F : c & 0x1F;
+        bool valid = length > 1 && i + length <= text.length();
+        for (size_t k = 1; valid && k < length; k++) {
+            uint8_t next = static_cast<uint8_t>(text[i + k]);
+            valid = (next & 0xC0) == 0x80;
+            cp = (cp << 6) | (next & 0x3F);
+        }
+        if (!valid) {
+            out += static_cast<char>(c);
+            i++;
+            continue;
+        }
+        i += length;
+
+        if (cp >= 0x300 && cp <= 0x36F) {
+            continue; // combining diacritical marks
+        }
+        if (cp >= 0xC0 && cp <= 0x17F && kLatinFold[cp - 0xC0][0] != '\0') {
+            out += kLatinFold[cp - 0xC0];
+            continue;
+        }
+        if ((cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) || (cp >= 0x410 && cp <= 0x42F)) {
+            cp += 0x20; // Greek and Cyrillic capitals
+        } else if (cp >= 0x400 && cp <= 0x40F) {
+            cp += 0x50;
+        }
+        append_utf8(out, cp);
+    }
+    return out;
+}
+
+} // namespace codec
+} // namespace vaultusb
@@ -0,0 +1,130 @@
+#include "compression.h"
+#include <algorithm>
+#include <cmath>
+#include <zlib.h>
+#ifdef VAULTUSB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace vaultusb {
+namespace compression {
+
+namespace {
+
+constexpr int kZlibDefaultLevel = 1; // Z_BEST_SPEED: the Pi's CPU is the bottleneck, not the card
+constexpr int kZstdDefaultLevel = 3;
+constexpr size_t kEntropyWindows = 8;
+constexpr size_t kEntropyWindowSize = 512;
+
+bool has_prefix(const std::string& text, const char* prefix) {
+    return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+} // namespace
+
+bool available(Codec codec) {
+    switch (codec) {
+        case Codec::None:
+        case Codec::Zlib:
+            return true;
+        case Codec::Zstd:
+#ifdef VAULTUSB_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char* name(Codec codec) {
+    switch (codec) {
+        case Codec::None: return "none";
+        case Codec::Zlib: return "zlib";
+        case Codec::Zstd: return "zstd";
+    }
+    return "unknown";
+}
+
+Codec from_name(const std::string& name) {
+    if (name == "zstd" && available(Codec::Zstd)) return Codec::Zstd;
+    if (name == "zlib" || name == "zstd") return Codec::Zlib;
+    if (name == "auto") return available(Codec::Zstd) ? Codec::Zstd : Codec::Zlib;
+    return Codec::None;
+}
+
+bool compressible_mime(const std::string& mime_type) {
+    if (mime_type == "image/svg+xml" || mime_type == "image/bmp" || mime_type == "audio/wav") {
+        return true;
+    }
+    if (has_prefix(mime_type, "image/") || has_prefix(mime_type, "video/") || has_prefix(mime_type, "audio/")) {
+        return false;
+    }
+    // Archives, and office formats that are zip containers underneath
+    return mime_type != "application/zip" && mime_type != "application/gzip" &&
+           mime_type != "application/x-7z-compressed" && mime_type != "application/x-xz" &&
+           mime_type != "application/zstd" && !has_prefix(mime_type, "application/vnd.openxmlformats") &&
+           !has_prefix(mime_type, "application/vnd.oasis.opendocument");
+}
+
+double sample_entropy(const uint8_t* data, size_t length) {
+    if (length == 0) {
+        return 0.0;
+    }
+
+    uint32_t counts[256] = {0};
+    size_t sampled = 0;
+    if (length <= kEntropyWindows * kEntropyWindowSize) {
+        for (size_t i = 0; i < length; i++) counts[data[i]]++;
+        sampled = length;
+    } else {
+        size_t stride = (length - kEntropyWindowSize) / (kEntropyWindows - 1);
+        for (size_t w = 0; w < kEntropyWindows; w++) {
+            const uint8_t* window = data + w * stride;
+            for (size_t i = 0; i < kEntropyWindowSize; i++) counts[window[i]]++;
+        }
+        sampled = kEntropyWindows * kEntropyWindowSize;
+    }
+
+    double entropy = 0.0;
+    for (uint32_t count : counts) {
+        if (count > 0) {
+            double p = static_cast<double>(count) / sampled;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+size_t compress(Codec codec, int level, const uint8_t* data, size_t length, uint8_t* out, size_t capacity) {
+    if (codec == Codec::Zlib) {
+        uLongf out_len = capacity;
+        int rc = compress2(out, &out_len, data, length, level > 0 ? std::min(level, 9) : kZlibDefaultLevel);
+        return rc == Z_OK ? static_cast<size_t>(out_len) : 0;
+    }
+#ifdef VAULTUSB_HAVE_ZSTD
+    if (codec == Codec::Zstd) {
+        size_t out_len = ZSTD_compress(out, capacity, data, length, level > 0 ? level : kZstdDefaultLevel);
+        return ZSTD_isError(out_len) ? 0 : out_len;
+    }
+#endif
+    return 0;
+}
+
+ssize_t decompress(Codec codec, const uint8_t* data, size_t length, uint8_t* out, size_t capacity) {
+    if (codec == Codec::Zlib) {
+        uLongf out_len = capacity;
+        int rc = uncompress(out, &out_len, data, length);
+        return rc == Z_OK ? static_cast<ssize_t>(out_len) : -1;
+    }
+#ifdef VAULTUSB_HAVE_ZSTD
+    if (codec == Codec::Zstd) {
+        size_t out_len = ZSTD_decompress(out, capacity, data, length);
+        return ZSTD_isError(out_len) ? -1 : static_cast<ssize_t>(out_len);
+    }
+#endif
+    return -1;
+}
+
+} // namespace compression
+} // namespace vaultusb
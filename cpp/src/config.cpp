@@ -70,6 +70,7 @@ void Config::load_from_file(const std::string& config_file) {
     host_ = get_value("app.host", host_);
     port_ = get_int_value("app.port", port_);
     secret_key_ = get_value("app.secret_key", secret_key_);
+    http_workers_ = get_int_value("app.http_workers", http_workers_);
     
     usb0_ip_ = get_value("networking.usb0_ip", usb0_ip_);
     usb0_netmask_ = get_value("networking.usb0_netmask", usb0_netmask_);
@@ -87,7 +88,38 @@ void Config::load_from_file(const std::string& config_file) {
     argon2_time_cost_ = get_int_value("security.argon2_time_cost", argon2_time_cost_);
     argon2_memory_cost_ = get_int_value("security.argon2_memory_cost", argon2_memory_cost_);
     argon2_parallelism_ = get_int_value("security.argon2_parallelism", argon2_parallelism_);
+    argon2_max_concurrency_ = get_int_value("security.argon2_max_concurrency", argon2_max_concurrency_);
+    argon2_huge_pages_ = get_bool_value("security.argon2_huge_pages", argon2_huge_pages_);
+    kdf_memory_budget_ = get_int_value("security.kdf_memory_budget", kdf_memory_budget_);
+    kdf_queue_depth_ = get_int_value("security.kdf_queue_depth", kdf_queue_depth_);
     file_key_size_ = get_int_value("security.file_key_size", file_key_size_);
+    secure_arena_size_ = get_int_value("security.secure_arena_size", secure_arena_size_);
+    
+    pipeline_block_size_ = get_int_value("storage.pipeline_block_size", pipeline_block_size_);
+    pipeline_depth_ = get_int_value("storage.pipeline_depth", pipeline_depth_);
+    shred_mode_ = get_value("storage.shred_mode", shred_mode_);
+    shred_rate_limit_ = get_int_value("storage.shred_rate_limit", shred_rate_limit_);
+    dedup_enabled_ = get_bool_value("storage.dedup", dedup_enabled_);
+    compression_ = get_value("storage.compression", compression_);
+    compression_level_ = get_int_value("storage.compression_level", compression_level_);
+    check_threads_ = get_int_value("storage.check_threads", check_threads_);
+    check_rate_limit_ = get_int_value("storage.check_rate_limit", check_rate_limit_);
+    check_interval_ = get_int_value("storage.check_interval", check_interval_);
+    check_report_ = get_value("storage.check_report", check_report_);
+    vault_fanout_ = get_int_value("storage.vault_fanout", vault_fanout_);
+    pack_threshold_ = get_int_value("storage.pack_threshold", pack_threshold_);
+    pack_segment_size_ = get_int_value("storage.pack_segment_size", pack_segment_size_);
+    pack_compact_threshold_ = get_int_value("storage.pack_compact_threshold", pack_compact_threshold_);
+    default_quota_ = get_int_value("storage.default_quota", default_quota_);
+    trash_retention_ = get_int_value("storage.trash_retention", trash_retention_);
+    upload_chunk_size_ = get_int_value("storage.upload_chunk_size", upload_chunk_size_);
+    upload_expiry_ = get_int_value("storage.upload_expiry", upload_expiry_);
+    version_chunk_size_ = get_int_value("storage.version_chunk_size", version_chunk_size_);
+    version_retention_ = get_int_value("storage.version_retention", version_retention_);
+    version_max_age_ = get_int_value("storage.version_max_age", version_max_age_);
+    backup_dir_ = get_value("storage.backup_dir", backup_dir_);
+    mirror_dir_ = get_value("storage.mirror_dir", mirror_dir_);
+    mirror_interval_ = get_int_value("storage.mirror_interval", mirror_interval_);
     
     tls_enabled_ = get_bool_value("tls.enabled", tls_enabled_);
     cert_file_ = get_value("tls.cert_file", cert_file_);
@@ -1,18 +1,337 @@
 #include "crypto.h"
+#include "cipher.h"
 #include "config.h"
+#include "argon2_pool.h"
+#include "kdf_executor.h"
+#include "codec.h"
+#include "shredder.h"
+#include "key_migrator.h"
 #include <iostream>
-#include <fstream>
-#include <random>
 #include <sstream>
-#include <iomanip>
+#include <random>
 #include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 #include <openssl/evp.h>
-#include <openssl/hkdf.h>
 #include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
 #include <argon2.h>
 
 namespace vaultusb {
 
+namespace {
+
+// Chunked stream format:
+//   header: magic(4) version(1) codec(1) reserved(2) chunk_size(4, BE) nonce(12)
+//   frames: length(4, BE) ciphertext tag(16)
+// Each frame is sealed with nonce = base_nonce XOR index and
+// AAD = header || index(8, BE) || last(1), so reordering, truncation and
+// header tampering all fail authentication.
+// With a codec in the header every chunk's plaintext starts with a flag
+// byte: 0 = stored raw, 1 = compressed with that codec.
+constexpr uint8_t kStreamMagic[4] = {'V', 'U', 'S', '2'};
+constexpr uint8_t kStreamVersion = 1;
+constexpr size_t kStreamHeaderSize = 24;
+constexpr size_t kStreamNonceSize = 12;
+constexpr size_t kTagSize = 16;
+constexpr size_t kFrameLengthSize = 4;
+constexpr size_t kMaxStreamChunkSize = 16 * 1024 * 1024;
+constexpr size_t kChunkFlagSize = 1;
+constexpr uint8_t kChunkRaw = 0;
+constexpr uint8_t kChunkCompressed = 1;
+constexpr double kMaxCompressibleEntropy = 7.5; // bits per byte
+
+void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t get_u32(const uint8_t* in) {
+    return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+           (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+// Reads until the buffer is full or the source is exhausted
+ssize_t read_full(const ByteSource& source, uint8_t* buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = source(buffer + total, length - total);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return static_cast<ssize_t>(total);
+}
+
+void chunk_nonce(const uint8_t* header, uint64_t index, uint8_t* nonce) {
+    std::memcpy(nonce, header + kStreamHeaderSize - kStreamNonceSize, kStreamNonceSize);
+    for (int i = 0; i < 8; i++) {
+        nonce[kStreamNonceSize - 1 - i] ^= static_cast<uint8_t>(index >> (8 * i));
+    }
+}
+
+void chunk_aad(const uint8_t* header, uint64_t index, bool last, uint8_t* aad) {
+    std::memcpy(aad, header, kStreamHeaderSize);
+    for (int i = 0; i < 8; i++) {
+        aad[kStreamHeaderSize + i] = static_cast<uint8_t>(index >> (56 - 8 * i));
+    }
+    aad[kStreamHeaderSize + 8] = last ? 1 : 0;
+}
+
+// Seals data in place and writes the tag directly after it
+bool seal_chunk(EVP_CIPHER_CTX* ctx, const uint8_t* key, const uint8_t* header,
+                uint64_t index, bool last, uint8_t* data, size_t length) {
+    uint8_t nonce[kStreamNonceSize];
+    uint8_t aad[kStreamHeaderSize + 9];
+    chunk_nonce(header, index, nonce);
+    chunk_aad(header, index, last, aad);
+
+    int len = 0;
+    if (EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, nullptr, &len, aad, sizeof(aad)) != 1 ||
+        EVP_EncryptUpdate(ctx, data, &len, data, static_cast<int>(length)) != 1 ||
+        EVP_EncryptFinal_ex(ctx, data + len, &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, kTagSize, data + length) != 1) {
+        return false;
+    }
+    return true;
+}
+
+// Opens data in place; the tag is expected directly after the ciphertext
+bool open_chunk(EVP_CIPHER_CTX* ctx, const uint8_t* key, const uint8_t* header,
+                uint64_t index, bool last, uint8_t* data, size_t length) {
+    uint8_t nonce[kStreamNonceSize];
+    uint8_t aad[kStreamHeaderSize + 9];
+    chunk_nonce(header, index, nonce);
+    chunk_aad(header, index, last, aad);
+
+    int len = 0;
+    if (EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, nullptr, &len, aad, sizeof(aad)) != 1 ||
+        EVP_DecryptUpdate(ctx, data, &len, data, static_cast<int>(length)) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, kTagSize, data + length) != 1 ||
+        EVP_DecryptFinal_ex(ctx, data + len, &len) != 1) {
+        return false;
+    }
+    return true;
+}
+
+// Compresses (with a codec) and seals the chunk in frame, laid out as
+// length(4) || [flag(1)] || plaintext(length) with room for the tag behind
+// it; returns the finished frame size, 0 on failure
+size_t seal_frame(EVP_CIPHER_CTX* ctx, const uint8_t* key, const uint8_t* header, uint64_t index, bool last,
+                  compression::Codec codec, int level, uint8_t* frame, size_t length, uint8_t* scratch) {
+    if (codec != compression::Codec::None) {
+        // Only keep the compressed form when it is strictly smaller
+        uint8_t* body = frame + kFrameLengthSize + kChunkFlagSize;
+        frame[kFrameLengthSize] = kChunkRaw;
+        if (length > 1 && compression::sample_entropy(body, length) < kMaxCompressibleEntropy) {
+            size_t packed = compression::compress(codec, level, body, length, scratch, length - 1);
+            if (packed > 0) {
+                std::memcpy(body, scratch, packed);
+                frame[kFrameLengthSize] = kChunkCompressed;
+                length = packed;
+            }
+        }
+        length += kChunkFlagSize;
+    }
+    
+    if (!seal_chunk(ctx, key, header, index, last, frame + kFrameLengthSize, length)) {
+        return 0;
+    }
+    put_u32(frame, static_cast<uint32_t>(length + kTagSize));
+    return length + kFrameLengthSize + kTagSize;
+}
+
+bool is_stream_header(const uint8_t* header) {
+    if (std::memcmp(header, kStreamMagic, sizeof(kStreamMagic)) != 0 || header[4] != kStreamVersion) {
+        return false;
+    }
+    uint32_t chunk_size = get_u32(header + 8);
+    return chunk_size > 0 && chunk_size <= kMaxStreamChunkSize;
+}
+
+// Sealed master key envelope:
+//   magic(4) version(1) kdf(1) reserved(2) t_cost(4) m_cost(4) parallelism(4)
+//   salt_len(1) nonce_len(1) reserved(2) || salt || nonce || ciphertext || tag(16)
+// The 24-byte header is authenticated as AAD so parameters cannot be downgraded.
+constexpr uint8_t kEnvelopeMagic[4] = {'V', 'U', 'M', 'K'};
+constexpr uint8_t kEnvelopeVersion = 1;
+constexpr size_t kEnvelopeHeaderSize = 24;
+constexpr uint8_t kKdfArgon2id = 1;
+constexpr uint8_t kKdfArgon2i = 2;
+
+struct Envelope {
+    int type = Argon2_id;
+    KdfParams params;
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> salt;
+    std::vector<uint8_t> nonce;
+    std::vector<uint8_t> sealed; // ciphertext || tag
+};
+
+bool parse_envelope(const std::string& data, Envelope& envelope) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+    if (data.size() < kEnvelopeHeaderSize || std::memcmp(p, kEnvelopeMagic, 4) != 0 || p[4] != kEnvelopeVersion) {
+        return false;
+    }
+
+    if (p[5] == kKdfArgon2id) {
+        envelope.type = Argon2_id;
+    } else if (p[5] == kKdfArgon2i) {
+        envelope.type = Argon2_i;
+    } else {
+        return false;
+    }
+
+    envelope.params.time_cost = get_u32(p + 8);
+    envelope.params.memory_cost = get_u32(p + 12);
+    envelope.params.parallelism = get_u32(p + 16);
+    size_t salt_len = p[20];
+    size_t nonce_len = p[21];
+    if (nonce_len != kStreamNonceSize || data.size() < kEnvelopeHeaderSize + salt_len + nonce_len + kTagSize) {
+        return false;
+    }
+
+    const uint8_t* body = p + kEnvelopeHeaderSize;
+    envelope.header.assign(p, p + kEnvelopeHeaderSize);
+    envelope.salt.assign(body, body + salt_len);
+    envelope.nonce.assign(body + salt_len, body + salt_len + nonce_len);
+    envelope.sealed.assign(body + salt_len + nonce_len, p + data.size());
+    return true;
+}
+
+bool read_file(const std::string& path, std::string& data) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    data.clear();
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<size_t>(n));
+    }
+    close(fd);
+    return n == 0;
+}
+
+// Wrapped data keys are bound to their file id
+std::vector<uint8_t> file_key_aad(const std::string& file_id) {
+    static const std::string prefix = "vaultusb-file-key:";
+    std::vector<uint8_t> aad(prefix.begin(), prefix.end());
+    aad.insert(aad.end(), file_id.begin(), file_id.end());
+    return aad;
+}
+
+// Write to a temporary file, fsync, then rename over the target
+bool write_file_atomic(const std::string& path, const std::string& data) {
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    const char* p = data.data();
+    size_t remaining = data.size();
+    bool ok = true;
+    while (remaining > 0) {
+        ssize_t n = write(fd, p, remaining);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        p += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // Persist the rename itself
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+// Extracts a string or integer value from the legacy sealed-key JSON
+std::string json_field(const std::string& json, const std::string& key) {
+    std::string needle = "\"" + key + "\":";
+    size_t pos = json.find(needle);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += needle.length();
+    if (pos < json.length() && json[pos] == '"') {
+        size_t end = json.find('"', pos + 1);
+        return end == std::string::npos ? "" : json.substr(pos + 1, end - pos - 1);
+    }
+    size_t end = json.find_first_of(",}", pos);
+    return json.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+// Parses "$argon2id$v=19$m=65536,t=3,p=1$<salt>$<hash>"
+bool parse_phc(const std::string& phc, argon2_type& type, KdfParams& params,
+               std::vector<uint8_t>& salt, std::vector<uint8_t>& hash) {
+    std::vector<std::string> fields;
+    std::istringstream iss(phc);
+    std::string field;
+    while (std::getline(iss, field, '$')) {
+        fields.push_back(field);
+    }
+    if (fields.size() != 6 || !fields[0].empty()) {
+        return false;
+    }
+
+    if (fields[1] == "argon2id") {
+        type = Argon2_id;
+    } else if (fields[1] == "argon2i") {
+        type = Argon2_i;
+    } else {
+        return false;
+    }
+
+    if (fields[2] != "v=19") {
+        return false;
+    }
+
+    unsigned long m = 0, t = 0, p = 0;
+    if (std::sscanf(fields[3].c_str(), "m=%lu,t=%lu,p=%lu", &m, &t, &p) != 3 || m == 0 || t == 0 || p == 0) {
+        return false;
+    }
+    params.memory_cost = static_cast<uint32_t>(m);
+    params.time_cost = static_cast<uint32_t>(t);
+    params.parallelism = static_cast<uint32_t>(p);
+
+    return codec::base64_decode(fields[4], salt) && codec::base64_decode(fields[5], hash) &&
+           !salt.empty() && !hash.empty();
+}
+
+} // namespace
+
 CryptoManager& CryptoManager::instance() {
     static CryptoManager instance;
     return instance;
@@ -25,80 +344,181 @@ CryptoManager::CryptoManager() {
     argon2_memory_cost_ = Config::instance().argon2_memory_cost();
     argon2_parallelism_ = Config::instance().argon2_parallelism();
     file_key_size_ = Config::instance().file_key_size();
+    stream_chunk_size_ = std::min<size_t>(std::max(Config::instance().pipeline_block_size(), 4096), kMaxStreamChunkSize);
+    stream_depth_ = std::max(Config::instance().pipeline_depth(), 2);
+    compression_level_ = Config::instance().compression_level();
+    
+    // Reserve Argon2 working memory once instead of per hash
+    Argon2MemoryPool::instance().initialize(
+        static_cast<size_t>(kdf_policy().memory_cost) * 1024,
+        kdf_concurrency(),
+        Config::instance().argon2_huge_pages());
 }
 
-std::vector<uint8_t> CryptoManager::generate_master_key() {
-    std::vector<uint8_t> key(32);
+SecureBytes CryptoManager::generate_master_key() {
+    SecureBytes key(32);
     RAND_bytes(key.data(), key.size());
     return key;
 }
 
-std::string CryptoManager::seal_master_key(const std::vector<uint8_t>& master_key, const std::string& password) {
+std::string CryptoManager::seal_master_key(const SecureBytes& master_key, const std::string& password) {
+    KdfParams params = kdf_policy();
     auto salt = generate_salt();
-    auto derived_key = derive_key_from_password(password, salt);
+    auto derived_key = derive_key_from_password(password, salt, Argon2_id, params);
     auto nonce = generate_nonce();
     
-    auto encrypted = encrypt_data(master_key, derived_key, nonce);
+    std::string envelope(kEnvelopeHeaderSize, '\0');
+    uint8_t* header = reinterpret_cast<uint8_t*>(&envelope[0]);
+    std::memcpy(header, kEnvelopeMagic, sizeof(kEnvelopeMagic));
+    header[4] = kEnvelopeVersion;
+    header[5] = kKdfArgon2id;
+    put_u32(header + 8, params.time_cost);
+    put_u32(header + 12, params.memory_cost);
+    put_u32(header + 16, params.parallelism);
+    header[20] = static_cast<uint8_t>(salt.size());
+    header[21] = static_cast<uint8_t>(nonce.size());
     
-    // Simple JSON-like format
-    std::ostringstream json;
-    json << "{\"salt\":\"";
-    for (auto b : salt) json << std::hex << std::setw(2) << std::setfill('0') << (int)b;
-    json << "\",\"nonce\":\"";
-    for (auto b : nonce) json << std::hex << std::setw(2) << std::setfill('0') << (int)b;
-    json << "\",\"data\":\"";
-    for (auto b : encrypted) json << std::hex << std::setw(2) << std::setfill('0') << (int)b;
-    json << "\"}";
+    std::vector<uint8_t> aad(header, header + kEnvelopeHeaderSize);
+    auto sealed = cipher::aead_seal(master_key, derived_key, nonce, aad);
     
-    return json.str();
+    envelope.append(salt.begin(), salt.end());
+    envelope.append(nonce.begin(), nonce.end());
+    envelope.append(sealed.begin(), sealed.end());
+    return envelope;
 }
 
-std::vector<uint8_t> CryptoManager::unseal_master_key(const std::string& sealed_data, const std::string& password) {
-    // Simple JSON parsing (in production, use a proper JSON library)
-    std::string salt_hex, nonce_hex, data_hex;
-    
-    // Extract hex strings from JSON
-    size_t salt_start = sealed_data.find("\"salt\":\"") + 8;
-    size_t salt_end = sealed_data.find("\"", salt_start);
-    salt_hex = sealed_data.substr(salt_start, salt_end - salt_start);
-    
-    size_t nonce_start = sealed_data.find("\"nonce\":\"") + 9;
-    size_t nonce_end = sealed_data.find("\"", nonce_start);
-    nonce_hex = sealed_data.substr(nonce_start, nonce_end - nonce_start);
+SecureBytes CryptoManager::unseal_master_key(const std::string& sealed_data, const std::string& password) {
+    Envelope envelope;
+    if (parse_envelope(sealed_data, envelope)) {
+        auto derived_key = derive_key_from_password(password, envelope.salt, envelope.type, envelope.params);
+        return cipher::aead_open(envelope.sealed, derived_key, envelope.nonce, envelope.header);
+    }
     
-    size_t data_start = sealed_data.find("\"data\":\"") + 8;
-    size_t data_end = sealed_data.find("\"", data_start);
-    data_hex = sealed_data.substr(data_start, data_end - data_start);
+    // Legacy JSON-like format (unauthenticated ciphertext)
+    auto salt = hex_to_bytes(json_field(sealed_data, "salt"));
+    auto nonce = hex_to_bytes(json_field(sealed_data, "nonce"));
+    auto encrypted = hex_to_bytes(json_field(sealed_data, "data"));
     
-    // Convert hex to bytes
-    auto salt = hex_to_bytes(salt_hex);
-    auto nonce = hex_to_bytes(nonce_hex);
-    auto encrypted = hex_to_bytes(data_hex);
+    // Keys sealed before parameters were recorded used Argon2i at the configured cost
+    int type = Argon2_i;
+    KdfParams params = kdf_policy();
+    if (json_field(sealed_data, "kdf") == "argon2id") {
+        type = Argon2_id;
+        params.time_cost = std::stoul(json_field(sealed_data, "t"));
+        params.memory_cost = std::stoul(json_field(sealed_data, "m"));
+        params.parallelism = std::stoul(json_field(sealed_data, "p"));
+    }
     
-    auto derived_key = derive_key_from_password(password, salt);
-    return decrypt_data(encrypted, derived_key, nonce);
+    auto derived_key = derive_key_from_password(password, salt, type, params);
+    auto plain = cipher::decrypt_data(encrypted, derived_key, nonce);
+    SecureBytes master_key(plain.begin(), plain.end());
+    OPENSSL_cleanse(plain.data(), plain.size());
+    return master_key;
 }
 
 bool CryptoManager::load_master_key(const std::string& password) {
-    std::ifstream file(master_key_file_);
-    if (!file.is_open()) {
+    // Unlocking again would swap the active key for whatever this password unseals
+    if (is_unlocked_) {
         return false;
     }
     
-    std::string sealed_data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
+    std::string sealed_data;
+    if (!read_file(master_key_file_, sealed_data)) {
+        return false;
+    }
     
+    SecureBytes master_key;
     try {
-        master_key_ = unseal_master_key(sealed_data, password);
-        is_unlocked_ = true;
-        return true;
+        master_key = unseal_master_key(sealed_data, password);
     } catch (const std::exception& e) {
         std::cerr << "Failed to load master key: " << e.what() << std::endl;
         return false;
     }
+    
+    // An interrupted rotation left the next key behind: keep rewrapping towards it
+    SecureBytes next_key;
+    std::string next_sealed;
+    if (read_file(master_key_file_ + ".next", next_sealed)) {
+        try {
+            next_key = unseal_master_key(next_sealed, password);
+        } catch (const std::exception& e) {
+            std::cerr << "Ignoring unreadable pending master key: " << e.what() << std::endl;
+        }
+    }
+    
+    // Legacy envelopes carry no tag, so a wrong password is undetectable from
+    // the file alone: check the key against the vault before it is installed
+    Envelope envelope;
+    bool is_envelope = parse_envelope(sealed_data, envelope);
+    bool confirmed = is_envelope;
+    if (!is_envelope) {
+        auto confirmation = KeyMigrator::instance().confirm_master_key(master_key, !next_key.empty());
+        if (confirmation == KeyMigrator::Confirmation::Rejected) {
+            return false;
+        }
+        confirmed = confirmation == KeyMigrator::Confirmation::Confirmed;
+    }
+    
+    // Upgrade the envelope when it is legacy or sealed below the current policy
+    if (confirmed && (!is_envelope || envelope.type != Argon2_id || params_below_policy(envelope.params))) {
+        if (!save_master_key(master_key, password)) {
+            std::cerr << "Failed to reseal master key with current KDF policy" << std::endl;
+        }
+    }
+    
+    uint32_t key_id = key_id_for(master_key);
+    uint32_t next_id = next_key.empty() ? 0 : key_id_for(next_key);
+    
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    if (is_unlocked_) {
+        return false; // a concurrent unlock got there first
+    }
+    master_key_ = std::move(master_key);
+    master_key_id_ = key_id;
+    next_master_key_ = std::move(next_key);
+    next_key_id_ = next_id;
+    master_key_confirmed_ = confirmed;
+    is_unlocked_ = true;
+    return true;
+}
+
+bool CryptoManager::authenticate_legacy_object(const SecureBytes& master_key, int fd, int64_t offset,
+                                               int64_t length, const std::string& file_id) {
+    uint8_t header[kStreamHeaderSize + kFrameLengthSize];
+    if (length < static_cast<int64_t>(sizeof(header)) ||
+        pread(fd, header, sizeof(header), offset) != static_cast<ssize_t>(sizeof(header)) ||
+        !is_stream_header(header)) {
+        return false;
+    }
+    
+    // One authenticated frame is proof enough
+    size_t frame_len = get_u32(header + kStreamHeaderSize);
+    int64_t frame_end = static_cast<int64_t>(sizeof(header) + frame_len);
+    if (frame_len < kTagSize || frame_len > get_u32(header + 8) + kChunkFlagSize + kTagSize || frame_end > length) {
+        return false;
+    }
+    std::vector<uint8_t> frame(frame_len);
+    if (pread(fd, frame.data(), frame_len, offset + static_cast<int64_t>(sizeof(header))) !=
+        static_cast<ssize_t>(frame_len)) {
+        return false;
+    }
+    
+    auto file_key = cipher::hkdf_derive(master_key, file_id, file_key_size_);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    bool ok = open_chunk(ctx, file_key.data(), header, 0, frame_end == length, frame.data(), frame_len - kTagSize);
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(frame.data(), frame.size());
+    return ok;
+}
+
+std::future<bool> CryptoManager::load_master_key_async(const std::string& password) {
+    return KdfExecutor::instance().submit([this, password]() { return load_master_key(password); });
 }
 
-bool CryptoManager::save_master_key(const std::vector<uint8_t>& master_key, const std::string& password) {
+bool CryptoManager::save_master_key(const SecureBytes& master_key, const std::string& password) {
     try {
         std::string sealed_data = seal_master_key(master_key, password);
         
@@ -106,266 +526,726 @@ bool CryptoManager::save_master_key(const std::vector<uint8_t>& master_key, cons
         std::string dir = master_key_file_.substr(0, master_key_file_.find_last_of('/'));
         system(("mkdir -p " + dir).c_str());
         
-        std::ofstream file(master_key_file_);
-        if (!file.is_open()) {
-            return false;
-        }
-        
-        file << sealed_data;
-        file.close();
-        
-        return true;
+        return write_file_atomic(master_key_file_, sealed_data);
     } catch (const std::exception& e) {
         std::cerr << "Failed to save master key: " << e.what() << std::endl;
         return false;
     }
 }
 
-std::vector<uint8_t> CryptoManager::derive_file_key(const std::string& file_id) {
+SecureBytes CryptoManager::generate_file_key() {
+    SecureBytes key(file_key_size_);
+    if (RAND_bytes(key.data(), key.size()) != 1) {
+        throw std::runtime_error("Failed to generate file key");
+    }
+    return key;
+}
+
+std::string CryptoManager::wrap_file_key(const SecureBytes& file_key, const std::string& file_id,
+                                         uint32_t& key_id) {
+    // New wraps always use the newest master key
+    std::unique_lock<std::mutex> lock(key_mutex_);
     if (!is_unlocked_ || master_key_.empty()) {
         throw std::runtime_error("Master key not unlocked");
     }
+    // An unconfirmed key may be garbage from a wrong password, and a key
+    // wrapped under it would be lost on the next unlock with the right one
+    if (!master_key_confirmed_) {
+        throw std::runtime_error("Master key sealed in the legacy format is not confirmed yet");
+    }
+    bool rotating = !next_master_key_.empty();
+    SecureBytes master_key = rotating ? next_master_key_ : master_key_;
+    key_id = rotating ? next_key_id_ : master_key_id_;
+    lock.unlock();
     
-    return hkdf_derive(master_key_, file_id, file_key_size_);
+    auto nonce = generate_nonce();
+    auto sealed = cipher::aead_seal(file_key, master_key, nonce, file_key_aad(file_id));
+    nonce.insert(nonce.end(), sealed.begin(), sealed.end());
+    return bytes_to_hex(nonce);
 }
 
-bool CryptoManager::encrypt_file(const std::string& file_path, const std::string& file_id) {
+SecureBytes CryptoManager::unwrap_file_key(const std::string& wrapped_key, const std::string& file_id,
+                                           uint32_t key_id) {
+    std::unique_lock<std::mutex> lock(key_mutex_);
     if (!is_unlocked_ || master_key_.empty()) {
         throw std::runtime_error("Master key not unlocked");
     }
+    SecureBytes master_key;
+    if (key_id == master_key_id_) {
+        master_key = master_key_;
+    } else if (key_id == next_key_id_ && !next_master_key_.empty()) {
+        master_key = next_master_key_;
+    } else {
+        throw std::runtime_error("File key wrapped by an unknown master key");
+    }
+    lock.unlock();
     
+    auto wrapped = hex_to_bytes(wrapped_key);
+    if (wrapped.size() < kStreamNonceSize + kTagSize) {
+        throw std::runtime_error("Invalid wrapped file key");
+    }
+    std::vector<uint8_t> nonce(wrapped.begin(), wrapped.begin() + kStreamNonceSize);
+    std::vector<uint8_t> sealed(wrapped.begin() + kStreamNonceSize, wrapped.end());
+    return cipher::aead_open(sealed, master_key, nonce, file_key_aad(file_id));
+}
+
+SecureBytes CryptoManager::resolve_file_key(const std::string& file_id, const std::string& wrapped_key,
+                                            uint32_t key_id) {
+    if (key_id == 0 || wrapped_key.empty()) {
+        return derive_file_key(file_id);
+    }
+    return unwrap_file_key(wrapped_key, file_id, key_id);
+}
+
+uint32_t CryptoManager::active_key_id() {
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    return next_master_key_.empty() ? master_key_id_ : next_key_id_;
+}
+
+std::string CryptoManager::content_digest(const SecureBytes& key, const uint8_t* sha256) {
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!HMAC(EVP_sha256(), key.data(), key.size(), sha256, SHA256_DIGEST_LENGTH, digest, &length)) {
+        throw std::runtime_error("HMAC failed");
+    }
+    return codec::hex_encode(digest, length);
+}
+
+uint32_t CryptoManager::key_id_for(const SecureBytes& master_key) {
+    auto digest = cipher::hkdf_derive(master_key, "vaultusb-key-id", 4);
+    uint32_t key_id = get_u32(digest.data());
+    return key_id != 0 ? key_id : 1; // 0 is reserved for legacy HKDF-keyed files
+}
+
+bool CryptoManager::begin_key_rotation(const std::string& password) {
+    // An unconfirmed key may be garbage from a wrong password; never rewrap towards it
+    if (!is_unlocked_ || !master_key_confirmed_ || rotation_in_progress()) {
+        return false;
+    }
+    
+    // The new key is sealed with the vault password, so confirm it first
+    std::string sealed_data;
+    if (!read_file(master_key_file_, sealed_data)) {
+        return false;
+    }
     try {
-        auto file_key = derive_file_key(file_id);
-        auto nonce = generate_nonce();
-        
-        // Read file
-        std::ifstream file(file_path, std::ios::binary);
-        if (!file.is_open()) {
+        auto current = unseal_master_key(sealed_data, password);
+        std::lock_guard<std::mutex> lock(key_mutex_);
+        if (current.size() != master_key_.size() ||
+            CRYPTO_memcmp(current.data(), master_key_.data(), current.size()) != 0) {
             return false;
         }
-        
-        std::vector<uint8_t> plaintext((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        file.close();
-        
-        // Encrypt
-        auto encrypted = encrypt_data(plaintext, file_key, nonce);
-        
-        // Write back (nonce + encrypted data)
-        std::ofstream out_file(file_path, std::ios::binary);
-        if (!out_file.is_open()) {
+    } catch (const std::exception&) {
+        return false;
+    }
+    
+    auto next_key = generate_master_key();
+    try {
+        if (!write_file_atomic(master_key_file_ + ".next", seal_master_key(next_key, password))) {
             return false;
         }
-        
-        out_file.write(reinterpret_cast<const char*>(nonce.data()), nonce.size());
-        out_file.write(reinterpret_cast<const char*>(encrypted.data()), encrypted.size());
-        out_file.close();
-        
-        return true;
     } catch (const std::exception& e) {
-        std::cerr << "Failed to encrypt file: " << e.what() << std::endl;
+        std::cerr << "Failed to seal rotated master key: " << e.what() << std::endl;
         return false;
     }
+    
+    uint32_t next_id = key_id_for(next_key);
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    next_master_key_ = std::move(next_key);
+    next_key_id_ = next_id;
+    return true;
 }
 
-std::vector<uint8_t> CryptoManager::decrypt_file(const std::string& file_path, const std::string& file_id) {
+std::future<bool> CryptoManager::begin_key_rotation_async(const std::string& password) {
+    return KdfExecutor::instance().submit([this, password]() { return begin_key_rotation(password); });
+}
+
+bool CryptoManager::finish_key_rotation() {
+    // Callers guarantee no data key is still wrapped by the old master key
+    std::string next_path = master_key_file_ + ".next";
+    if (rename(next_path.c_str(), master_key_file_.c_str()) != 0) {
+        return false;
+    }
+    std::string dir = master_key_file_.substr(0, master_key_file_.find_last_of('/'));
+    int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    master_key_ = std::move(next_master_key_);
+    master_key_id_ = next_key_id_;
+    SecureBytes().swap(next_master_key_);
+    next_key_id_ = 0;
+    return true;
+}
+
+bool CryptoManager::rotation_in_progress() {
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    return !next_master_key_.empty();
+}
+
+SecureBytes CryptoManager::derive_file_key(const std::string& file_id) {
+    std::unique_lock<std::mutex> lock(key_mutex_);
     if (!is_unlocked_ || master_key_.empty()) {
         throw std::runtime_error("Master key not unlocked");
     }
+    SecureBytes master_key = master_key_;
+    lock.unlock();
+    
+    return cipher::hkdf_derive(master_key, file_id, file_key_size_);
+}
+
+bool CryptoManager::encrypt_file(const std::string& file_path, const std::string& file_id) {
+    if (!is_unlocked_) {
+        throw std::runtime_error("Master key not unlocked");
+    }
+    
+    // Encrypt into a sibling file, then replace the plaintext atomically
+    std::string tmp_path = file_path + ".enc.tmp";
+    int in_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        return false;
+    }
+    int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out_fd < 0) {
+        close(in_fd);
+        return false;
+    }
     
+    bool ok = false;
     try {
-        auto file_key = derive_file_key(file_id);
-        
-        // Read file
-        std::ifstream file(file_path, std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open file");
-        }
-        
-        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        file.close();
-        
-        if (data.size() < 12) {
-            throw std::runtime_error("File too small");
-        }
-        
-        // Split nonce and encrypted data
-        std::vector<uint8_t> nonce(data.begin(), data.begin() + 12);
-        std::vector<uint8_t> encrypted(data.begin() + 12, data.end());
-        
-        return decrypt_data(encrypted, file_key, nonce);
+        ok = encrypt_stream(
+            [in_fd](uint8_t* buffer, size_t length) { return read(in_fd, buffer, length); },
+            [out_fd](const uint8_t* data, size_t length) {
+                while (length > 0) {
+                    ssize_t n = write(out_fd, data, length);
+                    if (n < 0) {
+                        return false;
+                    }
+                    data += n;
+                    length -= static_cast<size_t>(n);
+                }
+                return true;
+            },
+            file_id);
+        ok = ok && fdatasync(out_fd) == 0;
     } catch (const std::exception& e) {
-        throw std::runtime_error(std::string("Failed to decrypt file: ") + e.what());
+        std::cerr << "Failed to encrypt file: " << e.what() << std::endl;
+        ok = false;
+    }
+    
+    close(in_fd);
+    if (close(out_fd) != 0) {
+        ok = false;
+    }
+    
+    if (!ok || rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
     }
+    
+    return true;
 }
 
-std::string CryptoManager::hash_password(const std::string& password) {
-    std::vector<uint8_t> salt = generate_salt(16);
-    std::vector<uint8_t> hash(32);
-    
-    int result = argon2i_hash_raw(
-        argon2_time_cost_, argon2_memory_cost_, argon2_parallelism_,
-        password.c_str(), password.length(),
-        salt.data(), salt.size(),
-        hash.data(), hash.size()
-    );
+std::vector<uint8_t> CryptoManager::decrypt_file(const std::string& file_path, const std::string& file_id) {
+    std::vector<uint8_t> plaintext;
+    bool ok = decrypt_file_to(file_path, file_id, [&plaintext](const uint8_t* data, size_t length) {
+        plaintext.insert(plaintext.end(), data, data + length);
+        return true;
+    });
     
-    if (result != ARGON2_OK) {
-        throw std::runtime_error("Argon2 hash failed");
+    if (!ok) {
+        throw std::runtime_error("Failed to decrypt file: " + file_path);
+    }
+    return plaintext;
+}
+
+bool CryptoManager::decrypt_file_to(const std::string& file_path, const std::string& file_id, const ByteSink& sink) {
+    return decrypt_file_to(file_path, derive_file_key(file_id), sink);
+}
+
+bool CryptoManager::decrypt_file_to(const std::string& file_path, const SecureBytes& file_key,
+                                    const ByteSink& sink) {
+    if (!is_unlocked_) {
+        throw std::runtime_error("Master key not unlocked");
     }
     
-    // Combine salt and hash
-    std::vector<uint8_t> combined;
-    combined.insert(combined.end(), salt.begin(), salt.end());
-    combined.insert(combined.end(), hash.begin(), hash.end());
+    int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
     
-    return bytes_to_hex(combined);
+    bool ok = decrypt_file_to(fd, file_key, sink);
+    close(fd);
+    return ok;
 }
 
-bool CryptoManager::verify_password(const std::string& password, const std::string& password_hash) {
+bool CryptoManager::decrypt_file_to(int fd, const SecureBytes& file_key, const ByteSink& sink,
+                                    int64_t offset, int64_t length) {
+    posix_fadvise(fd, offset, length < 0 ? 0 : length, POSIX_FADV_SEQUENTIAL);
+    
     try {
-        auto combined = hex_to_bytes(password_hash);
-        if (combined.size() < 16) {
-            return false;
-        }
-        
-        std::vector<uint8_t> salt(combined.begin(), combined.begin() + 16);
-        std::vector<uint8_t> stored_hash(combined.begin() + 16, combined.end());
-        std::vector<uint8_t> computed_hash(32);
-        
-        int result = argon2i_verify(
-            stored_hash.data(), stored_hash.size(),
-            password.c_str(), password.length(),
-            salt.data(), salt.size()
-        );
-        
-        return result == ARGON2_OK;
-    } catch (const std::exception&) {
+        return decrypt_stream([fd, &offset, &length](uint8_t* buffer, size_t size) -> ssize_t {
+            if (length >= 0) {
+                size = std::min(size, static_cast<size_t>(length));
+            }
+            if (size == 0) {
+                return 0;
+            }
+            ssize_t n = pread(fd, buffer, size, offset);
+            if (n > 0) {
+                offset += n;
+                if (length >= 0) {
+                    length -= n;
+                }
+            }
+            return n;
+        }, sink, file_key);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to decrypt file: " << e.what() << std::endl;
         return false;
     }
 }
 
-void CryptoManager::lock() {
-    master_key_.clear();
-    is_unlocked_ = false;
+bool CryptoManager::secure_delete(const std::string& file_path) {
+    // Shredding happens in the background; the caller only pays for the queue insert
+    return Shredder::instance().enqueue(file_path);
+}
+
+bool CryptoManager::encrypt_stream(const ByteSource& source, const ByteSink& sink, const std::string& file_id) {
+    return encrypt_stream(source, sink, derive_file_key(file_id));
 }
 
-std::vector<uint8_t> CryptoManager::derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt) {
-    std::vector<uint8_t> key(32);
-    int result = argon2i_hash_raw(
-        argon2_time_cost_, argon2_memory_cost_, argon2_parallelism_,
-        password.c_str(), password.length(),
-        salt.data(), salt.size(),
-        key.data(), key.size()
-    );
+bool CryptoManager::encrypt_stream(const ByteSource& source, const ByteSink& sink, const SecureBytes& file_key,
+                                   compression::Codec codec) {
+    if (!compression::available(codec)) {
+        codec = compression::Codec::None;
+    }
     
-    if (result != ARGON2_OK) {
-        throw std::runtime_error("Argon2 key derivation failed");
+    auto header_bytes = new_stream_header(codec);
+    const uint8_t* header = header_bytes.data();
+    
+    if (!sink(header, header_bytes.size())) {
+        return false;
     }
     
-    return key;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        throw std::runtime_error("Failed to create cipher context");
+    }
+    
+    // One byte of lookahead tells the reader whether a full block is the last one
+    bool have_pending = false;
+    uint8_t pending = 0;
+    const size_t chunk_size = stream_chunk_size_;
+    const bool compressed = codec != compression::Codec::None;
+    const size_t flag_size = compressed ? kChunkFlagSize : 0;
+    const int level = compression_level_;
+    std::vector<uint8_t> scratch(compressed ? chunk_size : 0);
+    
+    BlockPipeline pipeline(chunk_size + flag_size + kFrameLengthSize + kTagSize, stream_depth_);
+    bool ok = pipeline.run(
+        [&](PipelineBlock& block) {
+            uint8_t* payload = block.data.data() + kFrameLengthSize + flag_size;
+            size_t filled = 0;
+            if (have_pending) {
+                payload[filled++] = pending;
+                have_pending = false;
+            }
+            ssize_t n = read_full(source, payload + filled, chunk_size - filled);
+            if (n < 0) {
+                return false;
+            }
+            filled += static_cast<size_t>(n);
+            
+            if (filled < chunk_size) {
+                block.last = true;
+            } else {
+                ssize_t peek = read_full(source, &pending, 1);
+                if (peek < 0) {
+                    return false;
+                }
+                have_pending = peek == 1;
+                block.last = !have_pending;
+            }
+            block.length = filled;
+            return true;
+        },
+        [&](PipelineBlock& block) {
+            block.length = seal_frame(ctx, file_key.data(), header, block.index, block.last, codec, level,
+                                      block.data.data(), block.length, scratch.data());
+            return block.length > 0;
+        },
+        [&](const PipelineBlock& block) {
+            return sink(block.data.data(), block.length);
+        });
+    
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        std::cerr << "Stream encryption failed: " << pipeline.error() << std::endl;
+    }
+    return ok;
 }
 
-std::vector<uint8_t> CryptoManager::generate_salt(size_t length) {
-    std::vector<uint8_t> salt(length);
-    RAND_bytes(salt.data(), salt.size());
-    return salt;
+std::vector<uint8_t> CryptoManager::new_stream_header(compression::Codec codec) {
+    if (!compression::available(codec)) {
+        codec = compression::Codec::None;
+    }
+    
+    std::vector<uint8_t> header(kStreamHeaderSize, 0);
+    std::memcpy(header.data(), kStreamMagic, sizeof(kStreamMagic));
+    header[4] = kStreamVersion;
+    header[5] = static_cast<uint8_t>(codec);
+    put_u32(header.data() + 8, static_cast<uint32_t>(stream_chunk_size_));
+    auto nonce = generate_nonce(kStreamNonceSize);
+    std::memcpy(header.data() + kStreamHeaderSize - kStreamNonceSize, nonce.data(), kStreamNonceSize);
+    return header;
 }
 
-std::vector<uint8_t> CryptoManager::generate_nonce(size_t length) {
-    std::vector<uint8_t> nonce(length);
-    RAND_bytes(nonce.data(), nonce.size());
-    return nonce;
+size_t CryptoManager::stream_chunk_size(const std::vector<uint8_t>& header) {
+    return is_stream_format(header.data(), header.size()) ? get_u32(header.data() + 8) : 0;
 }
 
-std::vector<uint8_t> CryptoManager::encrypt_data(const std::vector<uint8_t>& data, const std::vector<uint8_t>& key, const std::vector<uint8_t>& nonce) {
+bool CryptoManager::encrypt_frames(const std::vector<uint8_t>& header, const SecureBytes& file_key,
+                                   uint64_t first_index, const uint8_t* data, size_t length, bool final,
+                                   std::vector<uint8_t>& out) {
+    const size_t chunk_size = stream_chunk_size(header);
+    if (chunk_size == 0) {
+        return false;
+    }
+    auto codec = static_cast<compression::Codec>(header[5]);
+    if (!compression::available(codec)) {
+        std::cerr << "Unsupported stream codec: " << static_cast<int>(header[5]) << std::endl;
+        return false;
+    }
+    // Only the final run may end in a short (or, for an empty file, empty) chunk
+    if (!final && (length == 0 || length % chunk_size != 0)) {
+        return false;
+    }
+    
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) {
         throw std::runtime_error("Failed to create cipher context");
     }
     
-    if (EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to initialize encryption");
+    const size_t flag_size = codec != compression::Codec::None ? kChunkFlagSize : 0;
+    std::vector<uint8_t> frame(chunk_size + flag_size + kFrameLengthSize + kTagSize);
+    std::vector<uint8_t> scratch(flag_size > 0 ? chunk_size : 0);
+    size_t frames = std::max<size_t>((length + chunk_size - 1) / chunk_size, 1);
+    out.reserve(out.size() + length + frames * (flag_size + kFrameLengthSize + kTagSize));
+    
+    bool ok = true;
+    for (size_t i = 0; i < frames && ok; i++) {
+        size_t offset = i * chunk_size;
+        size_t n = std::min(chunk_size, length - offset);
+        if (n > 0) {
+            std::memcpy(frame.data() + kFrameLengthSize + flag_size, data + offset, n);
+        }
+        size_t frame_len = seal_frame(ctx, file_key.data(), header.data(), first_index + i,
+                                      final && i + 1 == frames, codec, compression_level_,
+                                      frame.data(), n, scratch.data());
+        ok = frame_len > 0;
+        if (ok) {
+            out.insert(out.end(), frame.data(), frame.data() + frame_len);
+        }
     }
     
-    std::vector<uint8_t> ciphertext(data.size() + 16); // Extra space for tag
-    int len;
-    int ciphertext_len;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+bool CryptoManager::is_stream_format(const uint8_t* header, size_t length) {
+    return length >= kStreamHeaderSize && is_stream_header(header);
+}
+
+bool CryptoManager::decrypt_stream(const ByteSource& source, const ByteSink& sink, const std::string& file_id) {
+    return decrypt_stream(source, sink, derive_file_key(file_id));
+}
+
+bool CryptoManager::decrypt_stream(const ByteSource& source, const ByteSink& sink, const SecureBytes& file_key) {
+    uint8_t header[kStreamHeaderSize];
+    ssize_t header_len = read_full(source, header, sizeof(header));
+    if (header_len < 0) {
+        return false;
+    }
     
-    if (EVP_EncryptUpdate(ctx, ciphertext.data(), &len, data.data(), data.size()) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to encrypt data");
+    if (static_cast<size_t>(header_len) < sizeof(header) || !is_stream_header(header)) {
+        // Legacy single-shot format: nonce(12) || ciphertext (written without a tag)
+        std::vector<uint8_t> data(header, header + header_len);
+        uint8_t buffer[65536];
+        ssize_t n;
+        while ((n = source(buffer, sizeof(buffer))) > 0) {
+            data.insert(data.end(), buffer, buffer + n);
+        }
+        if (n < 0 || data.size() < kStreamNonceSize) {
+            return false;
+        }
+        
+        std::vector<uint8_t> nonce(data.begin(), data.begin() + kStreamNonceSize);
+        std::vector<uint8_t> encrypted(data.begin() + kStreamNonceSize, data.end());
+        auto plaintext = cipher::decrypt_data(encrypted, file_key, nonce);
+        return sink(plaintext.data(), plaintext.size());
     }
-    ciphertext_len = len;
     
-    if (EVP_EncryptFinal_ex(ctx, ciphertext.data() + len, &len) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to finalize encryption");
+    auto codec = static_cast<compression::Codec>(header[5]);
+    if (!compression::available(codec)) {
+        std::cerr << "Unsupported stream codec: " << static_cast<int>(header[5]) << std::endl;
+        return false;
     }
-    ciphertext_len += len;
+    const bool compressed = codec != compression::Codec::None;
+    const size_t flag_size = compressed ? kChunkFlagSize : 0;
+    const size_t chunk_size = get_u32(header + 8);
+    const size_t max_frame = chunk_size + flag_size + kTagSize;
+    std::vector<uint8_t> scratch(compressed ? chunk_size : 0);
     
-    EVP_CIPHER_CTX_free(ctx);
-    ciphertext.resize(ciphertext_len);
-    return ciphertext;
-}
-
-std::vector<uint8_t> CryptoManager::decrypt_data(const std::vector<uint8_t>& encrypted_data, const std::vector<uint8_t>& key, const std::vector<uint8_t>& nonce) {
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) {
         throw std::runtime_error("Failed to create cipher context");
     }
     
-    if (EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data()) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to initialize decryption");
+    // The reader looks ahead at the next frame length to detect the last frame
+    uint8_t next_length[kFrameLengthSize];
+    ssize_t next_len = read_full(source, next_length, sizeof(next_length));
+    
+    BlockPipeline pipeline(max_frame, stream_depth_);
+    bool ok = next_len == static_cast<ssize_t>(kFrameLengthSize) && pipeline.run(
+        [&](PipelineBlock& block) {
+            size_t frame_len = get_u32(next_length);
+            if (frame_len < kTagSize || frame_len > max_frame) {
+                return false;
+            }
+            if (read_full(source, block.data.data(), frame_len) != static_cast<ssize_t>(frame_len)) {
+                return false;
+            }
+            
+            next_len = read_full(source, next_length, sizeof(next_length));
+            if (next_len != 0 && next_len != static_cast<ssize_t>(kFrameLengthSize)) {
+                return false;
+            }
+            block.last = next_len == 0;
+            block.length = frame_len;
+            return true;
+        },
+        [&](PipelineBlock& block) {
+            size_t cipher_len = block.length - kTagSize;
+            uint8_t* data = block.data.data();
+            if (!open_chunk(ctx, file_key.data(), header, block.index, block.last, data, cipher_len)) {
+                return false;
+            }
+            if (compressed) {
+                if (cipher_len < kChunkFlagSize) {
+                    return false;
+                }
+                if (data[0] == kChunkCompressed) {
+                    ssize_t n = compression::decompress(codec, data + kChunkFlagSize, cipher_len - kChunkFlagSize,
+                                                        scratch.data(), scratch.size());
+                    if (n < 0) {
+                        return false;
+                    }
+                    std::memcpy(data + kChunkFlagSize, scratch.data(), static_cast<size_t>(n));
+                    cipher_len = kChunkFlagSize + static_cast<size_t>(n);
+                } else if (data[0] != kChunkRaw) {
+                    return false;
+                }
+            }
+            block.length = cipher_len;
+            return true;
+        },
+        [&](const PipelineBlock& block) {
+            // The flag byte, when present, is never part of the plaintext
+            return block.length <= flag_size || sink(block.data.data() + flag_size, block.length - flag_size);
+        });
+    
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok && !pipeline.error().empty()) {
+        std::cerr << "Stream decryption failed: " << pipeline.error() << std::endl;
     }
+    return ok;
+}
+
+std::string CryptoManager::hash_password(const std::string& password) {
+    KdfParams params = kdf_policy();
+    std::vector<uint8_t> salt = generate_salt(16);
+    SecureBytes hash = argon2_raw(Argon2_id, params, password, salt, 32);
     
-    std::vector<uint8_t> plaintext(encrypted_data.size());
-    int len;
-    int plaintext_len;
+    return "$argon2id$v=19$m=" + std::to_string(params.memory_cost) +
+           ",t=" + std::to_string(params.time_cost) +
+           ",p=" + std::to_string(params.parallelism) +
+           "$" + codec::base64_encode(salt, false) + "$" + codec::base64_encode(hash.data(), hash.size(), false);
+}
+
+bool CryptoManager::verify_password(const std::string& password, const std::string& password_hash) {
+    try {
+        argon2_type type = Argon2_i;
+        KdfParams params;
+        std::vector<uint8_t> salt, stored_hash;
+        
+        if (!password_hash.empty() && password_hash[0] == '$') {
+            if (!parse_phc(password_hash, type, params, salt, stored_hash)) {
+                return false;
+            }
+        } else {
+            // Legacy hex(salt || hash): Argon2i at the configured cost
+            auto combined = hex_to_bytes(password_hash);
+            if (combined.size() <= 16) {
+                return false;
+            }
+            params = kdf_policy();
+            salt.assign(combined.begin(), combined.begin() + 16);
+            stored_hash.assign(combined.begin() + 16, combined.end());
+        }
+        
+        auto computed_hash = argon2_raw(type, params, password, salt, stored_hash.size());
+        return CRYPTO_memcmp(computed_hash.data(), stored_hash.data(), stored_hash.size()) == 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool CryptoManager::password_needs_rehash(const std::string& password_hash) {
+    argon2_type type;
+    KdfParams params;
+    std::vector<uint8_t> salt, hash;
+    if (!parse_phc(password_hash, type, params, salt, hash)) {
+        return true;
+    }
+    return type != Argon2_id || params_below_policy(params);
+}
+
+KdfParams CryptoManager::kdf_policy() const {
+    KdfParams params;
+    params.time_cost = static_cast<uint32_t>(std::max(argon2_time_cost_, 1));
+    params.memory_cost = static_cast<uint32_t>(std::max(argon2_memory_cost_, 8));
+    params.parallelism = static_cast<uint32_t>(std::max(argon2_parallelism_, 1));
+    return params;
+}
+
+size_t CryptoManager::kdf_concurrency() const {
+    // Hashes that may run at once: the configured cap, limited by the memory budget
+    size_t concurrency = static_cast<size_t>(std::max(Config::instance().argon2_max_concurrency(), 1));
+    int budget_kib = Config::instance().kdf_memory_budget();
+    if (budget_kib > 0) {
+        size_t by_memory = static_cast<size_t>(budget_kib) / kdf_policy().memory_cost;
+        concurrency = std::max<size_t>(1, std::min(concurrency, by_memory));
+    }
+    return concurrency;
+}
+
+bool CryptoManager::params_below_policy(const KdfParams& params) const {
+    KdfParams policy = kdf_policy();
+    return params.time_cost < policy.time_cost ||
+           params.memory_cost < policy.memory_cost ||
+           params.parallelism < policy.parallelism;
+}
+
+KdfParams CryptoManager::calibrate_kdf(int target_ms, uint32_t max_memory_kib, double* measured_ms) {
+    // Use every core as a lane; memory first, then time cost to fill the budget
+    KdfParams params;
+    params.parallelism = std::max(1u, std::min(std::thread::hardware_concurrency(), 4u));
+    params.memory_cost = std::max<uint32_t>(max_memory_kib, 8 * params.parallelism);
+    params.time_cost = 1;
     
-    if (EVP_DecryptUpdate(ctx, plaintext.data(), &len, encrypted_data.data(), encrypted_data.size()) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to decrypt data");
+    const std::string password = "vaultusb-calibration";
+    auto salt = generate_salt(16);
+    auto measure = [&](const KdfParams& p) {
+        auto start = std::chrono::steady_clock::now();
+        argon2_raw(Argon2_id, p, password, salt, 32);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
+    
+    // Shrink memory until a single pass fits the target
+    double ms = measure(params);
+    while (ms > target_ms && params.memory_cost / 2 >= 8192) {
+        params.memory_cost /= 2;
+        ms = measure(params);
     }
-    plaintext_len = len;
     
-    if (EVP_DecryptFinal_ex(ctx, plaintext.data() + len, &len) != 1) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw std::runtime_error("Failed to finalize decryption");
+    // Argon2 cost is linear in passes; take as many as the target allows
+    if (ms > 0.0 && ms < target_ms) {
+        params.time_cost = std::max<uint32_t>(1, static_cast<uint32_t>(target_ms / ms));
+        ms = measure(params);
+        while (params.time_cost > 1 && ms > target_ms * 1.1) {
+            params.time_cost--;
+            ms = measure(params);
+        }
     }
-    plaintext_len += len;
     
-    EVP_CIPHER_CTX_free(ctx);
-    plaintext.resize(plaintext_len);
-    return plaintext;
+    if (measured_ms) {
+        *measured_ms = ms;
+    }
+    return params;
 }
 
-std::vector<uint8_t> CryptoManager::hkdf_derive(const std::vector<uint8_t>& key, const std::string& info, size_t length) {
-    std::vector<uint8_t> derived_key(length);
+void CryptoManager::lock() {
+    std::lock_guard<std::mutex> lock(key_mutex_);
+    // Releasing the buffers wipes them; clear() alone would leave the bytes in place
+    SecureBytes().swap(master_key_);
+    SecureBytes().swap(next_master_key_);
+    master_key_confirmed_ = false;
+    is_unlocked_ = false;
+}
+
+SecureBytes CryptoManager::derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt) {
+    return derive_key_from_password(password, salt, Argon2_id, kdf_policy());
+}
+
+SecureBytes CryptoManager::derive_key_from_password(const std::string& password, const std::vector<uint8_t>& salt,
+                                                    int argon2_type, const KdfParams& params) {
+    return argon2_raw(argon2_type, params, password, salt, 32);
+}
+
+SecureBytes CryptoManager::argon2_raw(int type, const KdfParams& params, const std::string& password,
+                                      const std::vector<uint8_t>& salt, size_t length) {
+    SecureBytes out(length);
+    
+    argon2_context context{};
+    context.out = out.data();
+    context.outlen = static_cast<uint32_t>(out.size());
+    context.pwd = reinterpret_cast<uint8_t*>(const_cast<char*>(password.data()));
+    context.pwdlen = static_cast<uint32_t>(password.length());
+    context.salt = const_cast<uint8_t*>(salt.data());
+    context.saltlen = static_cast<uint32_t>(salt.size());
+    context.t_cost = params.time_cost;
+    context.m_cost = params.memory_cost;
+    context.lanes = params.parallelism;
+    context.threads = params.parallelism;
+    context.version = ARGON2_VERSION_13;
+    context.allocate_cbk = &Argon2MemoryPool::allocate;
+    context.free_cbk = &Argon2MemoryPool::release;
+    context.flags = ARGON2_DEFAULT_FLAGS;
     
-    if (HKDF(derived_key.data(), length, EVP_sha256(), key.data(), key.size(),
-             reinterpret_cast<const uint8_t*>("vaultusb_file_key"), 16,
-             reinterpret_cast<const uint8_t*>(info.c_str()), info.length()) != 1) {
-        throw std::runtime_error("HKDF derivation failed");
+    int result = argon2_ctx(&context, static_cast<argon2_type>(type));
+    
+    if (result != ARGON2_OK) {
+        throw std::runtime_error(std::string("Argon2 failed: ") + argon2_error_message(result));
     }
     
-    return derived_key;
+    return out;
+}
+
+std::vector<uint8_t> CryptoManager::generate_salt(size_t length) {
+    std::vector<uint8_t> salt(length);
+    RAND_bytes(salt.data(), salt.size());
+    return salt;
+}
+
+std::vector<uint8_t> CryptoManager::generate_nonce(size_t length) {
+    std::vector<uint8_t> nonce(length);
+    RAND_bytes(nonce.data(), nonce.size());
+    return nonce;
 }
 
 std::string CryptoManager::bytes_to_hex(const std::vector<uint8_t>& bytes) {
-    std::ostringstream oss;
-    for (auto b : bytes) {
-        oss << std::hex << std::setw(2) << std::setfill('0') << (int)b;
-    }
-    return oss.str();
+    return codec::hex_encode(bytes);
 }
 
 std::vector<uint8_t> CryptoManager::hex_to_bytes(const std::string& hex) {
     std::vector<uint8_t> bytes;
-    for (size_t i = 0; i < hex.length(); i += 2) {
-        std::string byte_str = hex.substr(i, 2);
-        bytes.push_back(static_cast<uint8_t>(std::stoul(byte_str, nullptr, 16)));
+    if (!codec::hex_decode(hex, bytes)) {
+        throw std::runtime_error("Invalid hex string");
     }
     return bytes;
 }
@@ -1,11 +1,189 @@
 #include "database.h"
+#include "codec.h"
 #include "config.h"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
 
 namespace vaultusb {
 
+namespace {
+
+// Column order read by Database::file_from_row
+constexpr const char* kFileColumns =
+    "id, original_name, encrypted_name, size, mime_type, created_at, modified_at, user_id, is_deleted, "
+    "wrapped_key, key_id, content_digest, stored_size, deleted_at, folder_id, version";
+
+constexpr const char* kInsertFile = R"(
+    INSERT INTO files (id, original_name, encrypted_name, size, mime_type, created_at, modified_at, user_id, is_deleted,
+                       wrapped_key, key_id, content_digest, stored_size, folder_id, version)
+    VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+)";
+
+// Pages copied per step of an online backup; other statements get the
+// connection between steps
+constexpr int kBackupPagesPerStep = 256;
+
+// Column order read by Database::folder_from_row
+constexpr const char* kFolderColumns = "id, user_id, parent_id, name, created_at, modified_at";
+
+// A folder and all folders below it, seeded with the folder id ('' is the
+// root) and the user id; walks idx_folders_parent_name one level at a time
+constexpr const char* kSubtreeCte = R"(
+    WITH RECURSIVE tree (id) AS (
+        SELECT ?
+        UNION ALL
+        SELECT f.id FROM folders f JOIN tree t ON f.user_id = ? AND COALESCE(f.parent_id, '') = t.id
+    )
+)";
+
+// Column order read by Database::upload_session_from_row
+constexpr const char* kUploadSessionColumns =
+    "id, user_id, file_id, original_name, size, chunk_size, stream_header, wrapped_key, key_id, "
+    "created_at, updated_at";
+
+// kFileColumns with a table alias, for joins
+std::string file_columns(const std::string& alias) {
+    std::string columns = alias + kFileColumns;
+    for (size_t pos = columns.find(", "); pos != std::string::npos; pos = columns.find(", ", pos + 2)) {
+        columns.insert(pos + 2, alias);
+    }
+    return columns;
+}
+
+// SQL fold_text(): the search index and its triggers store folded names
+void sql_fold_text(sqlite3_context* context, int, sqlite3_value** argv) {
+    const unsigned char* text = sqlite3_value_text(argv[0]);
+    if (!text) {
+        sqlite3_result_null(context);
+        return;
+    }
+    std::string folded = codec::fold_text(reinterpret_cast<const char*>(text));
+    sqlite3_result_text(context, folded.c_str(), static_cast<int>(folded.length()), SQLITE_TRANSIENT);
+}
+
+// SQL mirror_enabled(): the mirror queue triggers only record while a
+// mirror is configured
+void sql_mirror_enabled(sqlite3_context* context, int, sqlite3_value**) {
+    sqlite3_result_int(context, Config::instance().mirror_dir().empty() ? 0 : 1);
+}
+
+// Set while a statement whose change stays on this device runs; the update
+// hook fires on the thread stepping the statement
+thread_local bool local_change = false;
+
+// Update hook counting row changes that a mirror pass has to ship: login
+// sessions, staged uploads, logs and the queues stay on this device. The
+// hook never fires for WITHOUT ROWID tables; writes that change only those
+// count themselves
+void count_metadata_change(void* counter, int, const char*, const char* table, sqlite3_int64) {
+    if (local_change) {
+        return;
+    }
+    static const char* const kLocalTables[] = {
+        "sessions", "upload_sessions", "upload_chunks", "system_logs", "shred_queue", "mirror_queue"
+    };
+    for (const char* local : kLocalTables) {
+        if (std::strcmp(table, local) == 0) {
+            return;
+        }
+    }
+    static_cast<std::atomic<int64_t>*>(counter)->fetch_add(1);
+}
+
+// MIME class of a column, as stored in user_stats
+std::string mime_class_sql(const std::string& column) {
+    return "CASE"
+           " WHEN " + column + " LIKE 'image/%' THEN 'image'"
+           " WHEN " + column + " LIKE 'video/%' THEN 'video'"
+           " WHEN " + column + " LIKE 'audio/%' THEN 'audio'"
+           " WHEN " + column + " LIKE 'text/%' THEN 'text'"
+           " WHEN " + column + " IN ('application/pdf', 'application/msword')"
+           " OR " + column + " LIKE 'application/vnd.%' THEN 'document'"
+           " WHEN " + column + " IN ('application/zip', 'application/gzip', 'application/x-tar',"
+           " 'application/x-7z-compressed', 'application/x-bzip2', 'application/x-xz') THEN 'archive'"
+           " ELSE 'other' END";
+}
+
+// Stored bytes a live row adds to (or removes from) its user's total: its
+// ciphertext size unless another live row of the user shares the ciphertext
+std::string stored_delta_sql(const std::string& row) {
+    return "CASE WHEN EXISTS (SELECT 1 FROM files WHERE encrypted_name = " + row + ".encrypted_name"
+           " AND user_id = " + row + ".user_id AND is_deleted = 0 AND rowid != " + row + ".rowid)"
+           " THEN 0 ELSE COALESCE(NULLIF(" + row + ".stored_size, 0), " + row + ".size) END";
+}
+
+// Trigger steps counting new in and old out; both are no-ops for deleted rows
+std::string user_stats_add_sql() {
+    return "INSERT INTO user_stats (user_id, file_count, logical_bytes, stored_bytes)"
+           " SELECT new.user_id, 1, new.size, " + stored_delta_sql("new") + " WHERE new.is_deleted = 0"
+           " ON CONFLICT (user_id) DO UPDATE SET file_count = file_count + 1,"
+           " logical_bytes = logical_bytes + excluded.logical_bytes,"
+           " stored_bytes = stored_bytes + excluded.stored_bytes;"
+           " INSERT INTO user_type_stats (user_id, mime_class, file_count, logical_bytes)"
+           " SELECT new.user_id, " + mime_class_sql("new.mime_type") + ", 1, new.size WHERE new.is_deleted = 0"
+           " ON CONFLICT (user_id, mime_class) DO UPDATE SET file_count = file_count + 1,"
+           " logical_bytes = logical_bytes + excluded.logical_bytes;";
+}
+
+std::string user_stats_remove_sql() {
+    return "UPDATE user_stats SET file_count = file_count - 1, logical_bytes = logical_bytes - old.size,"
+           " stored_bytes = stored_bytes - " + stored_delta_sql("old") +
+           " WHERE old.is_deleted = 0 AND user_id = old.user_id;"
+           " UPDATE user_type_stats SET file_count = file_count - 1, logical_bytes = logical_bytes - old.size"
+           " WHERE old.is_deleted = 0 AND user_id = old.user_id AND mime_class = " +
+           mime_class_sql("old.mime_type") + ";";
+}
+
+// Both tables from scratch; a shared ciphertext is counted on its oldest live row
+std::vector<std::string> user_stats_rebuild_sql() {
+    return {
+        "INSERT INTO user_stats (user_id, file_count, logical_bytes, stored_bytes)"
+        " SELECT f.user_id, COUNT(*), SUM(f.size),"
+        " SUM(CASE WHEN f.rowid = (SELECT MIN(rowid) FROM files o WHERE o.encrypted_name = f.encrypted_name"
+        " AND o.user_id = f.user_id AND o.is_deleted = 0)"
+        " THEN COALESCE(NULLIF(f.stored_size, 0), f.size) ELSE 0 END)"
+        " FROM files f WHERE f.is_deleted = 0 GROUP BY f.user_id",
+        "INSERT INTO user_type_stats (user_id, mime_class, file_count, logical_bytes)"
+        " SELECT user_id, " + mime_class_sql("mime_type") + " AS mime_class, COUNT(*), SUM(size)"
+        " FROM files WHERE is_deleted = 0 GROUP BY user_id, mime_class"
+    };
+}
+
+// Per-folder counters of the folder's own files (folder_id '' is the root);
+// a subtree total sums them over its folders, so moving a folder changes none
+std::string folder_stats_add_sql() {
+    return "INSERT INTO folder_stats (user_id, folder_id, file_count, logical_bytes)"
+           " SELECT new.user_id, COALESCE(new.folder_id, ''), 1, new.size WHERE new.is_deleted = 0"
+           " ON CONFLICT (user_id, folder_id) DO UPDATE SET file_count = file_count + 1,"
+           " logical_bytes = logical_bytes + excluded.logical_bytes;";
+}
+
+std::string folder_stats_remove_sql() {
+    return "UPDATE folder_stats SET file_count = file_count - 1, logical_bytes = logical_bytes - old.size"
+           " WHERE old.is_deleted = 0 AND user_id = old.user_id AND folder_id = COALESCE(old.folder_id, '');";
+}
+
+std::string folder_stats_rebuild_sql() {
+    return "INSERT INTO folder_stats (user_id, folder_id, file_count, logical_bytes)"
+           " SELECT user_id, COALESCE(folder_id, '') AS folder, COUNT(*), SUM(size)"
+           " FROM files WHERE is_deleted = 0 GROUP BY user_id, folder";
+}
+
+std::string like_escape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '%' || c == '_' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+} // namespace
+
 Database& Database::instance() {
     static Database instance;
     return instance;
@@ -14,7 +192,9 @@ Database& Database::instance() {
 bool Database::initialize(const std::string& db_file) {
     db_file_ = db_file;
     
-    int rc = sqlite3_open(db_file.c_str(), &db_);
+    // Serialized mode: the connection is shared by HTTP and background workers
+    int rc = sqlite3_open_v2(db_file.c_str(), &db_,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, nullptr);
     if (rc != SQLITE_OK) {
         std::cerr << "Cannot open database: " << sqlite3_errmsg(db_) << std::endl;
         return false;
@@ -23,6 +203,15 @@ bool Database::initialize(const std::string& db_file) {
     // Enable foreign keys
     execute_query("PRAGMA foreign_keys = ON");
     
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+#ifdef SQLITE_INNOCUOUS
+    flags |= SQLITE_INNOCUOUS; // called from triggers
+#endif
+    sqlite3_create_function_v2(db_, "fold_text", 1, flags, nullptr, sql_fold_text, nullptr, nullptr, nullptr);
+    sqlite3_create_function_v2(db_, "mirror_enabled", 0, flags & ~SQLITE_DETERMINISTIC, nullptr, sql_mirror_enabled,
+                               nullptr, nullptr, nullptr);
+    sqlite3_update_hook(db_, count_metadata_change, &metadata_changes_);
+    
     return create_tables();
 }
 
@@ -84,6 +273,15 @@ bool Database::create_tables() {
         )
         )",
         R"(
+        CREATE TABLE IF NOT EXISTS shred_queue (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            path TEXT NOT NULL,
+            size INTEGER NOT NULL,
+            bytes_done INTEGER DEFAULT 0,
+            created_at INTEGER NOT NULL
+        )
+        )",
+        R"(
         CREATE TABLE IF NOT EXISTS system_logs (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
             level TEXT NOT NULL,
@@ -102,9 +300,377 @@ bool Database::create_tables() {
         }
     }
     
+    if (!migrate_schema() || !ensure_search_index()) {
+        return false;
+    }
+    
     return create_default_admin_user();
 }
 
+bool Database::migrate_schema() {
+    // Each step upgrades PRAGMA user_version by one inside its own transaction
+    std::vector<std::vector<std::string>> migrations = {
+        // 1: envelope encryption (per-file data key wrapped by the master key)
+        {
+            "ALTER TABLE files ADD COLUMN wrapped_key TEXT",
+            "ALTER TABLE files ADD COLUMN key_id INTEGER DEFAULT 0",
+            "CREATE INDEX IF NOT EXISTS idx_files_key_id ON files (key_id)"
+        },
+        // 2: per-user content deduplication
+        {
+            "ALTER TABLE files ADD COLUMN content_digest TEXT",
+            R"(
+            CREATE TABLE objects (
+                user_id INTEGER NOT NULL,
+                digest TEXT NOT NULL,
+                encrypted_name TEXT NOT NULL,
+                size INTEGER NOT NULL,
+                refcount INTEGER NOT NULL DEFAULT 1,
+                created_at INTEGER NOT NULL,
+                PRIMARY KEY (user_id, digest)
+            )
+            )",
+            R"(
+            CREATE TABLE user_keys (
+                user_id INTEGER NOT NULL,
+                purpose TEXT NOT NULL,
+                wrapped_key TEXT NOT NULL,
+                key_id INTEGER NOT NULL,
+                PRIMARY KEY (user_id, purpose)
+            )
+            )",
+            "CREATE INDEX IF NOT EXISTS idx_files_encrypted_name ON files (encrypted_name)"
+        },
+        // 3: compress-before-encrypt (size stays the logical plaintext size)
+        {
+            "ALTER TABLE files ADD COLUMN stored_size INTEGER DEFAULT 0"
+        },
+        // 4: small objects packed into append-only segments
+        {
+            R"(
+            CREATE TABLE packs (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                encrypted_name TEXT NOT NULL UNIQUE,
+                sealed INTEGER NOT NULL DEFAULT 0,
+                created_at INTEGER NOT NULL
+            )
+            )",
+            R"(
+            CREATE TABLE pack_entries (
+                encrypted_name TEXT PRIMARY KEY,
+                pack_id INTEGER NOT NULL,
+                pack_offset INTEGER NOT NULL,
+                length INTEGER NOT NULL
+            )
+            )",
+            "CREATE INDEX IF NOT EXISTS idx_pack_entries_pack_id ON pack_entries (pack_id)"
+        },
+        // 5: per-user storage counters and quotas, maintained by triggers in
+        // the transaction that changes the file row
+        {
+            R"(
+            CREATE TABLE user_stats (
+                user_id INTEGER PRIMARY KEY,
+                file_count INTEGER NOT NULL DEFAULT 0,
+                logical_bytes INTEGER NOT NULL DEFAULT 0,
+                stored_bytes INTEGER NOT NULL DEFAULT 0
+            )
+            )",
+            R"(
+            CREATE TABLE user_type_stats (
+                user_id INTEGER NOT NULL,
+                mime_class TEXT NOT NULL,
+                file_count INTEGER NOT NULL DEFAULT 0,
+                logical_bytes INTEGER NOT NULL DEFAULT 0,
+                PRIMARY KEY (user_id, mime_class)
+            ) WITHOUT ROWID
+            )",
+            "ALTER TABLE users ADD COLUMN quota_bytes INTEGER",
+            "CREATE TRIGGER user_stats_insert AFTER INSERT ON files WHEN new.is_deleted = 0 BEGIN " +
+                user_stats_add_sql() + " END",
+            "CREATE TRIGGER user_stats_update AFTER UPDATE OF user_id, encrypted_name, size, mime_type, is_deleted, "
+            "stored_size ON files WHEN old.user_id IS NOT new.user_id OR old.encrypted_name IS NOT new.encrypted_name "
+            "OR old.size IS NOT new.size OR old.mime_type IS NOT new.mime_type OR old.is_deleted IS NOT new.is_deleted "
+            "OR old.stored_size IS NOT new.stored_size BEGIN " +
+                user_stats_remove_sql() + " " + user_stats_add_sql() + " END",
+            "CREATE TRIGGER user_stats_delete AFTER DELETE ON files WHEN old.is_deleted = 0 BEGIN " +
+                user_stats_remove_sql() + " END"
+        },
+        // 6: trash; deleted rows keep their ciphertext until purged. Rows
+        // deleted before had theirs shredded already and are dropped
+        {
+            "ALTER TABLE files ADD COLUMN deleted_at INTEGER",
+            "DELETE FROM files WHERE is_deleted = 1",
+            "CREATE INDEX IF NOT EXISTS idx_files_deleted_at ON files (deleted_at) WHERE deleted_at IS NOT NULL",
+            "CREATE INDEX IF NOT EXISTS idx_files_user_trash ON files (user_id, deleted_at) WHERE deleted_at IS NOT NULL"
+        },
+        // 7: resumable upload sessions; chunks are staged until commit
+        {
+            R"(
+            CREATE TABLE upload_sessions (
+                id TEXT PRIMARY KEY,
+                user_id INTEGER NOT NULL,
+                file_id TEXT NOT NULL,
+                original_name TEXT NOT NULL,
+                size INTEGER NOT NULL,
+                chunk_size INTEGER NOT NULL,
+                stream_header TEXT NOT NULL,
+                wrapped_key TEXT NOT NULL,
+                key_id INTEGER NOT NULL,
+                created_at INTEGER NOT NULL,
+                updated_at INTEGER NOT NULL,
+                FOREIGN KEY (user_id) REFERENCES users (id)
+            )
+            )",
+            R"(
+            CREATE TABLE upload_chunks (
+                session_id TEXT NOT NULL,
+                chunk_index INTEGER NOT NULL,
+                stored_size INTEGER NOT NULL,
+                digest TEXT NOT NULL,
+                PRIMARY KEY (session_id, chunk_index),
+                FOREIGN KEY (session_id) REFERENCES upload_sessions (id) ON DELETE CASCADE
+            ) WITHOUT ROWID
+            )",
+            "CREATE INDEX IF NOT EXISTS idx_upload_sessions_user_id ON upload_sessions (user_id)",
+            "CREATE INDEX IF NOT EXISTS idx_upload_sessions_updated_at ON upload_sessions (updated_at)"
+        },
+        // 8: 64-bit sizes. A 2-4 GiB size that went through a 32-bit int was
+        // stored negative; the triggers correct the counters with it
+        {
+            "UPDATE files SET size = size + 4294967296 WHERE size < 0",
+            "UPDATE objects SET size = size + 4294967296 WHERE size < 0"
+        },
+        // 9: virtual folders. Rows point at their parent (NULL = the user's
+        // root); trashed files keep a folder_id that may no longer exist
+        {
+            R"(
+            CREATE TABLE folders (
+                id TEXT PRIMARY KEY,
+                user_id INTEGER NOT NULL,
+                parent_id TEXT,
+                name TEXT NOT NULL,
+                created_at INTEGER NOT NULL,
+                modified_at INTEGER NOT NULL,
+                FOREIGN KEY (user_id) REFERENCES users (id),
+                FOREIGN KEY (parent_id) REFERENCES folders (id)
+            )
+            )",
+            "CREATE UNIQUE INDEX idx_folders_parent_name ON folders (user_id, COALESCE(parent_id, ''), name)",
+            "CREATE INDEX idx_folders_parent_id ON folders (parent_id)",
+            "ALTER TABLE files ADD COLUMN folder_id TEXT",
+            // Folder first: with user_id leading, the planner would take this
+            // index for the per-user lookups in the stats triggers
+            "CREATE INDEX idx_files_folder ON files (COALESCE(folder_id, ''), user_id, original_name) "
+            "WHERE is_deleted = 0",
+            R"(
+            CREATE TABLE folder_stats (
+                user_id INTEGER NOT NULL,
+                folder_id TEXT NOT NULL,
+                file_count INTEGER NOT NULL DEFAULT 0,
+                logical_bytes INTEGER NOT NULL DEFAULT 0,
+                PRIMARY KEY (user_id, folder_id)
+            ) WITHOUT ROWID
+            )",
+            "CREATE TRIGGER folder_stats_insert AFTER INSERT ON files WHEN new.is_deleted = 0 BEGIN " +
+                folder_stats_add_sql() + " END",
+            "CREATE TRIGGER folder_stats_update AFTER UPDATE OF user_id, folder_id, size, is_deleted ON files "
+            "WHEN old.user_id IS NOT new.user_id OR old.folder_id IS NOT new.folder_id OR old.size IS NOT new.size "
+            "OR old.is_deleted IS NOT new.is_deleted BEGIN " +
+                folder_stats_remove_sql() + " " + folder_stats_add_sql() + " END",
+            "CREATE TRIGGER folder_stats_delete AFTER DELETE ON files WHEN old.is_deleted = 0 BEGIN " +
+                folder_stats_remove_sql() + " END",
+            "CREATE TRIGGER folder_stats_drop AFTER DELETE ON folders BEGIN "
+            "DELETE FROM folder_stats WHERE user_id = old.user_id AND folder_id = old.id; END",
+            folder_stats_rebuild_sql()
+        },
+        // 10: file versions. A row with version > 0 has no object of its own:
+        // its content is that version's chunk list, and triggers keep its
+        // stored_size at the total of the chunks it holds
+        {
+            "ALTER TABLE files ADD COLUMN version INTEGER NOT NULL DEFAULT 0",
+            R"(
+            CREATE TABLE file_chunks (
+                file_id TEXT NOT NULL,
+                digest TEXT NOT NULL,
+                encrypted_name TEXT NOT NULL,
+                size INTEGER NOT NULL,
+                stored_size INTEGER NOT NULL,
+                refs INTEGER NOT NULL DEFAULT 0,
+                PRIMARY KEY (file_id, digest),
+                FOREIGN KEY (file_id) REFERENCES files (id) ON DELETE CASCADE
+            ) WITHOUT ROWID
+            )",
+            "CREATE INDEX idx_file_chunks_encrypted_name ON file_chunks (encrypted_name)",
+            R"(
+            CREATE TABLE file_versions (
+                file_id TEXT NOT NULL,
+                version INTEGER NOT NULL,
+                size INTEGER NOT NULL,
+                chunk_count INTEGER NOT NULL,
+                written_bytes INTEGER NOT NULL,
+                created_at INTEGER NOT NULL,
+                PRIMARY KEY (file_id, version),
+                FOREIGN KEY (file_id) REFERENCES files (id) ON DELETE CASCADE
+            ) WITHOUT ROWID
+            )",
+            "CREATE INDEX idx_file_versions_created_at ON file_versions (created_at)",
+            R"(
+            CREATE TABLE version_chunks (
+                file_id TEXT NOT NULL,
+                version INTEGER NOT NULL,
+                seq INTEGER NOT NULL,
+                digest TEXT NOT NULL,
+                PRIMARY KEY (file_id, version, seq),
+                FOREIGN KEY (file_id, version) REFERENCES file_versions (file_id, version) ON DELETE CASCADE
+            ) WITHOUT ROWID
+            )",
+            "CREATE TRIGGER file_chunks_insert AFTER INSERT ON file_chunks BEGIN "
+            "UPDATE files SET stored_size = stored_size + new.stored_size WHERE id = new.file_id; END",
+            "CREATE TRIGGER file_chunks_delete AFTER DELETE ON file_chunks BEGIN "
+            "UPDATE files SET stored_size = stored_size - old.stored_size WHERE id = old.file_id; END",
+            "CREATE TRIGGER version_chunks_insert AFTER INSERT ON version_chunks BEGIN "
+            "UPDATE file_chunks SET refs = refs + 1 WHERE file_id = new.file_id AND digest = new.digest; END",
+            "CREATE TRIGGER version_chunks_delete AFTER DELETE ON version_chunks BEGIN "
+            "UPDATE file_chunks SET refs = refs - 1 WHERE file_id = old.file_id AND digest = old.digest; END"
+        },
+        // 11: vault mirror queue; triggers record every object a commit adds
+        // or drops, in the same transaction, while a mirror is configured
+        {
+            R"(
+            CREATE TABLE mirror_queue (
+                seq INTEGER PRIMARY KEY AUTOINCREMENT,
+                encrypted_name TEXT NOT NULL,
+                queued_at INTEGER NOT NULL
+            )
+            )",
+            "CREATE TRIGGER mirror_files_insert AFTER INSERT ON files WHEN mirror_enabled() BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES (new.encrypted_name, strftime('%s', 'now')); END",
+            "CREATE TRIGGER mirror_files_update AFTER UPDATE OF encrypted_name ON files "
+            "WHEN mirror_enabled() AND old.encrypted_name != new.encrypted_name BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES "
+            "(old.encrypted_name, strftime('%s', 'now')), (new.encrypted_name, strftime('%s', 'now')); END",
+            "CREATE TRIGGER mirror_files_delete AFTER DELETE ON files WHEN mirror_enabled() BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES (old.encrypted_name, strftime('%s', 'now')); END",
+            "CREATE TRIGGER mirror_file_chunks_insert AFTER INSERT ON file_chunks WHEN mirror_enabled() BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES (new.encrypted_name, strftime('%s', 'now')); END",
+            "CREATE TRIGGER mirror_file_chunks_delete AFTER DELETE ON file_chunks WHEN mirror_enabled() BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES (old.encrypted_name, strftime('%s', 'now')); END",
+            "CREATE TRIGGER mirror_packs_delete AFTER DELETE ON packs WHEN mirror_enabled() BEGIN "
+            "INSERT INTO mirror_queue (encrypted_name, queued_at) VALUES (old.encrypted_name, strftime('%s', 'now')); END"
+        }
+    };
+    // 5 backfills the counters the way the reconcile does
+    for (auto& statement : user_stats_rebuild_sql()) {
+        migrations[4].push_back(statement);
+    }
+    
+    int version = 0;
+    execute_query("PRAGMA user_version", [&version](sqlite3_stmt* stmt) {
+        version = sqlite3_column_int(stmt, 0);
+        return SQLITE_OK;
+    });
+    
+    for (size_t i = version; i < migrations.size(); i++) {
+        bool ok = execute_query("BEGIN IMMEDIATE");
+        for (const auto& statement : migrations[i]) {
+            ok = ok && execute_query(statement);
+        }
+        ok = ok && execute_query("PRAGMA user_version = " + std::to_string(i + 1));
+        if (!ok) {
+            execute_query("ROLLBACK");
+            std::cerr << "Schema migration " << i + 1 << " failed" << std::endl;
+            return false;
+        }
+        execute_query("COMMIT");
+    }
+    return true;
+}
+
+bool Database::ensure_search_index() {
+    // FTS5 and its trigram tokenizer (SQLite 3.34) are optional in SQLite
+    // builds; without them search falls back to a scan
+    search_index_ = sqlite3_exec(db_, "CREATE VIRTUAL TABLE temp.fts_probe USING fts5(x, tokenize = 'trigram')",
+                                 nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (search_index_) {
+        execute_query("DROP TABLE temp.fts_probe");
+    }
+    
+    int objects = 0;
+    execute_query(R"(
+        SELECT COUNT(*) FROM sqlite_master
+        WHERE name IN ('files_fts', 'files_fts_insert', 'files_fts_update', 'files_fts_delete')
+    )", [&objects](sqlite3_stmt* stmt) {
+        objects = sqlite3_column_int(stmt, 0);
+        return SQLITE_OK;
+    });
+    
+    if (!search_index_) {
+        // Opened by a build without FTS5: the triggers would fail every write
+        if (objects > 0) {
+            execute_query("DROP TRIGGER IF EXISTS files_fts_insert");
+            execute_query("DROP TRIGGER IF EXISTS files_fts_update");
+            execute_query("DROP TRIGGER IF EXISTS files_fts_delete");
+        }
+        return true;
+    }
+    
+    // The index is keyed by files.rowid; a count mismatch (index created by an
+    // older run, rows renumbered by VACUUM) triggers a rebuild
+    int64_t indexed = -1;
+    int64_t live = 0;
+    if (objects == 4) {
+        execute_query("SELECT (SELECT COUNT(*) FROM files_fts), (SELECT COUNT(*) FROM files WHERE is_deleted = 0)",
+                      [&indexed, &live](sqlite3_stmt* stmt) {
+            indexed = sqlite3_column_int64(stmt, 0);
+            live = sqlite3_column_int64(stmt, 1);
+            return SQLITE_OK;
+        });
+        if (indexed == live) {
+            return true;
+        }
+    }
+    
+    const std::vector<std::string> statements = {
+        "DROP TABLE IF EXISTS files_fts",
+        "CREATE VIRTUAL TABLE files_fts USING fts5(name, mime, tokenize = 'trigram')",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS files_fts_insert AFTER INSERT ON files WHEN new.is_deleted = 0 BEGIN
+            INSERT INTO files_fts (rowid, name, mime)
+            VALUES (new.rowid, fold_text(new.original_name), fold_text(new.mime_type));
+        END
+        )",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS files_fts_update AFTER UPDATE OF original_name, mime_type, is_deleted ON files BEGIN
+            DELETE FROM files_fts WHERE rowid = old.rowid;
+            INSERT INTO files_fts (rowid, name, mime)
+            SELECT new.rowid, fold_text(new.original_name), fold_text(new.mime_type) WHERE new.is_deleted = 0;
+        END
+        )",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS files_fts_delete AFTER DELETE ON files BEGIN
+            DELETE FROM files_fts WHERE rowid = old.rowid;
+        END
+        )",
+        R"(
+        INSERT INTO files_fts (rowid, name, mime)
+        SELECT rowid, fold_text(original_name), fold_text(mime_type) FROM files WHERE is_deleted = 0
+        )"
+    };
+    
+    bool ok = execute_query("BEGIN IMMEDIATE");
+    for (const auto& statement : statements) {
+        ok = ok && execute_query(statement);
+    }
+    if (!ok) {
+        execute_query("ROLLBACK");
+        std::cerr << "Failed to build the search index" << std::endl;
+        return false;
+    }
+    execute_query("COMMIT");
+    return true;
+}
+
 bool Database::create_default_admin_user() {
     // Check if admin user exists
     auto admin_user = get_user_by_username("admin");
@@ -117,6 +683,132 @@ bool Database::create_default_admin_user() {
     return create_user(admin);
 }
 
+bool Database::backup_to(const std::string& path, std::vector<std::string>* mirror_queue, int64_t* mirror_seq) {
+    sqlite3* target = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &target, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot create database backup: " << sqlite3_errmsg(target) << std::endl;
+        sqlite3_close(target);
+        return false;
+    }
+    
+    // Writes made through this connection while the copy runs are carried
+    // into it, so it ends as one consistent state
+    sqlite3_backup* backup = sqlite3_backup_init(target, "main", db_, "main");
+    int rc = backup ? SQLITE_OK : SQLITE_ERROR;
+    while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+        if (rc != SQLITE_OK) {
+            sqlite3_sleep(10);
+        }
+        rc = sqlite3_backup_step(backup, kBackupPagesPerStep);
+    }
+    if (backup) {
+        sqlite3_backup_finish(backup);
+    }
+    
+    bool ok = rc == SQLITE_DONE;
+    if (!ok) {
+        std::cerr << "Database backup failed: " << sqlite3_errmsg(target) << std::endl;
+    }
+    
+    // The mirror ships what the copy's own queue holds, read before it goes
+    if (ok && mirror_queue && mirror_seq) {
+        mirror_queue->clear();
+        *mirror_seq = 0;
+        sqlite3_stmt* stmt;
+        ok = sqlite3_prepare_v2(target, "SELECT DISTINCT encrypted_name FROM mirror_queue ORDER BY encrypted_name",
+                                -1, &stmt, nullptr) == SQLITE_OK;
+        if (ok) {
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                mirror_queue->push_back(get_text_column(stmt, 0));
+            }
+            ok = rc == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+        }
+        ok = ok && sqlite3_prepare_v2(target, "SELECT COALESCE(MAX(seq), 0) FROM mirror_queue", -1, &stmt,
+                                      nullptr) == SQLITE_OK;
+        if (ok) {
+            ok = sqlite3_step(stmt) == SQLITE_ROW;
+            *mirror_seq = get_int64_column(stmt, 0);
+            sqlite3_finalize(stmt);
+        }
+        if (!ok) {
+            std::cerr << "Cannot read mirror queue: " << sqlite3_errmsg(target) << std::endl;
+        }
+    }
+    
+    // Login sessions, staged uploads and the shred and mirror queues belong
+    // to this device
+    char* err_msg = nullptr;
+    if (ok && sqlite3_exec(target, "PRAGMA foreign_keys = ON; DELETE FROM sessions; DELETE FROM upload_sessions; "
+                                   "DELETE FROM shred_queue; DELETE FROM mirror_queue", nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        std::cerr << "SQL error: " << err_msg << std::endl;
+        sqlite3_free(err_msg);
+        ok = false;
+    }
+    sqlite3_close(target);
+    return ok;
+}
+
+bool Database::read_backup(const std::string& db_file, std::vector<std::string>& objects,
+                           std::vector<std::string>* segments) {
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(db_file.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot open database backup: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        return false;
+    }
+    
+    sqlite3_stmt* stmt;
+    bool ok = sqlite3_prepare_v2(db, "PRAGMA quick_check", -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        const unsigned char* result = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_text(stmt, 0) : nullptr;
+        ok = result && std::string(reinterpret_cast<const char*>(result)) == "ok";
+        sqlite3_finalize(stmt);
+    }
+    if (!ok) {
+        std::cerr << "Database backup is damaged: " << db_file << std::endl;
+        sqlite3_close(db);
+        return false;
+    }
+    
+    // Same rule as has_file_ref: trashed rows still own their ciphertext
+    const std::string query = R"(
+        SELECT encrypted_name FROM files WHERE version = 0 AND (is_deleted = 0 OR deleted_at IS NOT NULL)
+        UNION SELECT encrypted_name FROM file_chunks
+        UNION SELECT encrypted_name FROM packs
+        EXCEPT SELECT encrypted_name FROM pack_entries
+    )";
+    
+    objects.clear();
+    ok = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            objects.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        }
+        ok = rc == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    if (ok && segments) {
+        segments->clear();
+        ok = sqlite3_prepare_v2(db, "SELECT encrypted_name FROM packs", -1, &stmt, nullptr) == SQLITE_OK;
+        if (ok) {
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                segments->emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+            }
+            ok = rc == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Cannot read database backup: " << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_close(db);
+    return ok;
+}
+
 bool Database::create_user(const User& user) {
     const std::string query = R"(
         INSERT INTO users (username, password_hash, totp_secret, totp_enabled, created_at, last_login, is_active)
@@ -234,6 +926,27 @@ bool Database::update_user(const User& user) {
     return rc == SQLITE_DONE;
 }
 
+bool Database::update_last_login(int user_id, std::time_t last_login) {
+    const std::string query = "UPDATE users SET last_login = ? WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, last_login);
+    bind_int(stmt, 2, user_id);
+    
+    // Not worth a mirror pass of its own; the next one carries it
+    local_change = true;
+    rc = sqlite3_step(stmt);
+    local_change = false;
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
 bool Database::create_session(const Session& session) {
     const std::string query = R"(
         INSERT INTO sessions (id, user_id, created_at, last_activity, is_active, ip_address, user_agent)
@@ -335,35 +1048,69 @@ bool Database::cleanup_expired_sessions(int timeout_seconds) {
 }
 
 bool Database::create_file(const File& file) {
-    const std::string query = R"(
-        INSERT INTO files (id, original_name, encrypted_name, size, mime_type, created_at, modified_at, user_id, is_deleted)
-        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
-    )";
-    
     sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    int rc = sqlite3_prepare_v2(db_, kInsertFile, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
         return false;
     }
     
+    bool ok = insert_file(stmt, file);
+    sqlite3_finalize(stmt);
+    
+    return ok;
+}
+
+bool Database::create_files(const std::vector<File>& files) {
+    return run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, kInsertFile, -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bool ok = true;
+        for (const auto& file : files) {
+            if (!insert_file(stmt, file)) {
+                ok = false;
+                break;
+            }
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    });
+}
+
+bool Database::insert_file(sqlite3_stmt* stmt, const File& file) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    
     bind_text(stmt, 1, file.id);
     bind_text(stmt, 2, file.original_name);
     bind_text(stmt, 3, file.encrypted_name);
-    bind_int(stmt, 4, file.size);
+    bind_int64(stmt, 4, file.size);
     bind_text(stmt, 5, file.mime_type);
     bind_int64(stmt, 6, file.created_at);
     bind_int64(stmt, 7, file.modified_at);
     bind_int(stmt, 8, file.user_id);
     bind_int(stmt, 9, file.is_deleted ? 1 : 0);
+    bind_text(stmt, 10, file.wrapped_key);
+    bind_int64(stmt, 11, file.key_id);
+    if (file.content_digest.empty()) {
+        sqlite3_bind_null(stmt, 12);
+    } else {
+        bind_text(stmt, 12, file.content_digest);
+    }
+    bind_int64(stmt, 13, file.stored_size);
+    if (file.folder_id.empty()) {
+        sqlite3_bind_null(stmt, 14);
+    } else {
+        bind_text(stmt, 14, file.folder_id);
+    }
+    bind_int64(stmt, 15, file.version);
     
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    return rc == SQLITE_DONE;
+    return sqlite3_step(stmt) == SQLITE_DONE;
 }
 
 std::shared_ptr<File> Database::get_file_by_id(const std::string& file_id) {
-    const std::string query = "SELECT * FROM files WHERE id = ? AND is_deleted = 0";
+    const std::string query = "SELECT " + std::string(kFileColumns) + " FROM files WHERE id = ? AND is_deleted = 0";
     
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
@@ -375,16 +1122,7 @@ std::shared_ptr<File> Database::get_file_by_id(const std::string& file_id) {
     
     rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) {
-        auto file = std::make_shared<File>();
-        file->id = get_text_column(stmt, 0);
-        file->original_name = get_text_column(stmt, 1);
-        file->encrypted_name = get_text_column(stmt, 2);
-        file->size = get_int_column(stmt, 3);
-        file->mime_type = get_text_column(stmt, 4);
-        file->created_at = get_int64_column(stmt, 5);
-        file->modified_at = get_int64_column(stmt, 6);
-        file->user_id = get_int_column(stmt, 7);
-        file->is_deleted = get_bool_column(stmt, 8);
+        auto file = std::make_shared<File>(file_from_row(stmt));
         
         sqlite3_finalize(stmt);
         return file;
@@ -395,8 +1133,7 @@ std::shared_ptr<File> Database::get_file_by_id(const std::string& file_id) {
 }
 
 std::vector<File> Database::get_user_files(int user_id, int limit, int offset) {
-    const std::string query = R"(
-        SELECT * FROM files 
+    const std::string query = "SELECT " + std::string(kFileColumns) + R"( FROM files 
         WHERE user_id = ? AND is_deleted = 0 
         ORDER BY created_at DESC 
         LIMIT ? OFFSET ?
@@ -415,18 +1152,99 @@ std::vector<File> Database::get_user_files(int user_id, int limit, int offset) {
     bind_int(stmt, 3, offset);
     
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        File file;
-        file.id = get_text_column(stmt, 0);
-        file.original_name = get_text_column(stmt, 1);
-        file.encrypted_name = get_text_column(stmt, 2);
-        file.size = get_int_column(stmt, 3);
-        file.mime_type = get_text_column(stmt, 4);
-        file.created_at = get_int64_column(stmt, 5);
-        file.modified_at = get_int64_column(stmt, 6);
-        file.user_id = get_int_column(stmt, 7);
-        file.is_deleted = get_bool_column(stmt, 8);
-        
-        files.push_back(file);
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+std::vector<File> Database::search_files(int user_id, const std::string& query, int limit) {
+    std::vector<File> files;
+    
+    // Terms are ANDed; trigrams need three characters, shorter terms are
+    // matched with LIKE on the folded name
+    std::vector<std::string> match_terms;
+    std::vector<std::string> like_terms;    // on the name
+    std::vector<std::string> like_types;    // on the mime type
+    std::istringstream words(codec::fold_text(query));
+    std::string word;
+    std::string first;
+    std::string phrase;
+    while (words >> word) {
+        bool type = word.compare(0, 5, "type:") == 0;
+        std::string term = type ? word.substr(5) : word;
+        if (term.empty()) {
+            continue;
+        }
+        if (!type) {
+            first = first.empty() ? term : first;
+            phrase += (phrase.empty() ? "" : " ") + term;
+        }
+        if (search_index_ && term.length() >= 3) {
+            std::string quoted;
+            for (char c : term) {
+                quoted += c == '"' ? "\"\"" : std::string(1, c);
+            }
+            match_terms.push_back(std::string(type ? "mime" : "name") + " : \"" + quoted + "\"");
+        } else {
+            (type ? like_types : like_terms).push_back("%" + like_escape(term) + "%");
+        }
+    }
+    if (match_terms.empty() && like_terms.empty() && like_types.empty()) {
+        return files;
+    }
+    
+    // Ranking uses the folded name and mime type stored in the index
+    std::string name = search_index_ ? "s.name" : "fold_text(f.original_name)";
+    std::string mime = search_index_ ? "s.mime" : "fold_text(f.mime_type)";
+    std::string sql = "SELECT " + file_columns("f.") + " FROM files f";
+    if (search_index_) {
+        sql += " JOIN files_fts s ON s.rowid = f.rowid";
+    }
+    sql += " WHERE f.user_id = ? AND f.is_deleted = 0";
+    std::string match;
+    for (const auto& term : match_terms) {
+        match += (match.empty() ? "" : " AND ") + term;
+    }
+    if (!match.empty()) {
+        sql += " AND files_fts MATCH ?";
+    }
+    for (size_t i = 0; i < like_terms.size(); i++) {
+        sql += " AND " + name + " LIKE ? ESCAPE '\\'";
+    }
+    for (size_t i = 0; i < like_types.size(); i++) {
+        sql += " AND " + mime + " LIKE ? ESCAPE '\\'";
+    }
+    sql += " ORDER BY " + name + " = ? DESC, " + name + " LIKE ? ESCAPE '\\' DESC, length(" + name +
+           "), f.modified_at DESC LIMIT ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Failed to prepare search: " << sqlite3_errmsg(db_) << std::endl;
+        return files;
+    }
+    
+    // bind_text does not copy: every bound string lives until the statement is done
+    std::string prefix = like_escape(first) + "%";
+    int index = 1;
+    bind_int(stmt, index++, user_id);
+    if (!match.empty()) {
+        bind_text(stmt, index++, match);
+    }
+    for (const auto& term : like_terms) {
+        bind_text(stmt, index++, term);
+    }
+    for (const auto& term : like_types) {
+        bind_text(stmt, index++, term);
+    }
+    bind_text(stmt, index++, phrase);
+    bind_text(stmt, index++, prefix);
+    bind_int(stmt, index++, limit);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
     }
     
     sqlite3_finalize(stmt);
@@ -449,7 +1267,7 @@ bool Database::update_file(const File& file) {
     
     bind_text(stmt, 1, file.original_name);
     bind_text(stmt, 2, file.encrypted_name);
-    bind_int(stmt, 3, file.size);
+    bind_int64(stmt, 3, file.size);
     bind_text(stmt, 4, file.mime_type);
     bind_int64(stmt, 5, file.modified_at);
     bind_int(stmt, 6, file.is_deleted ? 1 : 0);
@@ -462,7 +1280,7 @@ bool Database::update_file(const File& file) {
 }
 
 bool Database::delete_file(const std::string& file_id) {
-    const std::string query = "UPDATE files SET is_deleted = 1, modified_at = ? WHERE id = ?";
+    const std::string query = "UPDATE files SET is_deleted = 1, deleted_at = ?, modified_at = ? WHERE id = ? AND is_deleted = 0";
     
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
@@ -470,61 +1288,2007 @@ bool Database::delete_file(const std::string& file_id) {
         return false;
     }
     
-    bind_int64(stmt, 1, std::time(nullptr));
-    bind_text(stmt, 2, file_id);
+    std::time_t now = std::time(nullptr);
+    bind_int64(stmt, 1, now);
+    bind_int64(stmt, 2, now);
+    bind_text(stmt, 3, file_id);
     
     rc = sqlite3_step(stmt);
+    bool trashed = rc == SQLITE_DONE && sqlite3_changes(db_) > 0;
     sqlite3_finalize(stmt);
     
-    return rc == SQLITE_DONE;
+    return trashed;
 }
 
-bool Database::log_event(const SystemLog& log) {
-    const std::string query = R"(
-        INSERT INTO system_logs (level, message, component, created_at, user_id)
-        VALUES (?, ?, ?, ?, ?)
-    )";
+std::shared_ptr<File> Database::get_trashed_file(const std::string& file_id) {
+    const std::string query = "SELECT " + std::string(kFileColumns) +
+                              " FROM files WHERE id = ? AND is_deleted = 1 AND deleted_at IS NOT NULL";
     
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
-        return false;
+        return nullptr;
     }
     
-    bind_text(stmt, 1, log.level);
-    bind_text(stmt, 2, log.message);
-    bind_text(stmt, 3, log.component);
-    bind_int64(stmt, 4, log.created_at);
-    bind_int(stmt, 5, log.user_id);
+    bind_text(stmt, 1, file_id);
     
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    std::shared_ptr<File> file;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        file = std::make_shared<File>(file_from_row(stmt));
+    }
     
-    return rc == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    return file;
 }
 
-bool Database::execute_query(const std::string& query) {
-    char* err_msg = nullptr;
-    int rc = sqlite3_exec(db_, query.c_str(), nullptr, nullptr, &err_msg);
+std::vector<File> Database::get_user_trash(int user_id, int limit, int offset) {
+    const std::string query = "SELECT " + std::string(kFileColumns) + R"( FROM files
+        WHERE user_id = ? AND deleted_at IS NOT NULL
+        ORDER BY deleted_at DESC
+        LIMIT ? OFFSET ?
+    )";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << err_msg << std::endl;
-        sqlite3_free(err_msg);
-        return false;
+        return files;
     }
-    return true;
-}
-
-bool Database::bind_text(sqlite3_stmt* stmt, int index, const std::string& value) {
-    return sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_STATIC) == SQLITE_OK;
-}
-
-bool Database::bind_int(sqlite3_stmt* stmt, int index, int value) {
-    return sqlite3_bind_int(stmt, index, value) == SQLITE_OK;
+    
+    bind_int(stmt, 1, user_id);
+    bind_int(stmt, 2, limit);
+    bind_int(stmt, 3, offset);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
 }
 
-bool Database::bind_int64(sqlite3_stmt* stmt, int index, int64_t value) {
-    return sqlite3_bind_int64(stmt, index, value) == SQLITE_OK;
-}
+bool Database::get_trash_usage(int user_id, int64_t& files, int64_t& bytes) {
+    const std::string query = R"(
+        SELECT COUNT(*), COALESCE(SUM(COALESCE(NULLIF(stored_size, 0), size)), 0)
+        FROM files WHERE user_id = ? AND deleted_at IS NOT NULL
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        files = get_int64_column(stmt, 0);
+        bytes = get_int64_column(stmt, 1);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::restore_file(const std::string& file_id) {
+    const std::string query = R"(
+        UPDATE files SET is_deleted = 0, deleted_at = NULL, modified_at = ?,
+            folder_id = CASE WHEN folder_id IN (SELECT id FROM folders) THEN folder_id END
+        WHERE id = ? AND is_deleted = 1 AND deleted_at IS NOT NULL
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, std::time(nullptr));
+    bind_text(stmt, 2, file_id);
+    
+    rc = sqlite3_step(stmt);
+    bool restored = rc == SQLITE_DONE && sqlite3_changes(db_) > 0;
+    sqlite3_finalize(stmt);
+    
+    return restored;
+}
+
+int Database::purge_trash(int user_id, const std::string& file_id, std::time_t deleted_before, int limit,
+                          std::vector<std::string>& unreferenced) {
+    const std::string select = R"(
+        SELECT id, encrypted_name, user_id, content_digest, version FROM files
+        WHERE deleted_at IS NOT NULL AND deleted_at <= ? AND (? = 0 OR user_id = ?) AND (? = '' OR id = ?)
+        ORDER BY deleted_at LIMIT ?
+    )";
+    
+    int purged = 0;
+    bool ok = run_transaction([&]() {
+        struct Row {
+            std::string id;
+            std::string encrypted_name;
+            int user_id;
+            std::string digest;
+            int64_t version;
+        };
+        std::vector<Row> rows;
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, select.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_int64(stmt, 1, deleted_before);
+        bind_int(stmt, 2, user_id);
+        bind_int(stmt, 3, user_id);
+        bind_text(stmt, 4, file_id);
+        bind_text(stmt, 5, file_id);
+        bind_int(stmt, 6, limit);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            rows.push_back({get_text_column(stmt, 0), get_text_column(stmt, 1), get_int_column(stmt, 2),
+                            get_text_column(stmt, 3), get_int64_column(stmt, 4)});
+        }
+        sqlite3_finalize(stmt);
+        
+        // A versioned row has no object of its own; its chunks go with it
+        std::vector<std::string> chunk_names;
+        for (const auto& row : rows) {
+            if (row.version > 0) {
+                for (const auto& chunk : get_file_chunks(row.id)) {
+                    chunk_names.push_back(chunk.encrypted_name);
+                }
+            }
+        }
+        
+        if (sqlite3_prepare_v2(db_, "DELETE FROM files WHERE id = ?", -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bool deleted = true;
+        for (const auto& row : rows) {
+            bind_text(stmt, 1, row.id);
+            deleted = deleted && sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (!deleted) {
+            return false;
+        }
+        
+        // Deduplicated content goes with its last reference, anything else
+        // once no row shares its ciphertext
+        for (const auto& row : rows) {
+            if (row.version > 0) {
+                continue;
+            }
+            bool last = row.digest.empty() ? !has_file_ref(row.encrypted_name)
+                                           : release_object(row.user_id, row.digest);
+            if (last) {
+                unreferenced.push_back(row.encrypted_name);
+            }
+        }
+        // Copies of a versioned file share its chunk objects
+        std::sort(chunk_names.begin(), chunk_names.end());
+        chunk_names.erase(std::unique(chunk_names.begin(), chunk_names.end()), chunk_names.end());
+        for (const auto& name : chunk_names) {
+            if (!has_file_ref(name)) {
+                unreferenced.push_back(name);
+            }
+        }
+        purged = static_cast<int>(rows.size());
+        return true;
+    });
+    
+    if (!ok) {
+        unreferenced.clear();
+        return -1;
+    }
+    return purged;
+}
+
+std::vector<File> Database::get_files_after(const std::string& after_id, int limit) {
+    const std::string query = "SELECT " + std::string(kFileColumns) +
+                              " FROM files WHERE (is_deleted = 0 OR deleted_at IS NOT NULL) AND id > ? ORDER BY id LIMIT ?";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return files;
+    }
+    
+    bind_text(stmt, 1, after_id);
+    bind_int(stmt, 2, limit);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+bool Database::has_file_ref(const std::string& encrypted_name) {
+    const std::string query =
+        "SELECT 1 FROM files WHERE encrypted_name = ?1 AND (is_deleted = 0 OR deleted_at IS NOT NULL) "
+        "UNION ALL SELECT 1 FROM file_chunks WHERE encrypted_name = ?1 LIMIT 1";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    bool live = sqlite3_step(stmt) == SQLITE_ROW;
+    
+    sqlite3_finalize(stmt);
+    return live;
+}
+
+std::vector<ContentChunk> Database::get_file_chunks(const std::string& file_id) {
+    const std::string query =
+        "SELECT digest, encrypted_name, size, stored_size FROM file_chunks WHERE file_id = ?";
+    
+    std::vector<ContentChunk> chunks;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return chunks;
+    }
+    
+    bind_text(stmt, 1, file_id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        chunks.push_back({get_text_column(stmt, 0), get_text_column(stmt, 1), get_int64_column(stmt, 2),
+                          get_int64_column(stmt, 3)});
+    }
+    
+    sqlite3_finalize(stmt);
+    return chunks;
+}
+
+bool Database::add_file_version(const FileVersion& version, int64_t expected_version,
+                                const std::vector<ContentChunk>& new_chunks, const std::vector<std::string>& digests,
+                                const std::string& encrypted_name) {
+    return run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        bool ok = false;
+        
+        // Someone else wrote a version since this one was read
+        if (sqlite3_prepare_v2(db_, "SELECT version FROM files WHERE id = ?", -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, version.file_id);
+        ok = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) == expected_version;
+        sqlite3_finalize(stmt);
+        if (!ok) {
+            return false;
+        }
+        
+        // The first version replaces the row's object; from here on the chunk
+        // triggers keep stored_size
+        if (!encrypted_name.empty()) {
+            const std::string convert =
+                "UPDATE files SET encrypted_name = ?, content_digest = NULL, stored_size = 0 WHERE id = ?";
+            if (sqlite3_prepare_v2(db_, convert.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                return false;
+            }
+            bind_text(stmt, 1, encrypted_name);
+            bind_text(stmt, 2, version.file_id);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+            if (!ok) {
+                return false;
+            }
+        }
+        
+        const std::string insert_chunk = R"(
+            INSERT INTO file_chunks (file_id, digest, encrypted_name, size, stored_size) VALUES (?, ?, ?, ?, ?)
+        )";
+        if (sqlite3_prepare_v2(db_, insert_chunk.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        for (const auto& chunk : new_chunks) {
+            bind_text(stmt, 1, version.file_id);
+            bind_text(stmt, 2, chunk.digest);
+            bind_text(stmt, 3, chunk.encrypted_name);
+            bind_int64(stmt, 4, chunk.size);
+            bind_int64(stmt, 5, chunk.stored_size);
+            ok = ok && sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        
+        const std::string insert_version = R"(
+            INSERT INTO file_versions (file_id, version, size, chunk_count, written_bytes, created_at)
+            VALUES (?, ?, ?, ?, ?, ?)
+        )";
+        if (!ok || sqlite3_prepare_v2(db_, insert_version.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, version.file_id);
+        bind_int64(stmt, 2, version.version);
+        bind_int64(stmt, 3, version.size);
+        bind_int64(stmt, 4, static_cast<int64_t>(digests.size()));
+        bind_int64(stmt, 5, version.written_bytes);
+        bind_int64(stmt, 6, version.created_at);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        
+        const std::string insert_list = "INSERT INTO version_chunks (file_id, version, seq, digest) VALUES (?, ?, ?, ?)";
+        if (!ok || sqlite3_prepare_v2(db_, insert_list.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        for (size_t i = 0; ok && i < digests.size(); i++) {
+            bind_text(stmt, 1, version.file_id);
+            bind_int64(stmt, 2, version.version);
+            bind_int64(stmt, 3, static_cast<int64_t>(i));
+            bind_text(stmt, 4, digests[i]);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        
+        const std::string update_file = "UPDATE files SET version = ?, size = ?, modified_at = ? WHERE id = ?";
+        if (!ok || sqlite3_prepare_v2(db_, update_file.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_int64(stmt, 1, version.version);
+        bind_int64(stmt, 2, version.size);
+        bind_int64(stmt, 3, version.created_at);
+        bind_text(stmt, 4, version.file_id);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        return ok;
+    });
+}
+
+std::vector<FileVersion> Database::get_file_versions(const std::string& file_id) {
+    const std::string query = R"(
+        SELECT file_id, version, size, chunk_count, written_bytes, created_at FROM file_versions
+        WHERE file_id = ? ORDER BY version DESC
+    )";
+    
+    std::vector<FileVersion> versions;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return versions;
+    }
+    
+    bind_text(stmt, 1, file_id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        FileVersion version;
+        version.file_id = get_text_column(stmt, 0);
+        version.version = get_int64_column(stmt, 1);
+        version.size = get_int64_column(stmt, 2);
+        version.chunk_count = get_int64_column(stmt, 3);
+        version.written_bytes = get_int64_column(stmt, 4);
+        version.created_at = get_int64_column(stmt, 5);
+        versions.push_back(version);
+    }
+    
+    sqlite3_finalize(stmt);
+    return versions;
+}
+
+bool Database::get_version_chunks(const std::string& file_id, int64_t version, std::vector<ContentChunk>& chunks) {
+    const std::string query = R"(
+        SELECT c.digest, c.encrypted_name, c.size, c.stored_size FROM version_chunks v
+        JOIN file_chunks c ON c.file_id = v.file_id AND c.digest = v.digest
+        WHERE v.file_id = ? AND v.version = ? ORDER BY v.seq
+    )";
+    
+    chunks.clear();
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, file_id);
+    bind_int64(stmt, 2, version);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        chunks.push_back({get_text_column(stmt, 0), get_text_column(stmt, 1), get_int64_column(stmt, 2),
+                          get_int64_column(stmt, 3)});
+    }
+    
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+int Database::delete_file_versions(const std::string& file_id, int64_t version, int keep, std::time_t created_before,
+                                   std::vector<std::string>& unreferenced) {
+    // The current version is never deleted; the rest go by number, by count
+    // (newest first, the current one included) or by age
+    const std::string query = R"(
+        DELETE FROM file_versions WHERE file_id = ?1 AND version != (SELECT version FROM files WHERE id = ?1)
+        AND (?2 > 0 AND version = ?2
+             OR ?2 = 0 AND (?3 > 0 AND version NOT IN (SELECT version FROM file_versions WHERE file_id = ?1
+                                                       ORDER BY version DESC LIMIT ?3)
+                            OR created_at < ?4))
+    )";
+    
+    int deleted = 0;
+    bool ok = run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, file_id);
+        bind_int64(stmt, 2, version);
+        bind_int(stmt, 3, keep);
+        bind_int64(stmt, 4, created_before);
+        bool done = sqlite3_step(stmt) == SQLITE_DONE;
+        deleted = sqlite3_changes(db_);
+        sqlite3_finalize(stmt);
+        if (!done) {
+            return false;
+        }
+        if (deleted == 0) {
+            return true;
+        }
+        
+        // Chunks no remaining version lists
+        std::vector<std::string> names;
+        const std::string orphans = "SELECT encrypted_name FROM file_chunks WHERE file_id = ? AND refs <= 0";
+        if (sqlite3_prepare_v2(db_, orphans.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, file_id);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            names.push_back(get_text_column(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        
+        const std::string drop = "DELETE FROM file_chunks WHERE file_id = ? AND refs <= 0";
+        if (sqlite3_prepare_v2(db_, drop.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, file_id);
+        done = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        if (!done) {
+            return false;
+        }
+        
+        for (const auto& name : names) {
+            if (!has_file_ref(name)) {
+                unreferenced.push_back(name);
+            }
+        }
+        return true;
+    });
+    
+    if (!ok) {
+        unreferenced.clear();
+        return -1;
+    }
+    // Version rows are WITHOUT ROWID, and chunks still referenced leave files untouched
+    metadata_changes_ += deleted;
+    return deleted;
+}
+
+std::vector<std::string> Database::get_files_with_versions_before(std::time_t created_before, int limit) {
+    const std::string query = R"(
+        SELECT DISTINCT v.file_id FROM file_versions v JOIN files f ON f.id = v.file_id
+        WHERE v.created_at < ? AND v.version != f.version LIMIT ?
+    )";
+    
+    std::vector<std::string> file_ids;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return file_ids;
+    }
+    
+    bind_int64(stmt, 1, created_before);
+    bind_int(stmt, 2, limit);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        file_ids.push_back(get_text_column(stmt, 0));
+    }
+    
+    sqlite3_finalize(stmt);
+    return file_ids;
+}
+
+bool Database::create_versioned_copy(const File& copy, const std::string& source_id, int64_t source_version) {
+    return run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, kInsertFile, -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        File row = copy;
+        row.version = 1;
+        row.stored_size = 0;
+        bool ok = insert_file(stmt, row);
+        sqlite3_finalize(stmt);
+        
+        // The source's current version becomes the copy's first; chunk
+        // objects are shared, not copied
+        const std::vector<std::string> statements = {
+            R"(
+            INSERT INTO file_chunks (file_id, digest, encrypted_name, size, stored_size)
+            SELECT ?1, c.digest, c.encrypted_name, c.size, c.stored_size FROM file_chunks c
+            WHERE c.file_id = ?2 AND c.digest IN (SELECT digest FROM version_chunks WHERE file_id = ?2 AND version = ?3)
+            )",
+            R"(
+            INSERT INTO file_versions (file_id, version, size, chunk_count, written_bytes, created_at)
+            SELECT ?1, 1, size, chunk_count, 0, ?4 FROM file_versions WHERE file_id = ?2 AND version = ?3
+            )",
+            R"(
+            INSERT INTO version_chunks (file_id, version, seq, digest)
+            SELECT ?1, 1, seq, digest FROM version_chunks WHERE file_id = ?2 AND version = ?3
+            )"
+        };
+        for (size_t i = 0; i < statements.size(); i++) {
+            if (!ok || sqlite3_prepare_v2(db_, statements[i].c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                return false;
+            }
+            bind_text(stmt, 1, copy.id);
+            bind_text(stmt, 2, source_id);
+            bind_int64(stmt, 3, source_version);
+            bind_int64(stmt, 4, copy.created_at);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            // An empty version has no chunks, but the version row must exist
+            if (i == 1) {
+                ok = ok && sqlite3_changes(db_) > 0;
+            }
+            sqlite3_finalize(stmt);
+        }
+        return ok;
+    });
+}
+
+std::vector<File> Database::get_chunk_objects_after(const std::string& after_name, int limit) {
+    // One row per chunk object, carrying the data key of a file that holds it
+    const std::string query = "SELECT " + file_columns("f.") + R"(, c.encrypted_name, c.size FROM file_chunks c
+        JOIN files f ON f.id = c.file_id
+        WHERE c.encrypted_name > ? AND (f.is_deleted = 0 OR f.deleted_at IS NOT NULL)
+        GROUP BY c.encrypted_name ORDER BY c.encrypted_name LIMIT ?
+    )";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return files;
+    }
+    
+    bind_text(stmt, 1, after_name);
+    bind_int(stmt, 2, limit);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        File file = file_from_row(stmt);
+        file.encrypted_name = get_text_column(stmt, 16);
+        file.size = get_int64_column(stmt, 17);
+        file.version = 0;
+        files.push_back(file);
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+bool Database::create_folder(const Folder& folder) {
+    const std::string query = R"(
+        INSERT INTO folders (id, user_id, parent_id, name, created_at, modified_at)
+        VALUES (?, ?, NULLIF(?, ''), ?, ?, ?)
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, folder.id);
+    bind_int(stmt, 2, folder.user_id);
+    bind_text(stmt, 3, folder.parent_id);
+    bind_text(stmt, 4, folder.name);
+    bind_int64(stmt, 5, folder.created_at);
+    bind_int64(stmt, 6, folder.modified_at);
+    
+    // A name already taken in the parent fails the unique index
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+std::shared_ptr<Folder> Database::get_folder(const std::string& folder_id) {
+    const std::string query = "SELECT " + std::string(kFolderColumns) + " FROM folders WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return nullptr;
+    }
+    
+    bind_text(stmt, 1, folder_id);
+    
+    std::shared_ptr<Folder> folder;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        folder = std::make_shared<Folder>(folder_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return folder;
+}
+
+std::shared_ptr<Folder> Database::get_folder_by_name(int user_id, const std::string& parent_id,
+                                                     const std::string& name) {
+    const std::string query = "SELECT " + std::string(kFolderColumns) +
+                              " FROM folders WHERE user_id = ? AND COALESCE(parent_id, '') = ? AND name = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return nullptr;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, parent_id);
+    bind_text(stmt, 3, name);
+    
+    std::shared_ptr<Folder> folder;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        folder = std::make_shared<Folder>(folder_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return folder;
+}
+
+std::vector<Folder> Database::get_subfolders(int user_id, const std::string& parent_id, int limit, int offset) {
+    const std::string query = "SELECT " + std::string(kFolderColumns) + R"( FROM folders
+        WHERE user_id = ? AND COALESCE(parent_id, '') = ?
+        ORDER BY name
+        LIMIT ? OFFSET ?
+    )";
+    
+    std::vector<Folder> folders;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return folders;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, parent_id);
+    bind_int(stmt, 3, limit);
+    bind_int(stmt, 4, offset);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        folders.push_back(folder_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return folders;
+}
+
+std::vector<File> Database::get_folder_files(int user_id, const std::string& folder_id, int limit, int offset) {
+    const std::string query = "SELECT " + std::string(kFileColumns) + R"( FROM files
+        WHERE user_id = ? AND COALESCE(folder_id, '') = ? AND is_deleted = 0
+        ORDER BY original_name
+        LIMIT ? OFFSET ?
+    )";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return files;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, folder_id);
+    bind_int(stmt, 3, limit);
+    bind_int(stmt, 4, offset);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+std::vector<Folder> Database::get_folder_path(const std::string& folder_id) {
+    const std::string query = R"(
+        WITH RECURSIVE up (id, depth) AS (
+            SELECT ?, 0
+            UNION ALL
+            SELECT f.parent_id, up.depth + 1 FROM folders f JOIN up ON f.id = up.id WHERE f.parent_id IS NOT NULL
+        )
+        SELECT f.id, f.user_id, f.parent_id, f.name, f.created_at, f.modified_at
+        FROM up JOIN folders f ON f.id = up.id
+        ORDER BY up.depth DESC
+    )";
+    
+    std::vector<Folder> path;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return path;
+    }
+    
+    bind_text(stmt, 1, folder_id);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        path.push_back(folder_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return path;
+}
+
+bool Database::get_folder_stats(int user_id, const std::string& folder_id, FolderStats& stats) {
+    const std::string query = std::string(kSubtreeCte) + R"(
+        SELECT COUNT(*) - 1, COALESCE(SUM(s.file_count), 0), COALESCE(SUM(s.logical_bytes), 0)
+        FROM tree t LEFT JOIN folder_stats s ON s.user_id = ? AND s.folder_id = t.id
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, folder_id);
+    bind_int(stmt, 2, user_id);
+    bind_int(stmt, 3, user_id);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        stats.folders = get_int64_column(stmt, 0);
+        stats.file_count = get_int64_column(stmt, 1);
+        stats.logical_bytes = get_int64_column(stmt, 2);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::move_folder(int user_id, const std::string& folder_id, const std::string& parent_id,
+                           const std::string& name) {
+    // The cycle check and the update see the same tree
+    return run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        if (!parent_id.empty()) {
+            // The new parent must not be the folder or one of its descendants:
+            // walk up from it, one lookup per level
+            const char* ancestors = R"(
+                WITH RECURSIVE up (id) AS (
+                    SELECT id FROM folders WHERE id = ? AND user_id = ?
+                    UNION ALL
+                    SELECT f.parent_id FROM folders f JOIN up ON f.id = up.id WHERE f.parent_id IS NOT NULL
+                )
+                SELECT COUNT(*), COALESCE(SUM(id = ?), 0) FROM up
+            )";
+            if (sqlite3_prepare_v2(db_, ancestors, -1, &stmt, nullptr) != SQLITE_OK) {
+                return false;
+            }
+            bind_text(stmt, 1, parent_id);
+            bind_int(stmt, 2, user_id);
+            bind_text(stmt, 3, folder_id);
+            bool ok = sqlite3_step(stmt) == SQLITE_ROW && get_int64_column(stmt, 0) > 0 &&
+                      get_int64_column(stmt, 1) == 0;
+            sqlite3_finalize(stmt);
+            if (!ok) {
+                return false;
+            }
+        }
+        
+        const char* update = R"(
+            UPDATE folders SET parent_id = NULLIF(?, ''), name = ?, modified_at = ?
+            WHERE id = ? AND user_id = ?
+        )";
+        if (sqlite3_prepare_v2(db_, update, -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, parent_id);
+        bind_text(stmt, 2, name);
+        bind_int64(stmt, 3, std::time(nullptr));
+        bind_text(stmt, 4, folder_id);
+        bind_int(stmt, 5, user_id);
+        bool moved = sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(db_) > 0;
+        sqlite3_finalize(stmt);
+        return moved;
+    });
+}
+
+bool Database::move_file(int user_id, const std::string& file_id, const std::string& folder_id) {
+    const std::string query = R"(
+        UPDATE files SET folder_id = NULLIF(?, '')
+        WHERE id = ? AND user_id = ? AND is_deleted = 0
+          AND (? = '' OR EXISTS (SELECT 1 FROM folders WHERE id = ? AND user_id = ?))
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, folder_id);
+    bind_text(stmt, 2, file_id);
+    bind_int(stmt, 3, user_id);
+    bind_text(stmt, 4, folder_id);
+    bind_text(stmt, 5, folder_id);
+    bind_int(stmt, 6, user_id);
+    
+    rc = sqlite3_step(stmt);
+    bool moved = rc == SQLITE_DONE && sqlite3_changes(db_) > 0;
+    sqlite3_finalize(stmt);
+    
+    return moved;
+}
+
+int64_t Database::delete_folder(int user_id, const std::string& folder_id) {
+    int64_t trashed = -1;
+    bool ok = run_transaction([&]() {
+        // Files of the subtree go to the trash keeping their folder_id; a
+        // restore finds the folder gone and puts them in the root
+        std::string trash = std::string(kSubtreeCte) + R"(
+            UPDATE files SET is_deleted = 1, deleted_at = ?, modified_at = ?
+            WHERE user_id = ? AND is_deleted = 0 AND COALESCE(folder_id, '') IN (SELECT id FROM tree)
+        )";
+        std::string remove = std::string(kSubtreeCte) + "DELETE FROM folders WHERE user_id = ? AND id IN (SELECT id FROM tree)";
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, trash.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        std::time_t now = std::time(nullptr);
+        bind_text(stmt, 1, folder_id);
+        bind_int(stmt, 2, user_id);
+        bind_int64(stmt, 3, now);
+        bind_int64(stmt, 4, now);
+        bind_int(stmt, 5, user_id);
+        bool done = sqlite3_step(stmt) == SQLITE_DONE;
+        trashed = sqlite3_changes(db_);
+        sqlite3_finalize(stmt);
+        if (!done || sqlite3_prepare_v2(db_, remove.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, folder_id);
+        bind_int(stmt, 2, user_id);
+        bind_int(stmt, 3, user_id);
+        done = sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(db_) > 0;
+        sqlite3_finalize(stmt);
+        return done;
+    });
+    return ok ? trashed : -1;
+}
+
+bool Database::get_user_storage(int user_id, int64_t& logical_bytes, int64_t& stored_bytes) {
+    // Counters maintained by triggers; no row yet means nothing stored
+    const std::string query = R"(
+        SELECT COALESCE(SUM(logical_bytes), 0), COALESCE(SUM(stored_bytes), 0)
+        FROM user_stats WHERE user_id = ?
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        logical_bytes = get_int64_column(stmt, 0);
+        stored_bytes = get_int64_column(stmt, 1);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+std::vector<StorageUsage> Database::get_user_usage(int user_id) {
+    const std::string query = R"(
+        SELECT mime_class, file_count, logical_bytes FROM user_type_stats
+        WHERE user_id = ? AND file_count > 0 ORDER BY logical_bytes DESC
+    )";
+    
+    std::vector<StorageUsage> usage;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return usage;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        StorageUsage row;
+        row.mime_class = get_text_column(stmt, 0);
+        row.file_count = get_int64_column(stmt, 1);
+        row.logical_bytes = get_int64_column(stmt, 2);
+        usage.push_back(row);
+    }
+    
+    sqlite3_finalize(stmt);
+    return usage;
+}
+
+int Database::rebuild_user_stats() {
+    // Counters that dropped to zero stay behind as empty rows; they are not drift
+    std::vector<std::string> statements = {
+        "DELETE FROM user_stats WHERE file_count = 0 AND logical_bytes = 0 AND stored_bytes = 0",
+        "DELETE FROM user_type_stats WHERE file_count = 0 AND logical_bytes = 0",
+        "DELETE FROM folder_stats WHERE file_count = 0 AND logical_bytes = 0"
+    };
+    for (const std::string table : {"user_stats", "user_type_stats", "folder_stats"}) {
+        statements.push_back("DROP TABLE IF EXISTS temp." + table + "_before");
+        statements.push_back("CREATE TEMP TABLE " + table + "_before AS SELECT * FROM " + table);
+        statements.push_back("DELETE FROM " + table);
+    }
+    for (auto& statement : user_stats_rebuild_sql()) {
+        statements.push_back(statement);
+    }
+    statements.push_back(folder_stats_rebuild_sql());
+    
+    bool ok = execute_query("BEGIN IMMEDIATE");
+    for (const auto& statement : statements) {
+        ok = ok && execute_query(statement);
+    }
+    int drift = 0;
+    for (const std::string table : {"user_stats", "user_type_stats", "folder_stats"}) {
+        std::string before = "temp." + table + "_before";
+        ok = ok && execute_query(
+            "SELECT (SELECT COUNT(*) FROM (SELECT * FROM " + before + " EXCEPT SELECT * FROM " + table + ")) + "
+            "(SELECT COUNT(*) FROM (SELECT * FROM " + table + " EXCEPT SELECT * FROM " + before + "))",
+            [&drift](sqlite3_stmt* stmt) {
+                drift += sqlite3_column_int(stmt, 0);
+                return SQLITE_OK;
+            });
+    }
+    if (!ok || !execute_query("COMMIT")) {
+        execute_query("ROLLBACK");
+        std::cerr << "Failed to rebuild storage counters: " << sqlite3_errmsg(db_) << std::endl;
+        return -1;
+    }
+    execute_query("DROP TABLE IF EXISTS temp.user_stats_before");
+    execute_query("DROP TABLE IF EXISTS temp.user_type_stats_before");
+    execute_query("DROP TABLE IF EXISTS temp.folder_stats_before");
+    // user_type_stats and folder_stats are WITHOUT ROWID
+    metadata_changes_ += drift;
+    return drift;
+}
+
+int64_t Database::get_user_quota(int user_id) {
+    const std::string query = "SELECT quota_bytes FROM users WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return -1;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    
+    int64_t quota = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        quota = get_int64_column(stmt, 0);
+    }
+    
+    sqlite3_finalize(stmt);
+    return quota;
+}
+
+bool Database::set_user_quota(int user_id, int64_t quota_bytes) {
+    const std::string query = "UPDATE users SET quota_bytes = ? WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    if (quota_bytes < 0) {
+        sqlite3_bind_null(stmt, 1);
+    } else {
+        bind_int64(stmt, 1, quota_bytes);
+    }
+    bind_int(stmt, 2, user_id);
+    
+    rc = sqlite3_step(stmt);
+    bool updated = rc == SQLITE_DONE && sqlite3_changes(db_) > 0;
+    sqlite3_finalize(stmt);
+    return updated;
+}
+
+std::vector<File> Database::get_files_to_rekey(uint32_t key_id, int limit) {
+    // Includes deleted rows: their ciphertext may still be restored or read
+    const std::string query = "SELECT " + std::string(kFileColumns) + " FROM files WHERE key_id != ? LIMIT ?";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return files;
+    }
+    
+    bind_int64(stmt, 1, key_id);
+    bind_int(stmt, 2, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+int Database::count_files_to_rekey(uint32_t key_id) {
+    const std::string query = "SELECT COUNT(*) FROM files WHERE key_id != ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return -1;
+    }
+    
+    bind_int64(stmt, 1, key_id);
+    int count = sqlite3_step(stmt) == SQLITE_ROW ? get_int_column(stmt, 0) : -1;
+    
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+std::vector<File> Database::get_legacy_key_files(int limit) {
+    const std::string query = "SELECT " + std::string(kFileColumns) + " FROM files "
+                              "WHERE key_id = 0 AND version = 0 ORDER BY created_at DESC LIMIT ?";
+    
+    std::vector<File> files;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return files;
+    }
+    
+    bind_int(stmt, 1, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        files.push_back(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+bool Database::update_file_key(const std::string& file_id, const std::string& wrapped_key, uint32_t key_id,
+                               uint32_t expected_key_id) {
+    // Compare-and-set so a concurrent rewrap of the same row is never overwritten
+    const std::string query = "UPDATE files SET wrapped_key = ?, key_id = ? WHERE id = ? AND key_id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, wrapped_key);
+    bind_int64(stmt, 2, key_id);
+    bind_text(stmt, 3, file_id);
+    bind_int64(stmt, 4, expected_key_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+std::shared_ptr<File> Database::get_file_by_encrypted_name(const std::string& encrypted_name) {
+    // Deleted rows still carry a valid wrapped key for shared ciphertext
+    const std::string query = "SELECT " + std::string(kFileColumns) + " FROM files WHERE encrypted_name = ? LIMIT 1";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return nullptr;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    
+    std::shared_ptr<File> file;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        file = std::make_shared<File>(file_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return file;
+}
+
+bool Database::acquire_object(int user_id, const std::string& digest, const std::string& encrypted_name, int64_t size,
+                              std::string& stored_name) {
+    // Single upsert statement: either creates the object or takes another reference
+    const std::string query = R"(
+        INSERT INTO objects (user_id, digest, encrypted_name, size, refcount, created_at)
+        VALUES (?, ?, ?, ?, 1, ?)
+        ON CONFLICT (user_id, digest) DO UPDATE SET refcount = refcount + 1
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, digest);
+    bind_text(stmt, 3, encrypted_name);
+    bind_int64(stmt, 4, size);
+    bind_int64(stmt, 5, std::time(nullptr));
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        return false;
+    }
+    
+    int64_t stored_size = 0;
+    return find_object(user_id, digest, stored_name, stored_size);
+}
+
+bool Database::add_object_ref(int user_id, const std::string& digest) {
+    const std::string query = "UPDATE objects SET refcount = refcount + 1 WHERE user_id = ? AND digest = ? AND refcount > 0";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, digest);
+    
+    rc = sqlite3_step(stmt);
+    bool added = rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+    sqlite3_finalize(stmt);
+    
+    return added;
+}
+
+bool Database::find_object(int user_id, const std::string& digest, std::string& encrypted_name, int64_t& size) {
+    const std::string query = "SELECT encrypted_name, size FROM objects WHERE user_id = ? AND digest = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, digest);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        encrypted_name = get_text_column(stmt, 0);
+        size = get_int64_column(stmt, 1);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::release_object(int user_id, const std::string& digest) {
+    const std::vector<std::string> queries = {
+        "UPDATE objects SET refcount = refcount - 1 WHERE user_id = ? AND digest = ?",
+        "DELETE FROM objects WHERE user_id = ? AND digest = ? AND refcount <= 0"
+    };
+    
+    bool removed = false;
+    for (const auto& query : queries) {
+        sqlite3_stmt* stmt;
+        int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+        if (rc != SQLITE_OK) {
+            return false;
+        }
+        
+        bind_int(stmt, 1, user_id);
+        bind_text(stmt, 2, digest);
+        
+        rc = sqlite3_step(stmt);
+        removed = rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+        sqlite3_finalize(stmt);
+    }
+    
+    // True only when the last reference went away
+    return removed;
+}
+
+std::shared_ptr<UserKey> Database::get_user_key(int user_id, const std::string& purpose) {
+    const std::string query = "SELECT user_id, purpose, wrapped_key, key_id FROM user_keys WHERE user_id = ? AND purpose = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return nullptr;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    bind_text(stmt, 2, purpose);
+    
+    std::shared_ptr<UserKey> key;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        key = std::make_shared<UserKey>();
+        key->user_id = get_int_column(stmt, 0);
+        key->purpose = get_text_column(stmt, 1);
+        key->wrapped_key = get_text_column(stmt, 2);
+        key->key_id = static_cast<uint32_t>(get_int64_column(stmt, 3));
+    }
+    
+    sqlite3_finalize(stmt);
+    return key;
+}
+
+bool Database::create_user_key(const UserKey& key) {
+    // First writer wins; callers re-read to pick up a concurrently created key
+    const std::string query = "INSERT OR IGNORE INTO user_keys (user_id, purpose, wrapped_key, key_id) VALUES (?, ?, ?, ?)";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, key.user_id);
+    bind_text(stmt, 2, key.purpose);
+    bind_text(stmt, 3, key.wrapped_key);
+    bind_int64(stmt, 4, key.key_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+std::vector<UserKey> Database::get_user_keys_to_rekey(uint32_t key_id, int limit) {
+    const std::string query = "SELECT user_id, purpose, wrapped_key, key_id FROM user_keys WHERE key_id != ? LIMIT ?";
+    
+    std::vector<UserKey> keys;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return keys;
+    }
+    
+    bind_int64(stmt, 1, key_id);
+    bind_int(stmt, 2, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        UserKey key;
+        key.user_id = get_int_column(stmt, 0);
+        key.purpose = get_text_column(stmt, 1);
+        key.wrapped_key = get_text_column(stmt, 2);
+        key.key_id = static_cast<uint32_t>(get_int64_column(stmt, 3));
+        keys.push_back(key);
+    }
+    
+    sqlite3_finalize(stmt);
+    return keys;
+}
+
+bool Database::update_user_key(const UserKey& key, uint32_t expected_key_id) {
+    const std::string query = "UPDATE user_keys SET wrapped_key = ?, key_id = ? WHERE user_id = ? AND purpose = ? AND key_id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, key.wrapped_key);
+    bind_int64(stmt, 2, key.key_id);
+    bind_int(stmt, 3, key.user_id);
+    bind_text(stmt, 4, key.purpose);
+    bind_int64(stmt, 5, expected_key_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+bool Database::create_upload_session(const UploadSession& session) {
+    const std::string query = "INSERT INTO upload_sessions (" + std::string(kUploadSessionColumns) +
+                              ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+        return false;
+    }
+    
+    bind_text(stmt, 1, session.id);
+    bind_int(stmt, 2, session.user_id);
+    bind_text(stmt, 3, session.file_id);
+    bind_text(stmt, 4, session.original_name);
+    bind_int64(stmt, 5, session.size);
+    bind_int64(stmt, 6, session.chunk_size);
+    bind_text(stmt, 7, session.stream_header);
+    bind_text(stmt, 8, session.wrapped_key);
+    bind_int64(stmt, 9, session.key_id);
+    bind_int64(stmt, 10, session.created_at);
+    bind_int64(stmt, 11, session.updated_at);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+std::shared_ptr<UploadSession> Database::get_upload_session(const std::string& session_id) {
+    const std::string query = "SELECT " + std::string(kUploadSessionColumns) + " FROM upload_sessions WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return nullptr;
+    }
+    
+    bind_text(stmt, 1, session_id);
+    
+    std::shared_ptr<UploadSession> session;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        session = std::make_shared<UploadSession>(upload_session_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return session;
+}
+
+std::vector<UploadSession> Database::get_user_upload_sessions(int user_id) {
+    const std::string query = "SELECT " + std::string(kUploadSessionColumns) +
+                              " FROM upload_sessions WHERE user_id = ? ORDER BY created_at";
+    
+    std::vector<UploadSession> sessions;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return sessions;
+    }
+    
+    bind_int(stmt, 1, user_id);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        sessions.push_back(upload_session_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return sessions;
+}
+
+std::vector<UploadSession> Database::get_expired_upload_sessions(std::time_t before, int limit) {
+    const std::string query = "SELECT " + std::string(kUploadSessionColumns) +
+                              " FROM upload_sessions WHERE updated_at < ? ORDER BY updated_at LIMIT ?";
+    
+    std::vector<UploadSession> sessions;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return sessions;
+    }
+    
+    bind_int64(stmt, 1, before);
+    bind_int(stmt, 2, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        sessions.push_back(upload_session_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return sessions;
+}
+
+bool Database::delete_upload_session(const std::string& session_id) {
+    // upload_chunks rows go with it (ON DELETE CASCADE)
+    const std::string query = "DELETE FROM upload_sessions WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, session_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+std::vector<UploadChunk> Database::get_upload_chunks(const std::string& session_id) {
+    const std::string query = "SELECT chunk_index, stored_size, digest FROM upload_chunks "
+                              "WHERE session_id = ? ORDER BY chunk_index";
+    
+    std::vector<UploadChunk> chunks;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return chunks;
+    }
+    
+    bind_text(stmt, 1, session_id);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        UploadChunk chunk;
+        chunk.index = get_int64_column(stmt, 0);
+        chunk.stored_size = get_int64_column(stmt, 1);
+        chunk.digest = get_text_column(stmt, 2);
+        chunks.push_back(chunk);
+    }
+    
+    sqlite3_finalize(stmt);
+    return chunks;
+}
+
+bool Database::get_upload_chunk(const std::string& session_id, int64_t index, UploadChunk& chunk) {
+    const std::string query = "SELECT chunk_index, stored_size, digest FROM upload_chunks "
+                              "WHERE session_id = ? AND chunk_index = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, session_id);
+    bind_int64(stmt, 2, index);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        chunk.index = get_int64_column(stmt, 0);
+        chunk.stored_size = get_int64_column(stmt, 1);
+        chunk.digest = get_text_column(stmt, 2);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::add_upload_chunk(const std::string& session_id, const UploadChunk& chunk) {
+    const std::string insert = "INSERT OR IGNORE INTO upload_chunks (session_id, chunk_index, stored_size, digest) "
+                               "VALUES (?, ?, ?, ?)";
+    const std::string touch = "UPDATE upload_sessions SET updated_at = ? WHERE id = ?";
+    
+    return run_transaction([&]() {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, insert.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_text(stmt, 1, session_id);
+        bind_int64(stmt, 2, chunk.index);
+        bind_int64(stmt, 3, chunk.stored_size);
+        bind_text(stmt, 4, chunk.digest);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE || sqlite3_changes(db_) != 1) {
+            return false;
+        }
+        
+        if (sqlite3_prepare_v2(db_, touch.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+        bind_int64(stmt, 1, std::time(nullptr));
+        bind_text(stmt, 2, session_id);
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        // The session may have been committed or aborted meanwhile
+        return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+    });
+}
+
+std::vector<UploadSession> Database::get_upload_sessions_to_rekey(uint32_t key_id, int limit) {
+    const std::string query = "SELECT " + std::string(kUploadSessionColumns) +
+                              " FROM upload_sessions WHERE key_id != ? LIMIT ?";
+    
+    std::vector<UploadSession> sessions;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return sessions;
+    }
+    
+    bind_int64(stmt, 1, key_id);
+    bind_int(stmt, 2, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        sessions.push_back(upload_session_from_row(stmt));
+    }
+    
+    sqlite3_finalize(stmt);
+    return sessions;
+}
+
+bool Database::update_upload_session_key(const std::string& session_id, const std::string& wrapped_key,
+                                         uint32_t key_id, uint32_t expected_key_id) {
+    const std::string query = "UPDATE upload_sessions SET wrapped_key = ?, key_id = ? WHERE id = ? AND key_id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, wrapped_key);
+    bind_int64(stmt, 2, key_id);
+    bind_text(stmt, 3, session_id);
+    bind_int64(stmt, 4, expected_key_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+int64_t Database::create_pack(const std::string& encrypted_name) {
+    const std::string insert = "INSERT INTO packs (encrypted_name, sealed, created_at) VALUES (?, 0, ?)";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, insert.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return 0;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    bind_int64(stmt, 2, std::time(nullptr));
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        return 0;
+    }
+    
+    // Looked up by name: last_insert_rowid is shared by every thread on the connection
+    int64_t pack_id = 0;
+    const std::string select = "SELECT id FROM packs WHERE encrypted_name = ?";
+    if (sqlite3_prepare_v2(db_, select.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    bind_text(stmt, 1, encrypted_name);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        pack_id = get_int64_column(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return pack_id;
+}
+
+std::vector<Pack> Database::get_packs() {
+    const std::string query = R"(
+        SELECT p.id, p.encrypted_name, p.sealed, p.created_at, COUNT(e.encrypted_name), COALESCE(SUM(e.length), 0)
+        FROM packs p LEFT JOIN pack_entries e ON e.pack_id = p.id
+        GROUP BY p.id ORDER BY p.id
+    )";
+    
+    std::vector<Pack> packs;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return packs;
+    }
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Pack pack;
+        pack.id = get_int64_column(stmt, 0);
+        pack.encrypted_name = get_text_column(stmt, 1);
+        pack.sealed = get_int_column(stmt, 2) != 0;
+        pack.created_at = get_int64_column(stmt, 3);
+        pack.entries = get_int64_column(stmt, 4);
+        pack.live_bytes = get_int64_column(stmt, 5);
+        packs.push_back(pack);
+    }
+    
+    sqlite3_finalize(stmt);
+    return packs;
+}
+
+bool Database::seal_pack(int64_t pack_id) {
+    const std::string query = "UPDATE packs SET sealed = 1 WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, pack_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::delete_pack(int64_t pack_id) {
+    // Only empty segments are dropped; entries must have been moved or released
+    const std::string query = R"(
+        DELETE FROM packs WHERE id = ? AND NOT EXISTS (SELECT 1 FROM pack_entries WHERE pack_id = ?)
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, pack_id);
+    bind_int64(stmt, 2, pack_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+bool Database::is_pack_segment(const std::string& encrypted_name) {
+    const std::string query = "SELECT 1 FROM packs WHERE encrypted_name = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::add_pack_entry(const PackEntry& entry) {
+    const std::string query = R"(
+        INSERT INTO pack_entries (encrypted_name, pack_id, pack_offset, length) VALUES (?, ?, ?, ?)
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, entry.encrypted_name);
+    bind_int64(stmt, 2, entry.pack_id);
+    bind_int64(stmt, 3, entry.offset);
+    bind_int64(stmt, 4, entry.length);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::get_pack_entry(const std::string& encrypted_name, PackEntry& entry) {
+    const std::string query = R"(
+        SELECT e.pack_id, e.pack_offset, e.length, p.encrypted_name
+        FROM pack_entries e JOIN packs p ON p.id = e.pack_id
+        WHERE e.encrypted_name = ?
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        entry.encrypted_name = encrypted_name;
+        entry.pack_id = get_int64_column(stmt, 0);
+        entry.offset = get_int64_column(stmt, 1);
+        entry.length = get_int64_column(stmt, 2);
+        entry.segment = get_text_column(stmt, 3);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+std::vector<PackEntry> Database::get_pack_entries(int64_t pack_id) {
+    const std::string query = R"(
+        SELECT encrypted_name, pack_offset, length FROM pack_entries WHERE pack_id = ? ORDER BY pack_offset
+    )";
+    
+    std::vector<PackEntry> entries;
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return entries;
+    }
+    
+    bind_int64(stmt, 1, pack_id);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        PackEntry entry;
+        entry.encrypted_name = get_text_column(stmt, 0);
+        entry.pack_id = pack_id;
+        entry.offset = get_int64_column(stmt, 1);
+        entry.length = get_int64_column(stmt, 2);
+        entries.push_back(entry);
+    }
+    
+    sqlite3_finalize(stmt);
+    return entries;
+}
+
+bool Database::move_pack_entry(const std::string& encrypted_name, int64_t from_pack, int64_t to_pack, int64_t offset) {
+    // Fails if the entry was released (or moved) since it was read
+    const std::string query = R"(
+        UPDATE pack_entries SET pack_id = ?, pack_offset = ? WHERE encrypted_name = ? AND pack_id = ?
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, to_pack);
+    bind_int64(stmt, 2, offset);
+    bind_text(stmt, 3, encrypted_name);
+    bind_int64(stmt, 4, from_pack);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+bool Database::delete_pack_entry(const std::string& encrypted_name) {
+    const std::string query = "DELETE FROM pack_entries WHERE encrypted_name = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, encrypted_name);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE && sqlite3_changes(db_) == 1;
+}
+
+bool Database::enqueue_shred(const std::string& path, int64_t size) {
+    const std::string query = "INSERT INTO shred_queue (path, size, bytes_done, created_at) VALUES (?, ?, 0, ?)";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, path);
+    bind_int64(stmt, 2, size);
+    bind_int64(stmt, 3, std::time(nullptr));
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+std::vector<ShredJob> Database::get_shred_jobs(int limit) {
+    std::vector<ShredJob> jobs;
+    const std::string query = "SELECT id, path, size, bytes_done, created_at FROM shred_queue ORDER BY id LIMIT ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return jobs;
+    }
+    
+    bind_int(stmt, 1, limit);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        ShredJob job;
+        job.id = get_int_column(stmt, 0);
+        job.path = get_text_column(stmt, 1);
+        job.size = get_int64_column(stmt, 2);
+        job.bytes_done = get_int64_column(stmt, 3);
+        job.created_at = get_int64_column(stmt, 4);
+        jobs.push_back(job);
+    }
+    
+    sqlite3_finalize(stmt);
+    return jobs;
+}
+
+bool Database::update_shred_progress(int job_id, int64_t bytes_done) {
+    const std::string query = "UPDATE shred_queue SET bytes_done = ? WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, bytes_done);
+    bind_int(stmt, 2, job_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::delete_shred_job(int job_id) {
+    const std::string query = "DELETE FROM shred_queue WHERE id = ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int(stmt, 1, job_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::get_shred_backlog(int64_t& files, int64_t& bytes) {
+    const std::string query = "SELECT COUNT(*), COALESCE(SUM(size - bytes_done), 0) FROM shred_queue";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        files = get_int64_column(stmt, 0);
+        bytes = get_int64_column(stmt, 1);
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::delete_mirror_queue(int64_t last_seq) {
+    const std::string query = "DELETE FROM mirror_queue WHERE seq <= ?";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_int64(stmt, 1, last_seq);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::get_mirror_backlog(int64_t& entries, std::time_t& oldest) {
+    const std::string query = "SELECT COUNT(*), COALESCE(MIN(queued_at), 0) FROM mirror_queue";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        entries = get_int64_column(stmt, 0);
+        oldest = static_cast<std::time_t>(get_int64_column(stmt, 1));
+    }
+    
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+int64_t Database::metadata_change_count() {
+    return metadata_changes_;
+}
+
+bool Database::log_event(const SystemLog& log) {
+    const std::string query = R"(
+        INSERT INTO system_logs (level, message, component, created_at, user_id)
+        VALUES (?, ?, ?, ?, ?)
+    )";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        return false;
+    }
+    
+    bind_text(stmt, 1, log.level);
+    bind_text(stmt, 2, log.message);
+    bind_text(stmt, 3, log.component);
+    bind_int64(stmt, 4, log.created_at);
+    bind_int(stmt, 5, log.user_id);
+    
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_DONE;
+}
+
+bool Database::execute_query(const std::string& query) {
+    char* err_msg = nullptr;
+    int rc = sqlite3_exec(db_, query.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        std::cerr << "SQL error: " << err_msg << std::endl;
+        sqlite3_free(err_msg);
+        return false;
+    }
+    return true;
+}
+
+bool Database::run_transaction(const std::function<bool()>& body) {
+    sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+    sqlite3_mutex_enter(mutex);
+    bool begun = execute_query("BEGIN IMMEDIATE");
+    bool ok = begun && body() && execute_query("COMMIT");
+    if (begun && !ok) {
+        execute_query("ROLLBACK");
+    }
+    sqlite3_mutex_leave(mutex);
+    return ok;
+}
+
+bool Database::execute_query(const std::string& query, std::function<int(sqlite3_stmt*)> callback) {
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "SQL error: " << sqlite3_errmsg(db_) << std::endl;
+        return false;
+    }
+    
+    // The callback returns SQLITE_OK to continue with the next row
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (callback(stmt) != SQLITE_OK) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool Database::bind_text(sqlite3_stmt* stmt, int index, const std::string& value) {
+    return sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_STATIC) == SQLITE_OK;
+}
+
+bool Database::bind_int(sqlite3_stmt* stmt, int index, int value) {
+    return sqlite3_bind_int(stmt, index, value) == SQLITE_OK;
+}
+
+bool Database::bind_int64(sqlite3_stmt* stmt, int index, int64_t value) {
+    return sqlite3_bind_int64(stmt, index, value) == SQLITE_OK;
+}
 
 std::string Database::get_text_column(sqlite3_stmt* stmt, int column) {
     const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
@@ -535,6 +3299,54 @@ int Database::get_int_column(sqlite3_stmt* stmt, int column) {
     return sqlite3_column_int(stmt, column);
 }
 
+File Database::file_from_row(sqlite3_stmt* stmt) {
+    File file;
+    file.id = get_text_column(stmt, 0);
+    file.original_name = get_text_column(stmt, 1);
+    file.encrypted_name = get_text_column(stmt, 2);
+    file.size = get_int64_column(stmt, 3);
+    file.mime_type = get_text_column(stmt, 4);
+    file.created_at = get_int64_column(stmt, 5);
+    file.modified_at = get_int64_column(stmt, 6);
+    file.user_id = get_int_column(stmt, 7);
+    file.is_deleted = get_bool_column(stmt, 8);
+    file.wrapped_key = get_text_column(stmt, 9);
+    file.key_id = static_cast<uint32_t>(get_int64_column(stmt, 10));
+    file.content_digest = get_text_column(stmt, 11);
+    file.stored_size = get_int64_column(stmt, 12);
+    file.deleted_at = get_int64_column(stmt, 13);
+    file.folder_id = get_text_column(stmt, 14);
+    file.version = get_int64_column(stmt, 15);
+    return file;
+}
+
+Folder Database::folder_from_row(sqlite3_stmt* stmt) {
+    Folder folder;
+    folder.id = get_text_column(stmt, 0);
+    folder.user_id = get_int_column(stmt, 1);
+    folder.parent_id = get_text_column(stmt, 2);
+    folder.name = get_text_column(stmt, 3);
+    folder.created_at = get_int64_column(stmt, 4);
+    folder.modified_at = get_int64_column(stmt, 5);
+    return folder;
+}
+
+UploadSession Database::upload_session_from_row(sqlite3_stmt* stmt) {
+    UploadSession session;
+    session.id = get_text_column(stmt, 0);
+    session.user_id = get_int_column(stmt, 1);
+    session.file_id = get_text_column(stmt, 2);
+    session.original_name = get_text_column(stmt, 3);
+    session.size = get_int64_column(stmt, 4);
+    session.chunk_size = get_int64_column(stmt, 5);
+    session.stream_header = get_text_column(stmt, 6);
+    session.wrapped_key = get_text_column(stmt, 7);
+    session.key_id = static_cast<uint32_t>(get_int64_column(stmt, 8));
+    session.created_at = get_int64_column(stmt, 9);
+    session.updated_at = get_int64_column(stmt, 10);
+    return session;
+}
+
 int64_t Database::get_int64_column(sqlite3_stmt* stmt, int column) {
     return sqlite3_column_int64(stmt, column);
 }
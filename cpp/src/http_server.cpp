@@ -5,6 +5,12 @@
 #include "wifi.h"
 #include "system.h"
 #include "crypto.h"
+#include "shredder.h"
+#include "key_migrator.h"
+#include "vault_checker.h"
+#include "backup.h"
+#include "mirror.h"
+#include "codec.h"
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -15,6 +21,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <cstring>
+#include <cerrno>
+#include <cstdio>
 
 namespace vaultusb {
 
@@ -37,12 +45,28 @@ void HttpServer::run() {
     register_api_routes();
     running_ = true;
     
-    std::cout << "VaultUSB HTTP server listening on 0.0.0.0:" << port_ << std::endl;
+    // Bodies are read whole; upload chunks are the largest ones
+    max_request_size_ = std::max<size_t>(1024 * 1024, StorageManager::instance().upload_chunk_size() + 64 * 1024);
+    
+    size_t worker_count = static_cast<size_t>(std::max(Config::instance().http_workers(), 1));
+    for (size_t i = 0; i < worker_count; i++) {
+        workers_.emplace_back(&HttpServer::worker_loop, this);
+    }
+    
+    std::cout << "VaultUSB HTTP server listening on 0.0.0.0:" << port_
+              << " (" << worker_count << " workers)" << std::endl;
     accept_connections();
+    
+    connections_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
 }
 
 void HttpServer::stop() {
     running_ = false;
+    connections_cv_.notify_all();
     if (server_socket_ >= 0) {
         close(server_socket_);
         server_socket_ = -1;
@@ -54,6 +78,12 @@ void HttpServer::register_route(const std::string& method, const std::string& pa
     routes_[method][path] = handler;
 }
 
+void HttpServer::register_streaming_route(const std::string& method, const std::string& path,
+                                          std::function<HttpResponse(const HttpRequest&)> handler) {
+    streaming_routes_.insert(method + " " + path);
+    register_route(method, path, handler);
+}
+
 void HttpServer::add_middleware(std::function<bool(const HttpRequest&, HttpResponse&)> middleware) {
     middlewares_.push_back(middleware);
 }
@@ -105,38 +135,86 @@ void HttpServer::accept_connections() {
             continue;
         }
         
-        // Handle connection in current thread (for simplicity)
-        // In production, use thread pool or async I/O
+        // Hand the connection to a worker; shed load once the backlog is deep
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            if (pending_connections_.size() < workers_.size() * 8) {
+                pending_connections_.push_back(client_socket);
+                client_socket = -1;
+            }
+        }
+        
+        if (client_socket >= 0) {
+            reject_busy(client_socket);
+            close(client_socket);
+        } else {
+            connections_cv_.notify_one();
+        }
+    }
+}
+
+void HttpServer::worker_loop() {
+    while (true) {
+        int client_socket;
+        {
+            std::unique_lock<std::mutex> lock(connections_mutex_);
+            connections_cv_.wait(lock, [this]() { return !pending_connections_.empty() || !running_; });
+            if (pending_connections_.empty()) {
+                return;
+            }
+            client_socket = pending_connections_.front();
+            pending_connections_.pop_front();
+        }
+        
         handle_connection(client_socket);
         close(client_socket);
     }
 }
 
+void HttpServer::reject_busy(int client_socket) {
+    HttpResponse response(503, "Service Unavailable");
+    response.headers["Retry-After"] = "1";
+    response.body = "{\"error\":\"Server busy\"}";
+    send_response(client_socket, response);
+}
+
 void HttpServer::handle_connection(int client_socket) {
-    constexpr size_t max_request_size = 1024 * 1024; // 1MB
     std::string request_data;
-    char buffer[4096];
+    char buffer[65536];
     
     // Read request
     ssize_t bytes_read;
+    size_t expected_size = 0; // headers and body, known once the headers are in
+    size_t content_length = 0;
+    bool has_content_length = false;
+    bool streaming = false;
     while ((bytes_read = read(client_socket, buffer, sizeof(buffer))) > 0) {
         request_data.append(buffer, bytes_read);
         
         // Check if we have complete headers
-        if (request_data.find("\r\n\r\n") != std::string::npos) {
+        size_t header_end;
+        if (expected_size == 0 && (header_end = request_data.find("\r\n\r\n")) != std::string::npos) {
             // Parse Content-Length if present
-            size_t header_end = request_data.find("\r\n\r\n");
             std::string headers = request_data.substr(0, header_end);
             
-            size_t content_length = 0;
             std::istringstream header_stream(headers);
             std::string line;
+            std::getline(header_stream, line);
+            
+            // Streamed bodies are left on the socket for the handler
+            std::istringstream request_line(line);
+            std::string method, target;
+            request_line >> method >> target;
+            std::string route = route_pattern(method, target.substr(0, target.find('?')));
+            streaming = !route.empty() && streaming_routes_.count(method + " " + route) > 0;
+            
             while (std::getline(header_stream, line)) {
                 if (line.find("Content-Length:") == 0) {
                     std::string length_str = line.substr(15);
                     length_str.erase(0, length_str.find_first_not_of(" \t"));
                     try {
                         content_length = std::stoul(length_str);
+                        has_content_length = true;
                     } catch (const std::exception&) {
                         // Ignore parsing errors
                     }
@@ -144,14 +222,21 @@ void HttpServer::handle_connection(int client_socket) {
                 }
             }
             
-            // Check if we have complete body
-            size_t body_start = header_end + 4;
-            if (request_data.length() >= body_start + content_length) {
+            expected_size = header_end + 4 + content_length;
+            if (streaming) {
                 break;
             }
+            if (expected_size <= max_request_size_) {
+                request_data.reserve(expected_size);
+            }
         }
         
-        if (request_data.length() > max_request_size) {
+        // Check if we have complete body
+        if (expected_size > 0 && request_data.length() >= expected_size) {
+            break;
+        }
+        
+        if (request_data.length() > max_request_size_) {
             break;
         }
     }
@@ -163,6 +248,47 @@ void HttpServer::handle_connection(int client_socket) {
     
     // Parse request
     HttpRequest request = parse_request(request_data);
+    if (streaming) {
+        if (!has_content_length) {
+            HttpResponse response(411, "Length Required");
+            response.body = "{\"error\":\"Content-Length required\"}";
+            send_response(client_socket, response);
+            return;
+        }
+        
+        // What arrived with the headers is handed out first, then the socket
+        // is read up to Content-Length
+        struct BodyState {
+            std::string head;
+            size_t head_pos = 0;
+            size_t remaining = 0;
+        };
+        auto state = std::make_shared<BodyState>();
+        state->head = std::move(request.body);
+        state->head.resize(std::min(state->head.size(), content_length));
+        state->remaining = content_length - state->head.size();
+        request.body.clear();
+        request.body_source = [client_socket, state](uint8_t* data, size_t length) -> ssize_t {
+            if (state->head_pos < state->head.size()) {
+                size_t n = std::min(length, state->head.size() - state->head_pos);
+                std::memcpy(data, state->head.data() + state->head_pos, n);
+                state->head_pos += n;
+                return static_cast<ssize_t>(n);
+            }
+            if (state->remaining == 0) {
+                return 0;
+            }
+            ssize_t n;
+            do {
+                n = read(client_socket, data, std::min(length, state->remaining));
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0) {
+                return -1; // the client went away mid-body
+            }
+            state->remaining -= static_cast<size_t>(n);
+            return n;
+        };
+    }
     
     // Apply middlewares
     HttpResponse response;
@@ -241,52 +367,98 @@ std::string HttpServer::build_response(const HttpResponse& response) {
     std::ostringstream oss;
     oss << "HTTP/1.1 " << response.status_code << " " << response.status_text << "\r\n";
     oss << "Content-Type: " << response.content_type << "\r\n";
-    oss << "Content-Length: " << response.body.length() << "\r\n";
+    if (!response.body_stream) {
+        oss << "Content-Length: " << response.body.length() << "\r\n";
+    } else if (response.content_length >= 0) {
+        oss << "Content-Length: " << response.content_length << "\r\n";
+    } else {
+        oss << "Transfer-Encoding: chunked\r\n";
+    }
     oss << "Connection: close\r\n";
     
     for (const auto& header : response.headers) {
         oss << header.first << ": " << header.second << "\r\n";
     }
     
-    oss << "\r\n" << response.body;
+    oss << "\r\n";
+    if (!response.body_stream) {
+        oss << response.body;
+    }
     return oss.str();
 }
 
 void HttpServer::send_response(int client_socket, const HttpResponse& response) {
     std::string response_str = build_response(response);
-    ssize_t bytes_sent = 0;
+    if (!send_all(client_socket, response_str.c_str(), response_str.length()) || !response.body_stream) {
+        return;
+    }
     
-    while (bytes_sent < static_cast<ssize_t>(response_str.length())) {
-        ssize_t result = write(client_socket, response_str.c_str() + bytes_sent, 
-                              response_str.length() - bytes_sent);
+    // Stream the body as the producer hands over blocks
+    bool chunked = response.content_length < 0;
+    bool ok = response.body_stream([this, client_socket, chunked](const uint8_t* data, size_t length) {
+        if (length == 0) {
+            return true;
+        }
+        if (chunked) {
+            char size_line[32];
+            int n = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+            if (!send_all(client_socket, size_line, n)) {
+                return false;
+            }
+        }
+        if (!send_all(client_socket, reinterpret_cast<const char*>(data), length)) {
+            return false;
+        }
+        return !chunked || send_all(client_socket, "\r\n", 2);
+    });
+    
+    // A failed producer leaves the body short so the client sees an error
+    if (ok && chunked) {
+        send_all(client_socket, "0\r\n\r\n", 5);
+    }
+}
+
+bool HttpServer::send_all(int client_socket, const char* data, size_t length) {
+    size_t bytes_sent = 0;
+    while (bytes_sent < length) {
+        ssize_t result = write(client_socket, data + bytes_sent, length - bytes_sent);
         if (result < 0) {
+            if (errno == EINTR) continue;
             std::perror("write");
-            break;
+            return false;
         }
         bytes_sent += result;
     }
+    return true;
 }
 
 std::function<HttpResponse(const HttpRequest&)> HttpServer::find_route(const std::string& method, const std::string& path) {
+    std::string pattern = route_pattern(method, path);
+    if (pattern.empty()) {
+        return nullptr;
+    }
+    return routes_.at(method).at(pattern);
+}
+
+std::string HttpServer::route_pattern(const std::string& method, const std::string& path) {
     auto method_routes = routes_.find(method);
     if (method_routes == routes_.end()) {
-        return nullptr;
+        return "";
     }
     
     // Try exact match first
-    auto exact_match = method_routes->second.find(path);
-    if (exact_match != method_routes->second.end()) {
-        return exact_match->second;
+    if (method_routes->second.count(path) > 0) {
+        return path;
     }
     
     // Try pattern matching
     for (const auto& route : method_routes->second) {
         if (match_route(route.first, path)) {
-            return route.second;
+            return route.first;
         }
     }
     
-    return nullptr;
+    return "";
 }
 
 bool HttpServer::match_route(const std::string& pattern, const std::string& path) {
@@ -321,6 +493,71 @@ bool HttpServer::match_route(const std::string& pattern, const std::string& path
     return pattern == path;
 }
 
+std::string HttpServer::path_segment(const std::string& path, size_t index) {
+    // Segment 0 is the one after the leading slash: /api/files/{id} -> api, files, id
+    size_t start = path.empty() || path[0] != '/' ? 0 : 1;
+    for (size_t i = 0; i < index; i++) {
+        start = path.find('/', start);
+        if (start == std::string::npos) {
+            return "";
+        }
+        start++;
+    }
+    size_t end = path.find('/', start);
+    return path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+std::string HttpServer::json_string_field(const std::string& body, const std::string& key) {
+    size_t key_pos = body.find("\"" + key + "\":");
+    if (key_pos == std::string::npos) {
+        return "";
+    }
+    size_t start = body.find('"', key_pos + key.length() + 3);
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = body.find('"', start + 1);
+    return end == std::string::npos ? "" : body.substr(start + 1, end - start - 1);
+}
+
+int64_t HttpServer::json_int_field(const std::string& body, const std::string& key) {
+    size_t key_pos = body.find("\"" + key + "\":");
+    if (key_pos == std::string::npos) {
+        return -1;
+    }
+    size_t start = body.find_first_not_of(" \t\r\n", key_pos + key.length() + 3);
+    if (start == std::string::npos || !std::isdigit(static_cast<unsigned char>(body[start]))) {
+        return -1;
+    }
+    try {
+        return std::stoll(body.substr(start, 20));
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+std::vector<std::string> HttpServer::json_string_array_field(const std::string& body, const std::string& key) {
+    std::vector<std::string> values;
+    size_t key_pos = body.find("\"" + key + "\":");
+    if (key_pos == std::string::npos) {
+        return values;
+    }
+    size_t start = body.find_first_not_of(" \t\r\n", key_pos + key.length() + 3);
+    if (start == std::string::npos || body[start] != '[') {
+        return values;
+    }
+    size_t end = body.find(']', start);
+    for (size_t pos = body.find('"', start); pos < end; pos = body.find('"', pos + 1)) {
+        size_t close = body.find('"', pos + 1);
+        if (close == std::string::npos || close > end) {
+            break;
+        }
+        values.push_back(body.substr(pos + 1, close - pos - 1));
+        pos = close;
+    }
+    return values;
+}
+
 bool HttpServer::auth_middleware(const HttpRequest& request, HttpResponse& response) {
     // Skip auth for certain paths
     if (request.path == "/" || request.path == "/health" || 
@@ -385,14 +622,52 @@ void HttpServer::register_api_routes() {
     register_route("GET", "/health", [this](const HttpRequest& req) { return handle_health_check(req); });
     register_route("POST", "/api/auth/login", [this](const HttpRequest& req) { return handle_login(req); });
     register_route("POST", "/api/auth/logout", [this](const HttpRequest& req) { return handle_logout(req); });
+    register_route("POST", "/api/auth/change-password", [this](const HttpRequest& req) { return handle_change_password(req); });
     register_route("POST", "/api/vault/unlock", [this](const HttpRequest& req) { return handle_unlock_vault(req); });
     register_route("POST", "/api/vault/lock", [this](const HttpRequest& req) { return handle_lock_vault(req); });
     register_route("GET", "/api/vault/status", [this](const HttpRequest& req) { return handle_vault_status(req); });
+    register_route("POST", "/api/vault/rotate-key", [this](const HttpRequest& req) { return handle_rotate_key(req); });
+    register_route("GET", "/api/vault/rotation", [this](const HttpRequest& req) { return handle_rotation_status(req); });
     register_route("GET", "/api/files", [this](const HttpRequest& req) { return handle_list_files(req); });
+    register_route("GET", "/api/files/search", [this](const HttpRequest& req) { return handle_search_files(req); });
     register_route("POST", "/api/files/upload", [this](const HttpRequest& req) { return handle_upload_file(req); });
+    register_route("POST", "/api/files/dedup-check", [this](const HttpRequest& req) { return handle_dedup_check(req); });
+    register_route("POST", "/api/uploads", [this](const HttpRequest& req) { return handle_create_upload(req); });
+    register_route("GET", "/api/uploads", [this](const HttpRequest& req) { return handle_list_uploads(req); });
+    register_route("GET", "/api/uploads/{upload_id}", [this](const HttpRequest& req) { return handle_upload_status(req); });
+    register_route("PUT", "/api/uploads/{upload_id}/chunks/{index}", [this](const HttpRequest& req) { return handle_put_upload_chunk(req); });
+    register_route("POST", "/api/uploads/{upload_id}/commit", [this](const HttpRequest& req) { return handle_commit_upload(req); });
+    register_route("DELETE", "/api/uploads/{upload_id}", [this](const HttpRequest& req) { return handle_abort_upload(req); });
+    register_route("POST", "/api/files/export", [this](const HttpRequest& req) { return handle_export_files(req); });
+    register_streaming_route("POST", "/api/files/import", [this](const HttpRequest& req) { return handle_import_archive(req); });
+    register_route("GET", "/api/files/{file_id}/download", [this](const HttpRequest& req) { return handle_download_file(req); });
+    register_route("DELETE", "/api/files/{file_id}", [this](const HttpRequest& req) { return handle_delete_file(req); });
+    register_route("POST", "/api/files/{file_id}/copy", [this](const HttpRequest& req) { return handle_copy_file(req); });
+    register_route("POST", "/api/files/{file_id}/move", [this](const HttpRequest& req) { return handle_move_file(req); });
+    register_streaming_route("PUT", "/api/files/{file_id}/content", [this](const HttpRequest& req) { return handle_write_version(req); });
+    register_route("GET", "/api/files/{file_id}/versions", [this](const HttpRequest& req) { return handle_list_versions(req); });
+    register_route("GET", "/api/files/{file_id}/versions/{version}/download", [this](const HttpRequest& req) { return handle_download_version(req); });
+    register_route("POST", "/api/files/{file_id}/versions/{version}/restore", [this](const HttpRequest& req) { return handle_restore_version(req); });
+    register_route("DELETE", "/api/files/{file_id}/versions/{version}", [this](const HttpRequest& req) { return handle_delete_version(req); });
+    register_route("POST", "/api/folders", [this](const HttpRequest& req) { return handle_create_folder(req); });
+    register_route("GET", "/api/folders/{folder_id}", [this](const HttpRequest& req) { return handle_list_folder(req); });
+    register_route("GET", "/api/folders/{folder_id}/stats", [this](const HttpRequest& req) { return handle_folder_stats(req); });
+    register_route("POST", "/api/folders/{folder_id}/move", [this](const HttpRequest& req) { return handle_move_folder(req); });
+    register_route("DELETE", "/api/folders/{folder_id}", [this](const HttpRequest& req) { return handle_delete_folder(req); });
+    register_route("GET", "/api/trash", [this](const HttpRequest& req) { return handle_list_trash(req); });
+    register_route("DELETE", "/api/trash", [this](const HttpRequest& req) { return handle_empty_trash(req); });
+    register_route("POST", "/api/trash/{file_id}/restore", [this](const HttpRequest& req) { return handle_restore_file(req); });
+    register_route("DELETE", "/api/trash/{file_id}", [this](const HttpRequest& req) { return handle_purge_file(req); });
+    register_route("GET", "/api/storage/stats", [this](const HttpRequest& req) { return handle_storage_stats(req); });
     register_route("GET", "/api/wifi/networks", [this](const HttpRequest& req) { return handle_scan_wifi(req); });
     register_route("GET", "/api/wifi/status", [this](const HttpRequest& req) { return handle_wifi_status(req); });
     register_route("GET", "/api/system/status", [this](const HttpRequest& req) { return handle_system_status(req); });
+    register_route("GET", "/api/system/shred", [this](const HttpRequest& req) { return handle_shred_status(req); });
+    register_route("GET", "/api/system/check", [this](const HttpRequest& req) { return handle_check_status(req); });
+    register_route("POST", "/api/system/check", [this](const HttpRequest& req) { return handle_start_check(req); });
+    register_route("GET", "/api/system/backup", [this](const HttpRequest& req) { return handle_backup_status(req); });
+    register_route("POST", "/api/system/backup", [this](const HttpRequest& req) { return handle_start_backup(req); });
+    register_route("GET", "/api/system/mirror", [this](const HttpRequest& req) { return handle_mirror_status(req); });
 }
 
 HttpResponse HttpServer::handle_root(const HttpRequest& request) {
@@ -438,7 +713,16 @@ HttpResponse HttpServer::handle_login(const HttpRequest& request) {
         password = request.body.substr(pass_start, pass_end - pass_start);
     }
     
-    auto user = AuthManager::instance().authenticate_user(username, password);
+    // Argon2 runs on the KDF executor; other connections keep being served
+    auto pending = AuthManager::instance().authenticate_user_async(username, password);
+    if (!pending.valid()) {
+        HttpResponse response(503, "Service Unavailable");
+        response.headers["Retry-After"] = "1";
+        response.body = "{\"success\":false,\"message\":\"Too many login attempts in progress\"}";
+        return response;
+    }
+    
+    auto user = pending.get();
     if (user) {
         std::string token = AuthManager::instance().create_session(*user, request.client_ip, request.user_agent);
         
@@ -458,6 +742,41 @@ HttpResponse HttpServer::handle_logout(const HttpRequest& request) {
     return response;
 }
 
+HttpResponse HttpServer::handle_change_password(const HttpRequest& request) {
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string current_password = json_string_field(request.body, "current_password");
+    std::string new_password = json_string_field(request.body, "new_password");
+    if (new_password.empty()) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"success\":false,\"message\":\"New password required\"}";
+        return response;
+    }
+    
+    auto pending = AuthManager::instance().change_password_async(*user, current_password, new_password);
+    if (!pending.valid()) {
+        HttpResponse response(503, "Service Unavailable");
+        response.headers["Retry-After"] = "1";
+        response.body = "{\"success\":false,\"message\":\"Server busy, try again\"}";
+        return response;
+    }
+    
+    if (pending.get()) {
+        HttpResponse response(200, "OK");
+        response.body = "{\"success\":true,\"message\":\"Password changed\"}";
+        return response;
+    }
+    
+    HttpResponse response(403, "Forbidden");
+    response.body = "{\"success\":false,\"message\":\"Current password is incorrect\"}";
+    return response;
+}
+
 HttpResponse HttpServer::handle_unlock_vault(const HttpRequest& request) {
     // Extract password from form data
     std::string password;
@@ -468,10 +787,29 @@ HttpResponse HttpServer::handle_unlock_vault(const HttpRequest& request) {
         password = url_decode(password);
     }
     
-    if (CryptoManager::instance().load_master_key(password)) {
+    // A second unlock would swap the active key for whatever this password unseals
+    if (CryptoManager::instance().is_unlocked()) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"success\":false,\"message\":\"Vault is already unlocked\"}";
+        return response;
+    }
+    
+    auto pending = CryptoManager::instance().load_master_key_async(password);
+    if (!pending.valid()) {
+        HttpResponse response(503, "Service Unavailable");
+        response.headers["Retry-After"] = "1";
+        response.body = "{\"success\":false,\"message\":\"Server busy, try again\"}";
+        return response;
+    }
+    
+    if (pending.get()) {
         vault_unlocked_ = true;
         update_activity();
         
+        // Resume converting legacy keys or an interrupted rotation
+        KeyMigrator::instance().start();
+        VaultChecker::instance().start_if_due();
+        
         HttpResponse response(200, "OK");
         response.body = "{\"success\":true,\"message\":\"Vault unlocked successfully\"}";
         return response;
@@ -483,6 +821,8 @@ HttpResponse HttpServer::handle_unlock_vault(const HttpRequest& request) {
 }
 
 HttpResponse HttpServer::handle_lock_vault(const HttpRequest& request) {
+    KeyMigrator::instance().stop();
+    VaultChecker::instance().stop();
     CryptoManager::instance().lock();
     vault_unlocked_ = false;
     
@@ -494,7 +834,64 @@ HttpResponse HttpServer::handle_lock_vault(const HttpRequest& request) {
 HttpResponse HttpServer::handle_vault_status(const HttpRequest& request) {
     HttpResponse response(200, "OK");
     response.body = "{\"unlocked\":" + std::string(check_vault_unlocked() ? "true" : "false") + 
-                   ",\"last_activity\":" + std::to_string(last_activity_) + "}";
+                   ",\"last_activity\":" + std::to_string(last_activity_.load()) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_rotate_key(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    if (CryptoManager::instance().rotation_in_progress()) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"success\":false,\"message\":\"Rotation already in progress\"}";
+        return response;
+    }
+    
+    if (!CryptoManager::instance().master_key_confirmed()) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"success\":false,\"message\":\"Master key sealed in the legacy format is not confirmed yet\"}";
+        return response;
+    }
+    
+    auto pending = CryptoManager::instance().begin_key_rotation_async(json_string_field(request.body, "password"));
+    if (!pending.valid()) {
+        HttpResponse response(503, "Service Unavailable");
+        response.headers["Retry-After"] = "1";
+        response.body = "{\"success\":false,\"message\":\"Server busy, try again\"}";
+        return response;
+    }
+    
+    if (!pending.get()) {
+        HttpResponse response(403, "Forbidden");
+        response.body = "{\"success\":false,\"message\":\"Invalid master password\"}";
+        return response;
+    }
+    
+    update_activity();
+    KeyMigrator::instance().start();
+    
+    HttpResponse response(202, "Accepted");
+    response.body = "{\"success\":true,\"message\":\"Master key rotation started\"}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_rotation_status(const HttpRequest& request) {
+    auto progress = KeyMigrator::instance().progress();
+    
+    std::ostringstream json;
+    json << "{\"running\":" << (progress.running ? "true" : "false") << ","
+         << "\"rotating\":" << (progress.rotating ? "true" : "false") << ","
+         << "\"remaining\":" << progress.remaining << ","
+         << "\"rewrapped\":" << progress.rewrapped << ","
+         << "\"failed\":" << progress.failed << ","
+         << "\"error\":\"" << json_escape(progress.error) << "\"}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
     return response;
 }
 
@@ -533,57 +930,1288 @@ HttpResponse HttpServer::handle_list_files(const HttpRequest& request) {
     return response;
 }
 
-HttpResponse HttpServer::handle_upload_file(const HttpRequest& request) {
-    // Simplified file upload - in production, use proper multipart parsing
-    HttpResponse response(501, "Not Implemented");
-    response.body = "{\"error\":\"File upload not implemented in this version\"}";
+HttpResponse HttpServer::handle_search_files(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto query = request.query_params.find("q");
+    if (query == request.query_params.end() || query->second.empty()) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"Missing search query\"}";
+        return response;
+    }
+    int limit = 50;
+    auto limit_param = request.query_params.find("limit");
+    if (limit_param != request.query_params.end()) {
+        limit = std::min(std::max(std::atoi(limit_param->second.c_str()), 1), 500);
+    }
+    
+    update_activity();
+    auto files = StorageManager::instance().search_files(query->second, *user, limit);
+    
+    std::ostringstream json;
+    json << "{\"files\":[";
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"id\":\"" << files[i].id << "\","
+             << "\"original_name\":\"" << json_escape(files[i].original_name) << "\","
+             << "\"size\":" << files[i].size << ","
+             << "\"mime_type\":\"" << json_escape(files[i].mime_type) << "\","
+             << "\"created_at\":" << files[i].created_at << ","
+             << "\"modified_at\":" << files[i].modified_at << "}";
+    }
+    json << "],\"total\":" << files.size() << ","
+         << "\"indexed\":" << (Database::instance().has_search_index() ? "true" : "false") << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
     return response;
 }
 
-HttpResponse HttpServer::handle_scan_wifi(const HttpRequest& request) {
-    update_activity();
-    auto networks = WiFiManager::instance().scan_networks();
+HttpResponse HttpServer::handle_storage_stats(const HttpRequest& request) {
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto stats = StorageManager::instance().get_storage_stats(*user);
+    double ratio = stats.logical_bytes > 0 ? static_cast<double>(stats.stored_bytes) / stats.logical_bytes : 1.0;
     
     std::ostringstream json;
-    json << "[";
-    for (size_t i = 0; i < networks.size(); i++) {
-        if (i > 0) json << ",";
-        json << "{\"ssid\":\"" << json_escape(networks[i].ssid) << "\","
-             << "\"bssid\":\"" << json_escape(networks[i].bssid) << "\","
-             << "\"frequency\":" << networks[i].frequency << ","
-             << "\"signal_level\":" << networks[i].signal_level << ","
-             << "\"security\":\"" << json_escape(networks[i].security) << "\"}";
+    json << "{\"file_count\":" << stats.file_count << ","
+         << "\"logical_bytes\":" << stats.logical_bytes << ","
+         << "\"stored_bytes\":" << stats.stored_bytes << ","
+         << "\"ratio\":" << ratio << ","
+         << "\"quota_bytes\":" << stats.quota_bytes << ","
+         << "\"trash_files\":" << stats.trash_files << ","
+         << "\"trash_bytes\":" << stats.trash_bytes << ","
+         << "\"by_type\":{";
+    for (size_t i = 0; i < stats.by_type.size(); i++) {
+        const auto& usage = stats.by_type[i];
+        json << (i > 0 ? "," : "") << "\"" << usage.mime_class << "\":{"
+             << "\"file_count\":" << usage.file_count << ","
+             << "\"logical_bytes\":" << usage.logical_bytes << "}";
     }
-    json << "]";
+    json << "}}";
     
     HttpResponse response(200, "OK");
     response.body = json.str();
     return response;
 }
 
-HttpResponse HttpServer::handle_wifi_status(const HttpRequest& request) {
+HttpResponse HttpServer::handle_upload_file(const HttpRequest& request) {
+    // Simplified file upload - in production, use proper multipart parsing
+    HttpResponse response(501, "Not Implemented");
+    response.body = "{\"error\":\"File upload not implemented in this version\"}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_download_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string file_id = path_segment(request.path, 2);
+    auto file = StorageManager::instance().get_file_info(file_id, *user);
+    if (!file) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not found\"}";
+        return response;
+    }
+    
     update_activity();
-    auto status = WiFiManager::instance().get_status();
     
     HttpResponse response(200, "OK");
-    response.body = "{\"interface\":\"" + json_escape(status.interface) + 
-                   "\",\"status\":\"" + json_escape(status.status) + 
-                   "\",\"ssid\":\"" + json_escape(status.ssid) + 
-                   "\",\"ip_address\":\"" + json_escape(status.ip_address) + 
-                   "\",\"signal_level\":" + std::to_string(status.signal_level) + "}";
+    response.content_type = file->mime_type;
+    response.headers["Content-Disposition"] = "attachment; filename=\"" + json_escape(file->original_name) + "\"";
+    response.content_length = file->size;
+    response.body_stream = [file_id, user](const ByteSink& sink) {
+        return StorageManager::instance().retrieve_stream(file_id, *user, sink);
+    };
     return response;
 }
 
-HttpResponse HttpServer::handle_system_status(const HttpRequest& request) {
+HttpResponse HttpServer::handle_export_files(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    // Every file is looked up before the first byte goes out; without a
+    // "files" list the whole vault is exported
+    auto& storage = StorageManager::instance();
+    std::vector<File> files;
+    auto file_ids = json_string_array_field(request.body, "files");
+    if (request.body.find("\"files\"") == std::string::npos) {
+        for (int offset = 0;; offset += 1000) {
+            auto page = storage.list_files(*user, 1000, offset);
+            files.insert(files.end(), page.begin(), page.end());
+            if (page.size() < 1000) {
+                break;
+            }
+        }
+    }
+    for (const auto& file_id : file_ids) {
+        auto file = storage.get_file_info(file_id, *user);
+        if (!file) {
+            HttpResponse response(404, "Not Found");
+            response.body = "{\"error\":\"File not found\",\"file_id\":\"" + json_escape(file_id) + "\"}";
+            return response;
+        }
+        files.push_back(*file);
+    }
+    if (files.empty()) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"No files to export\"}";
+        return response;
+    }
+    
     update_activity();
-    auto status = SystemManager::instance().get_system_status();
     
+    std::string name = json_string_field(request.body, "name");
+    if (name.empty()) {
+        name = "vault-export.zip";
+    }
+    bool deflate = request.body.find("\"deflate\":true") != std::string::npos ||
+                   request.body.find("\"deflate\": true") != std::string::npos;
+    
+    // Built while decrypting and sent chunked; the size is not known up front
     HttpResponse response(200, "OK");
-    response.body = "{\"uptime\":" + std::to_string(status.uptime) + 
-                   ",\"memory_usage\":" + std::to_string(status.memory_usage) + 
-                   ",\"disk_usage\":" + std::to_string(status.disk_usage) + 
-                   ",\"cpu_usage\":" + std::to_string(status.cpu_usage) + 
-                   ",\"reboot_required\":" + std::string(status.reboot_required ? "true" : "false") + "}";
+    response.content_type = "application/zip";
+    response.headers["Content-Disposition"] = "attachment; filename=\"" + json_escape(name) + "\"";
+    response.body_stream = [files, user, deflate](const ByteSink& sink) {
+        return StorageManager::instance().export_zip(files, *user, deflate, sink);
+    };
+    return response;
+}
+
+HttpResponse HttpServer::handle_import_archive(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // The archive is unpacked while the body is still arriving
+    std::string folder_id;
+    auto folder_param_it = request.query_params.find("folder_id");
+    if (folder_param_it != request.query_params.end()) {
+        folder_id = folder_param(folder_param_it->second);
+    }
+    auto summary = StorageManager::instance().import_archive(request.body_source, *user, folder_id);
+    double seconds = std::max(summary.seconds, 1e-6);
+    
+    std::ostringstream json;
+    json << "{\"success\":" << (summary.error.empty() ? "true" : "false") << ","
+         << "\"files\":" << summary.files << ","
+         << "\"bytes\":" << summary.bytes << ","
+         << "\"skipped\":" << summary.skipped << ","
+         << "\"seconds\":" << summary.seconds << ","
+         << "\"files_per_second\":" << summary.files / seconds << ","
+         << "\"mb_per_second\":" << summary.bytes / seconds / (1024.0 * 1024.0);
+    if (!summary.error.empty()) {
+        json << ",\"error\":\"" << json_escape(summary.error) << "\"";
+    }
+    json << "}";
+    
+    HttpResponse response(200, "OK");
+    if (summary.quota_exceeded) {
+        response = HttpResponse(507, "Insufficient Storage");
+    } else if (!summary.error.empty()) {
+        response = HttpResponse(400, "Bad Request");
+    }
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_delete_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // Metadata update only; the file stays in the trash until purged
+    if (!StorageManager::instance().delete_file(path_segment(request.path, 2), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_copy_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    std::string copy_id = StorageManager::instance().copy_file(path_segment(request.path, 2), *user);
+    if (copy_id.empty()) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"file_id\":\"" + copy_id + "\"}";
+    return response;
+}
+
+std::string HttpServer::folder_param(const std::string& value) {
+    // "root" names the user's root folder in paths; the API layer below uses ""
+    return value == "root" ? std::string() : value;
+}
+
+std::string HttpServer::folder_json(const Folder& folder) {
+    std::ostringstream json;
+    json << "{\"id\":\"" << folder.id << "\","
+         << "\"name\":\"" << json_escape(folder.name) << "\","
+         << "\"parent_id\":\"" << folder.parent_id << "\","
+         << "\"created_at\":" << folder.created_at << ","
+         << "\"modified_at\":" << folder.modified_at << "}";
+    return json.str();
+}
+
+HttpResponse HttpServer::handle_create_folder(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    auto folder = StorageManager::instance().create_folder(folder_param(json_string_field(request.body, "parent_id")),
+                                                           json_string_field(request.body, "name"), *user);
+    if (!folder) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"error\":\"Invalid name, name taken or parent not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(201, "Created");
+    response.body = folder_json(*folder);
+    return response;
+}
+
+HttpResponse HttpServer::handle_list_folder(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto& storage = StorageManager::instance();
+    std::string folder_id = folder_param(path_segment(request.path, 2));
+    std::vector<Folder> path;
+    if (!folder_id.empty() && (path = storage.folder_path(folder_id, *user)).empty()) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Folder not found\"}";
+        return response;
+    }
+    
+    // Files are paged; subfolders come whole on the first page
+    int limit = 100;
+    int offset = 0;
+    auto limit_param = request.query_params.find("limit");
+    if (limit_param != request.query_params.end()) {
+        limit = std::min(std::max(std::atoi(limit_param->second.c_str()), 1), 1000);
+    }
+    auto offset_param = request.query_params.find("offset");
+    if (offset_param != request.query_params.end()) {
+        offset = std::max(std::atoi(offset_param->second.c_str()), 0);
+    }
+    
+    update_activity();
+    std::vector<Folder> folders;
+    if (offset == 0) {
+        folders = storage.list_subfolders(folder_id, *user, 10000);
+    }
+    auto files = storage.list_folder_files(folder_id, *user, limit, offset);
+    
+    std::ostringstream json;
+    json << "{\"id\":\"" << (folder_id.empty() ? "root" : folder_id) << "\",\"path\":[";
+    for (size_t i = 0; i < path.size(); i++) {
+        if (i > 0) json << ",";
+        json << folder_json(path[i]);
+    }
+    json << "],\"folders\":[";
+    for (size_t i = 0; i < folders.size(); i++) {
+        if (i > 0) json << ",";
+        json << folder_json(folders[i]);
+    }
+    json << "],\"files\":[";
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"id\":\"" << files[i].id << "\","
+             << "\"original_name\":\"" << json_escape(files[i].original_name) << "\","
+             << "\"size\":" << files[i].size << ","
+             << "\"mime_type\":\"" << json_escape(files[i].mime_type) << "\","
+             << "\"created_at\":" << files[i].created_at << ","
+             << "\"modified_at\":" << files[i].modified_at << "}";
+    }
+    json << "],\"limit\":" << limit << ",\"offset\":" << offset << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_folder_stats(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // Summed from per-folder counters; the subtree's files are not visited
+    FolderStats stats;
+    if (!StorageManager::instance().folder_stats(folder_param(path_segment(request.path, 2)), *user, stats)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Folder not found\"}";
+        return response;
+    }
+    
+    std::ostringstream json;
+    json << "{\"folders\":" << stats.folders << ","
+         << "\"file_count\":" << stats.file_count << ","
+         << "\"logical_bytes\":" << stats.logical_bytes << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_move_folder(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // One row changes however large the subtree is
+    auto& storage = StorageManager::instance();
+    std::string folder_id = path_segment(request.path, 2);
+    if (!storage.get_folder(folder_id, *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Folder not found\"}";
+        return response;
+    }
+    if (!storage.move_folder(folder_id, folder_param(json_string_field(request.body, "parent_id")),
+                             json_string_field(request.body, "name"), *user)) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"error\":\"Invalid name, name taken or target inside the folder\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_delete_folder(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    int64_t trashed = StorageManager::instance().delete_folder(path_segment(request.path, 2), *user);
+    if (trashed < 0) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Folder not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"trashed\":" + std::to_string(trashed) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_move_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    if (!StorageManager::instance().move_file(path_segment(request.path, 2),
+                                              folder_param(json_string_field(request.body, "folder_id")), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File or folder not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+std::string HttpServer::version_json(const FileVersion& version) {
+    std::ostringstream json;
+    json << "{\"version\":" << version.version << ","
+         << "\"size\":" << version.size << ","
+         << "\"chunk_count\":" << version.chunk_count << ","
+         << "\"written_bytes\":" << version.written_bytes << ","
+         << "\"created_at\":" << version.created_at << "}";
+    return json.str();
+}
+
+int64_t HttpServer::version_param(const std::string& value) {
+    if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos) {
+        return -1;
+    }
+    return std::stoll(value);
+}
+
+HttpResponse HttpServer::handle_write_version(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string file_id = path_segment(request.path, 2);
+    if (!StorageManager::instance().get_file_info(file_id, *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not found\"}";
+        return response;
+    }
+    
+    if (!request.body_source) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"Request body was not streamed\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // The body is the new content, chunked while it arrives
+    std::shared_ptr<FileVersion> version;
+    try {
+        version = StorageManager::instance().write_version(file_id, request.body_source, *user);
+    } catch (const std::runtime_error& e) {
+        HttpResponse response(507, "Insufficient Storage");
+        response.body = "{\"error\":\"" + json_escape(e.what()) + "\"}";
+        return response;
+    }
+    if (!version) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"error\":\"Version not written (another write in progress, or over quota)\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"version\":" + version_json(*version) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_list_versions(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto& storage = StorageManager::instance();
+    std::string file_id = path_segment(request.path, 2);
+    auto file = storage.get_file_info(file_id, *user);
+    if (!file) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not found\"}";
+        return response;
+    }
+    
+    update_activity();
+    auto versions = storage.list_versions(file_id, *user);
+    
+    std::ostringstream json;
+    json << "{\"file_id\":\"" << file_id << "\","
+         << "\"current_version\":" << file->version << ","
+         << "\"versions\":[";
+    for (size_t i = 0; i < versions.size(); i++) {
+        json << (i > 0 ? "," : "") << version_json(versions[i]);
+    }
+    json << "]}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_download_version(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto& storage = StorageManager::instance();
+    std::string file_id = path_segment(request.path, 2);
+    int64_t number = version_param(path_segment(request.path, 4));
+    auto file = storage.get_file_info(file_id, *user);
+    std::shared_ptr<FileVersion> version;
+    if (file && number >= 0) {
+        for (const auto& v : storage.list_versions(file_id, *user)) {
+            if (v.version == number) {
+                version = std::make_shared<FileVersion>(v);
+            }
+        }
+    }
+    if (!file || !(version || number == file->version)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Version not found\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // The version's chunks are decrypted one after the other into the response
+    HttpResponse response(200, "OK");
+    response.content_type = file->mime_type;
+    response.headers["Content-Disposition"] = "attachment; filename=\"" + json_escape(file->original_name) + "\"";
+    response.content_length = version ? version->size : file->size;
+    response.body_stream = [file_id, number, user](const ByteSink& sink) {
+        return StorageManager::instance().retrieve_version(file_id, number, *user, sink);
+    };
+    return response;
+}
+
+HttpResponse HttpServer::handle_restore_version(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    auto version = StorageManager::instance().restore_version(path_segment(request.path, 2),
+                                                              version_param(path_segment(request.path, 4)), *user);
+    if (!version) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Version not found, current or busy\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"version\":" + version_json(*version) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_delete_version(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // The current version cannot be deleted; delete the file instead
+    if (!StorageManager::instance().delete_version(path_segment(request.path, 2),
+                                                   version_param(path_segment(request.path, 4)), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Version not found, current or busy\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_list_trash(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    auto& storage = StorageManager::instance();
+    auto files = storage.list_trash(*user);
+    
+    std::ostringstream json;
+    json << "{\"files\":[";
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"id\":\"" << files[i].id << "\","
+             << "\"original_name\":\"" << json_escape(files[i].original_name) << "\","
+             << "\"size\":" << files[i].size << ","
+             << "\"mime_type\":\"" << json_escape(files[i].mime_type) << "\","
+             << "\"deleted_at\":" << files[i].deleted_at << ","
+             << "\"purge_at\":" << storage.purge_time(files[i]) << "}";
+    }
+    json << "],\"total\":" << files.size() << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_restore_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    if (!StorageManager::instance().restore_file(path_segment(request.path, 2), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not in trash or over quota\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_purge_file(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // The ciphertext is shredded in the background
+    if (!StorageManager::instance().purge_file(path_segment(request.path, 2), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"File not in trash\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_empty_trash(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    int64_t purged = StorageManager::instance().empty_trash(*user);
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"purged\":" + std::to_string(purged) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_dedup_check(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string sha256 = json_string_field(request.body, "sha256");
+    std::string name = json_string_field(request.body, "name");
+    if (sha256.size() != 64 || name.empty()) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"sha256 and name required\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // Known content becomes a new file right away and the upload can be skipped
+    std::string file_id = StorageManager::instance().link_existing(sha256, name, *user);
+    
+    HttpResponse response(200, "OK");
+    if (file_id.empty()) {
+        response.body = "{\"exists\":false}";
+    } else {
+        response.body = "{\"exists\":true,\"file_id\":\"" + file_id + "\"}";
+    }
+    return response;
+}
+
+std::string HttpServer::upload_json(const UploadSession& session, const std::vector<UploadChunk>& chunks,
+                                    bool list_chunks) {
+    std::ostringstream json;
+    json << "{\"upload_id\":\"" << session.id << "\","
+         << "\"name\":\"" << json_escape(session.original_name) << "\","
+         << "\"size\":" << session.size << ","
+         << "\"chunk_size\":" << session.chunk_size << ","
+         << "\"chunk_count\":" << session.chunk_count() << ","
+         << "\"received_count\":" << chunks.size() << ",";
+    if (list_chunks) {
+        json << "\"received\":[";
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (i > 0) json << ",";
+            json << chunks[i].index;
+        }
+        json << "],";
+    }
+    json << "\"updated_at\":" << session.updated_at << ","
+         << "\"expires_at\":" << StorageManager::instance().upload_expiry_time(session) << "}";
+    return json.str();
+}
+
+HttpResponse HttpServer::handle_create_upload(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string name = json_string_field(request.body, "name");
+    int64_t size = json_int_field(request.body, "size");
+    if (name.empty() || size < 0) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"name and size required\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    std::shared_ptr<UploadSession> session;
+    try {
+        session = StorageManager::instance().create_upload(name, size, *user);
+    } catch (const std::runtime_error& e) {
+        HttpResponse response(507, "Insufficient Storage");
+        response.body = "{\"error\":\"" + json_escape(e.what()) + "\"}";
+        return response;
+    }
+    if (!session) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"Cannot create upload\"}";
+        return response;
+    }
+    
+    HttpResponse response(201, "Created");
+    response.body = upload_json(*session, {}, false);
+    return response;
+}
+
+HttpResponse HttpServer::handle_list_uploads(const HttpRequest& request) {
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto& storage = StorageManager::instance();
+    auto sessions = storage.list_uploads(*user);
+    
+    std::ostringstream json;
+    json << "{\"uploads\":[";
+    for (size_t i = 0; i < sessions.size(); i++) {
+        if (i > 0) json << ",";
+        json << upload_json(sessions[i], storage.get_upload_chunks(sessions[i].id), false);
+    }
+    json << "],\"total\":" << sessions.size() << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_upload_status(const HttpRequest& request) {
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    // Lists the chunks that arrived, so a client resumes with the rest
+    auto& storage = StorageManager::instance();
+    auto session = storage.get_upload(path_segment(request.path, 2), *user);
+    if (!session) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Upload not found\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = upload_json(*session, storage.get_upload_chunks(session->id), true);
+    return response;
+}
+
+HttpResponse HttpServer::handle_put_upload_chunk(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    std::string index_text = path_segment(request.path, 4);
+    if (index_text.empty() || index_text.size() > 18 || index_text.find_first_not_of("0123456789") != std::string::npos) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"error\":\"Invalid chunk index\"}";
+        return response;
+    }
+    
+    int64_t index = std::stoll(index_text);
+    update_activity();
+    
+    // The body is the chunk's plaintext; every chunk but the last is chunk_size bytes
+    auto result = StorageManager::instance().put_upload_chunk(
+        path_segment(request.path, 2), index, reinterpret_cast<const uint8_t*>(request.body.data()),
+        request.body.size(), *user);
+    
+    HttpResponse response;
+    switch (result) {
+    case StorageManager::UploadResult::Ok:
+        response = HttpResponse(200, "OK");
+        response.body = "{\"success\":true,\"index\":" + std::to_string(index) + "}";
+        break;
+    case StorageManager::UploadResult::NotFound:
+        response = HttpResponse(404, "Not Found");
+        response.body = "{\"error\":\"Upload not found\"}";
+        break;
+    case StorageManager::UploadResult::Invalid:
+        response = HttpResponse(400, "Bad Request");
+        response.body = "{\"error\":\"Chunk index or length does not match the upload\"}";
+        break;
+    case StorageManager::UploadResult::Conflict:
+        response = HttpResponse(409, "Conflict");
+        response.body = "{\"error\":\"Chunk already received with different content or in progress\"}";
+        break;
+    case StorageManager::UploadResult::Failed:
+        response = HttpResponse(500, "Internal Server Error");
+        response.body = "{\"error\":\"Failed to store chunk\"}";
+        break;
+    }
+    return response;
+}
+
+HttpResponse HttpServer::handle_commit_upload(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    auto& storage = StorageManager::instance();
+    std::string upload_id = path_segment(request.path, 2);
+    auto session = storage.get_upload(upload_id, *user);
+    if (!session) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Upload not found\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    std::string file_id;
+    try {
+        file_id = storage.commit_upload(upload_id, *user);
+    } catch (const std::runtime_error& e) {
+        HttpResponse response(507, "Insufficient Storage");
+        response.body = "{\"error\":\"" + json_escape(e.what()) + "\"}";
+        return response;
+    }
+    if (file_id.empty()) {
+        int64_t missing = session->chunk_count() - static_cast<int64_t>(storage.get_upload_chunks(upload_id).size());
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"error\":\"Upload incomplete or already committing\",\"missing\":" +
+                        std::to_string(missing) + "}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true,\"file_id\":\"" + file_id + "\"}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_abort_upload(const HttpRequest& request) {
+    auto user = get_current_user(request);
+    if (!user) {
+        HttpResponse response(401, "Unauthorized");
+        response.body = "{\"error\":\"Invalid user\"}";
+        return response;
+    }
+    
+    update_activity();
+    
+    // Staged chunks are shredded in the background
+    if (!StorageManager::instance().abort_upload(path_segment(request.path, 2), *user)) {
+        HttpResponse response(404, "Not Found");
+        response.body = "{\"error\":\"Upload not found or committing\"}";
+        return response;
+    }
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"success\":true}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_scan_wifi(const HttpRequest& request) {
+    update_activity();
+    auto networks = WiFiManager::instance().scan_networks();
+    
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < networks.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"ssid\":\"" << json_escape(networks[i].ssid) << "\","
+             << "\"bssid\":\"" << json_escape(networks[i].bssid) << "\","
+             << "\"frequency\":" << networks[i].frequency << ","
+             << "\"signal_level\":" << networks[i].signal_level << ","
+             << "\"security\":\"" << json_escape(networks[i].security) << "\"}";
+    }
+    json << "]";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_wifi_status(const HttpRequest& request) {
+    update_activity();
+    auto status = WiFiManager::instance().get_status();
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"interface\":\"" + json_escape(status.interface) + 
+                   "\",\"status\":\"" + json_escape(status.status) + 
+                   "\",\"ssid\":\"" + json_escape(status.ssid) + 
+                   "\",\"ip_address\":\"" + json_escape(status.ip_address) + 
+                   "\",\"signal_level\":" + std::to_string(status.signal_level) + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_system_status(const HttpRequest& request) {
+    update_activity();
+    auto status = SystemManager::instance().get_system_status();
+    
+    HttpResponse response(200, "OK");
+    response.body = "{\"uptime\":" + std::to_string(status.uptime) + 
+                   ",\"memory_usage\":" + std::to_string(status.memory_usage) + 
+                   ",\"disk_usage\":" + std::to_string(status.disk_usage) + 
+                   ",\"cpu_usage\":" + std::to_string(status.cpu_usage) + 
+                   ",\"reboot_required\":" + std::string(status.reboot_required ? "true" : "false") + "}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_shred_status(const HttpRequest& request) {
+    auto progress = Shredder::instance().progress();
+    
+    std::ostringstream json;
+    json << "{\"mode\":\"" << progress.mode << "\","
+         << "\"rate_limit\":" << progress.rate_limit << ","
+         << "\"pending_files\":" << progress.pending_files << ","
+         << "\"pending_bytes\":" << progress.pending_bytes << ","
+         << "\"active\":" << (progress.active ? "true" : "false") << ","
+         << "\"current_size\":" << progress.current_size << ","
+         << "\"current_done\":" << progress.current_done << ","
+         << "\"shredded_files\":" << progress.shredded_files << ","
+         << "\"shredded_bytes\":" << progress.shredded_bytes << ","
+         << "\"failed_files\":" << progress.failed_files << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_check_status(const HttpRequest& request) {
+    auto progress = VaultChecker::instance().progress();
+    
+    std::ostringstream json;
+    json << "{\"running\":" << (progress.running ? "true" : "false") << ","
+         << "\"objects_total\":" << progress.objects_total << ","
+         << "\"objects_done\":" << progress.objects_done << ","
+         << "\"bytes_done\":" << progress.bytes_done << ","
+         << "\"last_report\":" << (progress.last_report.empty() ? "null" : progress.last_report) << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_start_check(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    if (!VaultChecker::instance().start()) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"success\":false,\"message\":\"Vault check already running\"}";
+        return response;
+    }
+    
+    update_activity();
+    HttpResponse response(202, "Accepted");
+    response.body = "{\"success\":true,\"message\":\"Vault check started\"}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_backup_status(const HttpRequest& request) {
+    auto progress = VaultBackup::instance().progress();
+    
+    std::ostringstream json;
+    json << "{\"running\":" << (progress.running ? "true" : "false") << ","
+         << "\"target\":\"" << codec::json_escape(Config::instance().backup_dir()) << "\","
+         << "\"objects_total\":" << progress.objects_total << ","
+         << "\"objects_done\":" << progress.objects_done << ","
+         << "\"bytes_done\":" << progress.bytes_done << ","
+         << "\"last_report\":" << (progress.last_report.empty() ? "null" : progress.last_report) << "}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
+    return response;
+}
+
+HttpResponse HttpServer::handle_start_backup(const HttpRequest& request) {
+    if (!check_vault_unlocked()) {
+        HttpResponse response(423, "Locked");
+        response.body = "{\"error\":\"Vault is locked\"}";
+        return response;
+    }
+    
+    if (Config::instance().backup_dir().empty()) {
+        HttpResponse response(400, "Bad Request");
+        response.body = "{\"success\":false,\"message\":\"No backup directory configured\"}";
+        return response;
+    }
+    if (!VaultBackup::instance().start()) {
+        HttpResponse response(409, "Conflict");
+        response.body = "{\"success\":false,\"message\":\"Backup already running\"}";
+        return response;
+    }
+    
+    update_activity();
+    HttpResponse response(202, "Accepted");
+    response.body = "{\"success\":true,\"message\":\"Backup started\"}";
+    return response;
+}
+
+HttpResponse HttpServer::handle_mirror_status(const HttpRequest& request) {
+    auto progress = VaultMirror::instance().progress();
+    double mb = progress.bytes_shipped / (1024.0 * 1024.0);
+    
+    std::ostringstream json;
+    json << "{\"enabled\":" << (progress.enabled ? "true" : "false") << ","
+         << "\"target\":\"" << codec::json_escape(progress.target) << "\","
+         << "\"state\":\"" << progress.state << "\","
+         << "\"pending\":" << progress.pending << ","
+         << "\"lag_seconds\":" << progress.lag_seconds << ","
+         << "\"pass_objects_done\":" << progress.pass_objects_done << ","
+         << "\"pass_objects_total\":" << progress.pass_objects_total << ","
+         << "\"last_sync\":" << progress.last_sync << ","
+         << "\"passes\":" << progress.passes << ","
+         << "\"objects_shipped\":" << progress.objects_shipped << ","
+         << "\"bytes_shipped\":" << progress.bytes_shipped << ","
+         << "\"mb_per_second\":" << (progress.busy_seconds > 0.0 ? mb / progress.busy_seconds : 0.0) << ","
+         << "\"last_error\":\"" << codec::json_escape(progress.last_error) << "\"}";
+    
+    HttpResponse response(200, "OK");
+    response.body = json.str();
     return response;
 }
 
@@ -634,18 +2262,7 @@ std::map<std::string, std::string> HttpServer::parse_query_string(const std::str
 }
 
 std::string HttpServer::json_escape(const std::string& str) {
-    std::ostringstream escaped;
-    for (char c : str) {
-        switch (c) {
-            case '"': escaped << "\\\""; break;
-            case '\\': escaped << "\\\\"; break;
-            case '\n': escaped << "\\n"; break;
-            case '\r': escaped << "\\r"; break;
-            case '\t': escaped << "\\t"; break;
-            default: escaped << c; break;
-        }
-    }
-    return escaped.str();
+    return codec::json_escape(str);
 }
 
 std::string HttpServer::now_iso8601() {
@@ -0,0 +1,96 @@
+#include "kdf_executor.h"
+
+namespace vaultusb {
+
+KdfExecutor& KdfExecutor::instance() {
+    static KdfExecutor instance;
+    return instance;
+}
+
+KdfExecutor::~KdfExecutor() {
+    stop();
+}
+
+void KdfExecutor::start(size_t workers, size_t queue_depth) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+
+    running_ = true;
+    queue_depth_ = queue_depth;
+    stats_.workers = workers > 0 ? workers : 1;
+    stats_.queue_depth = queue_depth;
+    for (size_t i = 0; i < stats_.workers; i++) {
+        workers_.emplace_back(&KdfExecutor::worker_loop, this);
+    }
+}
+
+void KdfExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+bool KdfExecutor::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            // Every admitted task not yet finished counts, whether a worker
+            // has picked it up or not, so a depth of 0 means "no waiting"
+            if (queue_.size() + stats_.running >= stats_.workers + queue_depth_) {
+                stats_.rejected++;
+                return false;
+            }
+            queue_.push_back(std::move(task));
+            stats_.queued = queue_.size();
+            cv_.notify_one();
+            return true;
+        }
+    }
+
+    // Not started (CLI tools): run on the caller
+    task();
+    return true;
+}
+
+void KdfExecutor::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !queue_.empty() || !running_; });
+            if (queue_.empty()) {
+                return;
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+            stats_.queued = queue_.size();
+            stats_.running++;
+        }
+
+        // packaged_task captures exceptions into the caller's future
+        task();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.running--;
+        stats_.completed++;
+    }
+}
+
+KdfExecutor::Stats KdfExecutor::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,194 @@
+#include "key_migrator.h"
+#include "crypto.h"
+#include "database.h"
+#include "pack_store.h"
+#include "vault_layout.h"
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace vaultusb {
+
+KeyMigrator& KeyMigrator::instance() {
+    static KeyMigrator instance;
+    return instance;
+}
+
+KeyMigrator::~KeyMigrator() {
+    stop();
+}
+
+KeyMigrator::Confirmation KeyMigrator::confirm_master_key(const SecureBytes& master_key, bool rotation_pending) {
+    auto& crypto = CryptoManager::instance();
+    // A pending rotation key is sealed in the tagged format with the same password
+    if (rotation_pending) {
+        return Confirmation::Confirmed;
+    }
+
+    // Files written before envelope encryption but in the chunked format are
+    // keyed by the master key itself; the first one found decides
+    for (const auto& file : Database::instance().get_legacy_key_files()) {
+        int result = -1; // -1: not in the chunked format or unreadable
+        auto check = [&](int fd, int64_t offset, int64_t length) {
+            uint8_t header[64];
+            ssize_t n = pread(fd, header, sizeof(header), offset);
+            if (n > 0 && CryptoManager::is_stream_format(header, static_cast<size_t>(n))) {
+                result = crypto.authenticate_legacy_object(master_key, fd, offset, length, file.id) ? 1 : 0;
+            }
+            return true;
+        };
+        try {
+            bool packed = false;
+            PackStore::instance().read(file.encrypted_name, check, &packed);
+            int fd = packed ? -1 : VaultLayout::instance().open(file.encrypted_name, O_RDONLY);
+            if (fd >= 0) {
+                struct stat st;
+                if (fstat(fd, &st) == 0) {
+                    check(fd, 0, st.st_size);
+                }
+                close(fd);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to check master key against file " << file.id << ": " << e.what() << std::endl;
+        }
+        if (result == 1) {
+            return Confirmation::Confirmed;
+        }
+        if (result == 0) {
+            std::cerr << "Master key does not authenticate file " << file.id << std::endl;
+            return Confirmation::Rejected;
+        }
+    }
+
+    std::cerr << "Master key unsealed from a legacy file could not be confirmed; "
+                 "it is not resealed and new files are refused" << std::endl;
+    return Confirmation::Unconfirmed;
+}
+
+void KeyMigrator::start() {
+    auto& crypto = CryptoManager::instance();
+    // An unconfirmed key may be garbage from a wrong password
+    if (!crypto.is_unlocked() || !crypto.master_key_confirmed() || running_.exchange(true)) {
+        return;
+    }
+
+    // A previous run has finished; reap its thread before starting a new one
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    stop_requested_ = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.error.clear();
+    }
+    worker_ = std::thread(&KeyMigrator::run, this);
+}
+
+void KeyMigrator::stop() {
+    stop_requested_ = true;
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+KeyMigrator::Progress KeyMigrator::progress() {
+    auto& crypto = CryptoManager::instance();
+    bool unlocked = crypto.is_unlocked();
+    uint32_t target = unlocked ? crypto.active_key_id() : 0;
+    int remaining = unlocked ? Database::instance().count_files_to_rekey(target) +
+                               static_cast<int>(Database::instance().get_user_keys_to_rekey(target).size()) : 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Progress progress = stats_;
+    progress.running = running_;
+    progress.rotating = unlocked && crypto.rotation_in_progress();
+    progress.target_key_id = target;
+    progress.remaining = remaining;
+    return progress;
+}
+
+void KeyMigrator::run() {
+    auto& crypto = CryptoManager::instance();
+    auto& db = Database::instance();
+
+    while (!stop_requested_ && crypto.is_unlocked()) {
+        uint32_t target = crypto.active_key_id();
+        
+        // Per-user secrets are few; rewrap them before the file rows
+        for (auto key : db.get_user_keys_to_rekey(target)) {
+            std::string wrap_id = "user:" + std::to_string(key.user_id) + ":" + key.purpose;
+            try {
+                uint32_t old_key_id = key.key_id;
+                auto secret = crypto.unwrap_file_key(key.wrapped_key, wrap_id, old_key_id);
+                key.wrapped_key = crypto.wrap_file_key(secret, wrap_id, key.key_id);
+                db.update_user_key(key, old_key_id);
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to rewrap user key " << wrap_id << ": " << e.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.failed++;
+                stats_.error = e.what();
+            }
+        }
+        
+        // Open upload sessions hold the data key of a file still to come
+        for (const auto& session : db.get_upload_sessions_to_rekey(target)) {
+            try {
+                auto file_key = crypto.unwrap_file_key(session.wrapped_key, session.file_id, session.key_id);
+                uint32_t key_id = 0;
+                std::string wrapped = crypto.wrap_file_key(file_key, session.file_id, key_id);
+                db.update_upload_session_key(session.id, wrapped, key_id, session.key_id);
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to rewrap key for upload " << session.id << ": " << e.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.failed++;
+                stats_.error = e.what();
+            }
+        }
+        
+        auto files = db.get_files_to_rekey(target);
+        if (files.empty()) {
+            // A rotation is only complete once no secret still needs the old key
+            if (!db.get_user_keys_to_rekey(target, 1).empty() || !db.get_upload_sessions_to_rekey(target, 1).empty()) {
+                break;
+            }
+            if (crypto.rotation_in_progress() && !crypto.finish_key_rotation()) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.error = "Failed to promote rotated master key";
+            }
+            break;
+        }
+
+        size_t converted = 0;
+        for (const auto& file : files) {
+            if (stop_requested_ || !crypto.is_unlocked()) {
+                break;
+            }
+            try {
+                auto file_key = crypto.resolve_file_key(file.id, file.wrapped_key, file.key_id);
+                uint32_t key_id = 0;
+                std::string wrapped = crypto.wrap_file_key(file_key, file.id, key_id);
+                // Another writer may have rewrapped the row meanwhile; that also counts as done
+                db.update_file_key(file.id, wrapped, key_id, file.key_id);
+                converted++;
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.rewrapped++;
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to rewrap key for file " << file.id << ": " << e.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.failed++;
+                stats_.error = e.what();
+            }
+        }
+
+        // Only unreadable rows left: stop instead of spinning on them
+        if (converted == 0) {
+            break;
+        }
+    }
+
+    running_ = false;
+}
+
+} // namespace vaultusb
@@ -9,10 +9,23 @@
 #include "wifi.h"
 #include "system.h"
 #include "http_server.h"
+#include "kdf_executor.h"
+#include "shredder.h"
+#include "key_migrator.h"
+#include "vault_checker.h"
+#include "vault_layout.h"
+#include "pack_store.h"
+#include "trash_collector.h"
+#include "backup.h"
+#include "mirror.h"
 
 #include <iostream>
+#include <fstream>
 #include <signal.h>
+#include <termios.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstdint>
 
 namespace vaultusb {
 
@@ -34,6 +47,25 @@ public:
                 port = std::atoi(argv[++i]);
             } else if (arg == "--config" && i + 1 < argc) {
                 config_file = argv[++i];
+            } else if (arg == "--calibrate-kdf") {
+                calibrate_ms_ = (i + 1 < argc && argv[i + 1][0] != '-') ? std::atoi(argv[++i]) : 500;
+            } else if (arg == "--check-vault") {
+                check_vault_ = true;
+            } else if (arg == "--check-report" && i + 1 < argc) {
+                check_report_ = argv[++i];
+            } else if (arg == "--check-rate" && i + 1 < argc) {
+                check_rate_ = std::atoi(argv[++i]);
+            } else if (arg == "--reconcile-stats") {
+                reconcile_stats_ = true;
+            } else if (arg == "--set-quota" && i + 2 < argc) {
+                quota_user_ = argv[++i];
+                quota_mib_ = std::atoll(argv[++i]);
+            } else if (arg == "--backup" && i + 1 < argc) {
+                backup_dir_ = argv[++i];
+            } else if (arg == "--verify-backup" && i + 1 < argc) {
+                verify_backup_dir_ = argv[++i];
+            } else if (arg == "--restore-backup" && i + 1 < argc) {
+                restore_backup_dir_ = argv[++i];
             } else if (arg == "--help") {
                 print_help();
                 return false;
@@ -43,14 +75,51 @@ public:
         // Load configuration
         Config::instance().load_from_file(config_file);
         
+        if (calibrate_ms_ > 0) {
+            calibrate_kdf();
+            return false;
+        }
+        
+        // Neither needs the live database; a restore must run before it exists
+        if (!verify_backup_dir_.empty() || !restore_backup_dir_.empty()) {
+            exit_code_ = run_backup_tool();
+            return false;
+        }
+        
         // Initialize database
         if (!Database::instance().initialize(Config::instance().db_file())) {
             std::cerr << "Failed to initialize database" << std::endl;
             return false;
         }
         
-        // Initialize crypto manager
+        if (check_vault_) {
+            exit_code_ = check_vault();
+            return false;
+        }
+        if (reconcile_stats_ || !quota_user_.empty()) {
+            exit_code_ = reconcile_stats_ ? reconcile_stats() : set_quota();
+            return false;
+        }
+        if (!backup_dir_.empty()) {
+            exit_code_ = run_backup_tool();
+            return false;
+        }
+        
+        // Resume any shredding left over from the previous run
+        Shredder::instance().start();
+        // Move ciphertexts from an older vault layout into the configured fan-out
+        VaultLayout::instance().start_migration();
+        // Reclaim space left by deleted small files in pack segments
+        PackStore::instance().start();
+        // Purge trashed files whose retention has expired
+        TrashCollector::instance().start();
+        // Keep the mirror directory, if any, in step with the vault
+        VaultMirror::instance().start();
+        
+        // Initialize crypto manager and the KDF workers sized to its memory pool
         CryptoManager::instance();
+        KdfExecutor::instance().start(CryptoManager::instance().kdf_concurrency(),
+                                      static_cast<size_t>(std::max(Config::instance().kdf_queue_depth(), 0)));
         
         // Initialize other managers
         AuthManager::instance();
@@ -79,14 +148,36 @@ public:
     
     void shutdown() {
         std::cout << "Shutting down VaultUSB server..." << std::endl;
+        KeyMigrator::instance().stop();
+        VaultChecker::instance().stop();
+        VaultBackup::instance().stop(); // also abandons a mirror pass in progress
+        VaultMirror::instance().stop();
+        TrashCollector::instance().stop();
+        VaultLayout::instance().stop_migration();
+        PackStore::instance().stop();
+        Shredder::instance().stop();
         Database::instance().cleanup();
     }
     
+    int exit_code() const { return exit_code_; }
+    
 private:
     VaultUSBApp() = default;
     VaultUSBApp(const VaultUSBApp&) = delete;
     VaultUSBApp& operator=(const VaultUSBApp&) = delete;
     
+    int calibrate_ms_ = 0;
+    bool check_vault_ = false;
+    std::string check_report_;
+    int check_rate_ = 0;
+    bool reconcile_stats_ = false;
+    std::string quota_user_;
+    int64_t quota_mib_ = 0;
+    std::string backup_dir_;
+    std::string verify_backup_dir_;
+    std::string restore_backup_dir_;
+    int exit_code_ = 1;
+    
     static void signal_handler(int signal) {
         if (signal == SIGINT || signal == SIGTERM) {
             std::cout << "\nReceived signal " << signal << ", shutting down..." << std::endl;
@@ -95,12 +186,122 @@ private:
         }
     }
     
+    void calibrate_kdf() {
+        // Use at most a quarter of physical memory for a single hash
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_size = sysconf(_SC_PAGE_SIZE);
+        uint32_t max_memory_kib = 262144;
+        if (pages > 0 && page_size > 0) {
+            uint64_t quarter_kib = static_cast<uint64_t>(pages) * page_size / 4096;
+            max_memory_kib = static_cast<uint32_t>(std::min<uint64_t>(max_memory_kib, quarter_kib));
+        }
+        
+        std::cout << "Calibrating Argon2id for " << calibrate_ms_ << " ms (max "
+                  << max_memory_kib / 1024 << " MiB)..." << std::endl;
+        double measured_ms = 0.0;
+        KdfParams params = CryptoManager::instance().calibrate_kdf(calibrate_ms_, max_memory_kib, &measured_ms);
+        
+        std::cout << "Measured " << static_cast<int>(measured_ms) << " ms. Suggested [security] settings:\n";
+        std::cout << "argon2_time_cost = " << params.time_cost << "\n";
+        std::cout << "argon2_memory_cost = " << params.memory_cost << "\n";
+        std::cout << "argon2_parallelism = " << params.parallelism << std::endl;
+    }
+    
+    // Exit status: 0 clean, 2 problems found, 1 on errors
+    int check_vault() {
+        // Without the master password only the directory/database reconciliation runs
+        std::cerr << "Master password (empty to skip tag verification): " << std::flush;
+        std::string password;
+        termios saved{};
+        bool tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+        if (tty) {
+            termios quiet = saved;
+            quiet.c_lflag &= ~ECHO;
+            tcsetattr(STDIN_FILENO, TCSANOW, &quiet);
+        }
+        std::getline(std::cin, password);
+        if (tty) {
+            tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+            std::cerr << std::endl;
+        }
+        
+        bool verify = !password.empty();
+        if (verify && !CryptoManager::instance().load_master_key(password)) {
+            std::cerr << "Invalid master password" << std::endl;
+            return 1;
+        }
+        
+        auto report = VaultChecker::instance().run_check(verify, std::max(check_rate_, 0) * int64_t(1024),
+                                                         Config::instance().check_threads());
+        CryptoManager::instance().lock();
+        
+        std::string json = report.to_json();
+        if (check_report_.empty()) {
+            std::cout << json << std::endl;
+        } else {
+            std::ofstream out(check_report_, std::ios::trunc);
+            if (!(out << json << "\n")) {
+                std::cerr << "Failed to write report: " << check_report_ << std::endl;
+                return 1;
+            }
+        }
+        
+        std::cerr << report.files << " files, " << report.objects_checked << " objects authenticated, "
+                  << report.orphans.size() << " orphaned, " << report.missing.size() << " missing, "
+                  << report.corrupt.size() << " corrupt, " << report.unverifiable.size() << " legacy" << std::endl;
+        return report.clean() && report.complete ? 0 : 2;
+    }
+    
+    int reconcile_stats() {
+        int drift = Database::instance().rebuild_user_stats();
+        if (drift < 0) {
+            return 1;
+        }
+        std::cerr << "Storage counters rebuilt, " << drift << " were out of date" << std::endl;
+        return 0;
+    }
+    
+    int set_quota() {
+        auto user = Database::instance().get_user_by_username(quota_user_);
+        int64_t bytes = quota_mib_ < 0 ? -1 : quota_mib_ * 1024 * 1024;
+        if (!user || !Database::instance().set_user_quota(user->id, bytes)) {
+            std::cerr << "Unknown user: " << quota_user_ << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    int run_backup_tool() {
+        auto& backup = VaultBackup::instance();
+        auto report = !restore_backup_dir_.empty() ? backup.restore(restore_backup_dir_)
+                    : !verify_backup_dir_.empty() ? backup.verify(verify_backup_dir_)
+                    : backup.run_backup(backup_dir_);
+        std::cout << report.to_json() << std::endl;
+        
+        std::cerr << report.operation << ": " << report.objects << " objects, " << report.objects_copied
+                  << " copied, " << report.bytes_copied << " bytes in " << report.seconds << " s, "
+                  << report.missing.size() << " missing, " << report.errors.size() << " errors" << std::endl;
+        for (const auto& error : report.errors) {
+            std::cerr << "  " << error << std::endl;
+        }
+        return report.clean() ? 0 : 2;
+    }
+    
     void print_help() {
         std::cout << "VaultUSB C++ Server\n";
         std::cout << "Usage: vaultusb_cpp [options]\n";
         std::cout << "Options:\n";
         std::cout << "  --port PORT        Port to listen on (default: 8000)\n";
         std::cout << "  --config FILE      Configuration file (default: config.toml)\n";
+        std::cout << "  --calibrate-kdf [MS]  Suggest Argon2 parameters for a target latency (default: 500)\n";
+        std::cout << "  --check-vault      Check the vault for orphaned, missing and corrupt files, then exit\n";
+        std::cout << "  --check-report FILE  Write the check's JSON report to FILE (default: stdout)\n";
+        std::cout << "  --check-rate KIB   Read rate limit for --check-vault in KiB/s (default: unthrottled)\n";
+        std::cout << "  --reconcile-stats  Rebuild the per-user storage counters from the file table, then exit\n";
+        std::cout << "  --set-quota USER MIB  Set a user's storage quota (0 = unlimited, -1 = storage.default_quota)\n";
+        std::cout << "  --backup DIR       Copy the vault into DIR, incrementally if it holds an earlier backup, then exit\n";
+        std::cout << "  --verify-backup DIR  Check every file of the backup in DIR against its manifest, then exit\n";
+        std::cout << "  --restore-backup DIR  Restore the backup in DIR into the configured (empty) vault, then exit\n";
         std::cout << "  --help             Show this help message\n";
     }
 };
@@ -109,7 +310,7 @@ private:
 
 int main(int argc, char* argv[]) {
     if (!vaultusb::VaultUSBApp::instance().initialize(argc, argv)) {
-        return 1;
+        return vaultusb::VaultUSBApp::instance().exit_code();
     }
     
     vaultusb::VaultUSBApp::instance().run();
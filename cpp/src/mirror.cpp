@@ -0,0 +1,137 @@
+#include "mirror.h"
+#include "backup.h"
+#include "config.h"
+#include "database.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/stat.h>
+
+namespace vaultusb {
+
+VaultMirror& VaultMirror::instance() {
+    static VaultMirror instance;
+    return instance;
+}
+
+VaultMirror::~VaultMirror() {
+    stop();
+}
+
+void VaultMirror::start() {
+    const std::string& target = Config::instance().mirror_dir();
+    if (target.empty()) {
+        // Left over from when a mirror was configured
+        Database::instance().delete_mirror_queue(INT64_MAX);
+        return;
+    }
+    if (running_.exchange(true)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.enabled = true;
+        stats_.target = target;
+        stats_.state = "catching_up";
+    }
+    worker_ = std::thread(&VaultMirror::worker_loop, this);
+}
+
+void VaultMirror::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+VaultMirror::Progress VaultMirror::progress() {
+    int64_t pending = 0;
+    std::time_t oldest = 0;
+    Database::instance().get_mirror_backlog(pending, oldest);
+    uint64_t pass_done = 0;
+    uint64_t pass_total = 0;
+    VaultBackup::instance().mirror_pass_progress(pass_done, pass_total);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Progress progress = stats_;
+    progress.pending = pending;
+    if (progress.state == "catching_up" || progress.state == "syncing") {
+        progress.pass_objects_done = pass_done;
+        progress.pass_objects_total = pass_total;
+    }
+    progress.lag_seconds = pending > 0 ? std::max<int64_t>(0, std::time(nullptr) - oldest) : 0;
+    return progress;
+}
+
+void VaultMirror::set_state(const std::string& state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.state = state;
+}
+
+void VaultMirror::worker_loop() {
+    const std::string target = Config::instance().mirror_dir();
+    auto interval = std::chrono::seconds(std::max(Config::instance().mirror_interval(), 1));
+    auto& db = Database::instance();
+
+    // The first pass catches up on whatever changed while nothing was running
+    bool full = true;
+    int64_t shipped_changes = -1;
+    while (running_) {
+        struct stat st;
+        if (stat(target.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            set_state("absent");
+            full = true;
+        } else {
+            // The pass ships the queue as its snapshot holds it, and clears
+            // only those entries; anything queued since waits for the next.
+            // Metadata changes that queue nothing (renames, moves, dropped
+            // versions) need the snapshot too; logins and logs do not
+            int64_t pending = 0;
+            std::time_t oldest = 0;
+            db.get_mirror_backlog(pending, oldest);
+            int64_t changes = db.metadata_change_count();
+            if (full || pending > 0 || changes != shipped_changes) {
+                set_state(full ? "catching_up" : "syncing");
+                int64_t queue_seq = 0;
+                auto report = VaultBackup::instance().run_mirror(target, full, queue_seq);
+                if (report.complete && (queue_seq == 0 || db.delete_mirror_queue(queue_seq))) {
+                    // Changes made meanwhile count as unshipped and get a pass of their own
+                    shipped_changes = changes;
+                    full = false;
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stats_.state = "idle";
+                    stats_.last_sync = report.finished_at;
+                    stats_.passes++;
+                    stats_.objects_shipped += report.objects_copied;
+                    stats_.bytes_shipped += report.bytes_copied;
+                    stats_.busy_seconds += report.seconds;
+                    stats_.last_error.clear();
+                } else {
+                    full = true;
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stats_.state = "failed";
+                    stats_.busy_seconds += report.seconds;
+                    stats_.last_error = !report.errors.empty() ? report.errors.front()
+                                      : !report.missing.empty() ? report.missing.front() + ": missing from the vault"
+                                      : "stopped";
+                }
+                if (!report.missing.empty()) {
+                    std::cerr << "Mirror pass found " << report.missing.size() << " objects missing from the vault"
+                              << std::endl;
+                }
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, interval, [this]() { return !running_; });
+    }
+}
+
+} // namespace vaultusb
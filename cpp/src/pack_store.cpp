@@ -0,0 +1,435 @@
+#include "pack_store.h"
+#include "codec.h"
+#include "config.h"
+#include "crypto.h"
+#include "database.h"
+#include "vault_layout.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <openssl/rand.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr size_t kMaxCachedFds = 256;
+constexpr auto kCompactInterval = std::chrono::minutes(5);
+
+bool pwrite_all(int fd, const uint8_t* data, size_t length, int64_t offset) {
+    while (length > 0) {
+        ssize_t n = pwrite(fd, data, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+bool pread_all(int fd, uint8_t* data, size_t length, int64_t offset) {
+    while (length > 0) {
+        ssize_t n = pread(fd, data, length, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+int64_t file_size(const std::string& encrypted_name) {
+    int fd = VaultLayout::instance().open(encrypted_name, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    int64_t size = fstat(fd, &st) == 0 ? st.st_size : -1;
+    close(fd);
+    return size;
+}
+
+} // namespace
+
+PackStore& PackStore::instance() {
+    static PackStore instance;
+    return instance;
+}
+
+PackStore::PackStore() {
+    auto& config = Config::instance();
+    threshold_ = static_cast<size_t>(std::max(config.pack_threshold(), 0));
+    segment_size_ = std::max(config.pack_segment_size(), 64) * int64_t(1024);
+    compact_threshold_ = std::min(std::max(config.pack_compact_threshold(), 1), 100);
+}
+
+PackStore::~PackStore() {
+    stop();
+    for (auto& entry : read_fds_) {
+        close(entry.second);
+    }
+    if (active_fd_ >= 0) {
+        close(active_fd_);
+    }
+}
+
+bool PackStore::open_active() {
+    if (active_fd_ >= 0) {
+        return true;
+    }
+    auto& layout = VaultLayout::instance();
+
+    // Keep filling the segment that was active before a restart; any other
+    // unsealed one is sealed so compaction can pick it up
+    for (const auto& pack : Database::instance().get_packs()) {
+        if (pack.sealed) {
+            continue;
+        }
+        int fd = active_fd_ < 0 ? layout.open(pack.encrypted_name, O_RDWR) : -1;
+        if (fd >= 0) {
+            active_fd_ = fd;
+            active_id_ = pack.id;
+        } else {
+            Database::instance().seal_pack(pack.id);
+        }
+    }
+    if (active_fd_ >= 0) {
+        return true;
+    }
+
+    uint8_t random[16];
+    if (RAND_bytes(random, sizeof(random)) != 1) {
+        return false;
+    }
+    std::string name = codec::hex_encode(random, sizeof(random));
+    int fd = layout.open(name, O_RDWR | O_CREAT | O_EXCL);
+    if (fd < 0) {
+        std::cerr << "Cannot create pack segment: " << strerror(errno) << std::endl;
+        return false;
+    }
+    int64_t pack_id = Database::instance().create_pack(name);
+    if (pack_id == 0) {
+        close(fd);
+        unlink(layout.path(name).c_str());
+        return false;
+    }
+    active_fd_ = fd;
+    active_id_ = pack_id;
+    return true;
+}
+
+void PackStore::seal_active() {
+    if (active_fd_ < 0) {
+        return;
+    }
+    fdatasync(active_fd_);
+    Database::instance().seal_pack(active_id_);
+    close(active_fd_);
+    active_fd_ = -1;
+    active_id_ = 0;
+}
+
+bool PackStore::write_active(const uint8_t* data, size_t length, bool sync, int64_t& pack_id, int64_t& offset) {
+    if (!open_active()) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(active_fd_, &st) != 0) {
+        return false;
+    }
+    offset = st.st_size;
+    pack_id = active_id_;
+
+    if (!pwrite_all(active_fd_, data, length, offset) || (sync && fdatasync(active_fd_) != 0)) {
+        std::cerr << "Failed to append to pack segment: " << strerror(errno) << std::endl;
+        if (ftruncate(active_fd_, offset) != 0) {
+            seal_active();
+        }
+        return false;
+    }
+
+    if (offset + static_cast<int64_t>(length) >= segment_size_) {
+        seal_active();
+    }
+    return true;
+}
+
+bool PackStore::append(const std::string& encrypted_name, const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(append_mutex_);
+
+    PackEntry entry;
+    entry.encrypted_name = encrypted_name;
+    entry.length = static_cast<int64_t>(length);
+    if (!write_active(data, length, true, entry.pack_id, entry.offset)) {
+        return false;
+    }
+    // An unindexed range is dead space and is reclaimed by compaction
+    return Database::instance().add_pack_entry(entry);
+}
+
+int PackStore::segment_fd(const PackEntry& entry, bool& cached) {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    auto it = read_fds_.find(entry.pack_id);
+    if (it != read_fds_.end()) {
+        cached = true;
+        return it->second;
+    }
+
+    int fd = VaultLayout::instance().open(entry.segment, O_RDONLY);
+    cached = fd >= 0 && read_fds_.size() < kMaxCachedFds;
+    if (cached) {
+        read_fds_[entry.pack_id] = fd;
+    }
+    return fd;
+}
+
+bool PackStore::read(const std::string& encrypted_name, const RangeReader& reader, bool* packed) {
+    if (packed) {
+        *packed = false;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+    PackEntry entry;
+    if (!Database::instance().get_pack_entry(encrypted_name, entry)) {
+        return false;
+    }
+    if (packed) {
+        *packed = true;
+    }
+
+    bool cached = false;
+    int fd = segment_fd(entry, cached);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = reader(fd, entry.offset, entry.length);
+    if (!cached) {
+        close(fd);
+    }
+    return ok;
+}
+
+bool PackStore::copy(const std::string& source_name, const std::string& target_name, bool* packed) {
+    std::vector<uint8_t> data;
+    bool ok = read(source_name, [&data](int fd, int64_t offset, int64_t length) {
+        data.resize(static_cast<size_t>(length));
+        return pread_all(fd, data.data(), data.size(), offset);
+    }, packed);
+    return ok && append(target_name, data.data(), data.size());
+}
+
+bool PackStore::release(const std::string& encrypted_name) {
+    std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+    PackEntry entry;
+    if (!Database::instance().get_pack_entry(encrypted_name, entry) ||
+        !Database::instance().delete_pack_entry(encrypted_name)) {
+        return false;
+    }
+
+    // The segment outlives the entry, so its bytes are wiped right away
+    {
+        std::lock_guard<std::mutex> wipe_lock(wipe_mutex_);
+        if (wipe_holds_ > 0) {
+            held_wipes_.push_back(entry);
+            return true;
+        }
+    }
+    wipe(entry);
+    return true;
+}
+
+void PackStore::wipe(const PackEntry& entry) {
+    int fd = VaultLayout::instance().open(entry.segment, O_WRONLY);
+    if (fd < 0) {
+        return; // compacted and shredded meanwhile
+    }
+    std::vector<uint8_t> zeros(static_cast<size_t>(entry.length), 0);
+    if (!pwrite_all(fd, zeros.data(), zeros.size(), entry.offset) || fdatasync(fd) != 0) {
+        std::cerr << "Failed to wipe packed object " << entry.encrypted_name << ": " << strerror(errno) << std::endl;
+    }
+    close(fd);
+}
+
+void PackStore::hold_wipes() {
+    std::lock_guard<std::mutex> lock(wipe_mutex_);
+    wipe_holds_++;
+}
+
+void PackStore::release_wipes() {
+    std::vector<PackEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(wipe_mutex_);
+        if (--wipe_holds_ > 0) {
+            return;
+        }
+        entries.swap(held_wipes_);
+    }
+    std::shared_lock<std::shared_mutex> lock(segments_mutex_);
+    for (const auto& entry : entries) {
+        wipe(entry);
+    }
+}
+
+bool PackStore::contains(const std::string& encrypted_name) {
+    PackEntry entry;
+    return Database::instance().get_pack_entry(encrypted_name, entry);
+}
+
+std::vector<std::string> PackStore::segment_names() {
+    std::vector<std::string> names;
+    for (const auto& pack : Database::instance().get_packs()) {
+        names.push_back(pack.encrypted_name);
+    }
+    return names;
+}
+
+void PackStore::start() {
+    if (threshold_ == 0 || running_.exchange(true)) {
+        return;
+    }
+    stop_requested_ = false;
+    worker_ = std::thread(&PackStore::worker_loop, this);
+}
+
+void PackStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex_);
+        running_ = false;
+        stop_requested_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void PackStore::worker_loop() {
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(worker_mutex_);
+            cv_.wait_for(lock, kCompactInterval, [this]() { return !running_; });
+        }
+        if (running_) {
+            compact();
+        }
+    }
+}
+
+int64_t PackStore::compact() {
+    int64_t reclaimed = 0;
+    for (const auto& pack : Database::instance().get_packs()) {
+        // Only sealed segments: nothing is appended to them any more
+        if (!pack.sealed || stop_requested_) {
+            continue;
+        }
+        int64_t size = file_size(pack.encrypted_name);
+        if (size <= 0 && pack.entries > 0) {
+            continue; // missing segments are reported by the integrity check
+        }
+        int64_t dead = std::max<int64_t>(size - pack.live_bytes, 0);
+        if (pack.entries == 0 || dead * 100 >= std::max<int64_t>(size, 1) * compact_threshold_) {
+            reclaimed += compact_segment(pack, std::max<int64_t>(size, 0));
+        }
+    }
+    return reclaimed;
+}
+
+int64_t PackStore::compact_segment(const Pack& pack, int64_t segment_bytes) {
+    auto& db = Database::instance();
+    auto& layout = VaultLayout::instance();
+
+    auto entries = db.get_pack_entries(pack.id);
+    int64_t live = 0;
+    if (!entries.empty()) {
+        int fd = layout.open(pack.encrypted_name, O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+
+        // Copy every live entry first, make the copies durable, then repoint
+        // the index; until then readers keep using the old ranges
+        struct Moved {
+            std::string name;
+            int64_t pack_id;
+            int64_t offset;
+        };
+        std::vector<Moved> moved;
+        std::vector<uint8_t> data;
+        bool ok = true;
+        {
+            std::lock_guard<std::mutex> lock(append_mutex_);
+            for (const auto& entry : entries) {
+                data.resize(static_cast<size_t>(entry.length));
+                Moved copy{entry.encrypted_name, 0, 0};
+                if (stop_requested_) {
+                    ok = false;
+                    break;
+                }
+                if (!pread_all(fd, data.data(), data.size(), entry.offset) ||
+                    !write_active(data.data(), data.size(), false, copy.pack_id, copy.offset)) {
+                    ok = false;
+                    break;
+                }
+                moved.push_back(copy);
+                live += entry.length;
+            }
+            ok = ok && (active_fd_ < 0 || fdatasync(active_fd_) == 0);
+        }
+        close(fd);
+
+        // Entries released meanwhile fail to move and stay dead in the new segment
+        for (size_t i = 0; ok && i < moved.size(); i++) {
+            db.move_pack_entry(moved[i].name, pack.id, moved[i].pack_id, moved[i].offset);
+        }
+        if (!ok) {
+            return 0;
+        }
+    }
+
+    // Wait for readers still on the old ranges before letting go of the segment
+    std::unique_lock<std::shared_mutex> lock(segments_mutex_);
+    if (!db.delete_pack(pack.id)) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> fd_lock(fd_mutex_);
+        auto it = read_fds_.find(pack.id);
+        if (it != read_fds_.end()) {
+            close(it->second);
+            read_fds_.erase(it);
+        }
+    }
+    CryptoManager::instance().secure_delete(layout.path(pack.encrypted_name));
+
+    int64_t reclaimed = std::max<int64_t>(segment_bytes - live, 0);
+    compacted_segments_++;
+    reclaimed_bytes_ += static_cast<uint64_t>(reclaimed);
+    return reclaimed;
+}
+
+PackStore::Stats PackStore::stats() {
+    Stats stats;
+    for (const auto& pack : Database::instance().get_packs()) {
+        stats.segments++;
+        stats.entries += pack.entries;
+        stats.live_bytes += pack.live_bytes;
+        stats.segment_bytes += std::max<int64_t>(file_size(pack.encrypted_name), 0);
+    }
+    stats.compacted_segments = compacted_segments_;
+    stats.reclaimed_bytes = reclaimed_bytes_;
+    return stats;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,177 @@
+#include "pipeline.h"
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+namespace vaultusb {
+
+void BlockPipeline::BlockQueue::push(PipelineBlock* block) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocks_.push_back(block);
+    }
+    cv_.notify_one();
+}
+
+PipelineBlock* BlockPipeline::BlockQueue::pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !blocks_.empty() || closed_; });
+    if (blocks_.empty()) {
+        return nullptr;
+    }
+
+    PipelineBlock* block = blocks_.front();
+    blocks_.pop_front();
+    return block;
+}
+
+void BlockPipeline::BlockQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cv_.notify_all();
+}
+
+BlockPipeline::BlockPipeline(size_t block_capacity, size_t depth) {
+    if (depth < 2) {
+        depth = 2;
+    }
+
+    pool_.resize(depth);
+    for (auto& block : pool_) {
+        block.data.resize(block_capacity);
+    }
+}
+
+void BlockPipeline::fail(const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (error_.empty()) {
+            error_ = message;
+        }
+    }
+    aborted_ = true;
+    free_.close();
+    filled_.close();
+    sealed_.close();
+}
+
+bool BlockPipeline::run(const ReadStage& read, const TransformStage& transform, const WriteStage& write) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto& block : pool_) {
+        free_.push(&block);
+    }
+
+    // Read stage: fill free blocks until the source reports the last one
+    std::thread reader([&]() {
+        uint64_t index = 0;
+        while (!aborted_) {
+            PipelineBlock* block = free_.pop();
+            if (!block) {
+                break;
+            }
+
+            block->length = 0;
+            block->last = false;
+            block->index = index++;
+
+            try {
+                if (!read(*block)) {
+                    fail("read stage failed");
+                    break;
+                }
+            } catch (const std::exception& e) {
+                fail(std::string("read stage failed: ") + e.what());
+                break;
+            }
+
+            // Read `last` before handing the block on: once pushed it may be
+            // recycled and refilled by the time we look again
+            bool last = block->last;
+            filled_.push(block);
+            if (last) {
+                break;
+            }
+        }
+        filled_.close();
+    });
+
+    // Transform stage: encrypt or decrypt in place on a worker
+    std::thread worker([&]() {
+        while (!aborted_) {
+            PipelineBlock* block = filled_.pop();
+            if (!block) {
+                break;
+            }
+
+            try {
+                if (!transform(*block)) {
+                    fail("transform stage failed");
+                    break;
+                }
+            } catch (const std::exception& e) {
+                fail(std::string("transform stage failed: ") + e.what());
+                break;
+            }
+
+            bool last = block->last;
+            sealed_.push(block);
+            if (last) {
+                break;
+            }
+        }
+        sealed_.close();
+    });
+
+    // Write stage: runs on the caller so sinks may use the caller's socket or fd
+    bool finished = false;
+    while (!aborted_) {
+        PipelineBlock* block = sealed_.pop();
+        if (!block) {
+            break;
+        }
+
+        try {
+            if (!write(*block)) {
+                fail("write stage failed");
+                break;
+            }
+        } catch (const std::exception& e) {
+            fail(std::string("write stage failed: ") + e.what());
+            break;
+        }
+
+        stats_.blocks++;
+        stats_.bytes_written += block->length;
+
+        bool last = block->last;
+        free_.push(block);
+        if (last) {
+            finished = true;
+            break;
+        }
+    }
+
+    if (!finished && !aborted_) {
+        fail("pipeline ended before the last block");
+    }
+
+    // Unblock and join the helper stages
+    free_.close();
+    filled_.close();
+    sealed_.close();
+    reader.join();
+    worker.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats_.seconds = elapsed.count();
+    if (stats_.seconds > 0.0) {
+        stats_.mb_per_second = static_cast<double>(stats_.bytes_written) / (1024.0 * 1024.0) / stats_.seconds;
+    }
+
+    return finished && !aborted_;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,133 @@
+#include "secure_memory.h"
+#include "config.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <openssl/crypto.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr size_t kSlotSize = 16; // allocation granularity and alignment
+constexpr size_t kMinArenaSize = 4096;
+
+} // namespace
+
+SecureArena& SecureArena::instance() {
+    // Never destroyed: key buffers owned by other singletons are released
+    // during static destruction and must still find the arena
+    static SecureArena* instance = new SecureArena();
+    return *instance;
+}
+
+SecureArena::SecureArena() {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t wanted = std::max<size_t>(static_cast<size_t>(std::max(Config::instance().secure_arena_size(), 0)) * 1024,
+                                     kMinArenaSize);
+    size_t capacity = (wanted + page - 1) / page * page;
+
+    // [guard page][arena][guard page]
+    size_t mapping_size = capacity + 2 * page;
+    void* mapping = mmap(nullptr, mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Secure arena unavailable, key buffers use the heap: " << strerror(errno) << std::endl;
+        return;
+    }
+    mapping_ = static_cast<uint8_t*>(mapping);
+    mapping_size_ = mapping_size;
+    base_ = mapping_ + page;
+    if (mprotect(base_, capacity, PROT_READ | PROT_WRITE) != 0) {
+        std::cerr << "Secure arena unavailable, key buffers use the heap: " << strerror(errno) << std::endl;
+        munmap(mapping_, mapping_size_);
+        mapping_ = nullptr;
+        base_ = nullptr;
+        return;
+    }
+
+    stats_.locked = mlock(base_, capacity) == 0;
+    if (!stats_.locked) {
+        std::cerr << "Cannot mlock secure arena (" << strerror(errno)
+                  << "); key material may be swapped out. Raise RLIMIT_MEMLOCK." << std::endl;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(base_, capacity, MADV_DONTDUMP);
+#endif
+#ifdef MADV_WIPEONFORK
+    madvise(base_, capacity, MADV_WIPEONFORK);
+#endif
+
+    capacity_ = capacity;
+    stats_.capacity = capacity;
+    used_.assign((capacity / kSlotSize + 63) / 64, 0);
+}
+
+bool SecureArena::owns(const void* ptr) const {
+    auto p = static_cast<const uint8_t*>(ptr);
+    return base_ && p >= base_ && p < base_ + capacity_;
+}
+
+void* SecureArena::allocate(size_t size) {
+    size_t slots = (std::max<size_t>(size, 1) + kSlotSize - 1) / kSlotSize;
+    size_t total = capacity_ / kSlotSize;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.allocations++;
+
+        // First fit over the slot bitmap; the arena is small and mostly empty
+        size_t run = 0;
+        for (size_t i = 0; i < total; i++) {
+            if (run == 0 && (i % 64) == 0 && used_[i / 64] == ~uint64_t(0)) {
+                i += 63;
+                continue;
+            }
+            if (used_[i / 64] & (uint64_t(1) << (i % 64))) {
+                run = 0;
+                continue;
+            }
+            if (++run == slots) {
+                size_t first = i + 1 - slots;
+                for (size_t s = first; s <= i; s++) {
+                    used_[s / 64] |= uint64_t(1) << (s % 64);
+                }
+                stats_.in_use += slots * kSlotSize;
+                stats_.peak = std::max(stats_.peak, stats_.in_use);
+                return base_ + first * kSlotSize;
+            }
+        }
+        stats_.heap_fallbacks++;
+    }
+    return ::operator new(size);
+}
+
+void SecureArena::deallocate(void* ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    OPENSSL_cleanse(ptr, size);
+
+    if (!owns(ptr)) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    size_t first = (static_cast<uint8_t*>(ptr) - base_) / kSlotSize;
+    size_t slots = (std::max<size_t>(size, 1) + kSlotSize - 1) / kSlotSize;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t s = first; s < first + slots; s++) {
+        used_[s / 64] &= ~(uint64_t(1) << (s % 64));
+    }
+    stats_.in_use -= slots * kSlotSize;
+}
+
+SecureArena::Stats SecureArena::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace vaultusb
@@ -0,0 +1,267 @@
+#include "shredder.h"
+#include "config.h"
+#include "database.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <openssl/rand.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr int64_t kSliceSize = 1 << 20;        // bytes discarded/overwritten per step
+constexpr int64_t kCheckpointBytes = 16 << 20; // persist progress this often
+
+} // namespace
+
+Shredder& Shredder::instance() {
+    static Shredder instance;
+    return instance;
+}
+
+Shredder::~Shredder() {
+    stop();
+}
+
+void Shredder::start() {
+    if (running_) {
+        return;
+    }
+
+    const std::string& mode = Config::instance().shred_mode();
+    if (mode == "discard") {
+        mode_ = Mode::Discard;
+    } else if (mode == "overwrite") {
+        mode_ = Mode::Overwrite;
+    } else {
+        mode_ = Mode::Auto;
+    }
+    rate_limit_ = std::max(Config::instance().shred_rate_limit(), 0) * int64_t(1024);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.mode = mode_ == Mode::Discard ? "discard" : mode_ == Mode::Overwrite ? "overwrite" : "auto";
+        stats_.rate_limit = rate_limit_;
+    }
+
+    // Jobs persisted by a previous run are picked up by the first queue scan
+    running_ = true;
+    worker_ = std::thread(&Shredder::worker_loop, this);
+}
+
+void Shredder::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+bool Shredder::enqueue(const std::string& file_path) {
+    struct stat st;
+    if (stat(file_path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+
+    if (!Database::instance().enqueue_shred(file_path, st.st_size)) {
+        std::cerr << "Failed to queue file for shredding: " << file_path << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_ = true;
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void Shredder::pause() {
+    paused_++;
+}
+
+void Shredder::resume() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        paused_--;
+        wake_ = true;
+    }
+    cv_.notify_one();
+}
+
+Shredder::Progress Shredder::progress() {
+    int64_t files = 0;
+    int64_t bytes = 0;
+    Database::instance().get_shred_backlog(files, bytes);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Progress progress = stats_;
+    progress.pending_files = files;
+    progress.pending_bytes = bytes;
+    return progress;
+}
+
+void Shredder::worker_loop() {
+    while (running_) {
+        if (paused_ > 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return paused_ == 0 || !running_; });
+            continue;
+        }
+
+        auto jobs = Database::instance().get_shred_jobs();
+        if (jobs.empty()) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, std::chrono::seconds(30), [this]() { return wake_ || !running_; });
+            wake_ = false;
+            continue;
+        }
+
+        for (auto& job : jobs) {
+            if (!running_ || paused_ > 0) {
+                break;
+            }
+            shred_job(job);
+        }
+    }
+}
+
+bool Shredder::shred_job(ShredJob& job) {
+    int fd = open(job.path.c_str(), O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        // Already gone: nothing left to shred
+        if (errno != ENOENT) {
+            std::cerr << "Cannot open file for shredding: " << job.path << ": " << strerror(errno) << std::endl;
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.failed_files++;
+        }
+        Database::instance().delete_shred_job(job.id);
+        return true;
+    }
+
+    struct stat st;
+    int64_t size = fstat(fd, &st) == 0 ? static_cast<int64_t>(st.st_size) : job.size;
+    int64_t offset = std::min(job.bytes_done, size);
+    int64_t saved = offset;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.active = true;
+        stats_.current_size = size;
+        stats_.current_done = offset;
+    }
+
+    Mode mode = mode_;
+    std::vector<uint8_t> pattern;
+    bool ok = true;
+    while (offset < size && running_) {
+        int64_t length = std::min(kSliceSize, size - offset);
+        auto started = std::chrono::steady_clock::now();
+
+        bool done = false;
+        if (mode != Mode::Overwrite) {
+            done = discard_range(fd, offset, length);
+            if (!done && mode == Mode::Discard) {
+                std::cerr << "Discard not supported for " << job.path << ": " << strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+            if (!done) {
+                // Filesystem cannot punch holes: overwrite the rest instead
+                mode = Mode::Overwrite;
+            }
+        }
+        if (!done) {
+            if (pattern.empty()) {
+                pattern.resize(kSliceSize);
+                RAND_bytes(pattern.data(), pattern.size());
+            }
+            if (!overwrite_range(fd, offset, length, pattern)) {
+                std::cerr << "Overwrite failed for " << job.path << ": " << strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+        }
+
+        offset += length;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.current_done = offset;
+        }
+        if (offset - saved >= kCheckpointBytes) {
+            Database::instance().update_shred_progress(job.id, offset);
+            saved = offset;
+        }
+
+        throttle(length, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    }
+
+    if (ok && offset < size) {
+        // Stopping: keep the row so the next start resumes here
+        Database::instance().update_shred_progress(job.id, offset);
+        close(fd);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.active = false;
+        return false;
+    }
+
+    fdatasync(fd);
+    close(fd);
+    if (unlink(job.path.c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "Failed to unlink shredded file: " << job.path << ": " << strerror(errno) << std::endl;
+        ok = false;
+    }
+    Database::instance().delete_shred_job(job.id);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.active = false;
+    if (ok) {
+        stats_.shredded_files++;
+        stats_.shredded_bytes += size;
+    } else {
+        stats_.failed_files++;
+    }
+    return true;
+}
+
+bool Shredder::discard_range(int fd, int64_t offset, int64_t length) {
+    // Deallocates the blocks; with discard-enabled mounts this reaches the flash as TRIM
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0;
+}
+
+bool Shredder::overwrite_range(int fd, int64_t offset, int64_t length, const std::vector<uint8_t>& pattern) {
+    while (length > 0) {
+        size_t chunk = static_cast<size_t>(std::min<int64_t>(length, pattern.size()));
+        ssize_t written = pwrite(fd, pattern.data(), chunk, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += written;
+        length -= written;
+    }
+    // Flush each slice so the throttle paces real device writes
+    return fdatasync(fd) == 0;
+}
+
+void Shredder::throttle(int64_t bytes, double elapsed_seconds) {
+    if (rate_limit_ <= 0) {
+        return;
+    }
+
+    double budget = static_cast<double>(bytes) / rate_limit_;
+    if (budget > elapsed_seconds) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::duration<double>(budget - elapsed_seconds), [this]() { return !running_; });
+    }
+}
+
+} // namespace vaultusb
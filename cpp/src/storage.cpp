@@ -2,116 +2,1583 @@
 #include "config.h"
 #include "database.h"
 #include "crypto.h"
+#include "codec.h"
+#include "compression.h"
+#include "pack_store.h"
+#include "vault_layout.h"
+#include "zip_writer.h"
+#include "archive_reader.h"
+#include "chunker.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <random>
 #include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <ctime>
 #include <unistd.h>
 
 namespace vaultusb {
 
+namespace {
+
+// Archive import inserts rows in batches, at least once a second
+constexpr size_t kImportBatch = 64;
+constexpr auto kImportFlushInterval = std::chrono::seconds(1);
+
+bool write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool read_all(int fd, uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Appends `length` bytes of in to out; copy_file_range keeps the copy in the
+// kernel (or shares extents) where the filesystem supports it
+bool copy_all(int in, int out, int64_t length) {
+    while (length > 0) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(length), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            break;
+        }
+        length -= n;
+    }
+    uint8_t buffer[65536];
+    while (length > 0) {
+        size_t want = static_cast<size_t>(std::min<int64_t>(length, sizeof(buffer)));
+        if (!read_all(in, buffer, want) || !write_all(out, buffer, want)) {
+            return false;
+        }
+        length -= static_cast<int64_t>(want);
+    }
+    return true;
+}
+
+// One path component: no separators, nothing a client could take for a path
+bool valid_folder_name(const std::string& name) {
+    return !name.empty() && name.size() <= 255 && name != "." && name != ".." &&
+           name.find_first_of(std::string("/\\\0", 3)) == std::string::npos;
+}
+
+bool sync_directory(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+} // namespace
+
 StorageManager& StorageManager::instance() {
     static StorageManager instance;
     return instance;
 }
 
-StorageManager::StorageManager() {
-    vault_dir_ = Config::instance().vault_dir();
-    ensure_vault_directory();
+StorageManager::StorageManager() {
+    vault_dir_ = Config::instance().vault_dir();
+    ensure_vault_directory();
+}
+
+std::string StorageManager::store_file(const std::vector<uint8_t>& file_data, const std::string& original_name, const User& user) {
+    size_t offset = 0;
+    return store_stream([&file_data, &offset](uint8_t* buffer, size_t length) {
+        size_t n = std::min(length, file_data.size() - offset);
+        std::memcpy(buffer, file_data.data() + offset, n);
+        offset += n;
+        return static_cast<ssize_t>(n);
+    }, original_name, user);
+}
+
+std::string StorageManager::store_stream(const ByteSource& source, const std::string& original_name, const User& user) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    // Checked against the counters up front; the stream is cut off once its
+    // ciphertext outgrows what is left
+    int64_t remaining = quota_remaining(user);
+    if (remaining == 0) {
+        throw std::runtime_error("Storage quota exceeded");
+    }
+    
+    File file_record;
+    std::string written_name;
+    if (!seal_file(source, original_name, user, remaining, file_record, written_name)) {
+        return "";
+    }
+    
+    // Store file metadata in database
+    if (!Database::instance().create_file(file_record)) {
+        release_file(file_record, written_name);
+        return "";
+    }
+    
+    return file_record.id;
+}
+
+bool StorageManager::seal_file(const ByteSource& source, const std::string& original_name, const User& user,
+                               int64_t remaining, File& file_record, std::string& written_name) {
+    written_name.clear();
+    try {
+        std::string file_id = generate_file_id();
+        std::string encrypted_name = generate_encrypted_filename();
+        
+        // Read ahead up to the pack threshold: small files are encrypted in
+        // memory and appended to a pack segment instead of getting a file
+        std::vector<uint8_t> head;
+        bool packed = false;
+        size_t threshold = PackStore::instance().threshold();
+        if (threshold > 0) {
+            head.resize(threshold + 1);
+            size_t have = 0;
+            while (have < head.size()) {
+                ssize_t n = source(head.data() + have, head.size() - have);
+                if (n < 0) {
+                    return false;
+                }
+                if (n == 0) {
+                    break;
+                }
+                have += static_cast<size_t>(n);
+            }
+            head.resize(have);
+            packed = have <= threshold;
+        }
+        size_t head_pos = 0;
+        ByteSource input = [&source, &head, &head_pos, packed](uint8_t* buffer, size_t length) -> ssize_t {
+            if (head_pos < head.size()) {
+                size_t n = std::min(length, head.size() - head_pos);
+                std::memcpy(buffer, head.data() + head_pos, n);
+                head_pos += n;
+                return static_cast<ssize_t>(n);
+            }
+            return packed ? 0 : source(buffer, length);
+        };
+        
+        // Random data key, stored wrapped by the master key; wrapped before
+        // the object is opened so a refused wrap leaves nothing behind
+        auto file_key = CryptoManager::instance().generate_file_key();
+        uint32_t key_id = 0;
+        std::string wrapped_key = CryptoManager::instance().wrap_file_key(file_key, file_id, key_id);
+        
+        int fd = -1;
+        std::vector<uint8_t> sealed;
+        if (!packed) {
+            fd = VaultLayout::instance().open(encrypted_name, O_WRONLY | O_CREAT | O_EXCL);
+            if (fd < 0) {
+                return false;
+            }
+            written_name = encrypted_name;
+        }
+        
+        // Hash the plaintext on the way through for deduplication
+        bool dedup = Config::instance().dedup_enabled();
+        std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> sha(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        if (dedup && (!sha || EVP_DigestInit_ex(sha.get(), EVP_sha256(), nullptr) != 1)) {
+            dedup = false;
+        }
+        
+        // Compress before encrypting unless the format is already compressed;
+        // the crypto stage also skips chunks that sample as high entropy
+        std::string mime_type = get_mime_type(original_name);
+        auto codec = compression::compressible_mime(mime_type)
+            ? compression::from_name(Config::instance().compression())
+            : compression::Codec::None;
+        
+        // Count plaintext bytes as they pass through to the encryption stage
+        int64_t plaintext_size = 0;
+        int64_t stored_size = 0;
+        bool ok = CryptoManager::instance().encrypt_stream(
+            [&input, &plaintext_size, &sha, dedup](uint8_t* buffer, size_t length) {
+                ssize_t n = input(buffer, length);
+                if (n > 0) {
+                    plaintext_size += n;
+                    if (dedup) {
+                        EVP_DigestUpdate(sha.get(), buffer, static_cast<size_t>(n));
+                    }
+                }
+                return n;
+            },
+            [fd, &sealed, &stored_size, remaining](const uint8_t* data, size_t length) {
+                stored_size += static_cast<int64_t>(length);
+                if (remaining >= 0 && stored_size > remaining) {
+                    std::cerr << "Upload exceeds the storage quota" << std::endl;
+                    return false;
+                }
+                if (fd < 0) {
+                    sealed.insert(sealed.end(), data, data + length);
+                    return true;
+                }
+                return write_all(fd, data, length);
+            },
+            file_key, codec);
+        if (fd >= 0) {
+            ok = ok && fdatasync(fd) == 0;
+            if (close(fd) != 0) {
+                ok = false;
+            }
+        } else if (ok) {
+            ok = PackStore::instance().append(encrypted_name, sealed.data(), sealed.size());
+            if (ok) {
+                written_name = encrypted_name;
+            }
+        }
+        
+        if (!ok) {
+            if (!written_name.empty()) {
+                discard_object(written_name, false);
+            }
+            return false;
+        }
+        
+        file_record = File(file_id, original_name, encrypted_name, plaintext_size, mime_type, user.id);
+        file_record.wrapped_key = wrapped_key;
+        file_record.key_id = key_id;
+        file_record.stored_size = stored_size;
+        
+        if (dedup) {
+            uint8_t sha256[EVP_MAX_MD_SIZE];
+            unsigned int sha_len = 0;
+            EVP_DigestFinal_ex(sha.get(), sha256, &sha_len);
+            std::string digest = CryptoManager::instance().content_digest(user_secret(user.id, "dedup"), sha256);
+            
+            std::string stored_name;
+            if (Database::instance().acquire_object(user.id, digest, encrypted_name, plaintext_size, stored_name)) {
+                file_record.content_digest = digest;
+                if (stored_name != encrypted_name) {
+                    // Already stored: drop the fresh ciphertext (its key is never persisted)
+                    if (share_object(file_record, stored_name)) {
+                        discard_object(encrypted_name, false);
+                        written_name.clear();
+                    } else {
+                        // The owning row is not visible yet; keep this copy undeduplicated
+                        Database::instance().release_object(user.id, digest);
+                        file_record.content_digest.clear();
+                    }
+                }
+            }
+        }
+        
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to store file: " << e.what() << std::endl;
+        if (!written_name.empty()) {
+            discard_object(written_name, false);
+        }
+        return false;
+    }
+}
+
+void StorageManager::release_file(const File& file_record, const std::string& written_name) {
+    if (!file_record.content_digest.empty() &&
+        Database::instance().release_object(file_record.user_id, file_record.content_digest) &&
+        file_record.encrypted_name != written_name) {
+        // Our reference was the last one on a shared object
+        discard_object(file_record.encrypted_name, true);
+    }
+    if (!written_name.empty()) {
+        discard_object(written_name, false);
+    }
+}
+
+std::string StorageManager::link_existing(const std::string& sha256_hex, const std::string& original_name, const User& user) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    std::vector<uint8_t> sha256;
+    if (!Config::instance().dedup_enabled() || !codec::hex_decode(sha256_hex, sha256) || sha256.size() != 32) {
+        return "";
+    }
+    
+    try {
+        std::string digest = CryptoManager::instance().content_digest(user_secret(user.id, "dedup"), sha256.data());
+        if (!Database::instance().add_object_ref(user.id, digest)) {
+            return "";
+        }
+        
+        std::string stored_name;
+        int64_t size = 0;
+        File file_record(generate_file_id(), original_name, "", 0, get_mime_type(original_name), user.id);
+        file_record.content_digest = digest;
+        if (!Database::instance().find_object(user.id, digest, stored_name, size) ||
+            !share_object(file_record, stored_name)) {
+            Database::instance().release_object(user.id, digest);
+            return "";
+        }
+        file_record.size = size;
+        
+        if (!Database::instance().create_file(file_record)) {
+            Database::instance().release_object(user.id, digest);
+            return "";
+        }
+        return file_record.id;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to link existing content: " << e.what() << std::endl;
+        return "";
+    }
+}
+
+bool StorageManager::share_object(File& file_record, const std::string& stored_name) {
+    // Any row on the object carries its data key; rewrap it for this row's id
+    auto owner = Database::instance().get_file_by_encrypted_name(stored_name);
+    if (!owner) {
+        return false;
+    }
+    
+    auto file_key = CryptoManager::instance().resolve_file_key(owner->id, owner->wrapped_key, owner->key_id);
+    file_record.wrapped_key = CryptoManager::instance().wrap_file_key(file_key, file_record.id, file_record.key_id);
+    file_record.encrypted_name = stored_name;
+    file_record.stored_size = owner->stored_size;
+    return true;
+}
+
+SecureBytes StorageManager::user_secret(int user_id, const std::string& purpose) {
+    // Wrapped like a file data key so it survives master-key rotation
+    std::string wrap_id = "user:" + std::to_string(user_id) + ":" + purpose;
+    auto key = Database::instance().get_user_key(user_id, purpose);
+    if (!key) {
+        UserKey created;
+        created.user_id = user_id;
+        created.purpose = purpose;
+        created.wrapped_key = CryptoManager::instance().wrap_file_key(
+            CryptoManager::instance().generate_file_key(), wrap_id, created.key_id);
+        Database::instance().create_user_key(created);
+        
+        key = Database::instance().get_user_key(user_id, purpose);
+        if (!key) {
+            throw std::runtime_error("Failed to create user key");
+        }
+    }
+    return CryptoManager::instance().unwrap_file_key(key->wrapped_key, wrap_id, key->key_id);
+}
+
+std::vector<uint8_t> StorageManager::retrieve_file(const std::string& file_id, const User& user) {
+    std::vector<uint8_t> data;
+    try {
+        bool ok = retrieve_stream(file_id, user, [&data](const uint8_t* chunk, size_t length) {
+            data.insert(data.end(), chunk, chunk + length);
+            return true;
+        });
+        if (!ok) {
+            return {};
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Failed to retrieve file: " << e.what() << std::endl;
+        return {};
+    }
+    return data;
+}
+
+bool StorageManager::retrieve_stream(const std::string& file_id, const User& user, const ByteSink& sink) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    auto file_record = Database::instance().get_file_by_id(file_id);
+    if (!file_record || file_record->user_id != user.id) {
+        return false;
+    }
+    
+    auto file_key = CryptoManager::instance().resolve_file_key(file_id, file_record->wrapped_key, file_record->key_id);
+    
+    // A versioned file is its current version's chunks
+    if (file_record->version > 0) {
+        return read_version(file_id, file_record->version, file_key, sink);
+    }
+    return read_object(file_record->encrypted_name, file_key, sink);
+}
+
+bool StorageManager::read_object(const std::string& encrypted_name, const SecureBytes& file_key,
+                                 const ByteSink& sink) {
+    // Packed objects are read straight from their range in the segment
+    bool packed = false;
+    bool ok = PackStore::instance().read(encrypted_name, [&file_key, &sink](int fd, int64_t offset, int64_t length) {
+        return CryptoManager::instance().decrypt_file_to(fd, file_key, sink, offset, length);
+    }, &packed);
+    if (packed) {
+        return ok;
+    }
+    
+    int fd = VaultLayout::instance().open(encrypted_name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    ok = CryptoManager::instance().decrypt_file_to(fd, file_key, sink);
+    close(fd);
+    return ok;
+}
+
+bool StorageManager::read_version(const std::string& file_id, int64_t version, const SecureBytes& file_key,
+                                  const ByteSink& sink) {
+    std::vector<ContentChunk> chunks;
+    if (!Database::instance().get_version_chunks(file_id, version, chunks)) {
+        return false;
+    }
+    for (const auto& chunk : chunks) {
+        if (!read_object(chunk.encrypted_name, file_key, sink)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StorageManager::export_zip(const std::vector<File>& files, const User& user, bool deflate,
+                                const ByteSink& sink) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    ZipWriter zip(sink);
+    std::set<std::string> names;
+    for (const auto& file : files) {
+        // Entry names are flat and unique: "a.txt", "a (1).txt", ...
+        std::string name = file.original_name;
+        std::replace(name.begin(), name.end(), '/', '_');
+        std::replace(name.begin(), name.end(), '\\', '_');
+        if (name.empty() || name == "." || name == "..") {
+            name = file.id;
+        }
+        size_t dot = name.find_last_of('.');
+        if (dot == 0 || dot == std::string::npos) {
+            dot = name.size();
+        }
+        std::string unique = name;
+        for (int n = 1; !names.insert(unique).second; n++) {
+            unique = name.substr(0, dot) + " (" + std::to_string(n) + ")" + name.substr(dot);
+        }
+        
+        bool ok = false;
+        try {
+            ok = zip.begin_entry(unique, file.modified_at, deflate && compression::compressible_mime(file.mime_type)) &&
+                 retrieve_stream(file.id, user, [&zip](const uint8_t* data, size_t length) {
+                     return zip.write(data, length);
+                 }) &&
+                 zip.end_entry();
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to export file: " << e.what() << std::endl;
+        }
+        if (!ok) {
+            // The archive is left truncated so the client sees the failure
+            std::cerr << "Export stopped at file " << file.id << std::endl;
+            return false;
+        }
+    }
+    return zip.finish();
+}
+
+StorageManager::ImportSummary StorageManager::import_archive(const ByteSource& source, const User& user,
+                                                             const std::string& folder_id) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto last_flush = start;
+    ImportSummary summary;
+    if (!folder_id.empty() && !get_folder(folder_id, user)) {
+        summary.error = "Folder not found";
+        return summary;
+    }
+    
+    // Directories of entry paths become folders below the target, found or
+    // created once per archive; false for a path that would climb out of it
+    std::unordered_map<std::string, std::string> folders;
+    auto folder_for = [&](const std::string& path, std::string& parent) {
+        parent = folder_id;
+        size_t start = 0;
+        for (size_t end = path.find('/'); end != std::string::npos; end = path.find('/', start)) {
+            std::string component = path.substr(start, end - start);
+            start = end + 1;
+            if (component.empty() || component == ".") {
+                continue;
+            }
+            if (!valid_folder_name(component)) {
+                return false;
+            }
+            auto cached = folders.find(parent + '/' + component);
+            if (cached != folders.end()) {
+                parent = cached->second;
+                continue;
+            }
+            auto folder = Database::instance().get_folder_by_name(user.id, parent, component);
+            if (!folder) {
+                folder = create_folder(parent, component, user);
+            }
+            if (!folder) {
+                return false;
+            }
+            folders[parent + '/' + component] = folder->id;
+            parent = folder->id;
+        }
+        return true;
+    };
+    
+    // Sealed files wait here for the next batched insert
+    std::vector<File> batch;
+    std::vector<std::string> batch_written;
+    int64_t batch_stored = 0;
+    auto flush = [&]() {
+        bool ok = batch.empty() || Database::instance().create_files(batch);
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (ok) {
+                summary.files++;
+                summary.bytes += batch[i].size;
+            } else {
+                release_file(batch[i], batch_written[i]);
+            }
+        }
+        if (!ok && summary.error.empty()) {
+            summary.error = "Could not record imported files";
+        }
+        batch.clear();
+        batch_written.clear();
+        batch_stored = 0;
+        last_flush = clock::now();
+        return ok;
+    };
+    
+    ArchiveReader reader(source);
+    ArchiveReader::Entry entry;
+    while (reader.next(entry)) {
+        std::string name = entry.name.substr(entry.name.find_last_of('/') + 1);
+        std::string parent;
+        if (!entry.regular || name.empty() || entry.name.compare(0, 9, "__MACOSX/") == 0 ||
+            !folder_for(entry.name, parent)) {
+            summary.skipped++;
+            continue;
+        }
+        
+        // The counters do not include the pending batch yet
+        int64_t remaining = quota_remaining(user);
+        if (remaining >= 0) {
+            remaining = std::max<int64_t>(remaining - batch_stored, 0);
+        }
+        if (remaining == 0) {
+            summary.error = "Storage quota exceeded";
+            summary.quota_exceeded = true;
+            break;
+        }
+        
+        File file_record;
+        std::string written_name;
+        ByteSource entry_source = [&reader](uint8_t* buffer, size_t length) { return reader.read(buffer, length); };
+        if (!seal_file(entry_source, name, user, remaining, file_record, written_name)) {
+            summary.error = reader.error().empty() ? "Could not store " + entry.name : reader.error();
+            break;
+        }
+        if (entry.mtime > 0) {
+            file_record.modified_at = entry.mtime;
+        }
+        file_record.folder_id = parent;
+        if (!written_name.empty()) {
+            batch_stored += file_record.stored_size;
+        }
+        batch.push_back(std::move(file_record));
+        batch_written.push_back(std::move(written_name));
+        
+        if ((batch.size() >= kImportBatch || clock::now() - last_flush >= kImportFlushInterval) && !flush()) {
+            break;
+        }
+    }
+    if (summary.error.empty()) {
+        summary.error = reader.error();
+    }
+    flush();
+    
+    summary.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return summary;
+}
+
+std::string StorageManager::copy_file(const std::string& file_id, const User& user) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    auto source = Database::instance().get_file_by_id(file_id);
+    if (!source || source->user_id != user.id) {
+        return "";
+    }
+    
+    // Deduplicated content: a copy is one more reference to the same object
+    if (!source->content_digest.empty() && Database::instance().add_object_ref(user.id, source->content_digest)) {
+        try {
+            File copy = *source;
+            copy.id = generate_file_id();
+            copy.created_at = std::time(nullptr);
+            copy.modified_at = copy.created_at;
+            if (share_object(copy, source->encrypted_name) && Database::instance().create_file(copy)) {
+                return copy.id;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to copy file: " << e.what() << std::endl;
+        }
+        Database::instance().release_object(user.id, source->content_digest);
+        return "";
+    }
+    
+    int64_t remaining = quota_remaining(user);
+    if (remaining >= 0 && (source->stored_size > 0 ? source->stored_size : source->size) > remaining) {
+        std::cerr << "Copy exceeds the storage quota" << std::endl;
+        return "";
+    }
+    
+    // A versioned file is copied as its current version, sharing its chunks
+    if (source->version > 0) {
+        try {
+            auto file_key = CryptoManager::instance().resolve_file_key(file_id, source->wrapped_key, source->key_id);
+            
+            File copy = *source;
+            copy.id = generate_file_id();
+            copy.encrypted_name = generate_encrypted_filename();
+            copy.created_at = std::time(nullptr);
+            copy.modified_at = copy.created_at;
+            copy.wrapped_key = CryptoManager::instance().wrap_file_key(file_key, copy.id, copy.key_id);
+            if (Database::instance().create_versioned_copy(copy, file_id, source->version)) {
+                return copy.id;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to copy file: " << e.what() << std::endl;
+        }
+        return "";
+    }
+    
+    std::string copy_name;
+    try {
+        // Stream frames do not depend on the file id: the ciphertext is copied
+        // as-is and only the data key is rewrapped for the new id
+        auto file_key = CryptoManager::instance().resolve_file_key(file_id, source->wrapped_key, source->key_id);
+        
+        File copy = *source;
+        copy.id = generate_file_id();
+        copy.encrypted_name = generate_encrypted_filename();
+        copy.created_at = std::time(nullptr);
+        copy.modified_at = copy.created_at;
+        copy.wrapped_key = CryptoManager::instance().wrap_file_key(file_key, copy.id, copy.key_id);
+        
+        if (!clone_file(source->encrypted_name, copy.encrypted_name)) {
+            return "";
+        }
+        copy_name = copy.encrypted_name;
+        
+        if (!Database::instance().create_file(copy)) {
+            discard_object(copy_name, false);
+            return "";
+        }
+        return copy.id;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to copy file: " << e.what() << std::endl;
+        if (!copy_name.empty()) {
+            discard_object(copy_name, false);
+        }
+        return "";
+    }
+}
+
+bool StorageManager::clone_file(const std::string& source_name, const std::string& target_name) {
+    // A packed object is copied into the active segment
+    bool packed = false;
+    bool copied = PackStore::instance().copy(source_name, target_name, &packed);
+    if (packed) {
+        return copied;
+    }
+    
+    auto& layout = VaultLayout::instance();
+    int in_fd = layout.open(source_name, O_RDONLY);
+    if (in_fd < 0) {
+        return false;
+    }
+    int out_fd = layout.open(target_name, O_WRONLY | O_CREAT | O_EXCL);
+    if (out_fd < 0) {
+        close(in_fd);
+        return false;
+    }
+    
+    // Share extents where the filesystem supports reflinks, else copy in the kernel
+    bool ok = ioctl(out_fd, FICLONE, in_fd) == 0;
+    if (!ok) {
+        struct stat st;
+        ok = fstat(in_fd, &st) == 0;
+        off_t remaining = ok ? st.st_size : 0;
+        while (ok && remaining > 0) {
+            ssize_t n = copy_file_range(in_fd, nullptr, out_fd, nullptr, remaining, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            remaining -= n;
+        }
+    }
+    ok = ok && fdatasync(out_fd) == 0;
+    
+    close(in_fd);
+    if (close(out_fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        unlink(layout.path(target_name).c_str());
+    }
+    return ok;
+}
+
+bool StorageManager::delete_file(const std::string& file_id, const User& user) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    try {
+        auto file_record = Database::instance().get_file_by_id(file_id);
+        if (!file_record || file_record->user_id != user.id) {
+            return false;
+        }
+        
+        // The ciphertext and its dedup reference stay with the trashed row
+        if (!Database::instance().delete_file(file_id)) {
+            return false;
+        }
+        if (Config::instance().trash_retention() <= 0) {
+            purge(user.id, file_id, std::time(nullptr), 1);
+        }
+        
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to delete file: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+std::vector<File> StorageManager::list_trash(const User& user, int limit, int offset) {
+    return Database::instance().get_user_trash(user.id, limit, offset);
+}
+
+bool StorageManager::restore_file(const std::string& file_id, const User& user) {
+    auto file_record = Database::instance().get_trashed_file(file_id);
+    if (!file_record || file_record->user_id != user.id) {
+        return false;
+    }
+    
+    // Counted against the quota again unless another live row shares the ciphertext
+    int64_t remaining = quota_remaining(user);
+    int64_t stored = file_record->stored_size > 0 ? file_record->stored_size : file_record->size;
+    if (remaining >= 0 && stored > remaining) {
+        std::cerr << "Restore exceeds the storage quota" << std::endl;
+        return false;
+    }
+    return Database::instance().restore_file(file_id);
+}
+
+bool StorageManager::purge_file(const std::string& file_id, const User& user) {
+    return purge(user.id, file_id, std::time(nullptr), 1) > 0;
+}
+
+int64_t StorageManager::empty_trash(const User& user) {
+    // Later deletions stay in the trash
+    std::time_t now = std::time(nullptr);
+    int64_t purged = 0;
+    int batch;
+    while ((batch = purge(user.id, "", now, 256)) > 0) {
+        purged += batch;
+    }
+    return purged;
+}
+
+std::time_t StorageManager::purge_time(const File& file) const {
+    return file.deleted_at + std::max(Config::instance().trash_retention(), 0) * std::time_t(86400);
+}
+
+int StorageManager::cleanup_deleted_files(int limit) {
+    std::time_t cutoff = std::time(nullptr) - std::max(Config::instance().trash_retention(), 0) * std::time_t(86400);
+    return purge(0, "", cutoff, limit);
+}
+
+int StorageManager::purge(int user_id, const std::string& file_id, std::time_t deleted_before, int limit) {
+    // Rows go first: a crash before shredding leaves an orphan for the
+    // integrity check, never a row without its ciphertext
+    std::vector<std::string> unreferenced;
+    int purged = Database::instance().purge_trash(user_id, file_id, deleted_before, limit, unreferenced);
+    for (const auto& encrypted_name : unreferenced) {
+        discard_object(encrypted_name, true);
+    }
+    return purged;
+}
+
+std::shared_ptr<UploadSession> StorageManager::create_upload(const std::string& original_name, int64_t size,
+                                                            const User& user) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    if (original_name.empty() || size < 0) {
+        return nullptr;
+    }
+    int64_t remaining = quota_remaining(user);
+    if (remaining >= 0 && size > remaining) {
+        throw std::runtime_error("Storage quota exceeded");
+    }
+    
+    try {
+        auto& crypto = CryptoManager::instance();
+        uint8_t random[16];
+        if (RAND_bytes(random, sizeof(random)) != 1) {
+            return nullptr;
+        }
+        
+        auto session = std::make_shared<UploadSession>();
+        session->id = codec::hex_encode(random, sizeof(random));
+        session->user_id = user.id;
+        session->file_id = generate_file_id();
+        session->original_name = original_name;
+        session->size = size;
+        session->chunk_size = static_cast<int64_t>(upload_chunk_size());
+        
+        // Same codec choice as store_stream; chunks are compressed frame by frame
+        auto codec = compression::compressible_mime(get_mime_type(original_name))
+            ? compression::from_name(Config::instance().compression())
+            : compression::Codec::None;
+        session->stream_header = codec::hex_encode(crypto.new_stream_header(codec));
+        session->wrapped_key = crypto.wrap_file_key(crypto.generate_file_key(), session->file_id, session->key_id);
+        session->created_at = std::time(nullptr);
+        session->updated_at = session->created_at;
+        
+        if (!Database::instance().create_upload_session(*session)) {
+            return nullptr;
+        }
+        return session;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to create upload session: " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+std::shared_ptr<UploadSession> StorageManager::get_upload(const std::string& upload_id, const User& user) {
+    auto session = Database::instance().get_upload_session(upload_id);
+    if (session && session->user_id == user.id) {
+        return session;
+    }
+    return nullptr;
+}
+
+std::vector<UploadSession> StorageManager::list_uploads(const User& user) {
+    return Database::instance().get_user_upload_sessions(user.id);
 }
 
-std::string StorageManager::store_file(const std::vector<uint8_t>& file_data, const std::string& original_name, const User& user) {
+std::vector<UploadChunk> StorageManager::get_upload_chunks(const std::string& upload_id) {
+    return Database::instance().get_upload_chunks(upload_id);
+}
+
+StorageManager::UploadResult StorageManager::put_upload_chunk(const std::string& upload_id, int64_t index,
+                                                              const uint8_t* data, size_t length,
+                                                              const User& user) {
     if (!CryptoManager::instance().is_unlocked()) {
         throw std::runtime_error("Vault is locked");
     }
     
+    auto session = get_upload(upload_id, user);
+    if (!session) {
+        return UploadResult::NotFound;
+    }
+    int64_t count = session->chunk_count();
+    if (index < 0 || index >= count) {
+        return UploadResult::Invalid;
+    }
+    bool final = index == count - 1;
+    int64_t expected = final ? session->size - index * session->chunk_size : session->chunk_size;
+    if (static_cast<int64_t>(length) != expected) {
+        return UploadResult::Invalid;
+    }
+    
+    // Frame nonces follow from the chunk index: one PUT per index at a time,
+    // so two different chunks are never sealed under the same nonces
+    std::string claim = upload_id + ":" + std::to_string(index);
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        if (!chunk_claims_.insert(claim).second) {
+            return UploadResult::Conflict; // the client retries
+        }
+    }
+    UploadResult result = store_upload_chunk(*session, index, data, length, final);
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        chunk_claims_.erase(claim);
+    }
+    return result;
+}
+
+StorageManager::UploadResult StorageManager::store_upload_chunk(const UploadSession& session, int64_t index,
+                                                                const uint8_t* data, size_t length, bool final) {
+    const std::string& upload_id = session.id;
     try {
-        std::string file_id = generate_file_id();
-        std::string encrypted_name = generate_encrypted_filename();
-        std::string encrypted_path = get_encrypted_file_path(encrypted_name);
+        auto& crypto = CryptoManager::instance();
+        std::vector<uint8_t> header;
+        size_t frame_size = 0;
+        if (codec::hex_decode(session.stream_header, header)) {
+            frame_size = CryptoManager::stream_chunk_size(header);
+        }
+        if (frame_size == 0 || session.chunk_size % frame_size != 0) {
+            return UploadResult::Failed;
+        }
         
-        // Write file to disk
-        std::ofstream file(encrypted_path, std::ios::binary);
-        if (!file.is_open()) {
-            return "";
+        // A received chunk is only compared: a repeat seals to the same
+        // ciphertext in memory, and nothing is written for either
+        std::vector<uint8_t> sealed;
+        auto file_key = crypto.resolve_file_key(session.file_id, session.wrapped_key, session.key_id);
+        uint64_t first_frame = static_cast<uint64_t>(index) * static_cast<uint64_t>(session.chunk_size / frame_size);
+        if (!crypto.encrypt_frames(header, file_key, first_frame, data, length, final, sealed)) {
+            return UploadResult::Failed;
+        }
+        uint8_t md[EVP_MAX_MD_SIZE];
+        unsigned int md_len = 0;
+        if (EVP_Digest(sealed.data(), sealed.size(), md, &md_len, EVP_sha256(), nullptr) != 1) {
+            return UploadResult::Failed;
         }
+        std::string digest = codec::hex_encode(md, md_len);
         
-        file.write(reinterpret_cast<const char*>(file_data.data()), file_data.size());
-        file.close();
+        UploadChunk chunk;
+        if (Database::instance().get_upload_chunk(upload_id, index, chunk)) {
+            return chunk.digest == digest ? UploadResult::Ok : UploadResult::Conflict;
+        }
         
-        // Encrypt the file
-        if (!CryptoManager::instance().encrypt_file(encrypted_path, file_id)) {
-            unlink(encrypted_path.c_str());
-            return "";
+        // Staged durably before it is recorded; a crash in between leaves a
+        // file that the session's cleanup shreds
+        std::string dir = upload_dir(upload_id);
+        if ((mkdir((vault_dir_ + "/.uploads").c_str(), 0700) != 0 && errno != EEXIST) ||
+            (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)) {
+            std::cerr << "Cannot create upload staging: " << dir << ": " << strerror(errno) << std::endl;
+            return UploadResult::Failed;
+        }
+        std::string path = dir + "/" + std::to_string(index) + "-" + digest.substr(0, 16);
+        std::string tmp_path = path + ".tmp";
+        // The claim rules out a concurrent writer: a leftover holds the same bytes
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return UploadResult::Failed;
+        }
+        bool ok = write_all(fd, sealed.data(), sealed.size()) && fdatasync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(tmp_path.c_str(), path.c_str()) == 0 && sync_directory(dir);
+        if (!ok) {
+            unlink(tmp_path.c_str());
+            return UploadResult::Failed;
         }
         
-        // Store file metadata in database
-        File file_record(file_id, original_name, encrypted_name, file_data.size(), get_mime_type(original_name), user.id);
-        if (!Database::instance().create_file(file_record)) {
-            unlink(encrypted_path.c_str());
-            return "";
+        chunk.index = index;
+        chunk.stored_size = static_cast<int64_t>(sealed.size());
+        chunk.digest = digest;
+        if (Database::instance().add_upload_chunk(upload_id, chunk)) {
+            return UploadResult::Ok;
         }
         
-        return file_id;
+        // The session ended meanwhile
+        UploadChunk recorded;
+        if (Database::instance().get_upload_chunk(upload_id, index, recorded) && recorded.digest == digest) {
+            return UploadResult::Ok;
+        }
+        crypto.secure_delete(path);
+        return Database::instance().get_upload_session(upload_id) ? UploadResult::Conflict : UploadResult::NotFound;
     } catch (const std::exception& e) {
-        std::cerr << "Failed to store file: " << e.what() << std::endl;
-        return "";
+        std::cerr << "Failed to store upload chunk: " << e.what() << std::endl;
+        return UploadResult::Failed;
     }
 }
 
-std::vector<uint8_t> StorageManager::retrieve_file(const std::string& file_id, const User& user) {
+std::string StorageManager::commit_upload(const std::string& upload_id, const User& user) {
     if (!CryptoManager::instance().is_unlocked()) {
         throw std::runtime_error("Vault is locked");
     }
     
+    auto session = get_upload(upload_id, user);
+    if (!session) {
+        return "";
+    }
+    auto chunks = Database::instance().get_upload_chunks(upload_id);
+    if (static_cast<int64_t>(chunks.size()) != session->chunk_count()) {
+        return "";
+    }
+    
+    // The session only reserved its plaintext size; check what is stored
+    int64_t stored_size = static_cast<int64_t>(session->stream_header.size() / 2);
+    for (const auto& chunk : chunks) {
+        stored_size += chunk.stored_size;
+    }
+    int64_t remaining = quota_remaining(user);
+    if (remaining >= 0 && stored_size > remaining) {
+        throw std::runtime_error("Storage quota exceeded");
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        if (!committing_.insert(upload_id).second) {
+            return "";
+        }
+    }
+    std::string file_id = assemble_upload(*session, user);
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        committing_.erase(upload_id);
+    }
+    return file_id;
+}
+
+std::string StorageManager::assemble_upload(const UploadSession& session, const User& user) {
+    std::string written_name;
     try {
-        auto file_record = Database::instance().get_file_by_id(file_id);
-        if (!file_record || file_record->user_id != user.id) {
-            return {};
+        auto chunks = Database::instance().get_upload_chunks(session.id);
+        std::vector<uint8_t> header;
+        if (static_cast<int64_t>(chunks.size()) != session.chunk_count() ||
+            !codec::hex_decode(session.stream_header, header)) {
+            return "";
         }
         
-        std::string encrypted_path = get_encrypted_file_path(file_record->encrypted_name);
-        if (!file_exists(encrypted_path)) {
-            return {};
+        // Small files go to a pack segment, as in store_stream
+        std::string encrypted_name = generate_encrypted_filename();
+        size_t threshold = PackStore::instance().threshold();
+        bool packed = threshold > 0 && session.size <= static_cast<int64_t>(threshold);
+        
+        int fd = -1;
+        std::vector<uint8_t> sealed;
+        bool ok = true;
+        if (packed) {
+            sealed = header;
+        } else {
+            fd = VaultLayout::instance().open(encrypted_name, O_WRONLY | O_CREAT | O_EXCL);
+            if (fd < 0) {
+                return "";
+            }
+            written_name = encrypted_name;
+            ok = write_all(fd, header.data(), header.size());
+        }
+        
+        // Header, then every chunk's frames in index order
+        std::string dir = upload_dir(session.id);
+        int64_t stored_size = static_cast<int64_t>(header.size());
+        for (size_t i = 0; ok && i < chunks.size(); i++) {
+            std::string path = dir + "/" + std::to_string(chunks[i].index) + "-" + chunks[i].digest.substr(0, 16);
+            int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in < 0) {
+                std::cerr << "Missing upload chunk: " << path << std::endl;
+                ok = false;
+                break;
+            }
+            if (packed) {
+                sealed.resize(sealed.size() + static_cast<size_t>(chunks[i].stored_size));
+                ok = read_all(in, sealed.data() + stored_size, static_cast<size_t>(chunks[i].stored_size));
+            } else {
+                ok = copy_all(in, fd, chunks[i].stored_size);
+            }
+            close(in);
+            stored_size += chunks[i].stored_size;
+        }
+        
+        if (fd >= 0) {
+            ok = ok && fdatasync(fd) == 0;
+            if (close(fd) != 0) {
+                ok = false;
+            }
+        } else if (ok) {
+            ok = PackStore::instance().append(encrypted_name, sealed.data(), sealed.size());
+            if (ok) {
+                written_name = encrypted_name;
+            }
+        }
+        
+        // Not deduplicated: the plaintext hash is unknown when chunks arrive out of order
+        File file_record(session.file_id, session.original_name, encrypted_name, session.size,
+                         get_mime_type(session.original_name), user.id);
+        file_record.wrapped_key = session.wrapped_key;
+        file_record.key_id = session.key_id;
+        file_record.stored_size = stored_size;
+        if (!ok || !Database::instance().create_file(file_record)) {
+            if (!written_name.empty()) {
+                discard_object(written_name, false);
+            }
+            return "";
         }
         
-        return CryptoManager::instance().decrypt_file(encrypted_path, file_id);
+        Database::instance().delete_upload_session(session.id);
+        discard_staging(session.id);
+        return session.file_id;
     } catch (const std::exception& e) {
-        std::cerr << "Failed to retrieve file: " << e.what() << std::endl;
-        return {};
+        std::cerr << "Failed to commit upload: " << e.what() << std::endl;
+        if (!written_name.empty()) {
+            discard_object(written_name, false);
+        }
+        return "";
     }
 }
 
-bool StorageManager::delete_file(const std::string& file_id, const User& user) {
+bool StorageManager::abort_upload(const std::string& upload_id, const User& user) {
+    if (!get_upload(upload_id, user)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        if (committing_.count(upload_id) > 0) {
+            return false;
+        }
+    }
+    if (!Database::instance().delete_upload_session(upload_id)) {
+        return false;
+    }
+    discard_staging(upload_id);
+    return true;
+}
+
+size_t StorageManager::upload_chunk_size() const {
+    size_t frame_size = CryptoManager::instance().stream_chunk_size();
+    size_t wanted = static_cast<size_t>(std::max(Config::instance().upload_chunk_size(), 0)) * 1024;
+    return std::max<size_t>(wanted / frame_size, 1) * frame_size;
+}
+
+std::time_t StorageManager::upload_expiry_time(const UploadSession& session) const {
+    int expiry = Config::instance().upload_expiry();
+    return expiry > 0 ? session.updated_at + expiry * std::time_t(3600) : 0;
+}
+
+int StorageManager::cleanup_upload_sessions(int limit) {
+    int discarded = 0;
+    int expiry = Config::instance().upload_expiry();
+    if (expiry > 0) {
+        std::time_t cutoff = std::time(nullptr) - expiry * std::time_t(3600);
+        for (const auto& session : Database::instance().get_expired_upload_sessions(cutoff, limit)) {
+            {
+                std::lock_guard<std::mutex> lock(commit_mutex_);
+                if (committing_.count(session.id) > 0) {
+                    continue;
+                }
+            }
+            if (Database::instance().delete_upload_session(session.id)) {
+                discard_staging(session.id);
+                discarded++;
+            }
+        }
+    }
+    
+    // Staging that outlived its session: a crash between the two, or a chunk
+    // that arrived after the end. Dot directories are already being shredded.
+    std::string root = vault_dir_ + "/.uploads";
+    std::vector<std::string> names;
+    if (DIR* dir = opendir(root.c_str())) {
+        while (struct dirent* de = readdir(dir)) {
+            if (std::strcmp(de->d_name, ".") != 0 && std::strcmp(de->d_name, "..") != 0) {
+                names.push_back(de->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    for (const auto& name : names) {
+        if (name[0] == '.') {
+            rmdir((root + "/" + name).c_str());
+        } else if (!Database::instance().get_upload_session(name)) {
+            discard_staging(name);
+        }
+    }
+    return discarded;
+}
+
+std::string StorageManager::upload_dir(const std::string& upload_id) {
+    return vault_dir_ + "/.uploads/" + upload_id;
+}
+
+void StorageManager::discard_staging(const std::string& upload_id) {
+    // Renamed to a dot directory first so a later sweep does not queue the
+    // same chunks twice; it is removed once the shredder has emptied it
+    std::string dir = vault_dir_ + "/.uploads/." + upload_id;
+    if (rename(upload_dir(upload_id).c_str(), dir.c_str()) != 0) {
+        return;
+    }
+    if (DIR* staging = opendir(dir.c_str())) {
+        while (struct dirent* de = readdir(staging)) {
+            if (de->d_name[0] != '.') {
+                CryptoManager::instance().secure_delete(dir + "/" + de->d_name);
+            }
+        }
+        closedir(staging);
+    }
+    rmdir(dir.c_str());
+}
+
+struct StorageManager::ChunkSet {
+    SecureBytes file_key;
+    SecureBytes digest_key;
+    compression::Codec codec = compression::Codec::None;
+    int64_t remaining = -1; // stored bytes the quota still allows, -1 = unlimited
+    std::unordered_map<std::string, ContentChunk> held; // by digest, the file's chunks and the new ones
+    std::vector<ContentChunk> added; // stored by this write, not yet recorded
+};
+
+std::shared_ptr<FileVersion> StorageManager::write_version(const std::string& file_id, const ByteSource& source,
+                                                           const User& user) {
     if (!CryptoManager::instance().is_unlocked()) {
         throw std::runtime_error("Vault is locked");
     }
+    // A legacy file's key derives from the master key, which may still be garbage
+    if (!CryptoManager::instance().master_key_confirmed()) {
+        throw std::runtime_error("Master key sealed in the legacy format is not confirmed yet");
+    }
+    
+    // Checked before the file is converted into its first version
+    if (!source) {
+        return nullptr;
+    }
+    
+    int64_t remaining = quota_remaining(user);
+    if (remaining == 0) {
+        throw std::runtime_error("Storage quota exceeded");
+    }
     
+    if (!lock_versions(file_id)) {
+        return nullptr;
+    }
+    std::shared_ptr<FileVersion> written;
+    ChunkSet chunks;
     try {
-        auto file_record = Database::instance().get_file_by_id(file_id);
-        if (!file_record || file_record->user_id != user.id) {
-            return false;
+        auto file = Database::instance().get_file_by_id(file_id);
+        if (file && file->user_id == user.id) {
+            chunks.file_key = CryptoManager::instance().resolve_file_key(file_id, file->wrapped_key, file->key_id);
+            chunks.digest_key = user_secret(user.id, "dedup");
+            chunks.codec = compression::compressible_mime(file->mime_type)
+                ? compression::from_name(Config::instance().compression())
+                : compression::Codec::None;
+            chunks.remaining = remaining;
+            for (auto& chunk : Database::instance().get_file_chunks(file_id)) {
+                chunks.held.emplace(chunk.digest, chunk);
+            }
+            
+            bool ok = true;
+            int64_t current = file->version;
+            std::vector<std::string> digests;
+            if (current == 0) {
+                // The file's object becomes version 1; its chunks are the
+                // base the new content is compared against
+                FileVersion first;
+                first.file_id = file_id;
+                first.version = 1;
+                ok = write_chunks([&](const ByteSink& sink) {
+                    return read_object(file->encrypted_name, chunks.file_key, sink);
+                }, chunks, first, digests) && commit_version(first, 0, chunks, digests, generate_encrypted_filename());
+                if (ok) {
+                    current = 1;
+                    bool last = file->content_digest.empty()
+                        ? !Database::instance().has_file_ref(file->encrypted_name)
+                        : Database::instance().release_object(user.id, file->content_digest);
+                    if (last) {
+                        discard_object(file->encrypted_name, true);
+                    }
+                }
+            }
+            
+            FileVersion version;
+            version.file_id = file_id;
+            version.version = current + 1;
+            ok = ok && write_chunks([&source](const ByteSink& sink) {
+                std::vector<uint8_t> buffer(65536);
+                while (true) {
+                    ssize_t n = source(buffer.data(), buffer.size());
+                    if (n <= 0) {
+                        return n == 0;
+                    }
+                    if (!sink(buffer.data(), static_cast<size_t>(n))) {
+                        return false;
+                    }
+                }
+            }, chunks, version, digests) && commit_version(version, current, chunks, digests, "");
+            if (ok) {
+                written = std::make_shared<FileVersion>(version);
+                prune_file_versions(file_id);
+            }
         }
-        
-        // Mark as deleted in database
-        if (!Database::instance().delete_file(file_id)) {
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to write version: " << e.what() << std::endl;
+        written.reset();
+    }
+    // Chunks of a version that was not recorded
+    for (const auto& chunk : chunks.added) {
+        discard_object(chunk.encrypted_name, false);
+    }
+    unlock_versions(file_id);
+    return written;
+}
+
+bool StorageManager::write_chunks(const std::function<bool(const ByteSink&)>& content, ChunkSet& chunks,
+                                  FileVersion& version, std::vector<std::string>& digests) {
+    Chunker chunker(static_cast<size_t>(std::max(Config::instance().version_chunk_size(), 4)) * 1024);
+    version.size = 0;
+    version.written_bytes = 0;
+    digests.clear();
+    
+    auto add_chunk = [&](const uint8_t* data, size_t length) {
+        uint8_t sha256[EVP_MAX_MD_SIZE];
+        unsigned int sha_len = 0;
+        if (EVP_Digest(data, length, sha256, &sha_len, EVP_sha256(), nullptr) != 1) {
             return false;
         }
-        
-        // Securely delete the encrypted file
-        std::string encrypted_path = get_encrypted_file_path(file_record->encrypted_name);
-        if (file_exists(encrypted_path)) {
-            CryptoManager::instance().secure_delete(encrypted_path);
+        std::string digest = CryptoManager::instance().content_digest(chunks.digest_key, sha256);
+        if (!chunks.held.count(digest)) {
+            ContentChunk chunk;
+            chunk.digest = digest;
+            if (!seal_chunk(data, length, chunks, chunk)) {
+                return false;
+            }
+            chunks.held.emplace(digest, chunk);
+            version.written_bytes += chunk.stored_size;
         }
-        
+        digests.push_back(digest);
+        version.size += static_cast<int64_t>(length);
         return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to delete file: " << e.what() << std::endl;
+    };
+    
+    // Chunks are cut while a maximum-size window is buffered, the rest at the end
+    std::vector<uint8_t> buffer;
+    auto drain = [&](bool final) {
+        size_t start = 0;
+        while (buffer.size() - start >= (final ? 1 : chunker.max_size())) {
+            size_t n = chunker.cut(buffer.data() + start, buffer.size() - start);
+            if (!add_chunk(buffer.data() + start, n)) {
+                return false;
+            }
+            start += n;
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(start));
+        return true;
+    };
+    bool ok = content([&](const uint8_t* data, size_t length) {
+        buffer.insert(buffer.end(), data, data + length);
+        return drain(false);
+    });
+    return ok && drain(true);
+}
+
+bool StorageManager::seal_chunk(const uint8_t* data, size_t length, ChunkSet& chunks, ContentChunk& chunk) {
+    // Each chunk is a complete stream of its own, so it decrypts on its own
+    std::vector<uint8_t> sealed;
+    size_t offset = 0;
+    bool ok = CryptoManager::instance().encrypt_stream(
+        [data, length, &offset](uint8_t* buffer, size_t want) {
+            size_t n = std::min(want, length - offset);
+            std::memcpy(buffer, data + offset, n);
+            offset += n;
+            return static_cast<ssize_t>(n);
+        },
+        [&sealed](const uint8_t* out, size_t n) {
+            sealed.insert(sealed.end(), out, out + n);
+            return true;
+        },
+        chunks.file_key, chunks.codec);
+    if (!ok) {
+        return false;
+    }
+    
+    chunk.encrypted_name = generate_encrypted_filename();
+    chunk.size = static_cast<int64_t>(length);
+    chunk.stored_size = static_cast<int64_t>(sealed.size());
+    if (chunks.remaining >= 0) {
+        if (chunk.stored_size > chunks.remaining) {
+            std::cerr << "Version exceeds the storage quota" << std::endl;
+            return false;
+        }
+        chunks.remaining -= chunk.stored_size;
+    }
+    
+    // A short last chunk is packed like a small file
+    if (length <= PackStore::instance().threshold()) {
+        ok = PackStore::instance().append(chunk.encrypted_name, sealed.data(), sealed.size());
+    } else {
+        int fd = VaultLayout::instance().open(chunk.encrypted_name, O_WRONLY | O_CREAT | O_EXCL);
+        if (fd < 0) {
+            return false;
+        }
+        ok = write_all(fd, sealed.data(), sealed.size()) && fdatasync(fd) == 0;
+        if (close(fd) != 0) {
+            ok = false;
+        }
+        if (!ok) {
+            discard_object(chunk.encrypted_name, false);
+            return false;
+        }
+    }
+    if (ok) {
+        chunks.added.push_back(chunk);
+    }
+    return ok;
+}
+
+bool StorageManager::commit_version(FileVersion& version, int64_t expected_version, ChunkSet& chunks,
+                                    const std::vector<std::string>& digests, const std::string& encrypted_name) {
+    version.created_at = std::time(nullptr);
+    version.chunk_count = static_cast<int64_t>(digests.size());
+    if (!Database::instance().add_file_version(version, expected_version, chunks.added, digests, encrypted_name)) {
+        return false;
+    }
+    chunks.added.clear();
+    return true;
+}
+
+std::vector<FileVersion> StorageManager::list_versions(const std::string& file_id, const User& user) {
+    auto file = Database::instance().get_file_by_id(file_id);
+    if (!file || file->user_id != user.id) {
+        return {};
+    }
+    return Database::instance().get_file_versions(file_id);
+}
+
+bool StorageManager::retrieve_version(const std::string& file_id, int64_t version, const User& user,
+                                      const ByteSink& sink) {
+    if (!CryptoManager::instance().is_unlocked()) {
+        throw std::runtime_error("Vault is locked");
+    }
+    
+    auto file = Database::instance().get_file_by_id(file_id);
+    if (!file || file->user_id != user.id) {
+        return false;
+    }
+    if (version == 0 || version == file->version) {
+        return retrieve_stream(file_id, user, sink);
+    }
+    
+    auto versions = Database::instance().get_file_versions(file_id);
+    if (std::none_of(versions.begin(), versions.end(),
+                     [version](const FileVersion& v) { return v.version == version; })) {
+        return false;
+    }
+    auto file_key = CryptoManager::instance().resolve_file_key(file_id, file->wrapped_key, file->key_id);
+    return read_version(file_id, version, file_key, sink);
+}
+
+std::shared_ptr<FileVersion> StorageManager::restore_version(const std::string& file_id, int64_t version,
+                                                             const User& user) {
+    auto file = Database::instance().get_file_by_id(file_id);
+    if (!file || file->user_id != user.id || file->version == 0 || version == file->version) {
+        return nullptr;
+    }
+    
+    if (!lock_versions(file_id)) {
+        return nullptr;
+    }
+    std::shared_ptr<FileVersion> restored;
+    auto versions = Database::instance().get_file_versions(file_id);
+    auto source = std::find_if(versions.begin(), versions.end(),
+                               [version](const FileVersion& v) { return v.version == version; });
+    std::vector<ContentChunk> list;
+    if (source != versions.end() && Database::instance().get_version_chunks(file_id, version, list)) {
+        // Only the chunk list is written; every chunk is already held
+        FileVersion current;
+        current.file_id = file_id;
+        current.version = file->version + 1;
+        current.size = source->size;
+        std::vector<std::string> digests;
+        for (const auto& chunk : list) {
+            digests.push_back(chunk.digest);
+        }
+        ChunkSet chunks;
+        if (commit_version(current, file->version, chunks, digests, "")) {
+            restored = std::make_shared<FileVersion>(current);
+            prune_file_versions(file_id);
+        }
+    }
+    unlock_versions(file_id);
+    return restored;
+}
+
+bool StorageManager::delete_version(const std::string& file_id, int64_t version, const User& user) {
+    auto file = Database::instance().get_file_by_id(file_id);
+    if (!file || file->user_id != user.id || version <= 0 || version == file->version) {
+        return false;
+    }
+    
+    if (!lock_versions(file_id)) {
         return false;
     }
+    std::vector<std::string> unreferenced;
+    int deleted = Database::instance().delete_file_versions(file_id, version, 0, 0, unreferenced);
+    for (const auto& encrypted_name : unreferenced) {
+        discard_object(encrypted_name, true);
+    }
+    unlock_versions(file_id);
+    return deleted > 0;
+}
+
+int StorageManager::prune_versions(int limit) {
+    int max_age = Config::instance().version_max_age();
+    if (max_age <= 0) {
+        return 0;
+    }
+    
+    std::time_t cutoff = std::time(nullptr) - static_cast<std::time_t>(max_age) * 86400;
+    int pruned = 0;
+    for (const auto& file_id : Database::instance().get_files_with_versions_before(cutoff, limit)) {
+        // A file being written is pruned by its write
+        if (lock_versions(file_id)) {
+            if (prune_file_versions(file_id) > 0) {
+                pruned++;
+            }
+            unlock_versions(file_id);
+        }
+    }
+    return pruned;
+}
+
+int StorageManager::prune_file_versions(const std::string& file_id) {
+    int keep = Config::instance().version_retention();
+    int max_age = Config::instance().version_max_age();
+    std::time_t cutoff = max_age > 0 ? std::time(nullptr) - static_cast<std::time_t>(max_age) * 86400 : 0;
+    if (keep <= 0 && cutoff == 0) {
+        return 0;
+    }
+    
+    // Rows go first, as for the trash
+    std::vector<std::string> unreferenced;
+    int deleted = Database::instance().delete_file_versions(file_id, 0, std::max(keep, 0), cutoff, unreferenced);
+    for (const auto& encrypted_name : unreferenced) {
+        discard_object(encrypted_name, true);
+    }
+    return deleted;
+}
+
+bool StorageManager::lock_versions(const std::string& file_id) {
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    return versioning_.insert(file_id).second;
+}
+
+void StorageManager::unlock_versions(const std::string& file_id) {
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    versioning_.erase(file_id);
 }
 
 std::vector<File> StorageManager::list_files(const User& user, int limit, int offset) {
@@ -127,40 +1594,121 @@ std::shared_ptr<File> StorageManager::get_file_info(const std::string& file_id,
 }
 
 std::vector<File> StorageManager::search_files(const std::string& query, const User& user, int limit) {
-    // Simple implementation - in production, use full-text search
-    auto files = list_files(user, 1000, 0); // Get all files
-    std::vector<File> results;
+    return Database::instance().search_files(user.id, query, limit);
+}
+
+std::shared_ptr<Folder> StorageManager::create_folder(const std::string& parent_id, const std::string& name,
+                                                      const User& user) {
+    if (!valid_folder_name(name) || (!parent_id.empty() && !get_folder(parent_id, user))) {
+        return nullptr;
+    }
     
-    for (const auto& file : files) {
-        if (file.original_name.find(query) != std::string::npos) {
-            results.push_back(file);
-            if (results.size() >= static_cast<size_t>(limit)) {
-                break;
-            }
-        }
+    auto folder = std::make_shared<Folder>();
+    folder->id = generate_file_id();
+    folder->user_id = user.id;
+    folder->parent_id = parent_id;
+    folder->name = name;
+    folder->created_at = std::time(nullptr);
+    folder->modified_at = folder->created_at;
+    if (!Database::instance().create_folder(*folder)) {
+        return nullptr;
+    }
+    return folder;
+}
+
+std::shared_ptr<Folder> StorageManager::get_folder(const std::string& folder_id, const User& user) {
+    auto folder = Database::instance().get_folder(folder_id);
+    if (folder && folder->user_id == user.id) {
+        return folder;
+    }
+    return nullptr;
+}
+
+std::vector<Folder> StorageManager::list_subfolders(const std::string& folder_id, const User& user, int limit,
+                                                    int offset) {
+    return Database::instance().get_subfolders(user.id, folder_id, limit, offset);
+}
+
+std::vector<File> StorageManager::list_folder_files(const std::string& folder_id, const User& user, int limit,
+                                                    int offset) {
+    return Database::instance().get_folder_files(user.id, folder_id, limit, offset);
+}
+
+std::vector<Folder> StorageManager::folder_path(const std::string& folder_id, const User& user) {
+    auto path = Database::instance().get_folder_path(folder_id);
+    if (!path.empty() && path.front().user_id != user.id) {
+        path.clear();
+    }
+    return path;
+}
+
+bool StorageManager::folder_stats(const std::string& folder_id, const User& user, FolderStats& stats) {
+    if (!folder_id.empty() && !get_folder(folder_id, user)) {
+        return false;
+    }
+    return Database::instance().get_folder_stats(user.id, folder_id, stats);
+}
+
+bool StorageManager::move_folder(const std::string& folder_id, const std::string& parent_id,
+                                 const std::string& name, const User& user) {
+    auto folder = get_folder(folder_id, user);
+    if (!folder) {
+        return false;
+    }
+    std::string new_name = name.empty() ? folder->name : name;
+    if (!valid_folder_name(new_name)) {
+        return false;
+    }
+    return Database::instance().move_folder(user.id, folder_id, parent_id, new_name);
+}
+
+bool StorageManager::move_file(const std::string& file_id, const std::string& folder_id, const User& user) {
+    return Database::instance().move_file(user.id, file_id, folder_id);
+}
+
+int64_t StorageManager::delete_folder(const std::string& folder_id, const User& user) {
+    if (folder_id.empty() || !get_folder(folder_id, user)) {
+        return -1;
     }
     
-    return results;
+    int64_t trashed = Database::instance().delete_folder(user.id, folder_id);
+    if (trashed > 0 && Config::instance().trash_retention() <= 0) {
+        empty_trash(user);
+    }
+    return trashed;
 }
 
 StorageManager::StorageStats StorageManager::get_storage_stats(const User& user) {
-    auto files = list_files(user, 10000, 0); // Get all files
-    
     StorageStats stats;
-    stats.file_count = files.size();
-    
-    for (const auto& file : files) {
-        stats.total_size += file.size;
+    stats.by_type = Database::instance().get_user_usage(user.id);
+    for (const auto& usage : stats.by_type) {
+        stats.file_count += usage.file_count;
     }
     
+    // Logical vs. on-disk bytes (after compression, shared objects counted once)
+    Database::instance().get_user_storage(user.id, stats.logical_bytes, stats.stored_bytes);
+    stats.total_size = stats.logical_bytes;
     stats.total_size_mb = static_cast<double>(stats.total_size) / (1024.0 * 1024.0);
+    stats.quota_bytes = quota_bytes(user);
+    Database::instance().get_trash_usage(user.id, stats.trash_files, stats.trash_bytes);
     
     return stats;
 }
 
-void StorageManager::cleanup_deleted_files() {
-    // This would be implemented to clean up files marked as deleted
-    // For now, it's a placeholder
+int64_t StorageManager::quota_bytes(const User& user) {
+    int64_t quota = Database::instance().get_user_quota(user.id);
+    return quota >= 0 ? quota : std::max(Config::instance().default_quota(), 0) * int64_t(1024 * 1024);
+}
+
+int64_t StorageManager::quota_remaining(const User& user) {
+    int64_t quota = quota_bytes(user);
+    if (quota == 0) {
+        return -1;
+    }
+    int64_t logical = 0;
+    int64_t stored = 0;
+    Database::instance().get_user_storage(user.id, logical, stored);
+    return std::max<int64_t>(quota - stored, 0);
 }
 
 std::string StorageManager::generate_file_id() {
@@ -170,14 +1718,13 @@ std::string StorageManager::generate_file_id() {
 }
 
 std::string StorageManager::generate_encrypted_filename() {
-    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
-    std::string result;
-    
-    for (int i = 0; i < 32; i++) {
-        result += chars[std::rand() % chars.length()];
+    // Packed objects have no O_EXCL to catch a repeat, so names must not
+    // follow a sequence that restarts with the process
+    uint8_t random[16];
+    if (RAND_bytes(random, sizeof(random)) != 1) {
+        throw std::runtime_error("Failed to generate object name");
     }
-    
-    return result;
+    return codec::hex_encode(random, sizeof(random));
 }
 
 std::string StorageManager::get_mime_type(const std::string& filename) {
@@ -190,7 +1737,9 @@ std::string StorageManager::get_mime_type(const std::string& filename) {
     std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
     
     // Simple MIME type mapping
-    if (extension == "txt") return "text/plain";
+    if (extension == "txt" || extension == "log") return "text/plain";
+    if (extension == "csv") return "text/csv";
+    if (extension == "md") return "text/markdown";
     if (extension == "html" || extension == "htm") return "text/html";
     if (extension == "css") return "text/css";
     if (extension == "js") return "application/javascript";
@@ -198,6 +1747,12 @@ std::string StorageManager::get_mime_type(const std::string& filename) {
     if (extension == "xml") return "application/xml";
     if (extension == "pdf") return "application/pdf";
     if (extension == "zip") return "application/zip";
+    if (extension == "gz") return "application/gzip";
+    if (extension == "doc") return "application/msword";
+    if (extension == "xls") return "application/vnd.ms-excel";
+    if (extension == "docx") return "application/vnd.openxmlformats-officedocument.wordprocessingml.document";
+    if (extension == "xlsx") return "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet";
+    if (extension == "odt") return "application/vnd.oasis.opendocument.text";
     if (extension == "jpg" || extension == "jpeg") return "image/jpeg";
     if (extension == "png") return "image/png";
     if (extension == "gif") return "image/gif";
@@ -213,7 +1768,20 @@ bool StorageManager::ensure_vault_directory() {
 }
 
 std::string StorageManager::get_encrypted_file_path(const std::string& encrypted_name) {
-    return vault_dir_ + "/" + encrypted_name;
+    return VaultLayout::instance().path(encrypted_name);
+}
+
+bool StorageManager::discard_object(const std::string& encrypted_name, bool shred) {
+    // Packed entries are wiped in place; the segment is reclaimed by compaction
+    if (PackStore::instance().release(encrypted_name)) {
+        return true;
+    }
+    
+    std::string encrypted_path = get_encrypted_file_path(encrypted_name);
+    if (!shred) {
+        return unlink(encrypted_path.c_str()) == 0;
+    }
+    return !file_exists(encrypted_path) || CryptoManager::instance().secure_delete(encrypted_path);
 }
 
 bool StorageManager::file_exists(const std::string& file_path) {
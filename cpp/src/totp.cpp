@@ -0,0 +1,129 @@
+#include "totp.h"
+#include <cctype>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+namespace vaultusb {
+namespace totp {
+
+namespace {
+
+// HMAC-SHA1 for TOTP; writes the 20-byte digest to `out`
+void hmac_sha1(const SecureBytes& key, const uint8_t* data, size_t length, uint8_t* out) {
+    unsigned int len = 0;
+    if (!HMAC(EVP_sha1(), key.data(), key.size(), data, length, out, &len) || len != SHA_DIGEST_LENGTH) {
+        throw std::runtime_error("HMAC failed");
+    }
+}
+
+} // namespace
+
+std::string base32_encode(const std::vector<uint8_t>& data) {
+    return base32_encode(data.data(), data.size());
+}
+
+std::string base32_encode(const uint8_t* data, size_t length) {
+    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    std::string result;
+    
+    for (size_t i = 0; i < length; i += 5) {
+        uint64_t buffer = 0;
+        int bits = 0;
+        
+        for (int j = 0; j < 5 && i + j < length; j++) {
+            buffer = (buffer << 8) | data[i + j];
+            bits += 8;
+        }
+        
+        while (bits >= 5) {
+            result += chars[(buffer >> (bits - 5)) & 0x1F];
+            bits -= 5;
+        }
+        
+        if (bits > 0) {
+            result += chars[(buffer << (5 - bits)) & 0x1F];
+        }
+    }
+    
+    return result;
+}
+
+SecureBytes base32_decode(const std::string& encoded) {
+    const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    SecureBytes result;
+    result.reserve(encoded.size() * 5 / 8);
+    
+    uint64_t buffer = 0;
+    int bits = 0;
+    
+    for (char c : encoded) {
+        size_t pos = chars.find(std::toupper(c));
+        if (pos == std::string::npos) continue;
+        
+        buffer = (buffer << 5) | pos;
+        bits += 5;
+        
+        while (bits >= 8) {
+            result.push_back((buffer >> (bits - 8)) & 0xFF);
+            bits -= 8;
+        }
+    }
+    
+    return result;
+}
+
+std::string code(const std::string& secret, uint64_t time_step) {
+    return code(base32_decode(secret), time_step);
+}
+
+std::string code(const SecureBytes& secret, uint64_t time_step) {
+    // Convert time step to big-endian bytes
+    uint8_t time_bytes[8];
+    for (int i = 7; i >= 0; i--) {
+        time_bytes[i] = time_step & 0xFF;
+        time_step >>= 8;
+    }
+    
+    // Compute HMAC-SHA1 into a stack buffer, wiped once the code is extracted
+    uint8_t hmac[SHA_DIGEST_LENGTH];
+    hmac_sha1(secret, time_bytes, sizeof(time_bytes), hmac);
+    
+    // Dynamic truncation
+    int offset = hmac[19] & 0x0F;
+    int code = ((hmac[offset] & 0x7F) << 24) |
+               ((hmac[offset + 1] & 0xFF) << 16) |
+               ((hmac[offset + 2] & 0xFF) << 8) |
+               (hmac[offset + 3] & 0xFF);
+    
+    code %= 1000000; // 6-digit code
+    OPENSSL_cleanse(hmac, sizeof(hmac));
+    
+    std::ostringstream oss;
+    oss << std::setfill('0') << std::setw(6) << code;
+    return oss.str();
+}
+
+bool verify(const std::string& secret, const std::string& token, uint64_t time_step) {
+    try {
+        auto secret_bytes = base32_decode(secret);
+        
+        // Check current and previous time step
+        for (int i = -1; i <= 1; i++) {
+            std::string expected_token = code(secret_bytes, time_step + i);
+            if (expected_token == token) {
+                return true;
+            }
+        }
+        return false;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+} // namespace totp
+} // namespace vaultusb
@@ -0,0 +1,120 @@
+#include "trash_collector.h"
+#include "storage.h"
+#include <chrono>
+#include <iostream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr auto kPassInterval = std::chrono::hours(1);
+constexpr auto kBatchPause = std::chrono::milliseconds(50);
+constexpr int kBatchSize = 256;
+
+// ioprio_set(2) has no glibc wrapper; "process" 0 is the calling thread
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioClassShift = 13;
+
+void set_idle_io_priority() {
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift) != 0) {
+        std::cerr << "Trash collector keeps the default I/O priority" << std::endl;
+    }
+#endif
+}
+
+} // namespace
+
+TrashCollector& TrashCollector::instance() {
+    static TrashCollector instance;
+    return instance;
+}
+
+TrashCollector::~TrashCollector() {
+    stop();
+}
+
+void TrashCollector::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    worker_ = std::thread(&TrashCollector::worker_loop, this);
+}
+
+void TrashCollector::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_.exchange(false)) {
+            return;
+        }
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void TrashCollector::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_ = true;
+    }
+    cv_.notify_all();
+}
+
+void TrashCollector::worker_loop() {
+    set_idle_io_priority();
+
+    // The first pass catches up on whatever expired while the server was down
+    while (running_) {
+        run_pass();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, kPassInterval, [this]() { return wake_ || !running_; });
+        wake_ = false;
+    }
+}
+
+void TrashCollector::run_pass() {
+    auto& storage = StorageManager::instance();
+    while (running_) {
+        int purged = storage.cleanup_deleted_files(kBatchSize);
+        if (purged < 0) {
+            failed_batches_++;
+            break;
+        }
+        purged_files_ += static_cast<uint64_t>(purged);
+        if (purged < kBatchSize) {
+            break;
+        }
+
+        // Each batch holds the database briefly; let requests in between
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, kBatchPause, [this]() { return !running_; });
+    }
+    if (running_) {
+        expired_uploads_ += static_cast<uint64_t>(storage.cleanup_upload_sessions());
+    }
+    if (running_) {
+        pruned_version_files_ += static_cast<uint64_t>(storage.prune_versions());
+    }
+    passes_++;
+    last_pass_ = std::time(nullptr);
+}
+
+TrashCollector::Progress TrashCollector::progress() {
+    Progress progress;
+    progress.running = running_;
+    progress.passes = passes_;
+    progress.purged_files = purged_files_;
+    progress.failed_batches = failed_batches_;
+    progress.expired_uploads = expired_uploads_;
+    progress.pruned_version_files = pruned_version_files_;
+    progress.last_pass = last_pass_;
+    return progress;
+}
+
+} // namespace vaultusb
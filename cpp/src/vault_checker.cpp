@@ -0,0 +1,427 @@
+#include "vault_checker.h"
+#include "codec.h"
+#include "config.h"
+#include "crypto.h"
+#include "database.h"
+#include "pack_store.h"
+#include "vault_layout.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+// Ciphertexts written this recently may belong to an upload whose row is not
+// committed yet, so they are never reported as orphans
+constexpr std::time_t kOrphanGraceSeconds = 600;
+
+void entries_to_json(std::ostringstream& json, const char* key, const std::vector<VaultChecker::Entry>& entries) {
+    json << "\"" << key << "\":[";
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto& e = entries[i];
+        if (i > 0) json << ",";
+        json << "{\"file_id\":\"" << codec::json_escape(e.file_id) << "\","
+             << "\"name\":\"" << codec::json_escape(e.name) << "\","
+             << "\"encrypted_name\":\"" << codec::json_escape(e.encrypted_name) << "\","
+             << "\"size\":" << e.size << ","
+             << "\"error\":\"" << codec::json_escape(e.error) << "\"}";
+    }
+    json << "]";
+}
+
+VaultChecker::Entry entry_for(const File& file) {
+    VaultChecker::Entry entry;
+    entry.file_id = file.id;
+    entry.name = file.original_name;
+    entry.encrypted_name = file.encrypted_name;
+    entry.size = file.stored_size;
+    return entry;
+}
+
+} // namespace
+
+std::string VaultChecker::Report::to_json() const {
+    double seconds = finished_at > started_at ? static_cast<double>(finished_at - started_at) : 0.0;
+
+    std::ostringstream json;
+    json << "{\"started_at\":" << started_at << ","
+         << "\"finished_at\":" << finished_at << ","
+         << "\"verified\":" << (verified ? "true" : "false") << ","
+         << "\"complete\":" << (complete ? "true" : "false") << ","
+         << "\"clean\":" << (clean() ? "true" : "false") << ","
+         << "\"files\":" << files << ","
+         << "\"objects_checked\":" << objects_checked << ","
+         << "\"bytes_checked\":" << bytes_checked << ","
+         << "\"mb_per_second\":" << (seconds > 0.0 ? bytes_checked / (1024.0 * 1024.0) / seconds : 0.0) << ",";
+    entries_to_json(json, "orphans", orphans);
+    json << ",";
+    entries_to_json(json, "missing", missing);
+    json << ",";
+    entries_to_json(json, "corrupt", corrupt);
+    json << ",";
+    entries_to_json(json, "unverifiable", unverifiable);
+    json << "}";
+    return json.str();
+}
+
+VaultChecker& VaultChecker::instance() {
+    static VaultChecker instance;
+    return instance;
+}
+
+VaultChecker::~VaultChecker() {
+    stop();
+}
+
+bool VaultChecker::start() {
+    if (running_.exchange(true)) {
+        return false;
+    }
+
+    // A previous run has finished; reap its thread before starting a new one
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    stop_requested_ = false;
+    worker_ = std::thread([this]() {
+        Report report = run_check(true, std::max(Config::instance().check_rate_limit(), 0) * int64_t(1024),
+                                  Config::instance().check_threads());
+        if (report.complete) {
+            std::string json = report.to_json();
+            save_report(json);
+            std::lock_guard<std::mutex> lock(mutex_);
+            last_report_ = json;
+        }
+        if (!report.clean()) {
+            std::cerr << "Vault check found " << report.orphans.size() << " orphaned, " << report.missing.size()
+                      << " missing and " << report.corrupt.size() << " corrupt files" << std::endl;
+        }
+        running_ = false;
+    });
+    return true;
+}
+
+void VaultChecker::start_if_due() {
+    int interval_hours = Config::instance().check_interval();
+    if (interval_hours <= 0) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(Config::instance().check_report().c_str(), &st) == 0 &&
+        std::time(nullptr) - st.st_mtime < static_cast<std::time_t>(interval_hours) * 3600) {
+        return;
+    }
+    start();
+}
+
+void VaultChecker::stop() {
+    stop_requested_ = true;
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+VaultChecker::Progress VaultChecker::progress() {
+    Progress progress;
+    progress.running = running_;
+    progress.objects_total = objects_total_;
+    progress.objects_done = objects_done_;
+    progress.bytes_done = bytes_done_;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (last_report_.empty()) {
+        last_report_ = load_report();
+    }
+    progress.last_report = last_report_;
+    return progress;
+}
+
+VaultChecker::Report VaultChecker::run_check(bool verify, int64_t rate_limit, int threads) {
+    Report report;
+    report.started_at = std::time(nullptr);
+    objects_total_ = 0;
+    objects_done_ = 0;
+    bytes_done_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rate_limit_ = rate_limit;
+        throttle_next_ = std::chrono::steady_clock::now();
+    }
+
+    std::vector<File> files;
+    std::string after;
+    while (!stop_requested_) {
+        auto page = Database::instance().get_files_after(after);
+        if (page.empty()) {
+            break;
+        }
+        after = page.back().id;
+        files.insert(files.end(), page.begin(), page.end());
+    }
+    report.files = files.size();
+
+    // A versioned file has no object of its own; each of its chunks is
+    // checked like one, opened with the file's data key
+    files.erase(std::remove_if(files.begin(), files.end(), [](const File& file) { return file.version > 0; }),
+                files.end());
+    after.clear();
+    while (!stop_requested_) {
+        auto page = Database::instance().get_chunk_objects_after(after);
+        if (page.empty()) {
+            break;
+        }
+        after = page.back().encrypted_name;
+        files.insert(files.end(), page.begin(), page.end());
+    }
+
+    reconcile(files, report);
+
+    // Deduplicated rows share one ciphertext: authenticate each object once
+    std::vector<const File*> objects;
+    std::set<std::string> seen;
+    std::set<std::string> missing;
+    for (const auto& entry : report.missing) {
+        missing.insert(entry.encrypted_name);
+    }
+    for (const auto& file : files) {
+        if (!missing.count(file.encrypted_name) && seen.insert(file.encrypted_name).second) {
+            objects.push_back(&file);
+        }
+    }
+
+    report.verified = verify && CryptoManager::instance().is_unlocked();
+    bool aborted = stop_requested_;
+    if (report.verified && !aborted) {
+        objects_total_ = objects.size();
+
+        size_t workers = threads > 0 ? static_cast<size_t>(threads) : std::thread::hardware_concurrency();
+        workers = std::max<size_t>(1, std::min(workers, objects.size()));
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool> abort_check{false};
+        auto worker = [&]() {
+            while (!stop_requested_ && !abort_check) {
+                size_t i = next++;
+                if (i >= objects.size()) {
+                    break;
+                }
+
+                Entry entry = entry_for(*objects[i]);
+                Outcome outcome = verify_object(*objects[i], entry);
+                if (outcome == Outcome::Aborted) {
+                    abort_check = true;
+                    break;
+                }
+                objects_done_++;
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (outcome == Outcome::Corrupt) {
+                    report.corrupt.push_back(entry);
+                } else if (outcome == Outcome::Legacy) {
+                    report.unverifiable.push_back(entry);
+                }
+                if (outcome != Outcome::Vanished) {
+                    report.objects_checked++;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < workers; i++) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        aborted = stop_requested_ || abort_check;
+    }
+
+    report.bytes_checked = bytes_done_;
+    report.complete = !aborted;
+    report.finished_at = std::time(nullptr);
+    return report;
+}
+
+void VaultChecker::reconcile(const std::vector<File>& files, Report& report) {
+    std::unordered_map<std::string, const File*> referenced;
+    for (const auto& file : files) {
+        referenced.emplace(file.encrypted_name, &file);
+    }
+    // Pack segments hold the objects of many rows
+    for (const auto& segment : PackStore::instance().segment_names()) {
+        referenced.emplace(segment, nullptr);
+    }
+
+    // Ciphertexts already queued for shredding are accounted for
+    std::set<std::string> shredding;
+    for (const auto& job : Database::instance().get_shred_jobs(1 << 30)) {
+        shredding.insert(job.path);
+    }
+
+    // Walks every shard directory, so objects not yet migrated are seen too
+    std::set<std::string> present;
+    std::time_t now = std::time(nullptr);
+    for (const auto& object : VaultLayout::instance().list_objects()) {
+        present.insert(object.name);
+
+        if (!referenced.count(object.name) && !shredding.count(object.path) &&
+            now - object.mtime >= kOrphanGraceSeconds) {
+            Entry entry;
+            entry.encrypted_name = object.name;
+            entry.size = object.size;
+            report.orphans.push_back(entry);
+        }
+    }
+
+    for (const auto& file : files) {
+        if (present.count(file.encrypted_name) || PackStore::instance().contains(file.encrypted_name)) {
+            continue;
+        }
+        // Purged since the rows were read: not missing, just gone
+        if (!Database::instance().has_file_ref(file.encrypted_name)) {
+            continue;
+        }
+        Entry entry = entry_for(file);
+        entry.error = "ciphertext not found";
+        report.missing.push_back(entry);
+    }
+}
+
+VaultChecker::Outcome VaultChecker::verify_object(const File& file, Entry& entry) {
+    // Packed objects are checked in place within their segment
+    bool packed = false;
+    Outcome outcome = Outcome::Ok;
+    bool found = PackStore::instance().read(file.encrypted_name, [&](int fd, int64_t offset, int64_t length) {
+        outcome = verify_range(file, entry, fd, offset, length);
+        return true;
+    }, &packed);
+    if (packed) {
+        return found ? outcome : Outcome::Vanished;
+    }
+
+    int fd = VaultLayout::instance().open(file.encrypted_name, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return Outcome::Vanished;
+        }
+        entry.error = strerror(errno);
+        return Outcome::Corrupt;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        outcome = verify_range(file, entry, fd, 0, st.st_size);
+    } else {
+        entry.error = strerror(errno);
+        outcome = Outcome::Corrupt;
+    }
+
+    // Do not let the scrub evict the page cache of files in active use
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return outcome;
+}
+
+VaultChecker::Outcome VaultChecker::verify_range(const File& file, Entry& entry, int fd, int64_t offset,
+                                                 int64_t length) {
+    entry.size = length;
+
+    uint8_t header[64];
+    ssize_t header_len = pread(fd, header, static_cast<size_t>(std::min<int64_t>(sizeof(header), length)), offset);
+    if (header_len < 0 || !CryptoManager::is_stream_format(header, static_cast<size_t>(header_len))) {
+        entry.error = "legacy format has no authentication tag";
+        return Outcome::Legacy;
+    }
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+
+    Outcome outcome = Outcome::Ok;
+    try {
+        auto& crypto = CryptoManager::instance();
+        auto file_key = crypto.resolve_file_key(file.id, file.wrapped_key, file.key_id);
+        bool ok = crypto.decrypt_stream(
+            [this, fd, &offset, &length](uint8_t* buffer, size_t size) -> ssize_t {
+                ssize_t n = pread(fd, buffer, std::min(size, static_cast<size_t>(length)), offset);
+                if (n > 0) {
+                    offset += n;
+                    length -= n;
+                    bytes_done_ += static_cast<uint64_t>(n);
+                    throttle(static_cast<size_t>(n));
+                }
+                return n;
+            },
+            // Plaintext is dropped as soon as its chunk has authenticated
+            [this](const uint8_t*, size_t) { return !stop_requested_; },
+            file_key);
+        if (stop_requested_) {
+            outcome = Outcome::Aborted;
+        } else if (!ok) {
+            entry.error = "authentication failed";
+            outcome = Outcome::Corrupt;
+        }
+    } catch (const std::exception& e) {
+        // Locked mid-check: the keys are gone, stop instead of reporting corruption
+        entry.error = e.what();
+        outcome = CryptoManager::instance().is_unlocked() ? Outcome::Corrupt : Outcome::Aborted;
+    }
+    return outcome;
+}
+
+void VaultChecker::throttle(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (rate_limit_ <= 0) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (throttle_next_ < now) {
+        throttle_next_ = now;
+    }
+    throttle_next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / rate_limit_));
+    auto until = throttle_next_;
+    cv_.wait_until(lock, until, [this]() { return stop_requested_.load(); });
+}
+
+std::string VaultChecker::load_report() {
+    std::ifstream file(Config::instance().check_report());
+    if (!file) {
+        return "";
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+bool VaultChecker::save_report(const std::string& json) {
+    const std::string& path = Config::instance().check_report();
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!(file << json << "\n")) {
+            std::cerr << "Failed to write vault check report: " << tmp_path << std::endl;
+            return false;
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to save vault check report: " << path << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace vaultusb
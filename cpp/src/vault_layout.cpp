@@ -0,0 +1,362 @@
+#include "vault_layout.h"
+#include "config.h"
+#include "database.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr int kMaxFanout = 3;
+constexpr int kMigrationBatch = 256;
+
+// FNV-1a; encrypted names are random, this only has to spread them evenly
+uint32_t name_hash(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool is_shard_name(const char* name) {
+    return std::isxdigit(static_cast<unsigned char>(name[0])) && std::isxdigit(static_cast<unsigned char>(name[1])) &&
+           name[2] == '\0';
+}
+
+// Collects regular files below dir_fd; takes ownership of dir_fd
+void walk(int dir_fd, const std::string& dir_path, int depth, std::vector<VaultLayout::Object>& objects) {
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+    while (struct dirent* de = readdir(dir)) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        std::string path = dir_path + "/" + de->d_name;
+        if (S_ISREG(st.st_mode)) {
+            VaultLayout::Object object;
+            object.name = de->d_name;
+            object.path = path;
+            object.size = st.st_size;
+            object.mtime = st.st_mtime;
+            objects.push_back(std::move(object));
+        } else if (S_ISDIR(st.st_mode) && depth < kMaxFanout && is_shard_name(de->d_name)) {
+            int child = openat(dirfd(dir), de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+            if (child >= 0) {
+                walk(child, path, depth + 1, objects);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+} // namespace
+
+VaultLayout& VaultLayout::instance() {
+    static VaultLayout instance;
+    return instance;
+}
+
+VaultLayout::VaultLayout()
+    : root_(Config::instance().vault_dir()),
+      fanout_(std::min(std::max(Config::instance().vault_fanout(), 0), kMaxFanout)),
+      top_fds_(256, -1) {
+    // A finished migration to this fan-out needs no fallback lookups
+    std::ifstream marker(marker_path());
+    std::string line;
+    migrated_ = std::getline(marker, line) && line == "fanout=" + std::to_string(fanout_);
+}
+
+VaultLayout::~VaultLayout() {
+    stop_migration();
+    for (int fd : top_fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (root_fd_ >= 0) {
+        close(root_fd_);
+    }
+}
+
+std::string VaultLayout::relative_path(const std::string& encrypted_name, int levels) {
+    static const char hex[] = "0123456789abcdef";
+    uint32_t hash = name_hash(encrypted_name);
+    std::string path;
+    for (int i = 0; i < levels; i++) {
+        uint8_t byte = static_cast<uint8_t>(hash >> (24 - 8 * i));
+        path += hex[byte >> 4];
+        path += hex[byte & 0x0F];
+        path += '/';
+    }
+    return path + encrypted_name;
+}
+
+std::string VaultLayout::marker_path() const {
+    return root_ + "/.layout";
+}
+
+bool VaultLayout::open_root() {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (root_fd_ >= 0) {
+        return true;
+    }
+    root_fd_ = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd_ < 0 && errno == ENOENT && mkdir(root_.c_str(), 0700) == 0) {
+        root_fd_ = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (root_fd_ < 0) {
+        std::cerr << "Cannot open vault directory " << root_ << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int VaultLayout::shard_fd(const std::string& encrypted_name, bool create, std::string& rest) {
+    if (!open_root()) {
+        return -1;
+    }
+    if (fanout_ == 0) {
+        rest = encrypted_name;
+        return root_fd_;
+    }
+
+    std::string relative = relative_path(encrypted_name, fanout_);
+    std::string top = relative.substr(0, 2);
+    rest = relative.substr(3);
+    size_t index = std::stoul(top, nullptr, 16);
+
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (top_fds_[index] < 0) {
+        int fd = openat(root_fd_, top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && create) {
+            if (mkdirat(root_fd_, top.c_str(), 0700) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            fd = openat(root_fd_, top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+            return -1;
+        }
+        top_fds_[index] = fd;
+    }
+
+    int dir = top_fds_[index];
+    if (create) {
+        // Deeper levels are reached through the cached first-level fd
+        for (size_t slash = rest.find('/'); slash != std::string::npos; slash = rest.find('/', slash + 1)) {
+            if (mkdirat(dir, rest.substr(0, slash).c_str(), 0700) != 0 && errno != EEXIST) {
+                return -1;
+            }
+        }
+    }
+    return dir;
+}
+
+int VaultLayout::open(const std::string& encrypted_name, int flags, mode_t mode) {
+    flags |= O_CLOEXEC | O_NOFOLLOW;
+    bool create = (flags & O_CREAT) != 0;
+
+    std::string rest;
+    int dir = shard_fd(encrypted_name, create, rest);
+    int fd = dir >= 0 ? openat(dir, rest.c_str(), flags, mode) : -1;
+    if (fd >= 0 || errno != ENOENT || create || migrated_ || root_fd_ < 0) {
+        return fd;
+    }
+
+    // Not moved yet: try the other layouts, then the target again in case
+    // the migrator moved it in between
+    for (int levels = 0; levels <= kMaxFanout; levels++) {
+        if (levels == fanout_) {
+            continue;
+        }
+        fd = openat(root_fd_, relative_path(encrypted_name, levels).c_str(), flags, mode);
+        if (fd >= 0 || errno != ENOENT) {
+            return fd;
+        }
+    }
+    dir = shard_fd(encrypted_name, false, rest);
+    return dir >= 0 ? openat(dir, rest.c_str(), flags, mode) : -1;
+}
+
+bool VaultLayout::locate(const std::string& encrypted_name, std::string& relative) {
+    auto found = [&](int levels) {
+        struct stat st;
+        std::string candidate = relative_path(encrypted_name, levels);
+        if (fstatat(root_fd_, candidate.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        relative = candidate;
+        return true;
+    };
+
+    if (found(fanout_)) {
+        return true;
+    }
+    for (int levels = 0; levels <= kMaxFanout && !migrated_; levels++) {
+        if (levels != fanout_ && found(levels)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string VaultLayout::path(const std::string& encrypted_name) {
+    std::lock_guard<std::mutex> lock(move_mutex_);
+    std::string relative;
+    if (!open_root() || !locate(encrypted_name, relative)) {
+        relative = relative_path(encrypted_name, fanout_);
+    }
+    return root_ + "/" + relative;
+}
+
+std::vector<VaultLayout::Object> VaultLayout::list_objects() {
+    std::vector<Object> objects;
+    int fd = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Cannot open vault directory: " << root_ << ": " << strerror(errno) << std::endl;
+        return objects;
+    }
+    walk(fd, root_, 0, objects);
+    return objects;
+}
+
+void VaultLayout::start_migration() {
+    if (migrated_ || running_.exchange(true)) {
+        return;
+    }
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    stop_requested_ = false;
+    worker_ = std::thread(&VaultLayout::run_migration, this);
+}
+
+void VaultLayout::stop_migration() {
+    stop_requested_ = true;
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+VaultLayout::Progress VaultLayout::migration_progress() {
+    Progress progress;
+    progress.running = running_;
+    progress.migrated = migrated_;
+    progress.moved = moved_;
+    progress.failed = failed_;
+    return progress;
+}
+
+bool VaultLayout::move_object(const std::string& encrypted_name) {
+    std::string target = relative_path(encrypted_name, fanout_);
+    struct stat st;
+    if (fstatat(root_fd_, target.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(move_mutex_);
+    std::string source;
+    if (!locate(encrypted_name, source) || source == target) {
+        return true; // missing ciphertexts are reported by the integrity check
+    }
+    // Purged since the batch was read: its path may already be queued for shredding
+    if (!Database::instance().has_file_ref(encrypted_name) && !Database::instance().is_pack_segment(encrypted_name)) {
+        return true;
+    }
+
+    std::string rest;
+    if (shard_fd(encrypted_name, true, rest) < 0 ||
+        renameat(root_fd_, source.c_str(), root_fd_, target.c_str()) != 0) {
+        std::cerr << "Cannot move " << source << " to " << target << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    moved_++;
+    return true;
+}
+
+void VaultLayout::run_migration() {
+    auto& db = Database::instance();
+    uint64_t failed_before = failed_;
+    bool complete = open_root();
+
+    // Only referenced objects (live or trashed rows, version chunks) and pack segments are moved; a rename within
+    // one filesystem is atomic, and readers fall back to the old location until the pass has finished
+    std::string after_id;
+    while (complete && !stop_requested_) {
+        auto files = db.get_files_after(after_id, kMigrationBatch);
+        if (files.empty()) {
+            break;
+        }
+        for (const auto& file : files) {
+            if (stop_requested_) {
+                break;
+            }
+            after_id = file.id;
+            if (!move_object(file.encrypted_name)) {
+                failed_++;
+            }
+        }
+    }
+    // Version chunks hang off file_chunks; versioned files rows only hold a placeholder name
+    std::string after_name;
+    while (complete && !stop_requested_) {
+        auto chunks = db.get_chunk_objects_after(after_name, kMigrationBatch);
+        if (chunks.empty()) {
+            break;
+        }
+        for (const auto& chunk : chunks) {
+            if (stop_requested_) {
+                break;
+            }
+            after_name = chunk.encrypted_name;
+            if (!move_object(chunk.encrypted_name)) {
+                failed_++;
+            }
+        }
+    }
+    // Pack segments are objects of their own; open segment fds survive the rename
+    for (const auto& pack : db.get_packs()) {
+        if (!complete || stop_requested_) {
+            break;
+        }
+        if (!move_object(pack.encrypted_name)) {
+            failed_++;
+        }
+    }
+
+    if (complete && !stop_requested_ && failed_ == failed_before) {
+        std::string tmp = marker_path() + ".tmp";
+        {
+            std::ofstream marker(tmp, std::ios::trunc);
+            marker << "fanout=" << fanout_ << "\n";
+        }
+        if (std::rename(tmp.c_str(), marker_path().c_str()) == 0) {
+            migrated_ = true;
+            if (moved_ > 0) {
+                std::cout << "Vault layout migration finished: " << moved_ << " files moved" << std::endl;
+            }
+        }
+    }
+    running_ = false;
+}
+
+} // namespace vaultusb
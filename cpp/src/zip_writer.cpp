@@ -0,0 +1,298 @@
+#include "zip_writer.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace vaultusb {
+
+namespace {
+
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kDescriptorSignature = 0x08074b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kZip64EndSignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr uint32_t kEndSignature = 0x06054b50;
+
+constexpr uint16_t kVersionZip64 = 45;
+constexpr uint16_t kVersionMadeByUnix = (3 << 8) | kVersionZip64;
+constexpr uint16_t kFlagDescriptor = 0x0008;
+constexpr uint16_t kFlagUtf8 = 0x0800;
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+constexpr uint16_t kZip64ExtraId = 0x0001;
+constexpr uint32_t kMax32 = 0xffffffff;
+constexpr uint16_t kMax16 = 0xffff;
+constexpr uint32_t kFileAttributes = 0100644u << 16;
+
+constexpr size_t kBufferSize = 65536;
+constexpr int kDeflateLevel = 1; // keeps up with the link on a Pi Zero
+
+void put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value));
+    put16(out, static_cast<uint16_t>(value >> 16));
+}
+
+void put64(std::vector<uint8_t>& out, uint64_t value) {
+    put32(out, static_cast<uint32_t>(value));
+    put32(out, static_cast<uint32_t>(value >> 32));
+}
+
+// MS-DOS date and time in local time; ZIP cannot represent dates before 1980
+void dos_date_time(std::time_t mtime, uint16_t& dos_time, uint16_t& dos_date) {
+    struct tm tm {};
+    if (mtime <= 0 || !localtime_r(&mtime, &tm) || tm.tm_year < 80) {
+        dos_time = 0;
+        dos_date = (1 << 5) | 1;
+        return;
+    }
+    dos_time = static_cast<uint16_t>((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    dos_date = static_cast<uint16_t>(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+} // namespace
+
+struct ZipWriter::Deflater {
+    z_stream stream {};
+    bool ready = false;
+    std::vector<uint8_t> out = std::vector<uint8_t>(kBufferSize);
+
+    ~Deflater() {
+        if (ready) {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+ZipWriter::ZipWriter(ByteSink sink) : sink_(std::move(sink)) {
+    buffer_.reserve(kBufferSize);
+}
+
+ZipWriter::~ZipWriter() = default;
+
+bool ZipWriter::begin_entry(const std::string& name, std::time_t mtime, bool deflate) {
+    if (in_entry_ || name.empty() || name.size() > kMax16) {
+        return false;
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.method = deflate ? kMethodDeflated : kMethodStored;
+    entry.offset = bytes_written();
+    entry.crc = static_cast<uint32_t>(crc32(0, Z_NULL, 0));
+    dos_date_time(mtime, entry.dos_time, entry.dos_date);
+
+    if (deflate) {
+        if (!deflater_) {
+            deflater_ = std::make_unique<Deflater>();
+        }
+        if (!deflater_->ready) {
+            if (deflateInit2(&deflater_->stream, kDeflateLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            deflater_->ready = true;
+        } else if (deflateReset(&deflater_->stream) != Z_OK) {
+            return false;
+        }
+    }
+
+    // Sizes and CRC follow in the descriptor; the ZIP64 field says they are 64-bit
+    std::vector<uint8_t> header;
+    header.reserve(30 + name.size() + 20);
+    put32(header, kLocalHeaderSignature);
+    put16(header, kVersionZip64);
+    put16(header, kFlagDescriptor | kFlagUtf8);
+    put16(header, entry.method);
+    put16(header, entry.dos_time);
+    put16(header, entry.dos_date);
+    put32(header, 0);
+    put32(header, kMax32);
+    put32(header, kMax32);
+    put16(header, static_cast<uint16_t>(name.size()));
+    put16(header, 20);
+    header.insert(header.end(), name.begin(), name.end());
+    put16(header, kZip64ExtraId);
+    put16(header, 16);
+    put64(header, 0);
+    put64(header, 0);
+
+    entries_.push_back(std::move(entry));
+    in_entry_ = true;
+    return emit(header.data(), header.size());
+}
+
+bool ZipWriter::write(const uint8_t* data, size_t length) {
+    if (!in_entry_) {
+        return false;
+    }
+    Entry& entry = entries_.back();
+    entry.size += length;
+    // crc32() takes a uInt length
+    for (size_t done = 0; done < length;) {
+        uInt n = static_cast<uInt>(std::min<size_t>(length - done, 1u << 30));
+        entry.crc = static_cast<uint32_t>(crc32(entry.crc, data + done, n));
+        done += n;
+    }
+
+    if (entry.method == kMethodDeflated) {
+        return deflate_input(data, length, false);
+    }
+    entry.compressed_size += length;
+    return emit(data, length);
+}
+
+bool ZipWriter::end_entry() {
+    if (!in_entry_) {
+        return false;
+    }
+    Entry& entry = entries_.back();
+    if (entry.method == kMethodDeflated && !deflate_input(nullptr, 0, true)) {
+        return false;
+    }
+    in_entry_ = false;
+
+    std::vector<uint8_t> descriptor;
+    put32(descriptor, kDescriptorSignature);
+    put32(descriptor, entry.crc);
+    put64(descriptor, entry.compressed_size);
+    put64(descriptor, entry.size);
+    return emit(descriptor.data(), descriptor.size());
+}
+
+bool ZipWriter::finish() {
+    if (in_entry_) {
+        return false;
+    }
+
+    uint64_t directory_offset = bytes_written();
+    std::vector<uint8_t> record;
+    for (const auto& entry : entries_) {
+        // Only values that do not fit in 32 bits move to the ZIP64 field, in this order
+        std::vector<uint8_t> extra;
+        bool large_size = entry.size >= kMax32;
+        bool large_compressed = entry.compressed_size >= kMax32;
+        bool large_offset = entry.offset >= kMax32;
+        if (large_size || large_compressed || large_offset) {
+            put16(extra, kZip64ExtraId);
+            put16(extra, static_cast<uint16_t>(8 * (large_size + large_compressed + large_offset)));
+            if (large_size) put64(extra, entry.size);
+            if (large_compressed) put64(extra, entry.compressed_size);
+            if (large_offset) put64(extra, entry.offset);
+        }
+
+        record.clear();
+        put32(record, kCentralHeaderSignature);
+        put16(record, kVersionMadeByUnix);
+        put16(record, kVersionZip64);
+        put16(record, kFlagDescriptor | kFlagUtf8);
+        put16(record, entry.method);
+        put16(record, entry.dos_time);
+        put16(record, entry.dos_date);
+        put32(record, entry.crc);
+        put32(record, large_compressed ? kMax32 : static_cast<uint32_t>(entry.compressed_size));
+        put32(record, large_size ? kMax32 : static_cast<uint32_t>(entry.size));
+        put16(record, static_cast<uint16_t>(entry.name.size()));
+        put16(record, static_cast<uint16_t>(extra.size()));
+        put16(record, 0); // comment
+        put16(record, 0); // disk
+        put16(record, 0); // internal attributes
+        put32(record, kFileAttributes);
+        put32(record, large_offset ? kMax32 : static_cast<uint32_t>(entry.offset));
+        record.insert(record.end(), entry.name.begin(), entry.name.end());
+        record.insert(record.end(), extra.begin(), extra.end());
+        if (!emit(record.data(), record.size())) {
+            return false;
+        }
+    }
+    uint64_t directory_size = bytes_written() - directory_offset;
+    uint64_t count = entries_.size();
+
+    record.clear();
+    bool zip64 = count >= kMax16 || directory_size >= kMax32 || directory_offset >= kMax32;
+    if (zip64) {
+        uint64_t end_offset = bytes_written();
+        put32(record, kZip64EndSignature);
+        put64(record, 44); // size of the rest of this record
+        put16(record, kVersionMadeByUnix);
+        put16(record, kVersionZip64);
+        put32(record, 0);
+        put32(record, 0);
+        put64(record, count);
+        put64(record, count);
+        put64(record, directory_size);
+        put64(record, directory_offset);
+
+        put32(record, kZip64LocatorSignature);
+        put32(record, 0);
+        put64(record, end_offset);
+        put32(record, 1);
+    }
+    put32(record, kEndSignature);
+    put16(record, 0);
+    put16(record, 0);
+    put16(record, zip64 ? kMax16 : static_cast<uint16_t>(count));
+    put16(record, zip64 ? kMax16 : static_cast<uint16_t>(count));
+    put32(record, zip64 ? kMax32 : static_cast<uint32_t>(directory_size));
+    put32(record, zip64 ? kMax32 : static_cast<uint32_t>(directory_offset));
+    put16(record, 0); // comment
+    return emit(record.data(), record.size()) && flush();
+}
+
+bool ZipWriter::deflate_input(const uint8_t* data, size_t length, bool finish) {
+    z_stream& stream = deflater_->stream;
+    Entry& entry = entries_.back();
+    size_t done = 0;
+    while (true) {
+        // avail_in is a uInt; feed large blocks in slices
+        if (stream.avail_in == 0 && done < length) {
+            size_t n = std::min<size_t>(length - done, 1u << 30);
+            stream.next_in = const_cast<Bytef*>(data + done);
+            stream.avail_in = static_cast<uInt>(n);
+            done += n;
+        }
+        stream.next_out = deflater_->out.data();
+        stream.avail_out = static_cast<uInt>(deflater_->out.size());
+        int rc = deflate(&stream, finish && done == length ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_STREAM_ERROR) {
+            return false;
+        }
+        size_t produced = deflater_->out.size() - stream.avail_out;
+        entry.compressed_size += produced;
+        if (produced > 0 && !emit(deflater_->out.data(), produced)) {
+            return false;
+        }
+        if (finish ? rc == Z_STREAM_END : stream.avail_in == 0 && done == length && stream.avail_out > 0) {
+            return true;
+        }
+    }
+}
+
+bool ZipWriter::emit(const uint8_t* data, size_t length) {
+    // Small records are gathered; large blocks skip the copy
+    if (buffer_.size() + length > kBufferSize && !flush()) {
+        return false;
+    }
+    if (length >= kBufferSize) {
+        offset_ += length;
+        return sink_(data, length);
+    }
+    buffer_.insert(buffer_.end(), data, data + length);
+    return true;
+}
+
+bool ZipWriter::flush() {
+    if (buffer_.empty()) {
+        return true;
+    }
+    offset_ += buffer_.size();
+    bool ok = sink_(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return ok;
+}
+
+} // namespace vaultusb